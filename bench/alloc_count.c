@@ -0,0 +1,48 @@
+// Counts the calls to malloc, calloc and realloc of a process and the bytes
+// they asked for. bench/run preloads it and reads the totals from the file
+// descriptor in BENCH_ALLOC_FD when the process exits. Needs glibc, which
+// exports the allocator under the __libc_ names
+//
+//   LD_PRELOAD=bench/alloc_count.so BENCH_ALLOC_FD=3 ./cumunisp ...
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t n);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t n);
+
+static unsigned long long allocs;
+static unsigned long long bytes;
+
+void *malloc(size_t n) {
+  allocs++;
+  bytes += n;
+  return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size) {
+  allocs++;
+  bytes += n * size;
+  return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t n) {
+  allocs++;
+  bytes += n;
+  return __libc_realloc(p, n);
+}
+
+__attribute__((destructor)) static void report(void) {
+  const char *fd = getenv("BENCH_ALLOC_FD");
+  if (!fd) {
+    return;
+  }
+  char buf[64];
+  int n = snprintf(buf, sizeof(buf), "%llu %llu\n", allocs, bytes);
+  if (write(atoi(fd), buf, n) != n) {
+    return;
+  }
+}
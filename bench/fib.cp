@@ -0,0 +1,2 @@
+; Recursive calls through select, from prelude.cp
+(print (fib 16))
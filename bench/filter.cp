@@ -0,0 +1,2 @@
+(def {xs} (range 0 1000))
+(print (len (filter (\ {x} {== (% x 3) 0}) xs)))
@@ -0,0 +1,2 @@
+(def {xs} (range 0 1000))
+(print (foldl + 0 xs))
@@ -0,0 +1,10 @@
+; Helpers shared by the workloads, loaded after prelude.cp
+
+; List of the numbers from a up to b, not including b
+(fun {range-acc a b acc} {
+  if (== a b) {acc} {range-acc a (- b 1) (cons (- b 1) acc)}
+})
+(fun {range a b} {range-acc a b nil})
+
+; Call f with n, n - 1 ... 1
+(fun {repeat n f} {if (== n 0) {nil} {do (f n) (repeat (- n 1) f)}})
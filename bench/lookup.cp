@@ -0,0 +1,4 @@
+; Keys near the end of a large association list
+(def {al} (map (\ {i} {list i (* i i)}) (range 0 500)))
+(repeat 30 (\ {i} {lookup (- 500 i) al}))
+(print (lookup 499 al))
@@ -0,0 +1,3 @@
+; map copies the rest of the list on every step
+(def {xs} (range 0 1000))
+(print (len (map (\ {x} {* x 2}) xs)))
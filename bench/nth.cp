@@ -0,0 +1,4 @@
+; Walks to the end of the list, one tail at a time
+(def {xs} (range 0 1000))
+(repeat 5 (\ {i} {nth 999 xs}))
+(print (nth 999 xs))
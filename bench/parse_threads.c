@@ -0,0 +1,156 @@
+// Threaded parse benchmark: parses files with the AST reader's grammar from
+// grammar.c, loaded once and shared by every thread. Each thread parses all of
+// the files the given number of times, and the throughput is reported for 1,
+// 2, 4 ... threads up to the given number. With a grammar that is only read
+// the throughput should grow with the threads up to the number of cores
+//
+//   bench/parse_threads [threads] [runs] [file...]
+
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "mpc.h"
+
+extern const mpc_grammar_t lval_ast_grammar;
+
+static mpc_parser_t *Cumunisp;
+static char **names;
+static char **texts;
+static long bytes;
+static int files;
+static int runs;
+
+static double now_ms(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Reads the whole file into a string, or exits if it can't
+static char *read_file(const char *filename) {
+  FILE *f = fopen(filename, "rb");
+  if (!f) {
+    perror(filename);
+    exit(1);
+  }
+  fseek(f, 0, SEEK_END);
+  long n = ftell(f);
+  rewind(f);
+  char *s = malloc(n + 1);
+  if (fread(s, 1, n, f) != (size_t)n) {
+    perror(filename);
+    exit(1);
+  }
+  s[n] = '\0';
+  fclose(f);
+  bytes += n;
+  return s;
+}
+
+// Parses every file runs times with the options cumunisp reads with. The
+// options are the thread's own and the grammar is only read
+static void *parse_all(void *failed) {
+  mpc_parse_opts_t opts = {
+      MPC_PARSE_AST_ARENA | MPC_PARSE_BORROWED | MPC_PARSE_LAZY_POSITIONS, 0,
+      NULL, NULL};
+  for (int i = 0; i < runs; i++) {
+    for (int j = 0; j < files; j++) {
+      mpc_result_t r;
+      if (mpc_parse_with(names[j], texts[j], Cumunisp, &r, &opts)) {
+        mpc_ast_delete(r.output);
+      } else {
+        mpc_err_delete(r.error);
+        (*(int *)failed)++;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Runs the parses on n threads at once, returns the wall time in ms
+static double bench(int n) {
+  pthread_t *ts = malloc(sizeof(pthread_t) * n);
+  int *failed = calloc(n, sizeof(int));
+  double t = now_ms();
+  for (int i = 0; i < n; i++) {
+    if (pthread_create(&ts[i], NULL, parse_all, &failed[i]) != 0) {
+      fprintf(stderr, "could not start thread %d\n", i);
+      exit(1);
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    pthread_join(ts[i], NULL);
+  }
+  t = now_ms() - t;
+  for (int i = 0; i < n; i++) {
+    if (failed[i]) {
+      fprintf(stderr, "%d parses failed on thread %d\n", failed[i], i);
+      exit(1);
+    }
+  }
+  free(failed);
+  free(ts);
+  return t;
+}
+
+int main(int argc, char **argv) {
+  int threads = argc > 1 ? atoi(argv[1]) : 8;
+  runs = argc > 2 ? atoi(argv[2]) : 500;
+  char *prelude[] = {"prelude.cp"};
+  files = argc > 3 ? argc - 3 : 1;
+  names = argc > 3 ? argv + 3 : prelude;
+  texts = malloc(sizeof(char *) * files);
+  for (int j = 0; j < files; j++) {
+    texts[j] = read_file(names[j]);
+  }
+
+  mpc_parser_t *Number = mpc_new("number");
+  mpc_parser_t *Symbol = mpc_new("symbol");
+  mpc_parser_t *String = mpc_new("string");
+  mpc_parser_t *Comment = mpc_new("comment");
+  mpc_parser_t *Sexpr = mpc_new("sexpr");
+  mpc_parser_t *Qexpr = mpc_new("qexpr");
+  mpc_parser_t *Expr = mpc_new("expr");
+  Cumunisp = mpc_new("cumunisp");
+  if (!mpc_load(&lval_ast_grammar, NULL, 8, Number, Symbol, String, Comment,
+                Sexpr, Qexpr, Expr, Cumunisp)) {
+    fprintf(stderr, "could not load the grammar\n");
+    return 1;
+  }
+
+  // Warm up the allocator and check every file parses
+  int failed = 0;
+  int r = runs;
+  runs = 1;
+  parse_all(&failed);
+  runs = r;
+  if (failed) {
+    fprintf(stderr, "%d files don't parse\n", failed);
+    return 1;
+  }
+
+  printf("%-8s %10s %10s %8s %11s\n", "threads", "wall ms", "MB/s", "speedup",
+         "efficiency");
+  double base = 0;
+  for (int n = 1; n <= threads;
+       n = n < threads && n * 2 > threads ? threads : n * 2) {
+    double t = bench(n);
+    double mbs = (double)bytes * runs * n / 1e6 / (t / 1e3);
+    if (n == 1) {
+      base = mbs;
+    }
+    printf("%-8d %10.1f %10.2f %7.2fx %10.0f%%\n", n, t, mbs, mbs / base,
+           100 * mbs / base / n);
+  }
+
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr,
+              Cumunisp);
+  for (int j = 0; j < files; j++) {
+    free(texts[j]);
+  }
+  free(texts);
+  return 0;
+}
@@ -0,0 +1,216 @@
+// Interpreter benchmark: runs each workload in bench/ on cumunisp after
+// prelude.cp and bench/lib.cp, and writes the median wall time, allocations
+// and peak RSS of each as JSON to stdout, with progress on stderr. The load
+// workload is a large file generated into bench/large.cp. Allocations are
+// counted in an extra run with bench/alloc_count.so preloaded, which also
+// checks that the workload printed no errors
+//
+//   bench/run [binary] [runs] [workload...]
+
+#define _XOPEN_SOURCE 700
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// Declared here since wait4 isn't part of POSIX
+pid_t wait4(pid_t pid, int *status, int options, struct rusage *usage);
+
+typedef struct {
+  const char *name;
+  const char *file;
+} workload;
+
+static const workload workloads[] = {
+    {"fib", "bench/fib.cp"},         {"map", "bench/map.cp"},
+    {"filter", "bench/filter.cp"},   {"foldl", "bench/foldl.cp"},
+    {"nth", "bench/nth.cp"},         {"strings", "bench/strings.cp"},
+    {"lookup", "bench/lookup.cp"},   {"load", "bench/large.cp"},
+};
+
+#define WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+static double now_ms(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Writes the file for the load workload: many definitions, functions and a
+// long list, which is read, evaluated and freed one form at a time
+static void generate_large(const char *filename) {
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    perror(filename);
+    exit(1);
+  }
+  fputs("; Generated by bench/run, do not edit\n", f);
+  for (int i = 0; i < 5000; i++) {
+    fprintf(f, "(def {v%d} %d.5)\n", i, i);
+  }
+  for (int i = 0; i < 2000; i++) {
+    fprintf(f, "(fun {f%d x} {+ x v%d \"s%d\"})\n", i, i, i);
+  }
+  fputs("(def {big} {", f);
+  for (int i = 0; i < 100000; i++) {
+    fprintf(f, i ? " %d" : "%d", i);
+  }
+  fputs("})\n(print (len big))\n", f);
+  fclose(f);
+}
+
+// Runs the workload once with its output sent to out, or discarded if out is
+// NULL. With preload set the allocator counts go to *allocs and *bytes.
+// Returns the wall time in ms, or a negative number on failure
+static double run(const char *bin, const char *file, FILE *out,
+                  const char *preload, long long *allocs, long long *bytes,
+                  long *rss_kb) {
+  int fds[2];
+  if (preload && pipe(fds) != 0) {
+    return -1;
+  }
+  // The child would write out whatever is still buffered
+  fflush(stdout);
+  double t = now_ms();
+  pid_t pid = fork();
+  if (pid < 0) {
+    return -1;
+  }
+  if (pid == 0) {
+    if (out) {
+      dup2(fileno(out), STDOUT_FILENO);
+    } else if (!freopen("/dev/null", "w", stdout)) {
+      _exit(127);
+    }
+    if (preload) {
+      char fd[16];
+      snprintf(fd, sizeof(fd), "%d", fds[1]);
+      close(fds[0]);
+      setenv("BENCH_ALLOC_FD", fd, 1);
+      setenv("LD_PRELOAD", preload, 1);
+    }
+    execl(bin, bin, "prelude.cp", "bench/lib.cp", file, (char *)NULL);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage ru;
+  if (preload) {
+    close(fds[1]);
+  }
+  if (wait4(pid, &status, 0, &ru) < 0) {
+    return -1;
+  }
+  t = now_ms() - t;
+  *rss_kb = ru.ru_maxrss;
+  if (preload) {
+    char buf[64];
+    ssize_t n = read(fds[0], buf, sizeof(buf) - 1);
+    close(fds[0]);
+    buf[n > 0 ? n : 0] = '\0';
+    if (sscanf(buf, "%lld %lld", allocs, bytes) != 2) {
+      *allocs = *bytes = -1;
+    }
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? t : -1;
+}
+
+// Runs the workload with the allocator counted and fails if it printed an
+// error, since then the timings would be of the wrong thing
+static int check(const char *bin, const workload *w, const char *preload,
+                 long long *allocs, long long *bytes) {
+  FILE *out = tmpfile();
+  long rss;
+  *allocs = *bytes = -1;
+  if (!out || run(bin, w->file, out, preload, allocs, bytes, &rss) < 0) {
+    fprintf(stderr, "%s: failed to run %s\n", w->name, bin);
+    return 0;
+  }
+  rewind(out);
+  char line[256];
+  int ok = 1;
+  while (ok && fgets(line, sizeof(line), out)) {
+    if (strstr(line, "Error")) {
+      fprintf(stderr, "%s: %s", w->name, line);
+      ok = 0;
+    }
+  }
+  fclose(out);
+  return ok;
+}
+
+static int cmp_double(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+int main(int argc, char **argv) {
+  const char *bin = argc > 1 ? argv[1] : "./cumunisp";
+  int runs = argc > 2 ? atoi(argv[2]) : 5;
+  if (runs < 1) {
+    runs = 1;
+  }
+
+  // The counting allocator is optional, without it allocations are null
+  char preload[PATH_MAX];
+  int counted = realpath("bench/alloc_count.so", preload) != NULL;
+
+  generate_large("bench/large.cp");
+
+  double *times = malloc(sizeof(double) * runs);
+  int first = 1;
+  printf("{\n  \"binary\": \"%s\",\n  \"runs\": %d,\n  \"workloads\": [", bin,
+         runs);
+  for (int i = 0; i < WORKLOADS; i++) {
+    const workload *w = &workloads[i];
+    if (argc > 3) {
+      int wanted = 0;
+      for (int j = 3; j < argc; j++) {
+        wanted |= strcmp(argv[j], w->name) == 0;
+      }
+      if (!wanted) {
+        continue;
+      }
+    }
+
+    long long allocs, bytes;
+    if (!check(bin, w, counted ? preload : NULL, &allocs, &bytes)) {
+      return 1;
+    }
+    long rss = 0;
+    for (int j = 0; j < runs; j++) {
+      long r;
+      times[j] = run(bin, w->file, NULL, NULL, NULL, NULL, &r);
+      if (times[j] < 0) {
+        fprintf(stderr, "%s: failed to run %s\n", w->name, bin);
+        return 1;
+      }
+      rss = r > rss ? r : rss;
+    }
+    qsort(times, runs, sizeof(double), cmp_double);
+    double median = runs % 2 ? times[runs / 2]
+                             : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+
+    fprintf(stderr, "%-8s %10.1f ms %12lld allocs %8ld KB\n", w->name, median,
+            allocs, rss);
+    printf("%s\n    {\"name\": \"%s\", \"median_ms\": %.3f, \"min_ms\": %.3f, "
+           "\"max_ms\": %.3f, ",
+           first ? "" : ",", w->name, median, times[0], times[runs - 1]);
+    if (allocs >= 0) {
+      printf("\"allocs\": %lld, \"alloc_bytes\": %lld, ", allocs, bytes);
+    } else {
+      printf("\"allocs\": null, \"alloc_bytes\": null, ");
+    }
+    printf("\"peak_rss_kb\": %ld}", rss);
+    first = 0;
+  }
+  printf("\n  ]\n}\n");
+  free(times);
+  return 0;
+}
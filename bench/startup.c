@@ -0,0 +1,71 @@
+// Startup benchmark: runs cumunisp on a tiny program many times, loading the
+// precompiled grammar and building it from source at runtime, and reports
+// the mean wall time per process for each
+//
+//   bench/startup [binary] [runs]
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_ms(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+// Runs the command once with its output discarded, returns 0 on failure
+static int run(char **argv) {
+  pid_t pid = fork();
+  if (pid < 0) {
+    return 0;
+  }
+  if (pid == 0) {
+    if (!freopen("/dev/null", "w", stdout)) {
+      _exit(127);
+    }
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  int status;
+  if (waitpid(pid, &status, 0) < 0) {
+    return 0;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static double bench(char **argv, int runs) {
+  // Warm up the page cache first
+  if (!run(argv)) {
+    fprintf(stderr, "failed to run %s\n", argv[0]);
+    exit(1);
+  }
+  double t = now_ms();
+  for (int i = 0; i < runs; i++) {
+    run(argv);
+  }
+  return (now_ms() - t) / runs;
+}
+
+int main(int argc, char **argv) {
+  char *bin = argc > 1 ? argv[1] : "./cumunisp";
+  int runs = argc > 2 ? atoi(argv[2]) : 500;
+  char *prog = "bench/startup.cp";
+
+  char *loaded[] = {bin, prog, NULL};
+  char *runtime[] = {bin, "--runtime-grammar", prog, NULL};
+  char *ast_loaded[] = {bin, "--ast-reader", prog, NULL};
+  char *ast_runtime[] = {bin, "--ast-reader", "--runtime-grammar", prog, NULL};
+
+  double a = bench(runtime, runs), b = bench(loaded, runs);
+  double c = bench(ast_runtime, runs), d = bench(ast_loaded, runs);
+
+  printf("%-14s %12s %12s %8s\n", "reader", "runtime ms", "loaded ms",
+         "speedup");
+  printf("%-14s %12.3f %12.3f %7.2fx\n", "direct", a, b, a / b);
+  printf("%-14s %12.3f %12.3f %7.2fx\n", "ast", c, d, c / d);
+  return 0;
+}
@@ -0,0 +1 @@
+(def {x} (+ 1 2))
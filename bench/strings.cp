@@ -0,0 +1,7 @@
+; Appending in a loop, rendering numbers and joining a list of strings
+(fun {build n s} {
+  if (== n 0) {s} {build (- n 1) (str-cat s (to-string n) ",")}
+})
+(def {s} (build 2500 ""))
+(print (str-len s) (substr s 1000 20))
+(print (str-len (str-join (map to-string (range 0 1000)) ", ")))
@@ -1,7 +1,17 @@
+// setitimer for the profiler is part of the X/Open interfaces
+#define _XOPEN_SOURCE 700
 #include "mpc.h"
+#include "numconv.h"
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#ifndef _WIN32
+#include <sys/time.h>
+#include <unistd.h>
+#endif
 
 // If we are compiling on Windows compile these functions
 #ifdef _WIN32
@@ -11,7 +21,9 @@ static char buffer[2048];
 
 char *readline(char *prompt) {
   fputs(prompt, stdout);
-  fgets(buffer, 2048, stdin);
+  if (!fgets(buffer, 2048, stdin)) {
+    return NULL;
+  }
   char *cpy = malloc(strlen(buffer) + 1);
   strcpy(cpy, buffer);
   cpy[strlen(cpy) - 1] = '\0';
@@ -24,7 +36,8 @@ void add_history(char *unused) {}
 #include <editline/readline.h>
 #endif
 
-// Forward Declarations
+// Parsers of the AST reader. All of the readers are built once at startup and
+// only read after that, so any number of parses can share them
 mpc_parser_t *Number;
 mpc_parser_t *Symbol;
 mpc_parser_t *String;
@@ -34,6 +47,22 @@ mpc_parser_t *Qexpr;
 mpc_parser_t *Expr;
 mpc_parser_t *Cumunisp;
 
+// Direct reader, used unless started with --ast-reader
+mpc_parser_t *ReadExpr;
+mpc_parser_t *Reader;
+int ast_reader = 0;
+
+// Reads one top-level form at a time for builtin_load
+mpc_parser_t *Form;
+
+// Both readers are loaded from the tables in grammar.c, which the Makefile
+// generates with --dump-grammar. Bootstrap builds have no tables yet
+int runtime_grammar = 0;
+#ifndef CUMUNISP_BOOTSTRAP
+extern const mpc_grammar_t lval_reader_grammar;
+extern const mpc_grammar_t lval_ast_grammar;
+#endif
+
 struct lval;
 struct lenv;
 typedef struct lval lval;
@@ -52,47 +81,118 @@ enum {
 
 typedef lval *(*lbuiltin)(lenv *, lval *);
 
+// Shared storage for long strings. A leaf keeps its bytes in flat, a rope
+// node keeps a left and right half until someone needs the bytes, at which
+// point it is flattened in place and becomes a leaf
+typedef struct lstr lstr;
+struct lstr {
+  int refs;
+  size_t len;
+  lstr *left;
+  lstr *right;
+  char *flat;
+};
+
+// Strings shorter than this are stored inline after the lval itself
+#define LVAL_STR_INLINE 24
+
+// Concatenations shorter than this are copied instead of building a rope node
+#define LSTR_FLAT_MAX 256
+
+// Name a lambda was first bound to by def. Names are interned so copies of a
+// lambda share them, and the profiler keeps its counts of each here
+typedef struct lname lname;
+struct lname {
+  char *str;
+  unsigned long self;
+  unsigned long total;
+  unsigned long stamp;
+  lname *next;
+};
+
 // lval Struct
 struct lval {
   int type;
+  // Lists change between sexpr and qexpr in place, so frees are counted by
+  // the type the lval was allocated as
+  int alloc_type;
 
   // Basic
   double num;
   char *err;
   char *sym;
+
+  // String, str is NULL while the rope has not been flattened yet
   char *str;
+  size_t len;
+  lstr *rope;
 
-  // Function
+  // Function, name is NULL until a lambda is bound with def, nullary is set
+  // for builtins which take no arguments
   lbuiltin builtin;
   lenv *env;
   lval *formals;
   lval *body;
+  lname *name;
+  int nullary;
 
   // Count and Pointer to a list of "lval"
   int count;
   lval **cell;
+
+  // Inline storage for short strings, must stay the last member
+  char sbuf[];
 };
 
+// Counters of what the interpreter does. They are always on, (stats) returns
+// them and (stats-reset) sets them back to zero. lval_bytes counts the lvals
+// themselves with their inline strings, not what they point to
+#define LVAL_TYPES 7
+
+typedef struct {
+  unsigned long allocs[LVAL_TYPES];
+  unsigned long frees[LVAL_TYPES];
+  unsigned long lval_bytes;
+  unsigned long copies;
+  unsigned long copy_bytes;
+  unsigned long env_copies;
+  unsigned long lookups;
+  unsigned long lookup_depth;
+  unsigned long builtin_calls;
+  unsigned long lambda_calls;
+} lstats;
+
+lstats stats;
+
+// Every lval is allocated here so it is counted by type
+lval *lval_alloc(int type, size_t size) {
+  lval *v = malloc(size);
+  v->type = type;
+  v->alloc_type = type;
+  stats.allocs[type]++;
+  stats.lval_bytes += size;
+  return v;
+}
+
 // lval fun constructor
 lval *lval_builtin(lbuiltin func) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
+  lval *v = lval_alloc(LVAL_FUN, sizeof(lval));
   v->builtin = func;
+  v->nullary = 0;
+  v->name = NULL;
   return v;
 }
 
 // Create a pointer to a new Number type lval
 lval *lval_num(double x) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_NUM;
+  lval *v = lval_alloc(LVAL_NUM, sizeof(lval));
   v->num = x;
   return v;
 }
 
 // A pointer to a new empty Qexpr lval
 lval *lval_qexpr(void) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_QEXPR;
+  lval *v = lval_alloc(LVAL_QEXPR, sizeof(lval));
   v->count = 0;
   v->cell = NULL;
   return v;
@@ -100,8 +200,7 @@ lval *lval_qexpr(void) {
 
 // Create a pointer to a new Error type lval
 lval *lval_err(char *fmt, ...) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_ERR;
+  lval *v = lval_alloc(LVAL_ERR, sizeof(lval));
 
   // Create a va list and initialize it
   va_list va;
@@ -123,31 +222,166 @@ lval *lval_err(char *fmt, ...) {
 }
 
 // Create a pointer to a new Symbol type lval
-lval *lval_sym(char *s) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_SYM;
-  v->sym = malloc(strlen(s) + 1);
-  strcpy(v->sym, s);
+lval *lval_sym_n(const char *s, size_t len) {
+  lval *v = lval_alloc(LVAL_SYM, sizeof(lval));
+  v->sym = malloc(len + 1);
+  memcpy(v->sym, s, len);
+  v->sym[len] = '\0';
   return v;
 }
 
+lval *lval_sym(char *s) { return lval_sym_n(s, strlen(s)); }
+
 // A point to a new empty Sexpr lval
 lval *lval_sexpr(void) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_SEXPR;
+  lval *v = lval_alloc(LVAL_SEXPR, sizeof(lval));
   v->count = 0;
   v->cell = NULL;
   return v;
 }
 
-lval *lval_str(char *s) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_STR;
-  v->str = malloc(strlen(s) + 1);
-  strcpy(v->str, s);
+// Allocate a leaf with room for len bytes stored right after the header
+lstr *lstr_alloc(size_t len) {
+  lstr *r = malloc(sizeof(lstr) + len + 1);
+  r->refs = 1;
+  r->len = len;
+  r->left = NULL;
+  r->right = NULL;
+  r->flat = (char *)(r + 1);
+  r->flat[len] = '\0';
+  return r;
+}
+
+// Join two strings without copying them, takes ownership of both references
+lstr *lstr_concat(lstr *l, lstr *r) {
+  lstr *n = malloc(sizeof(lstr));
+  n->refs = 1;
+  n->len = l->len + r->len;
+  n->left = l;
+  n->right = r;
+  n->flat = NULL;
+  return n;
+}
+
+// Drop a reference. Ropes built by appending in a loop are as deep as the
+// number of appends so they are released without recursion
+void lstr_unref(lstr *r) {
+  int num = 0;
+  int slots = 0;
+  lstr **stack = NULL;
+
+  while (r) {
+    lstr *next = NULL;
+    if (--r->refs == 0) {
+      if (r->left) {
+        if (num == slots) {
+          slots = slots ? slots * 2 : 16;
+          stack = realloc(stack, sizeof(lstr *) * slots);
+        }
+        stack[num++] = r->right;
+        next = r->left;
+      }
+      if (r->flat && r->flat != (char *)(r + 1)) {
+        free(r->flat);
+      }
+      free(r);
+    }
+    r = next ? next : (num ? stack[--num] : NULL);
+  }
+  free(stack);
+}
+
+// Copy the bytes of a rope into one buffer and release its halves
+void lstr_flatten(lstr *r) {
+  if (r->flat) {
+    return;
+  }
+
+  char *buf = malloc(r->len + 1);
+  size_t off = 0;
+  int num = 0;
+  int slots = 16;
+  lstr **stack = malloc(sizeof(lstr *) * slots);
+
+  stack[num++] = r;
+  while (num) {
+    lstr *n = stack[--num];
+    if (n->flat) {
+      memcpy(buf + off, n->flat, n->len);
+      off += n->len;
+      continue;
+    }
+    if (num + 2 > slots) {
+      slots *= 2;
+      stack = realloc(stack, sizeof(lstr *) * slots);
+    }
+    stack[num++] = n->right;
+    stack[num++] = n->left;
+  }
+  free(stack);
+  buf[r->len] = '\0';
+
+  lstr_unref(r->left);
+  lstr_unref(r->right);
+  r->left = NULL;
+  r->right = NULL;
+  r->flat = buf;
+}
+
+// A new String lval with room for len bytes, the caller fills in v->str
+lval *lval_str_alloc(size_t len) {
+  lval *v;
+  if (len < LVAL_STR_INLINE) {
+    v = lval_alloc(LVAL_STR, sizeof(lval) + LVAL_STR_INLINE);
+    v->str = v->sbuf;
+    v->rope = NULL;
+  } else {
+    v = lval_alloc(LVAL_STR, sizeof(lval));
+    v->rope = lstr_alloc(len);
+    v->str = v->rope->flat;
+  }
+  v->len = len;
+  v->str[len] = '\0';
+  return v;
+}
+
+lval *lval_str_n(const char *s, size_t len) {
+  lval *v = lval_str_alloc(len);
+  memcpy(v->str, s, len);
+  return v;
+}
+
+lval *lval_str(char *s) { return lval_str_n(s, strlen(s)); }
+
+// Wrap shared string storage, takes ownership of the reference
+lval *lval_str_rope(lstr *r) {
+  lval *v = lval_alloc(LVAL_STR, sizeof(lval));
+  v->len = r->len;
+  v->rope = r;
+  v->str = r->flat;
   return v;
 }
 
+// Contents of a String lval, flattening it first if it is a rope
+char *lval_str_ptr(lval *v) {
+  if (!v->str) {
+    lstr_flatten(v->rope);
+    v->str = v->rope->flat;
+  }
+  return v->str;
+}
+
+// A new reference to the storage of a String lval, for building ropes
+lstr *lval_str_share(lval *v) {
+  if (v->rope) {
+    v->rope->refs++;
+    return v->rope;
+  }
+  lstr *r = lstr_alloc(v->len);
+  memcpy(r->flat, v->str, v->len);
+  return r;
+}
+
 // Function that calls free() for every malloc to prevent memory leaks
 void lval_del(lval *v) {
   switch (v->type) {
@@ -166,9 +400,11 @@ void lval_del(lval *v) {
   case LVAL_SYM:
     free(v->sym);
     break;
-  // Free string memory for string type
+  // Release string storage, inline strings go with the lval
   case LVAL_STR:
-    free(v->str);
+    if (v->rope) {
+      lstr_unref(v->rope);
+    }
     break;
 
     // If Qexpr or Sexpr then delete all elems inside
@@ -182,14 +418,20 @@ void lval_del(lval *v) {
     break;
   }
 
+  stats.frees[v->alloc_type]++;
   free(v);
 }
-lval *lval_read_num(mpc_ast_t *t) {
-  errno = 0;
-  double x = strtod(t->contents, NULL);
-  return errno != ERANGE ? lval_num(x) : lval_err("Invalid number!");
+
+// Tokens in an arena AST aren't terminated, numconv reads them in place
+lval *lval_read_num_n(const char *s, size_t len) {
+  double x;
+  return len > 0 && numconv_parse(s, len, &x) == len
+             ? lval_num(x)
+             : lval_err("Invalid number!");
 }
 
+lval *lval_read_num(char *s) { return lval_read_num_n(s, strlen(s)); }
+
 lval *lval_add(lval *v, lval *x) {
   v->count++;
   v->cell = realloc(v->cell, sizeof(lval *) * v->count);
@@ -197,12 +439,12 @@ lval *lval_add(lval *v, lval *x) {
   return v;
 }
 
-lval *lval_read_str(mpc_ast_t *t) {
-  // Cut off the final quote character
-  t->contents[strlen(t->contents) - 1] = '\0';
-  // Copy the string missing out the first quote character
-  char *unescaped = malloc(strlen(t->contents + 1) + 1);
-  strcpy(unescaped, t->contents + 1);
+lval *lval_read_str_n(const char *s, size_t n) {
+  // Copy the string missing out the quote characters
+  size_t len = n - 2;
+  char *unescaped = malloc(len + 1);
+  memcpy(unescaped, s + 1, len);
+  unescaped[len] = '\0';
   // Pass through the unescape function
   unescaped = mpcf_unescape(unescaped);
   // Construct a new lval using the string
@@ -212,148 +454,461 @@ lval *lval_read_str(mpc_ast_t *t) {
   return str;
 }
 
-lval *lval_read(mpc_ast_t *t) {
+lval *lval_read_str(char *s) { return lval_read_str_n(s, strlen(s)); }
 
-  // If Symbol or Number return conversion to that type
-  if (strstr(t->tag, "number")) {
-    return lval_read_num(t);
-  }
-  if (strstr(t->tag, "string")) {
-    return lval_read_str(t);
-  }
-  if (strstr(t->tag, "symbol")) {
-    return lval_sym(t->contents);
-  }
+// Rules of the AST grammar, numbered by their position in the list of
+// parsers given to mpca_lang and mpc_load in lval_grammar_new
+enum {
+  RULE_NUMBER,
+  RULE_SYMBOL,
+  RULE_STRING,
+  RULE_COMMENT,
+  RULE_SEXPR,
+  RULE_QEXPR,
+  RULE_EXPR,
+  RULE_CUMUNISP
+};
 
-  // If root (>) or sexpr then crete empty list
-  lval *x = NULL;
-  if (strstr(t->tag, ">")) {
-    x = lval_sexpr();
-  }
-  if (strstr(t->tag, "sexpr")) {
-    x = lval_sexpr();
-  }
+lval *lval_read(mpc_ast_t *t) {
 
-  if (strstr(t->tag, "qexpr")) {
+  lval *x;
+  switch (t->tag_id) {
+  // If Symbol, Number or String return conversion to that type
+  case RULE_NUMBER:
+    return lval_read_num_n(t->contents, t->contents_len);
+  case RULE_STRING:
+    return lval_read_str_n(t->contents, t->contents_len);
+  case RULE_SYMBOL:
+    return lval_sym_n(t->contents, t->contents_len);
+  case RULE_COMMENT:
+    return NULL;
+  case RULE_QEXPR:
     x = lval_qexpr();
+    break;
+  // The root (>) and sexpr are both read as an S-Expression
+  default:
+    x = lval_sexpr();
+    break;
   }
 
-  // Fill this list with any valid wxpression contained within
+  // Fill this list with any valid wxpression contained within, skipping
+  // brackets, anchors and comments
   for (int i = 0; i < t->children_num; i++) {
-    if (strcmp(t->children[i]->contents, "(") == 0) {
+    mpc_ast_t *c = t->children[i];
+    if (c->flags & MPC_AST_DROPPABLE || c->tag_id == RULE_COMMENT) {
       continue;
     }
-    if (strcmp(t->children[i]->contents, ")") == 0) {
-      continue;
-    }
-    if (strcmp(t->children[i]->contents, "{") == 0) {
-      continue;
-    }
-    if (strcmp(t->children[i]->contents, "}") == 0) {
-      continue;
-    }
-    if (strcmp(t->children[i]->tag, "regex") == 0) {
-      continue;
+    x = lval_add(x, lval_read(c));
+  }
+  return x;
+}
+
+// Direct reader folds, these build lvals straight from the matched text so
+// no mpc_ast_t is ever allocated
+mpc_val_t *lval_fold_num(mpc_val_t *x) {
+  lval *v = lval_read_num(x);
+  free(x);
+  return v;
+}
+
+mpc_val_t *lval_fold_sym(mpc_val_t *x) {
+  lval *v = lval_sym(x);
+  free(x);
+  return v;
+}
+
+mpc_val_t *lval_fold_str(mpc_val_t *x) {
+  lval *v = lval_read_str(x);
+  free(x);
+  return v;
+}
+
+// Comments produce nothing and are skipped by lval_fold_list
+mpc_val_t *lval_fold_comment(mpc_val_t *x) {
+  free(x);
+  return NULL;
+}
+
+mpc_val_t *lval_fold_list(int n, mpc_val_t **xs) {
+  lval *x = lval_sexpr();
+  for (int i = 0; i < n; i++) {
+    if (xs[i]) {
+      x->count++;
     }
-    if (strstr(t->children[i]->tag, "comment")) {
-      continue;
+  }
+  if (x->count) {
+    x->cell = malloc(sizeof(lval *) * x->count);
+    for (int i = 0, j = 0; i < n; i++) {
+      if (xs[i]) {
+        x->cell[j++] = xs[i];
+      }
     }
-    x = lval_add(x, lval_read(t->children[i]));
   }
   return x;
 }
 
-void lval_print(lval *v);
+// Drop the brackets or anchors around a list
+mpc_val_t *lval_fold_sexpr(int n, mpc_val_t **xs) {
+  free(xs[0]);
+  free(xs[n - 1]);
+  return xs[1];
+}
+
+mpc_val_t *lval_fold_qexpr(int n, mpc_val_t **xs) {
+  lval *x = lval_fold_sexpr(n, xs);
+  x->type = LVAL_QEXPR;
+  return x;
+}
+
+// Functions the direct reader refers to, so it can be saved and loaded
+const mpc_symbol_t lval_reader_symbols[] = {
+    {"lval_fold_num", (mpc_func_t)lval_fold_num},
+    {"lval_fold_sym", (mpc_func_t)lval_fold_sym},
+    {"lval_fold_str", (mpc_func_t)lval_fold_str},
+    {"lval_fold_comment", (mpc_func_t)lval_fold_comment},
+    {"lval_fold_list", (mpc_func_t)lval_fold_list},
+    {"lval_fold_sexpr", (mpc_func_t)lval_fold_sexpr},
+    {"lval_fold_qexpr", (mpc_func_t)lval_fold_qexpr},
+    {"lval_del", (mpc_func_t)lval_del},
+    {NULL, NULL}};
+
+// Build the direct reader. It uses the same tokens and structure as the
+// grammar in lval_grammar_new so errors are reported at the same positions
+void lval_reader_new(void) {
+  ReadExpr = mpc_new("expr");
+  Reader = mpc_new("cumunisp");
+
+#ifndef CUMUNISP_BOOTSTRAP
+  if (!runtime_grammar && mpc_load(&lval_reader_grammar, lval_reader_symbols,
+                                   2, ReadExpr, Reader)) {
+    return;
+  }
+#endif
+
+  mpc_parser_t *number =
+      mpc_apply(mpc_tok(mpc_re("-?[0-9]+(\\.[0-9]*)?")), lval_fold_num);
+  mpc_parser_t *symbol = mpc_apply(
+      mpc_tok(mpc_re("[a-zA-Z0-9_+\\-*/\\\\=<>!&%^]+")), lval_fold_sym);
+  mpc_parser_t *string =
+      mpc_apply(mpc_tok(mpc_re("\"(\\\\(.|\\n)|[^\"\\\\])*\"")), lval_fold_str);
+  mpc_parser_t *comment =
+      mpc_apply(mpc_tok(mpc_re(";[^\\r\\n]*")), lval_fold_comment);
+  mpc_parser_t *sexpr =
+      mpc_and(3, lval_fold_sexpr, mpc_tok(mpc_char('(')),
+              mpc_many(lval_fold_list, ReadExpr), mpc_tok(mpc_char(')')), free,
+              (mpc_dtor_t)lval_del);
+  mpc_parser_t *qexpr =
+      mpc_and(3, lval_fold_qexpr, mpc_tok(mpc_char('{')),
+              mpc_many(lval_fold_list, ReadExpr), mpc_tok(mpc_char('}')), free,
+              (mpc_dtor_t)lval_del);
+
+  mpc_define(ReadExpr, mpc_or(6, number, symbol, string, comment, sexpr, qexpr));
+  mpc_define(Reader, mpc_and(3, lval_fold_sexpr, mpc_tok(mpc_re("^")),
+                             mpc_many(lval_fold_list, ReadExpr),
+                             mpc_tok(mpc_re("$")), free, (mpc_dtor_t)lval_del));
+  mpc_optimise(ReadExpr);
+  mpc_optimise(Reader);
+}
+
+// Build the mpca grammar used by the AST reader
+void lval_grammar_new(void) {
+  Number = mpc_new("number");
+  Symbol = mpc_new("symbol");
+  String = mpc_new("string");
+  Comment = mpc_new("comment");
+  Sexpr = mpc_new("sexpr");
+  Qexpr = mpc_new("qexpr");
+  Expr = mpc_new("expr");
+  Cumunisp = mpc_new("cumunisp");
+
+#ifndef CUMUNISP_BOOTSTRAP
+  if (!runtime_grammar && mpc_load(&lval_ast_grammar, NULL, 8, Number, Symbol,
+                                   String, Comment, Sexpr, Qexpr, Expr,
+                                   Cumunisp)) {
+    return;
+  }
+#endif
+
+  mpca_lang(MPCA_LANG_DEFAULT,
+            "                                                     \
+      number   : /-?[0-9]+(\\.[0-9]*)?/ ;                             \
+      symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%^]+/ ;  \
+      string   : /\"(\\\\(.|\\n)|[^\"\\\\])*\"/ ; \
+      comment  : /;[^\\r\\n]*/ ; \
+      sexpr    : '(' <expr>* ')' ; \
+      qexpr    : '{' <expr>* '}' ; \
+      expr     : <number> | <symbol> | <string> \
+               | <comment>| <sexpr> | <qexpr>;                           \
+      cumunisp    : /^/ <expr>* /$/ ;             \
+    ",
+            Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Cumunisp);
+}
+
+// Build both readers from their source and write them out as C
+int lval_grammar_dump(const char *filename) {
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    perror(filename);
+    return 0;
+  }
+
+  runtime_grammar = 1;
+  lval_reader_new();
+  lval_grammar_new();
+
+  fputs("// Generated by cumunisp --dump-grammar, do not edit\n", f);
+  fputs("#include \"mpc.h\"\n\n", f);
+  int ok = mpc_dump_c(f, "lval_reader_grammar", lval_reader_symbols, 2,
+                      ReadExpr, Reader);
+  fputs("\n", f);
+  ok = ok && mpc_dump_c(f, "lval_ast_grammar", NULL, 8, Number, Symbol, String,
+                        Comment, Sexpr, Qexpr, Expr, Cumunisp);
+  ok = fclose(f) == 0 && ok;
+  if (!ok) {
+    fprintf(stderr, "%s: could not write grammar\n", filename);
+    remove(filename);
+  }
+
+  mpc_cleanup(2, ReadExpr, Reader);
+  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr,
+              Cumunisp);
+  return ok;
+}
+
+// Parser for whole programs, the output is read with lval_read_result
+mpc_parser_t *lval_reader(void) { return ast_reader ? Cumunisp : Reader; }
+
+// Options to parse with lval_reader. The input is parsed where it is rather
+// than copied first, rows and columns are only worked out for errors, and the
+// AST reader builds its tree in an arena so it is released in one go once it
+// has been read
+mpc_parse_opts_t lval_opts = {MPC_PARSE_BORROWED | MPC_PARSE_LAZY_POSITIONS, 0,
+                              NULL, NULL};
+mpc_parse_opts_t lval_ast_opts = {
+    MPC_PARSE_AST_ARENA | MPC_PARSE_BORROWED | MPC_PARSE_LAZY_POSITIONS, 0, NULL,
+    NULL};
+const mpc_parse_opts_t *lval_reader_opts(void) {
+  return ast_reader ? &lval_ast_opts : &lval_opts;
+}
+
+// Build the parser for a single top-level form with whichever reader is in
+// use. It skips whitespace before the form, so it can be run again from where
+// the last form ended, and its output is NULL at the end of the input
+void lval_form_new(void) {
+  mpc_parser_t *expr = ast_reader ? Expr : ReadExpr;
+  Form = mpc_and(2, mpcf_snd_free, mpc_whitespaces(),
+                 mpc_or(2, expr, mpc_apply(mpc_re("$"), mpcf_free)), free);
+  mpc_optimise(Form);
+}
+
+// Turn the output of a successful parse into an S-Expression of the
+// top-level forms
+lval *lval_read_result(mpc_result_t *r) {
+  if (!ast_reader) {
+    return r->output;
+  }
+  lval *x = lval_read(r->output);
+  mpc_ast_delete(r->output);
+  return x;
+}
+
+// Turn the output of a successful parse with Form into the form, or NULL if
+// there was only a comment or the end of the input
+lval *lval_read_form(mpc_result_t *r) {
+  if (!ast_reader || r->output == NULL) {
+    return r->output;
+  }
+  lval *x = lval_read(r->output);
+  mpc_ast_delete(r->output);
+  return x;
+}
 
-// Function to loop over all the sub-expresession and prints them
-void lval_expr_print(lval *v, char open, char close) {
-  putchar(open);
-  for (int i = 0; i < v->count; i++) {
-    // Print Value contained within
-    lval_print(v->cell[i]);
+// Growable text buffer. Printing renders into out, which is written to stdout
+// whenever a line is finished or it fills up. to-string renders into a buffer
+// of its own that only grows
+typedef struct lbuf {
+  char *data;
+  size_t len;
+  size_t cap;
+  int flush;
+} lbuf;
+
+// Size of the output buffer, writes at least this long skip it
+#define LBUF_OUT_SIZE 8192
+
+lbuf out = {NULL, 0, 0, 1};
+
+void lbuf_flush(lbuf *b) {
+  if (b->flush && b->len) {
+    fwrite(b->data, 1, b->len, stdout);
+    b->len = 0;
+  }
+}
 
-    // Don't print trailing space if last element
-    if (i != (v->count - 1)) {
-      putchar(' ');
+// Make room for n more bytes and return where they go. Output is flushed
+// rather than grown
+char *lbuf_reserve(lbuf *b, size_t n) {
+  if (b->len + n > b->cap) {
+    lbuf_flush(b);
+  }
+  if (b->len + n > b->cap) {
+    size_t cap = b->cap ? b->cap : (b->flush ? LBUF_OUT_SIZE : 64);
+    while (cap < b->len + n) {
+      cap *= 2;
     }
+    b->data = realloc(b->data, cap);
+    b->cap = cap;
   }
-  putchar(close);
+  return b->data + b->len;
 }
 
-// Print string
-void lval_print_str(lval *v) {
-  // Make a copy of the string
-  char *escaped = malloc(strlen(v->str) + 1);
-  strcpy(escaped, v->str);
-  // Pass it through the escape function
-  escaped = mpcf_escape(escaped);
-  // Print it between " characters
-  printf("\"%s\"", escaped);
-  // Free the copied string
-  free(escaped);
+void lbuf_write(lbuf *b, const char *s, size_t n) {
+  if (b->flush && n >= LBUF_OUT_SIZE) {
+    lbuf_flush(b);
+    fwrite(s, 1, n, stdout);
+    return;
+  }
+  memcpy(lbuf_reserve(b, n), s, n);
+  b->len += n;
 }
 
-// Print an "lval"
-void lval_print(lval *v) {
-  // In the case the type is a number print it
+void lbuf_puts(lbuf *b, const char *s) { lbuf_write(b, s, strlen(s)); }
+
+void lbuf_putc(lbuf *b, char c) {
+  if (b->len == b->cap) {
+    lbuf_reserve(b, 1);
+  }
+  b->data[b->len++] = c;
+  if (c == '\n') {
+    lbuf_flush(b);
+  }
+}
+
+// Numbers are formatted straight into the buffer
+void lbuf_num(lbuf *b, double x) {
+  b->len += numconv_format(x, lbuf_reserve(b, NUMCONV_FORMAT_MAX));
+}
+
+void lval_write(lbuf *b, lval *v);
+
+// Write all the sub-expressions between open and close. Numbers and symbols
+// are written from the loop, so long flat lists cost no call per element
+void lval_expr_write(lbuf *b, lval *v, char open, char close) {
+  lbuf_putc(b, open);
+  for (int i = 0; i < v->count; i++) {
+    lval *x = v->cell[i];
+    if (i) {
+      lbuf_putc(b, ' ');
+    }
+    if (x->type == LVAL_NUM) {
+      lbuf_num(b, x->num);
+    } else if (x->type == LVAL_SYM) {
+      lbuf_puts(b, x->sym);
+    } else {
+      lval_write(b, x);
+    }
+  }
+  lbuf_putc(b, close);
+}
+
+// Write string between " characters, escaping it on the fly. The runs
+// between escapes are copied in one go
+void lval_str_write(lbuf *b, lval *v) {
+  char *s = lval_str_ptr(v);
+  size_t run = 0;
+  lbuf_putc(b, '"');
+  for (size_t i = 0; i < v->len; i++) {
+    const char *esc;
+    switch (s[i]) {
+    case '\a': esc = "\\a"; break;
+    case '\b': esc = "\\b"; break;
+    case '\f': esc = "\\f"; break;
+    case '\n': esc = "\\n"; break;
+    case '\r': esc = "\\r"; break;
+    case '\t': esc = "\\t"; break;
+    case '\v': esc = "\\v"; break;
+    case '\\': esc = "\\\\"; break;
+    case '\'': esc = "\\'"; break;
+    case '"': esc = "\\\""; break;
+    case '\0': esc = "\\0"; break;
+    default: continue;
+    }
+    lbuf_write(b, s + run, i - run);
+    lbuf_write(b, esc, 2);
+    run = i + 1;
+  }
+  lbuf_write(b, s + run, v->len - run);
+  lbuf_putc(b, '"');
+}
+
+// Write an "lval" into a buffer
+void lval_write(lbuf *b, lval *v) {
   switch (v->type) {
+  // Shortest text that reads back as the same number
   case LVAL_NUM:
-    printf("%g", v->num);
+    lbuf_num(b, v->num);
     break;
 
     // lval fun type
   case LVAL_FUN:
     if (v->builtin) {
-      printf("<builtin>");
+      lbuf_puts(b, "<builtin>");
     } else {
-      printf("(\\ )");
-      lval_print(v->formals);
-      putchar(' ');
-      lval_print(v->body);
-      putchar(')');
+      lbuf_puts(b, "(\\ )");
+      lval_write(b, v->formals);
+      lbuf_putc(b, ' ');
+      lval_write(b, v->body);
+      lbuf_putc(b, ')');
     }
     break;
 
     // In the case the type is an error
   case LVAL_ERR:
-    printf("Error: %s", v->err);
+    lbuf_puts(b, "Error: ");
+    lbuf_puts(b, v->err);
     break;
   case LVAL_SYM:
-    printf("%s", v->sym);
+    lbuf_puts(b, v->sym);
     break;
   case LVAL_STR:
-    lval_print_str(v);
+    lval_str_write(b, v);
     break;
   case LVAL_SEXPR:
-    lval_expr_print(v, '(', ')');
+    lval_expr_write(b, v, '(', ')');
     break;
   case LVAL_QEXPR:
-    lval_expr_print(v, '{', '}');
+    lval_expr_write(b, v, '{', '}');
     break;
   }
 }
 
-void lval_print_expr(lval *v, char open, char close) {
-  putchar(open);
-  for (int i = 0; i < v->count; i++) {
-    lval_print(v->cell[i]);
-    if (i != (v->count - 1)) {
-      putchar(' ');
-    }
-  }
-  putchar(close);
-}
+// Print an "lval"
+void lval_print(lval *v) { lval_write(&out, v); }
 
 lenv *lenv_copy(lenv *e);
 
 // Copying the environment
 lval *lval_copy(lval *v) {
-  lval *x = malloc(sizeof(lval));
-  x->type = v->type;
+  stats.copies++;
+  stats.copy_bytes += sizeof(lval);
+
+  // Short strings are copied with the lval, long ones share their storage
+  if (v->type == LVAL_STR) {
+    if (!v->rope) {
+      stats.copy_bytes += LVAL_STR_INLINE;
+      return lval_str_n(v->str, v->len);
+    }
+    v->rope->refs++;
+    return lval_str_rope(v->rope);
+  }
+
+  lval *x = lval_alloc(v->type, sizeof(lval));
 
   switch (v->type) {
   // Copy Functions and Numbers directly
   case LVAL_FUN:
+    x->name = v->name;
+    x->nullary = v->nullary;
     if (v->builtin) {
 
       x->builtin = v->builtin;
@@ -370,16 +925,14 @@ lval *lval_copy(lval *v) {
 
   // Copy Strings using malloc and strcpy
   case LVAL_ERR:
-    x->err = malloc(sizeof(strlen(v->err) + 1));
+    x->err = malloc(strlen(v->err) + 1);
     strcpy(x->err, v->err);
+    stats.copy_bytes += strlen(v->err) + 1;
     break;
   case LVAL_SYM:
-    x->sym = malloc(sizeof(strlen(v->sym) + 1));
+    x->sym = malloc(strlen(v->sym) + 1);
     strcpy(x->sym, v->sym);
-    break;
-  case LVAL_STR:
-    x->str = malloc(strlen(v->str) + 1);
-    strcpy(x->str, v->str);
+    stats.copy_bytes += strlen(v->sym) + 1;
     break;
 
   // Copy Lists by copying each sub-expression
@@ -387,6 +940,7 @@ lval *lval_copy(lval *v) {
   case LVAL_QEXPR:
     x->count = v->count;
     x->cell = malloc(sizeof(lval *) * x->count);
+    stats.copy_bytes += sizeof(lval *) * x->count;
     for (int i = 0; i < x->count; i++) {
       x->cell[i] = lval_copy(v->cell[i]);
     }
@@ -413,12 +967,13 @@ lenv *lenv_new(void) {
   return e;
 }
 lval *lval_lambda(lval *formals, lval *body) {
-  lval *v = malloc(sizeof(lval));
-  v->type = LVAL_FUN;
+  lval *v = lval_alloc(LVAL_FUN, sizeof(lval));
   v->builtin = NULL;
+  v->nullary = 0;
   v->env = lenv_new();
   v->formals = formals;
   v->body = body;
+  v->name = NULL;
   return v;
 }
 
@@ -435,6 +990,7 @@ void lenv_del(lenv *e) {
 }
 
 lenv *lenv_copy(lenv *e) {
+  stats.env_copies++;
   lenv *n = malloc(sizeof(lenv));
   n->par = e->par;
   n->count = e->count;
@@ -449,21 +1005,22 @@ lenv *lenv_copy(lenv *e) {
 }
 
 // Get from environment
+// Counts one lookup, and every parent it moves on to as depth walked
 lval *lenv_get(lenv *e, lval *k) {
-  // Iterate over all items in environment
-  for (int i = 0; i < e->count; i++) {
-    // Check if the stored string matches the symbel string
-    // If it does, return a copy of the value
-    if (strcmp(e->syms[i], k->sym) == 0) {
-      return lval_copy(e->vals[i]);
+  stats.lookups++;
+  for (; e; e = e->par) {
+    // Iterate over all items in environment
+    for (int i = 0; i < e->count; i++) {
+      // Check if the stored string matches the symbel string
+      // If it does, return a copy of the value
+      if (strcmp(e->syms[i], k->sym) == 0) {
+        return lval_copy(e->vals[i]);
+      }
     }
+    stats.lookup_depth += e->par != NULL;
   }
-  if (e->par) {
-    return lenv_get(e->par, k);
-  } else {
-    // If no symbol found return error
-    return lval_err("Unbound Symbol '%s'", k->sym);
-  }
+  // If no symbol found return error
+  return lval_err("Unbound Symbol '%s'", k->sym);
 }
 
 // Put into environment
@@ -501,7 +1058,7 @@ void lenf_def(lenv *e, lval *k, lval *v) {
 // Print an "lval" followed by a newline
 void lval_println(lval *v) {
   lval_print(v);
-  putchar('\n');
+  lbuf_putc(&out, '\n');
 }
 
 lval *lval_pop(lval *v, int i) {
@@ -772,6 +1329,9 @@ lval *builtin_init(lenv *e, lval *a) {
 
   return v;
 }
+
+void lval_name(lval *v, const char *name);
+
 lval *builtin_var(lenv *e, lval *a, char *func) {
   LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
 
@@ -790,6 +1350,7 @@ lval *builtin_var(lenv *e, lval *a, char *func) {
 
   for (int i = 0; i < syms->count; i++) {
     if (strcmp(func, "def") == 0) {
+      lval_name(a->cell[i + 1], syms->cell[i]->sym);
       lenv_def(e, syms->cell[i], a->cell[i + 1]);
     }
     if (strcmp(func, "=") == 0) {
@@ -845,7 +1406,13 @@ int lval_eq(lval *x, lval *y) {
   case LVAL_SYM:
     return (strcmp(x->sym, y->sym) == 0);
   case LVAL_STR:
-    return (strcmp(x->str, y->str) == 0);
+    if (x->len != y->len) {
+      return 0;
+    }
+    if (x->rope && x->rope == y->rope) {
+      return 1;
+    }
+    return memcmp(lval_str_ptr(x), lval_str_ptr(y), x->len) == 0;
 
   // If builtin compare, otherwise compare formals and body
   case LVAL_FUN:
@@ -915,26 +1482,49 @@ lval *builtin_load(lenv *e, lval *a) {
   LASSERT_NUM("load", a, 1);
   LASSERT_TYPE("load", a, 0, LVAL_STR);
 
-  // Parse File given by string name
+  // Parse File given by string name one form at a time, each is evaluated
+  // and freed before the next is read. "-" reads from standard input
   mpc_result_t r;
-  if (mpc_parse_contents(a->cell[0]->str, Cumunisp, &r)) {
-
-    // Read contents
-    lval *expr = lval_read(r.output);
-    mpc_ast_delete(r.output);
-
-    /* Evaluate each Expression */
-    while (expr->count) {
-      lval *x = lval_eval(e, lval_pop(expr, 0));
+  char *filename = lval_str_ptr(a->cell[0]);
+  mpc_stream_t *s = strcmp(filename, "-") == 0
+                        ? mpc_stream_pipe("<stdin>", stdin)
+                        : mpc_stream_contents(filename, &r);
+  int ok = s != NULL;
+
+  while (ok && !mpc_stream_eoi(s)) {
+    ok = mpc_stream_next(s, Form, &r, lval_reader_opts());
+    lval *expr = ok ? lval_read_form(&r) : NULL;
+    if (expr) {
+      lval *x = lval_eval(e, expr);
       // If Evaluation leads to error print it
       if (x->type == LVAL_ERR) {
         lval_println(x);
       }
       lval_del(x);
     }
+  }
+
+  // A form read on its own can't list what the end of the form before it
+  // expected, so the error comes from parsing the whole file again like
+  // the REPL does
+  mpc_result_t w;
+  if (s && !ok && strcmp(filename, "-") != 0) {
+    if (mpc_parse_contents_with(filename, lval_reader(), &w,
+                                lval_reader_opts())) {
+      lval_del(lval_read_result(&w));
+    } else {
+      mpc_err_delete(r.error);
+      r.error = w.error;
+    }
+  }
 
-    // Delete expressions and arguments
-    lval_del(expr);
+  if (s) {
+    mpc_stream_delete(s);
+  }
+
+  if (ok) {
+
+    // Delete arguments
     lval_del(a);
 
     // Return empty list
@@ -959,28 +1549,339 @@ lval *builtin_print(lenv *e, lval *a) {
   // Print each argument followed by a space
   for (int i = 0; i < a->count; i++) {
     lval_print(a->cell[i]);
-    putchar(' ');
+    lbuf_putc(&out, ' ');
   }
 
   // Print a newline and delete arguments
-  putchar('\n');
+  lbuf_putc(&out, '\n');
   lval_del(a);
 
   return lval_sexpr();
 }
 
+// Render any value into a string, the same text print would show
+lval *builtin_to_string(lenv *e, lval *a) {
+  (void)e;
+  LASSERT_NUM("to-string", a, 1);
+
+  lbuf b = {NULL, 0, 0, 0};
+  lval_write(&b, a->cell[0]);
+  lval *x = lval_str_n(b.data, b.len);
+  free(b.data);
+  lval_del(a);
+  return x;
+}
+
+// Names of the lval types in the stats, in the order of the enumeration
+char *lval_type_keys[LVAL_TYPES] = {"num", "sym", "sexpr", "qexpr",
+                                    "err", "fun", "str"};
+
+lval *lval_stat(char *name, double n) {
+  lval *v = lval_qexpr();
+  v = lval_add(v, lval_str(name));
+  return lval_add(v, lval_num(n));
+}
+
+// The counters as {{"name" value} ...}, so lookup from the prelude finds
+// them. They are taken before the result is built so it doesn't count itself
+lval *builtin_stats(lenv *e, lval *a) {
+  (void)e;
+  lstats s = stats;
+  LASSERT_NUM("stats", a, 0);
+  lval_del(a);
+
+  lval *x = lval_qexpr();
+  char name[32];
+  for (int i = 0; i < LVAL_TYPES; i++) {
+    snprintf(name, sizeof(name), "allocs-%s", lval_type_keys[i]);
+    x = lval_add(x, lval_stat(name, s.allocs[i]));
+  }
+  for (int i = 0; i < LVAL_TYPES; i++) {
+    snprintf(name, sizeof(name), "frees-%s", lval_type_keys[i]);
+    x = lval_add(x, lval_stat(name, s.frees[i]));
+  }
+  x = lval_add(x, lval_stat("lval-bytes", s.lval_bytes));
+  x = lval_add(x, lval_stat("copies", s.copies));
+  x = lval_add(x, lval_stat("copy-bytes", s.copy_bytes));
+  x = lval_add(x, lval_stat("env-copies", s.env_copies));
+  x = lval_add(x, lval_stat("lookups", s.lookups));
+  x = lval_add(x, lval_stat("lookup-depth", s.lookup_depth));
+  x = lval_add(x, lval_stat("builtin-calls", s.builtin_calls));
+  x = lval_add(x, lval_stat("lambda-calls", s.lambda_calls));
+  return x;
+}
+
+// Nanoseconds on the monotonic clock, or of CPU time used by the process
+double lclock_ns(int cpu) {
+#ifndef _WIN32
+  struct timespec t;
+  clock_gettime(cpu ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+#else
+  return (double)(cpu ? clock() : time(NULL) * CLOCKS_PER_SEC) /
+         CLOCKS_PER_SEC * 1e9;
+#endif
+}
+
+unsigned long lstats_allocs(void) {
+  unsigned long n = 0;
+  for (int i = 0; i < LVAL_TYPES; i++) {
+    n += stats.allocs[i];
+  }
+  return n;
+}
+
+// What one evaluation cost, summed over the runs of bench
+typedef struct {
+  double wall_ns;
+  double cpu_ns;
+  unsigned long allocs;
+  unsigned long lval_bytes;
+} lcost;
+
+// Evaluate the Q-expression x like eval does, adding what it cost to c. Only
+// the evaluation is measured, the caller makes x
+lval *lval_eval_timed(lenv *e, lval *x, lcost *c) {
+  x->type = LVAL_SEXPR;
+  unsigned long allocs = lstats_allocs(), bytes = stats.lval_bytes;
+  // The CPU interval is nested in the wall one, so it doesn't include the
+  // time spent reading the wall clock
+  double wall = lclock_ns(0), cpu = lclock_ns(1);
+  lval *r = lval_eval(e, x);
+  c->cpu_ns += lclock_ns(1) - cpu;
+  c->wall_ns += lclock_ns(0) - wall;
+  c->allocs += lstats_allocs() - allocs;
+  c->lval_bytes += stats.lval_bytes - bytes;
+  return r;
+}
+
+// {result {{"name" value} ...}}, with the costs averaged over the runs
+lval *lval_timed(lval *r, lcost *c, int runs) {
+  lval *m = lval_qexpr();
+  if (runs > 1) {
+    m = lval_add(m, lval_stat("runs", runs));
+  }
+  m = lval_add(m, lval_stat("wall-ns", c->wall_ns / runs));
+  m = lval_add(m, lval_stat("cpu-ns", c->cpu_ns / runs));
+  m = lval_add(m, lval_stat("allocs", (double)c->allocs / runs));
+  m = lval_add(m, lval_stat("lval-bytes", (double)c->lval_bytes / runs));
+  return lval_add(lval_add(lval_qexpr(), r), m);
+}
+
+lval *builtin_time(lenv *e, lval *a) {
+  LASSERT_NUM("time", a, 1);
+  LASSERT_TYPE("time", a, 0, LVAL_QEXPR);
+
+  lcost c = {0, 0, 0, 0};
+  lval *r = lval_eval_timed(e, lval_take(a, 0), &c);
+  if (r->type == LVAL_ERR) {
+    return r;
+  }
+  return lval_timed(r, &c, 1);
+}
+
+// Most runs bench takes, so the count always fits in an int
+#define LBENCH_RUNS_MAX 1000000000
+
+// Evaluate the expression the given number of times, keeping the last result
+lval *builtin_bench(lenv *e, lval *a) {
+  LASSERT_NUM("bench", a, 2);
+  LASSERT_TYPE("bench", a, 0, LVAL_NUM);
+  LASSERT_TYPE("bench", a, 1, LVAL_QEXPR);
+
+  double n = a->cell[0]->num;
+  char num[NUMCONV_FORMAT_MAX];
+  numconv_format(n, num);
+  LASSERT(a, n >= 1 && n <= LBENCH_RUNS_MAX && n == (int)n,
+          "Function 'bench' passed invalid runs %s, Expected a whole number "
+          "from 1 to %d!",
+          num, LBENCH_RUNS_MAX);
+
+  int runs = (int)n;
+  lcost c = {0, 0, 0, 0};
+  lval *r = NULL;
+  for (int i = 0; i < runs; i++) {
+    if (r) {
+      lval_del(r);
+    }
+    r = lval_eval_timed(e, lval_copy(a->cell[1]), &c);
+    if (r->type == LVAL_ERR) {
+      lval_del(a);
+      return r;
+    }
+  }
+  lval_del(a);
+  return lval_timed(r, &c, runs);
+}
+
+lval *builtin_stats_reset(lenv *e, lval *a) {
+  (void)e;
+  LASSERT_NUM("stats-reset", a, 0);
+  lval_del(a);
+  memset(&stats, 0, sizeof(stats));
+  return lval_sexpr();
+}
+
 lval *builtin_err(lenv *e, lval *a) {
   LASSERT_NUM("error", a, 1);
   LASSERT_TYPE("error", a, 0, LVAL_STR);
 
   // Construct Error from first argument
-  lval *err = lval_err(a->cell[0]->str);
+  lval *err = lval_err("%s", lval_str_ptr(a->cell[0]));
 
   // Delete arguments and return
   lval_del(a);
   return err;
 }
 
+lval *builtin_str_len(lenv *e, lval *a) {
+  (void)e;
+  LASSERT_NUM("str-len", a, 1);
+  LASSERT_TYPE("str-len", a, 0, LVAL_STR);
+
+  lval *x = lval_num(a->cell[0]->len);
+  lval_del(a);
+  return x;
+}
+
+lval *builtin_str_cat(lenv *e, lval *a) {
+  (void)e;
+  size_t total = 0;
+  for (int i = 0; i < a->count; i++) {
+    LASSERT_TYPE("str-cat", a, i, LVAL_STR);
+    total += a->cell[i]->len;
+  }
+
+  lval *x;
+  if (total < LSTR_FLAT_MAX) {
+    // Short results are cheaper to copy than to keep as a rope
+    x = lval_str_alloc(total);
+    size_t off = 0;
+    for (int i = 0; i < a->count; i++) {
+      memcpy(x->str + off, lval_str_ptr(a->cell[i]), a->cell[i]->len);
+      off += a->cell[i]->len;
+    }
+  } else {
+    // Long results share the storage of their parts so appending to a
+    // string in a loop does not copy everything built so far
+    lstr *r = NULL;
+    for (int i = 0; i < a->count; i++) {
+      if (a->cell[i]->len == 0) {
+        continue;
+      }
+      lstr *part = lval_str_share(a->cell[i]);
+      r = r ? lstr_concat(r, part) : part;
+    }
+    x = lval_str_rope(r);
+  }
+
+  lval_del(a);
+  return x;
+}
+
+lval *builtin_substr(lenv *e, lval *a) {
+  (void)e;
+  LASSERT(a, a->count == 2 || a->count == 3,
+          "Function 'substr' passed incorrect number of arguments. Got: %i, "
+          "Expected: 2 or 3!",
+          a->count);
+  LASSERT_TYPE("substr", a, 0, LVAL_STR);
+  LASSERT_TYPE("substr", a, 1, LVAL_NUM);
+
+  lval *s = a->cell[0];
+  double start = a->cell[1]->num;
+  double count = s->len - start;
+  if (a->count == 3) {
+    LASSERT_TYPE("substr", a, 2, LVAL_NUM);
+    count = a->cell[2]->num;
+  }
+
+  LASSERT(a, start >= 0 && start <= s->len && start == (size_t)start,
+          "Function 'substr' passed invalid start %g for string of length %zu!",
+          start, s->len);
+  LASSERT(a, count >= 0 && count <= s->len - start && count == (size_t)count,
+          "Function 'substr' passed invalid length %g for string of length "
+          "%zu!",
+          count, s->len);
+
+  lval *x = lval_str_n(lval_str_ptr(s) + (size_t)start, (size_t)count);
+  lval_del(a);
+  return x;
+}
+
+lval *builtin_split(lenv *e, lval *a) {
+  (void)e;
+  LASSERT_NUM("split", a, 2);
+  LASSERT_TYPE("split", a, 0, LVAL_STR);
+  LASSERT_TYPE("split", a, 1, LVAL_STR);
+  LASSERT(a, a->cell[1]->len != 0, "Function '%s' passed empty separator!",
+          "split");
+
+  char *s = lval_str_ptr(a->cell[0]);
+  char *sep = lval_str_ptr(a->cell[1]);
+  size_t len = a->cell[0]->len;
+  size_t seplen = a->cell[1]->len;
+
+  lval *x = lval_qexpr();
+  size_t start = 0;
+  size_t i = 0;
+  while (i + seplen <= len) {
+    char *hit = memchr(s + i, sep[0], len - seplen - i + 1);
+    if (!hit) {
+      break;
+    }
+    i = hit - s;
+    if (memcmp(hit, sep, seplen) == 0) {
+      x = lval_add(x, lval_str_n(s + start, i - start));
+      i += seplen;
+      start = i;
+    } else {
+      i++;
+    }
+  }
+  x = lval_add(x, lval_str_n(s + start, len - start));
+
+  lval_del(a);
+  return x;
+}
+
+lval *builtin_str_join(lenv *e, lval *a) {
+  (void)e;
+  LASSERT_NUM("str-join", a, 2);
+  LASSERT_TYPE("str-join", a, 0, LVAL_QEXPR);
+  LASSERT_TYPE("str-join", a, 1, LVAL_STR);
+
+  lval *l = a->cell[0];
+  lval *sep = a->cell[1];
+
+  // Size the result up front so it is built with a single allocation
+  size_t total = 0;
+  for (int i = 0; i < l->count; i++) {
+    LASSERT(a, l->cell[i]->type == LVAL_STR,
+            "Function 'str-join' passed incorrect type for element %i. Got: "
+            "%s, Expected: %s!",
+            i, ltype_name(l->cell[i]->type), ltype_name(LVAL_STR));
+    total += l->cell[i]->len;
+  }
+  if (l->count > 1) {
+    total += sep->len * (l->count - 1);
+  }
+
+  lval *x = lval_str_alloc(total);
+  size_t off = 0;
+  for (int i = 0; i < l->count; i++) {
+    if (i > 0) {
+      memcpy(x->str + off, lval_str_ptr(sep), sep->len);
+      off += sep->len;
+    }
+    memcpy(x->str + off, lval_str_ptr(l->cell[i]), l->cell[i]->len);
+    off += l->cell[i]->len;
+  }
+
+  lval_del(a);
+  return x;
+}
+
 lval *builtin_add(lenv *e, lval *a) { return builtin_op(e, a, "+"); }
 lval *builtin_sub(lenv *e, lval *a) { return builtin_op(e, a, "-"); }
 lval *builtin_mul(lenv *e, lval *a) { return builtin_op(e, a, "*"); }
@@ -997,14 +1898,24 @@ lval *builtin_eq(lenv *e, lval *a) { return builtin_cmp(e, a, "=="); };
 lval *builtin_ne(lenv *e, lval *a) { return builtin_cmp(e, a, "!="); };
 
 // Add builitins functions
-void lenv_add_builtin(lenv *e, char *name, lbuiltin func) {
+void lenv_add_builtin_fn(lenv *e, char *name, lbuiltin func, int nullary) {
   lval *k = lval_sym(name);
   lval *v = lval_builtin(func);
+  v->nullary = nullary;
   lenv_put(e, k, v);
   lval_del(k);
   lval_del(v);
 }
 
+void lenv_add_builtin(lenv *e, char *name, lbuiltin func) {
+  lenv_add_builtin_fn(e, name, func, 0);
+}
+
+// For builtins which take no arguments
+void lenv_add_nullary(lenv *e, char *name, lbuiltin func) {
+  lenv_add_builtin_fn(e, name, func, 1);
+}
+
 void lenv_add_builtins(lenv *e) {
   // Variable Functions
   lenv_add_builtin(e, "\\", builtin_lambda);
@@ -1050,12 +1961,238 @@ void lenv_add_builtins(lenv *e) {
   lenv_add_builtin(e, "load", builtin_load);
   lenv_add_builtin(e, "err", builtin_err);
   lenv_add_builtin(e, "print", builtin_print);
+  lenv_add_builtin(e, "to-string", builtin_to_string);
+  lenv_add_nullary(e, "stats", builtin_stats);
+  lenv_add_nullary(e, "stats-reset", builtin_stats_reset);
+  lenv_add_builtin(e, "time", builtin_time);
+  lenv_add_builtin(e, "bench", builtin_bench);
+  lenv_add_builtin(e, "str-len", builtin_str_len);
+  lenv_add_builtin(e, "str-cat", builtin_str_cat);
+  lenv_add_builtin(e, "substr", builtin_substr);
+  lenv_add_builtin(e, "split", builtin_split);
+  lenv_add_builtin(e, "str-join", builtin_str_join);
+}
+
+// Profiler, on with --profile. The names of the lambdas being called are kept
+// on a shadow stack. A CPU timer only counts ticks, and the stack is sampled
+// at the next call or return, where it is safe to allocate
+typedef struct lprof_stack lprof_stack;
+struct lprof_stack {
+  unsigned long count;
+  int depth;
+  lname **frames;
+  lprof_stack *next;
+};
+
+// Buckets of the table the names of lambdas are interned in
+#define LNAME_BUCKETS 256
+
+lname *lname_table[LNAME_BUCKETS];
+
+lname *lname_intern(const char *str) {
+  unsigned h = 0;
+  for (const char *c = str; *c; c++) {
+    h = h * 31 + (unsigned char)*c;
+  }
+  lname **b = &lname_table[h % LNAME_BUCKETS];
+  for (lname *n = *b; n; n = n->next) {
+    if (strcmp(n->str, str) == 0) {
+      return n;
+    }
+  }
+  lname *n = calloc(1, sizeof(lname));
+  n->str = malloc(strlen(str) + 1);
+  strcpy(n->str, str);
+  n->next = *b;
+  *b = n;
+  return n;
+}
+
+// Lambdas keep the first name they are defined as, so a lambda defined again
+// under another name is still known by where it was written
+void lval_name(lval *v, const char *name) {
+  if (v->type == LVAL_FUN && !v->builtin && !v->name) {
+    v->name = lname_intern(name);
+  }
+}
+
+// Buckets of the table of sampled stacks, and the file they are written to
+#define PROF_BUCKETS 4096
+#define PROF_FILE "cumunisp.folded"
+
+int profiling = 0;
+volatile sig_atomic_t prof_ticks = 0;
+lname *prof_anon;
+lname **prof_stack;
+int prof_depth = 0;
+int prof_slots = 0;
+lprof_stack *prof_stacks[PROF_BUCKETS];
+
+// Add the ticks since the last sample to the current stack
+void prof_sample(void) {
+  unsigned long ticks = prof_ticks;
+  prof_ticks = 0;
+
+  uintptr_t h = prof_depth;
+  for (int i = 0; i < prof_depth; i++) {
+    h = h * 31 + ((uintptr_t)prof_stack[i] >> 4);
+  }
+  lprof_stack **b = &prof_stacks[h % PROF_BUCKETS];
+  for (lprof_stack *p = *b; p; p = p->next) {
+    if (p->depth == prof_depth &&
+        memcmp(p->frames, prof_stack, sizeof(lname *) * prof_depth) == 0) {
+      p->count += ticks;
+      return;
+    }
+  }
+  lprof_stack *p = malloc(sizeof(lprof_stack));
+  p->count = ticks;
+  p->depth = prof_depth;
+  p->frames = malloc(sizeof(lname *) * (prof_depth ? prof_depth : 1));
+  memcpy(p->frames, prof_stack, sizeof(lname *) * prof_depth);
+  p->next = *b;
+  *b = p;
+}
+
+void prof_push(lval *f) {
+  if (prof_ticks) {
+    prof_sample();
+  }
+  if (prof_depth == prof_slots) {
+    prof_slots = prof_slots ? prof_slots * 2 : 256;
+    prof_stack = realloc(prof_stack, sizeof(lname *) * prof_slots);
+  }
+  prof_stack[prof_depth++] = f->name ? f->name : prof_anon;
+}
+
+void prof_pop(void) {
+  if (prof_ticks) {
+    prof_sample();
+  }
+  prof_depth--;
+}
+
+#ifndef _WIN32
+void prof_tick(int sig) {
+  (void)sig;
+  prof_ticks++;
+}
+#endif
+
+// Sample every millisecond of CPU time
+void prof_start(void) {
+  profiling = 1;
+  prof_anon = lname_intern("(lambda)");
+#ifndef _WIN32
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = prof_tick;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+  struct itimerval t = {{0, 1000}, {0, 1000}};
+  setitimer(ITIMER_PROF, &t, NULL);
+#else
+  fputs("--profile needs a CPU timer, which Windows builds don't have\n",
+        stderr);
+#endif
+}
+
+// Ctrl+c ends the prompt like the end of input does, after the expression
+// being evaluated, so the profile is still written. Closing stdin is safe in
+// a handler and makes readline return NULL. A second Ctrl+c quits at once
+void prof_interrupt(int sig) {
+  signal(sig, SIG_DFL);
+#ifndef _WIN32
+  close(STDIN_FILENO);
+#endif
+}
+
+int prof_cmp_self(const void *a, const void *b) {
+  const lname *x = *(lname *const *)a, *y = *(lname *const *)b;
+  if (x->self != y->self) {
+    return x->self < y->self ? 1 : -1;
+  }
+  return (x->total < y->total) - (x->total > y->total);
+}
+
+// Write the samples as folded stacks for flamegraph.pl, and a table of the
+// self and total samples of each function to stderr. A function that is on
+// a stack more than once counts once towards its total
+void prof_stop(void) {
+#ifndef _WIN32
+  struct itimerval t = {{0, 0}, {0, 0}};
+  setitimer(ITIMER_PROF, &t, NULL);
+#endif
+  if (prof_ticks) {
+    prof_sample();
+  }
+
+  FILE *f = fopen(PROF_FILE, "w");
+  if (!f) {
+    perror(PROF_FILE);
+    return;
+  }
+  lname *top = lname_intern("(toplevel)");
+  unsigned long samples = 0, stamp = 0;
+  for (int i = 0; i < PROF_BUCKETS; i++) {
+    for (lprof_stack *p = prof_stacks[i]; p; p = p->next) {
+      if (!p->count) {
+        continue;
+      }
+      samples += p->count;
+      stamp++;
+      fputs(top->str, f);
+      top->total += p->count;
+      for (int j = 0; j < p->depth; j++) {
+        fprintf(f, ";%s", p->frames[j]->str);
+        if (p->frames[j]->stamp != stamp) {
+          p->frames[j]->stamp = stamp;
+          p->frames[j]->total += p->count;
+        }
+      }
+      (p->depth ? p->frames[p->depth - 1] : top)->self += p->count;
+      fprintf(f, " %lu\n", p->count);
+    }
+  }
+  fclose(f);
+
+  int count = 0;
+  for (int i = 0; i < LNAME_BUCKETS; i++) {
+    for (lname *n = lname_table[i]; n; n = n->next) {
+      count += n->total != 0;
+    }
+  }
+  lname **names = malloc(sizeof(lname *) * count);
+  count = 0;
+  for (int i = 0; i < LNAME_BUCKETS; i++) {
+    for (lname *n = lname_table[i]; n; n = n->next) {
+      if (n->total) {
+        names[count++] = n;
+      }
+    }
+  }
+  qsort(names, count, sizeof(lname *), prof_cmp_self);
+
+  fprintf(stderr, "%lu samples, folded stacks written to %s\n", samples,
+          PROF_FILE);
+  fprintf(stderr, "%8s %8s %8s %8s  %s\n", "self", "self%", "total", "total%",
+          "function");
+  double percent = samples ? 100.0 / samples : 0;
+  for (int i = 0; i < count; i++) {
+    fprintf(stderr, "%8lu %7.1f%% %8lu %7.1f%%  %s\n", names[i]->self,
+            percent * names[i]->self, names[i]->total,
+            percent * names[i]->total, names[i]->str);
+  }
+  free(names);
 }
 
 lval *lval_call(lenv *e, lval *f, lval *a) {
   if (f->builtin) {
+    stats.builtin_calls++;
     return f->builtin(e, a);
   }
+  stats.lambda_calls++;
 
   int given = a->count;
   int total = f->formals->count;
@@ -1110,12 +2247,23 @@ lval *lval_call(lenv *e, lval *f, lval *a) {
 
   if (f->formals->count == 0) {
     f->env->par = e;
+    if (profiling) {
+      prof_push(f);
+      lval *r =
+          builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+      prof_pop();
+      return r;
+    }
     return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
   } else {
     return lval_copy(f);
   }
 }
 
+// Builtins that take no arguments, which are called when they are alone in
+// an S-expression instead of evaluating to themselves
+int lval_nullary(lval *f) { return f->type == LVAL_FUN && f->nullary; }
+
 lval *lval_eval_sexpr(lenv *e, lval *v) {
 
   for (int i = 0; i < v->count; i++) {
@@ -1130,7 +2278,7 @@ lval *lval_eval_sexpr(lenv *e, lval *v) {
   if (v->count == 0) {
     return v;
   }
-  if (v->count == 1) {
+  if (v->count == 1 && !lval_nullary(v->cell[0])) {
     return lval_eval(e, lval_take(v, 0));
   }
 
@@ -1150,30 +2298,33 @@ lval *lval_eval_sexpr(lenv *e, lval *v) {
 }
 
 int main(int argc, char **argv) {
-  // Create some Parsers
-  Number = mpc_new("number");
-  Symbol = mpc_new("symbol");
-  String = mpc_new("string");
-  Comment = mpc_new("comment");
-  Sexpr = mpc_new("sexpr");
-  Qexpr = mpc_new("qexpr");
-  Expr = mpc_new("expr");
-  Cumunisp = mpc_new("cumunisp");
+  // Options come before any files
+  while (argc >= 2) {
+    if (strcmp(argv[1], "--ast-reader") == 0) {
+      // Optionally read through the mpc AST like older versions did
+      ast_reader = 1;
+    } else if (strcmp(argv[1], "--runtime-grammar") == 0) {
+      // Build the grammar from its source rather than loading it
+      runtime_grammar = 1;
+    } else if (strcmp(argv[1], "--profile") == 0) {
+      // Sample which lambdas the program spends its time in
+      prof_start();
+    } else if (strcmp(argv[1], "--dump-grammar") == 0 && argc >= 3) {
+      return lval_grammar_dump(argv[2]) ? 0 : 1;
+    } else {
+      break;
+    }
+    argv++;
+    argc--;
+  }
 
-  // Define Parsers
-  mpca_lang(MPCA_LANG_DEFAULT,
-            "                                                     \
-      number   : /-?[0-9]+(\\.[0-9]*)?/ ;                             \
-      symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%^]+/ ;  \
-      string   : /\"(\\\\.|[^\"])*\"/ ; \
-      comment  : /;[^\\r\\n]*/ ; \
-      sexpr    : '(' <expr>* ')' ; \
-      qexpr    : '{' <expr>* '}' ; \
-      expr     : <number> | <symbol> | <string> \
-               | <comment>| <sexpr> | <qexpr>;                           \
-      cumunisp    : /^/ <expr>* /$/ ;             \
-    ",
-            Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Cumunisp);
+  // Create the Parsers
+  if (ast_reader) {
+    lval_grammar_new();
+  } else {
+    lval_reader_new();
+  }
+  lval_form_new();
 
   lenv *e = lenv_new();
   lenv_add_builtins(e);
@@ -1184,22 +2335,30 @@ int main(int argc, char **argv) {
     // Print Version and Exit Information
     puts("Cumunisp Version 0.0.0.0.3");
     puts("Press Ctrl+c to Exit\n");
+    if (profiling) {
+      signal(SIGINT, prof_interrupt);
+    }
 
     while (1) {
-      // Output prompt
+      // Output prompt, after anything still buffered
+      lbuf_flush(&out);
       char *input = readline("cumunisp> ");
+      // Stop at the end of the input, so the profile is written
+      if (!input) {
+        lbuf_putc(&out, '\n');
+        break;
+      }
       // Add input to history
       add_history(input);
 
       // Attempt to Parse the user Input
       mpc_result_t r;
-      if (mpc_parse("<stdin>", input, Cumunisp, &r)) {
+      if (mpc_parse_with("<stdin>", input, lval_reader(), &r,
+                         lval_reader_opts())) {
 
-        lval *x = lval_eval(e, lval_read(r.output));
+        lval *x = lval_eval(e, lval_read_result(&r));
         lval_println(x);
         lval_del(x);
-
-        mpc_ast_delete(r.output);
       } else {
         // Otherwise print the Error
         mpc_err_print(r.error);
@@ -1231,8 +2390,19 @@ int main(int argc, char **argv) {
     }
   }
   lenv_del(e);
+  lbuf_flush(&out);
+  if (profiling) {
+    prof_stop();
+  }
+  free(out.data);
   // Undefine and delete Parsers
-  mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Cumunisp);
+  mpc_delete(Form);
+  if (ast_reader) {
+    mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr,
+                Cumunisp);
+  } else {
+    mpc_cleanup(2, ReadExpr, Reader);
+  }
 
   return 0;
 }
@@ -1,4 +1,33 @@
+/* Memory mapped file input needs POSIX */
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "mpc.h"
+#include <limits.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MPC_HAVE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Profiling times parsers with a monotonic clock where there is one */
+#include <time.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define MPC_HAVE_CLOCK_GETTIME
+#endif
+
+/* Runs of a character class are scanned with SSE2 or AVX2 when available */
+#if defined(__SSE2__)
+#define MPC_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MPC_HAVE_AVX2
+#include <immintrin.h>
+#endif
 
 /*
 ** State Type
@@ -22,6 +51,204 @@ static mpc_state_t mpc_state_new(void) {
   return s;
 }
 
+static void mpc_state_advance(mpc_state_t *s, const char *x, size_t n) {
+  size_t j;
+  for (j = 0; j < n; j++) {
+    s->pos++;
+    s->col++;
+    if (x[j] == '\n') {
+      s->col = 0;
+      s->row++;
+    }
+  }
+}
+
+/*
+** Character Class Type
+*/
+
+/*
+** Character classes are stored as a set of 256 bits.
+** Classes made of only a few ranges of characters also
+** keep those ranges, or the ranges of the characters
+** not in the class, so that runs of the class can be
+** scanned a whole vector at a time.
+*/
+
+#define MPC_CLASS_RANGES_MAX 8
+
+typedef struct {
+  unsigned char set[32];
+  int negated;
+  int ranges_num;
+  unsigned char lo[MPC_CLASS_RANGES_MAX];
+  unsigned char hi[MPC_CLASS_RANGES_MAX];
+} mpc_class_t;
+
+static int mpc_class_has(const mpc_class_t *c, char x) {
+  unsigned char b = (unsigned char)x;
+  return (c->set[b >> 3] >> (b & 7)) & 1;
+}
+
+static int mpc_class_ranges(mpc_class_t *c, int negated) {
+  int b, n = 0, in, prev = 0;
+  for (b = 0; b < 256; b++) {
+    in = mpc_class_has(c, (char)b) != negated;
+    if (in && !prev) {
+      if (n == MPC_CLASS_RANGES_MAX) { return -1; }
+      c->lo[n] = (unsigned char)b;
+      n++;
+    }
+    if (in) { c->hi[n-1] = (unsigned char)b; }
+    prev = in;
+  }
+  return n;
+}
+
+static void mpc_class_plan(mpc_class_t *c) {
+  c->negated = 0;
+  c->ranges_num = mpc_class_ranges(c, 0);
+  if (c->ranges_num >= 0) { return; }
+  c->negated = 1;
+  c->ranges_num = mpc_class_ranges(c, 1);
+}
+
+/*
+** The null character marks the end of input
+** so it is never part of a class.
+*/
+
+static mpc_class_t *mpc_class_new(int(*f)(const void*, char), const void *d) {
+  int b;
+  mpc_class_t *c = calloc(1, sizeof(mpc_class_t));
+  for (b = 1; b < 256; b++) {
+    if (f(d, (char)b)) { c->set[b >> 3] |= (unsigned char)(1 << (b & 7)); }
+  }
+  mpc_class_plan(c);
+  return c;
+}
+
+static mpc_class_t *mpc_class_copy(const mpc_class_t *c) {
+  mpc_class_t *d = malloc(sizeof(mpc_class_t));
+  memcpy(d, c, sizeof(mpc_class_t));
+  return d;
+}
+
+static int mpc_class_oneof(const void *d, char x) { return strchr(d, x) != 0; }
+static int mpc_class_noneof(const void *d, char x) { return strchr(d, x) == 0; }
+
+static int mpc_class_range(const void *d, char x) {
+  const char *r = d;
+  return x >= r[0] && x <= r[1];
+}
+
+static int mpc_ctz(unsigned int x) {
+#if defined(__GNUC__)
+  return __builtin_ctz(x);
+#else
+  int n = 0;
+  while (!(x & 1)) { x >>= 1; n++; }
+  return n;
+#endif
+}
+
+static size_t mpc_class_span_scalar(const mpc_class_t *c, const char *x, size_t n) {
+  size_t j = 0;
+  while (j < n && mpc_class_has(c, x[j])) { j++; }
+  return j;
+}
+
+#ifdef MPC_HAVE_SSE2
+
+static size_t mpc_class_span_sse2(const mpc_class_t *c, const char *x, size_t n) {
+
+  __m128i lo[MPC_CLASS_RANGES_MAX], width[MPC_CLASS_RANGES_MAX];
+  __m128i v, t, in;
+  unsigned int m;
+  size_t j = 0;
+  int k;
+
+  for (k = 0; k < c->ranges_num; k++) {
+    lo[k] = _mm_set1_epi8((char)c->lo[k]);
+    width[k] = _mm_set1_epi8((char)(c->hi[k] - c->lo[k]));
+  }
+
+  /* A byte is in a range when its offset from the start is at most the width */
+  while (j + 16 <= n) {
+    v = _mm_loadu_si128((const __m128i*)(x + j));
+    in = _mm_setzero_si128();
+    for (k = 0; k < c->ranges_num; k++) {
+      t = _mm_sub_epi8(v, lo[k]);
+      in = _mm_or_si128(in, _mm_cmpeq_epi8(t, _mm_min_epu8(t, width[k])));
+    }
+    m = (unsigned int)_mm_movemask_epi8(in);
+    if (c->negated) { m = ~m & 0xFFFF; }
+    if (m != 0xFFFF) { return j + mpc_ctz(~m); }
+    j += 16;
+  }
+
+  return j + mpc_class_span_scalar(c, x + j, n - j);
+}
+
+#endif
+
+#ifdef MPC_HAVE_AVX2
+
+__attribute__((target("avx2")))
+static size_t mpc_class_span_avx2(const mpc_class_t *c, const char *x, size_t n) {
+
+  __m256i lo[MPC_CLASS_RANGES_MAX], width[MPC_CLASS_RANGES_MAX];
+  __m256i v, t, in;
+  unsigned int m;
+  size_t j = 0;
+  int k;
+
+  for (k = 0; k < c->ranges_num; k++) {
+    lo[k] = _mm256_set1_epi8((char)c->lo[k]);
+    width[k] = _mm256_set1_epi8((char)(c->hi[k] - c->lo[k]));
+  }
+
+  while (j + 32 <= n) {
+    v = _mm256_loadu_si256((const __m256i*)(x + j));
+    in = _mm256_setzero_si256();
+    for (k = 0; k < c->ranges_num; k++) {
+      t = _mm256_sub_epi8(v, lo[k]);
+      in = _mm256_or_si256(in, _mm256_cmpeq_epi8(t, _mm256_min_epu8(t, width[k])));
+    }
+    m = (unsigned int)_mm256_movemask_epi8(in);
+    if (c->negated) { m = ~m; }
+    if (m != 0xFFFFFFFFu) { return j + mpc_ctz(~m); }
+    j += 32;
+  }
+
+  return j + mpc_class_span_scalar(c, x + j, n - j);
+}
+
+#endif
+
+/*
+** Returns the length of the run of characters
+** in the class at the start of the buffer.
+*/
+
+static size_t mpc_class_span(const mpc_class_t *c, const char *x, size_t n) {
+
+  if (n == 0 || !mpc_class_has(c, x[0])) { return 0; }
+  if (c->ranges_num < 0) { return mpc_class_span_scalar(c, x, n); }
+
+#ifdef MPC_HAVE_AVX2
+  if (n >= 32 && __builtin_cpu_supports("avx2")) {
+    return mpc_class_span_avx2(c, x, n);
+  }
+#endif
+
+#ifdef MPC_HAVE_SSE2
+  return mpc_class_span_sse2(c, x, n);
+#else
+  return mpc_class_span_scalar(c, x, n);
+#endif
+}
+
 /*
 ** Input Type
 */
@@ -41,20 +268,25 @@ static mpc_state_t mpc_state_new(void) {
 ** by seeking in the file at different positions.
 **
 ** The final mode is Pipe. This is the difficult
-** one. As we assume pipes cannot be seeked - and
-** only support a single character lookahead at
-** any point, when the input is marked for a
-** potential backtracking we start buffering any
-** input.
-**
-** This means that if we are requested to seek
-** back we can simply start reading from the
-** buffer instead of the input.
+** one. As we assume pipes cannot be seeked, they
+** are read a chunk at a time into a buffer, and
+** that is scanned instead. Input before the
+** outermost mark can never be rewound to, so it
+** is dropped when the buffer is next filled and
+** the buffer only grows while marks hold on to
+** more input than it has room for. Anything read
+** ahead of where the parse stops is lost with it.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
 ** to parse for all input methods.
 **
+** `mpc_parse_contents` avoids the File mode
+** altogether. Regular files are memory mapped
+** and scanned as a String, anything else is
+** read into a buffer first, so peeking and
+** backtracking never touch stdio.
+**
 */
 
 enum {
@@ -63,30 +295,140 @@ enum {
   MPC_INPUT_PIPE   = 2
 };
 
+enum {
+  MPC_INPUT_HEAP     = 0,
+  MPC_INPUT_MAPPED   = 1,
+  MPC_INPUT_BORROWED = 2
+};
+
 enum {
   MPC_INPUT_MARKS_MIN = 32
 };
 
+enum {
+  MPC_INPUT_READ_CHUNK = 65536
+};
+
+/*
+** Small allocations come from a pool of fixed size slots
+** and free slots are kept on a list threaded through them,
+** so taking or returning one doesn't have to search. The
+** pool is carved out of the arena, which also holds other
+** memory the parse keeps until its input is deleted. The
+** arena grows in blocks and is released all at once.
+*/
+
 enum {
   MPC_INPUT_MEM_NUM = 512
 };
 
-typedef struct {
+typedef union mpc_mem_t {
+  union mpc_mem_t *next;
   char mem[64];
 } mpc_mem_t;
 
+enum {
+  MPC_ARENA_BLOCK_MIN = 4096
+};
+
+typedef struct mpc_arena_t {
+  struct mpc_arena_t *next;
+  size_t size;
+  size_t used;
+} mpc_arena_t;
+
+/*
+** An AST made with `MPC_PARSE_AST_ARENA` has its nodes,
+** children and interned tags in blocks like the above.
+** The root is the first thing in the arena so it can be
+** released from there, along with the input the tokens
+** point into once the parse has handed it over.
+*/
+
+typedef struct {
+  mpc_ast_t root;
+  mpc_arena_t *blocks;
+  char *buffer;
+  size_t length;
+  int storage;
+  char **tags;
+  int tags_num;
+  int tags_slots;
+  char *scratch;
+  size_t scratch_len;
+} mpc_ast_arena_t;
+
+/*
+** Packrat parsing stores the result of running a parser
+** at a position in a table indexed by both. Each entry
+** has a single slot in the table and evicts whatever was
+** there before, so the memory used stays bounded however
+** long the input is.
+**
+** Copying outputs can cost as much as producing them so
+** the first success at a position is only marked as seen.
+** The output is stored if the parser is run there again,
+** which is when the parse is actually backtracking.
+*/
+
+enum {
+  MPC_MEMO_SLOTS = 4096
+};
+
+enum {
+  MPC_MEMO_SEEN    = 1,
+  MPC_MEMO_FAILURE = 2,
+  MPC_MEMO_SUCCESS = 3
+};
+
+typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  char last;
+  char flags;
+  char result;
+  char end_last;
+  mpc_state_t end;
+  mpc_val_t *output;
+  mpc_dtor_t dtor;
+  mpc_err_t *error;
+  mpc_err_t *merged;
+} mpc_memo_t;
+
+typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  int tail;
+  unsigned long rewinds;
+  double start;
+} mpc_profile_frame_t;
+
 typedef struct {
 
   int type;
   char *filename;
+  int filename_storage;
   mpc_state_t state;
 
+  int lazy;
+  long *lines;
+  long lines_num;
+  long lines_slots;
+  long lines_end;
+  long lines_last;
+
   char *string;
+  size_t length;
+  int storage;
   char *buffer;
+  size_t buffer_len;
+  size_t buffer_slots;
+  long buffer_pos;
   FILE *file;
 
   int suppress;
   int backtrack;
+  int overflow;
   int marks_slots;
   int marks_num;
   mpc_state_t *marks;
@@ -94,9 +436,28 @@ typedef struct {
   char *lasts;
   char last;
 
-  size_t mem_index;
-  char mem_full[MPC_INPUT_MEM_NUM];
-  mpc_mem_t mem[MPC_INPUT_MEM_NUM];
+  mpc_memo_t *memo;
+  int memo_all;
+  mpc_apply_t memo_copy;
+  mpc_dtor_t memo_dtor;
+  mpc_parser_t *memo_skip;
+
+  int mem_num;
+  int mem_used;
+  mpc_mem_t *mem;
+  mpc_mem_t *mem_free;
+  mpc_arena_t *arena;
+  mpc_parse_stats_t stats;
+
+  mpc_ast_arena_t *ast;
+
+  void *frames;
+  int frames_slots;
+
+  mpc_profile_t *profile;
+  mpc_profile_frame_t *profile_stk;
+  int profile_num;
+  int profile_slots;
 
 } mpc_input_t;
 
@@ -106,25 +467,56 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
 
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
+  i->filename_storage = MPC_INPUT_HEAP;
   i->type = MPC_INPUT_STRING;
 
   i->state = mpc_state_new();
 
-  i->string = malloc(strlen(string) + 1);
-  strcpy(i->string, string);
+  i->lazy = 0;
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_end = 0;
+  i->lines_last = 0;
+
+  i->length = strlen(string);
+  i->storage = MPC_INPUT_HEAP;
+  i->string = malloc(i->length + 1);
+  memcpy(i->string, string, i->length + 1);
   i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_slots = 0;
+  i->buffer_pos = 0;
   i->file = NULL;
 
   i->suppress = 0;
   i->backtrack = 1;
+  i->overflow = 0;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo = NULL;
+  i->memo_all = 0;
+  i->memo_copy = NULL;
+  i->memo_dtor = NULL;
+  i->memo_skip = NULL;
+
+  i->mem_num = MPC_INPUT_MEM_NUM;
+  i->mem_used = 0;
+  i->mem = NULL;
+  i->mem_free = NULL;
+  i->arena = NULL;
+  i->ast = NULL;
+  i->frames = NULL;
+  i->frames_slots = 0;
+  i->profile = NULL;
+  i->profile_stk = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  memset(&i->stats, 0, sizeof(mpc_parse_stats_t));
 
   return i;
 }
@@ -135,55 +527,182 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
 
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
+  i->filename_storage = MPC_INPUT_HEAP;
   i->type = MPC_INPUT_STRING;
 
   i->state = mpc_state_new();
 
+  i->lazy = 0;
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_end = 0;
+  i->lines_last = 0;
+
   i->string = malloc(length + 1);
   strncpy(i->string, string, length);
   i->string[length] = '\0';
+  i->length = strlen(i->string);
+  i->storage = MPC_INPUT_HEAP;
   i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_slots = 0;
+  i->buffer_pos = 0;
   i->file = NULL;
 
   i->suppress = 0;
   i->backtrack = 1;
+  i->overflow = 0;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo = NULL;
+  i->memo_all = 0;
+  i->memo_copy = NULL;
+  i->memo_dtor = NULL;
+  i->memo_skip = NULL;
+
+  i->mem_num = MPC_INPUT_MEM_NUM;
+  i->mem_used = 0;
+  i->mem = NULL;
+  i->mem_free = NULL;
+  i->arena = NULL;
+  i->ast = NULL;
+  i->frames = NULL;
+  i->frames_slots = 0;
+  i->profile = NULL;
+  i->profile_stk = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  memset(&i->stats, 0, sizeof(mpc_parse_stats_t));
 
   return i;
 
 }
 
+/*
+** A borrowed String input scans the caller's buffer and
+** filename where they are instead of copying them. Like
+** `mpc_nparse` it stops at the first NUL.
+*/
+
+static mpc_input_t *mpc_input_new_borrowed(const char *filename, const char *string, size_t length) {
+
+  mpc_input_t *i = malloc(sizeof(mpc_input_t));
+  const char *end = memchr(string, '\0', length);
+
+  i->filename = (char*)filename;
+  i->filename_storage = MPC_INPUT_BORROWED;
+  i->type = MPC_INPUT_STRING;
+
+  i->state = mpc_state_new();
+
+  i->lazy = 0;
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_end = 0;
+  i->lines_last = 0;
+
+  i->string = (char*)string;
+  i->length = end ? (size_t)(end - string) : length;
+  i->storage = MPC_INPUT_BORROWED;
+  i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_slots = 0;
+  i->buffer_pos = 0;
+  i->file = NULL;
+
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->overflow = 0;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
+
+  i->memo = NULL;
+  i->memo_all = 0;
+  i->memo_copy = NULL;
+  i->memo_dtor = NULL;
+  i->memo_skip = NULL;
+
+  i->mem_num = MPC_INPUT_MEM_NUM;
+  i->mem_used = 0;
+  i->mem = NULL;
+  i->mem_free = NULL;
+  i->arena = NULL;
+  i->ast = NULL;
+  i->frames = NULL;
+  i->frames_slots = 0;
+  i->profile = NULL;
+  i->profile_stk = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  memset(&i->stats, 0, sizeof(mpc_parse_stats_t));
+
+  return i;
+}
+
 static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
 
   mpc_input_t *i = malloc(sizeof(mpc_input_t));
 
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
+  i->filename_storage = MPC_INPUT_HEAP;
 
   i->type = MPC_INPUT_PIPE;
   i->state = mpc_state_new();
 
+  i->lazy = 0;
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_end = 0;
+  i->lines_last = 0;
+
   i->string = NULL;
+  i->length = 0;
+  i->storage = MPC_INPUT_HEAP;
   i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_slots = 0;
+  i->buffer_pos = 0;
   i->file = pipe;
 
   i->suppress = 0;
   i->backtrack = 1;
+  i->overflow = 0;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo = NULL;
+  i->memo_all = 0;
+  i->memo_copy = NULL;
+  i->memo_dtor = NULL;
+  i->memo_skip = NULL;
+
+  i->mem_num = MPC_INPUT_MEM_NUM;
+  i->mem_used = 0;
+  i->mem = NULL;
+  i->mem_free = NULL;
+  i->arena = NULL;
+  i->ast = NULL;
+  i->frames = NULL;
+  i->frames_slots = 0;
+  i->profile = NULL;
+  i->profile_stk = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  memset(&i->stats, 0, sizeof(mpc_parse_stats_t));
 
   return i;
 
@@ -195,62 +714,262 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
 
   i->filename = malloc(strlen(filename) + 1);
   strcpy(i->filename, filename);
+  i->filename_storage = MPC_INPUT_HEAP;
   i->type = MPC_INPUT_FILE;
   i->state = mpc_state_new();
 
+  i->lazy = 0;
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_end = 0;
+  i->lines_last = 0;
+
   i->string = NULL;
+  i->length = 0;
+  i->storage = MPC_INPUT_HEAP;
   i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_slots = 0;
+  i->buffer_pos = 0;
   i->file = file;
 
   i->suppress = 0;
   i->backtrack = 1;
+  i->overflow = 0;
+  i->marks_num = 0;
+  i->marks_slots = MPC_INPUT_MARKS_MIN;
+  i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
+  i->lasts = malloc(sizeof(char) * i->marks_slots);
+  i->last = '\0';
+
+  i->memo = NULL;
+  i->memo_all = 0;
+  i->memo_copy = NULL;
+  i->memo_dtor = NULL;
+  i->memo_skip = NULL;
+
+  i->mem_num = MPC_INPUT_MEM_NUM;
+  i->mem_used = 0;
+  i->mem = NULL;
+  i->mem_free = NULL;
+  i->arena = NULL;
+  i->ast = NULL;
+  i->frames = NULL;
+  i->frames_slots = 0;
+  i->profile = NULL;
+  i->profile_stk = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  memset(&i->stats, 0, sizeof(mpc_parse_stats_t));
+
+  return i;
+}
+
+/*
+** Read the whole of a file as a String input. Regular
+** files are mapped rather than copied, other files are
+** read in chunks. Returns NULL if the file can't be read.
+*/
+
+static char *mpc_input_read_all(FILE *file, size_t *length) {
+
+  size_t slots = MPC_INPUT_READ_CHUNK, num = 0, n;
+  char *buffer = malloc(slots + 1);
+
+  while ((n = fread(buffer + num, 1, slots - num, file)) > 0) {
+    num += n;
+    if (num == slots) {
+      slots += slots / 2;
+      buffer = realloc(buffer, slots + 1);
+    }
+  }
+
+  if (ferror(file)) { free(buffer); return NULL; }
+
+  buffer[num] = '\0';
+  *length = num;
+  return buffer;
+}
+
+static mpc_input_t *mpc_input_new_contents(const char *filename, FILE *file) {
+
+  mpc_input_t *i;
+  char *string = NULL;
+  size_t length = 0;
+  int storage = MPC_INPUT_HEAP;
+
+#ifdef MPC_HAVE_MMAP
+  struct stat st;
+  void *map;
+  if (fstat(fileno(file), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (map != MAP_FAILED) {
+      string = map;
+      length = st.st_size;
+      storage = MPC_INPUT_MAPPED;
+    }
+  }
+#endif
+
+  if (string == NULL) {
+    string = mpc_input_read_all(file, &length);
+    if (string == NULL) { return NULL; }
+  }
+
+  i = malloc(sizeof(mpc_input_t));
+
+  i->filename = malloc(strlen(filename) + 1);
+  strcpy(i->filename, filename);
+  i->filename_storage = MPC_INPUT_HEAP;
+  i->type = MPC_INPUT_STRING;
+
+  i->state = mpc_state_new();
+
+  i->lazy = 0;
+  i->lines = NULL;
+  i->lines_num = 0;
+  i->lines_slots = 0;
+  i->lines_end = 0;
+  i->lines_last = 0;
+
+  i->string = string;
+  i->length = length;
+  i->storage = storage;
+  i->buffer = NULL;
+  i->buffer_len = 0;
+  i->buffer_slots = 0;
+  i->buffer_pos = 0;
+  i->file = NULL;
+
+  i->suppress = 0;
+  i->backtrack = 1;
+  i->overflow = 0;
   i->marks_num = 0;
   i->marks_slots = MPC_INPUT_MARKS_MIN;
   i->marks = malloc(sizeof(mpc_state_t) * i->marks_slots);
   i->lasts = malloc(sizeof(char) * i->marks_slots);
   i->last = '\0';
 
-  i->mem_index = 0;
-  memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
+  i->memo = NULL;
+  i->memo_all = 0;
+  i->memo_copy = NULL;
+  i->memo_dtor = NULL;
+  i->memo_skip = NULL;
+
+  i->mem_num = MPC_INPUT_MEM_NUM;
+  i->mem_used = 0;
+  i->mem = NULL;
+  i->mem_free = NULL;
+  i->arena = NULL;
+  i->ast = NULL;
+  i->frames = NULL;
+  i->frames_slots = 0;
+  i->profile = NULL;
+  i->profile_stk = NULL;
+  i->profile_num = 0;
+  i->profile_slots = 0;
+  memset(&i->stats, 0, sizeof(mpc_parse_stats_t));
 
   return i;
 }
 
+static void mpc_memo_clear(mpc_memo_t *m);
+static void mpc_ast_arena_delete(mpc_ast_arena_t *a);
+static void mpc_blocks_free(mpc_arena_t *a);
+
 static void mpc_input_delete(mpc_input_t *i) {
 
-  free(i->filename);
+  int j;
+
+  if (i->filename_storage == MPC_INPUT_HEAP) { free(i->filename); }
 
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
+  if (i->type == MPC_INPUT_STRING) {
+#ifdef MPC_HAVE_MMAP
+    if (i->storage == MPC_INPUT_MAPPED) { munmap(i->string, i->length); }
+#endif
+    if (i->storage == MPC_INPUT_HEAP) { free(i->string); }
+  }
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
 
+  if (i->memo) {
+    for (j = 0; j < MPC_MEMO_SLOTS; j++) { mpc_memo_clear(&i->memo[j]); }
+  }
+
+  if (i->ast) { mpc_ast_arena_delete(i->ast); }
+  mpc_blocks_free(i->arena);
+
+  free(i->profile_stk);
+  free(i->lines);
   free(i->marks);
   free(i->lasts);
   free(i);
 }
 
+static void *mpc_blocks_alloc(mpc_arena_t **blocks, size_t n) {
+
+  mpc_arena_t *a = *blocks;
+  size_t size;
+
+  /* Keep every allocation aligned for any type */
+  n = (n + 15) & ~(size_t)15;
+
+  if (a == NULL || a->used + n > a->size) {
+    size = a ? a->size * 2 : MPC_ARENA_BLOCK_MIN;
+    while (size < n) { size *= 2; }
+    a = malloc(sizeof(mpc_arena_t) + 16 + size);
+    a->next = *blocks;
+    a->size = size;
+    a->used = 0;
+    *blocks = a;
+  }
+
+  a->used += n;
+  return (char*)a + ((sizeof(mpc_arena_t) + 15) & ~(size_t)15) + a->used - n;
+}
+
+static void mpc_blocks_free(mpc_arena_t *a) {
+  mpc_arena_t *n;
+  while (a) {
+    n = a->next;
+    free(a);
+    a = n;
+  }
+}
+
+static void *mpc_arena_alloc(mpc_input_t *i, size_t n) {
+  i->stats.arena_bytes += (n + 15) & ~(size_t)15;
+  return mpc_blocks_alloc(&i->arena, n);
+}
+
 static int mpc_mem_ptr(mpc_input_t *i, void *p) {
   return
     (char*)p >= (char*)(i->mem) &&
-    (char*)p <  (char*)(i->mem) + (MPC_INPUT_MEM_NUM * sizeof(mpc_mem_t));
+    (char*)p <  (char*)(i->mem + i->mem_used);
 }
 
 static void *mpc_malloc(mpc_input_t *i, size_t n) {
-  size_t j;
-  char *p;
+  mpc_mem_t *p;
 
-  if (n > sizeof(mpc_mem_t)) { return malloc(n); }
+  if (n > sizeof(mpc_mem_t)) { i->stats.large_allocs++; return malloc(n); }
 
-  j = i->mem_index;
-  do {
-    if (!i->mem_full[i->mem_index]) {
-      p = (void*)(i->mem + i->mem_index);
-      i->mem_full[i->mem_index] = 1;
-      i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-      return p;
-    }
-    i->mem_index = (i->mem_index+1) % MPC_INPUT_MEM_NUM;
-  } while (j != i->mem_index);
+  if (i->mem_free) {
+    p = i->mem_free;
+    i->mem_free = p->next;
+    i->stats.pool_hits++;
+    return p;
+  }
+
+  if (i->mem == NULL && i->mem_num > 0) {
+    i->mem = mpc_arena_alloc(i, sizeof(mpc_mem_t) * i->mem_num);
+  }
+
+  if (i->mem_used < i->mem_num) {
+    i->stats.pool_hits++;
+    return i->mem + i->mem_used++;
+  }
 
+  i->stats.pool_misses++;
   return malloc(n);
 }
 
@@ -261,10 +980,10 @@ static void *mpc_calloc(mpc_input_t *i, size_t n, size_t m) {
 }
 
 static void mpc_free(mpc_input_t *i, void *p) {
-  size_t j;
+  mpc_mem_t *m = p;
   if (!mpc_mem_ptr(i, p)) { free(p); return; }
-  j = ((size_t)(((char*)p) - ((char*)i->mem))) / sizeof(mpc_mem_t);
-  i->mem_full[j] = 0;
+  m->next = i->mem_free;
+  i->mem_free = m;
 }
 
 static void *mpc_realloc(mpc_input_t *i, void *p, size_t n) {
@@ -313,14 +1032,9 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->marks[i->marks_num-1] = i->state;
   i->lasts[i->marks_num-1] = i->last;
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
-  }
-
 }
 
 static void mpc_input_unmark(mpc_input_t *i) {
-  int j;
 
   if (i->backtrack < 1) { return; }
 
@@ -335,14 +1049,6 @@ static void mpc_input_unmark(mpc_input_t *i) {
     i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
   }
 
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    for (j = strlen(i->buffer) - 1; j >= 0; j--)
-      ungetc(i->buffer[j], i->file);
-
-    free(i->buffer);
-    i->buffer = NULL;
-  }
-
 }
 
 static void mpc_input_rewind(mpc_input_t *i) {
@@ -352,6 +1058,8 @@ static void mpc_input_rewind(mpc_input_t *i) {
   i->state = i->marks[i->marks_num-1];
   i->last  = i->lasts[i->marks_num-1];
 
+  if (i->profile_num > 0) { i->profile_stk[i->profile_num-1].rewinds++; }
+
   if (i->type == MPC_INPUT_FILE) {
     fseek(i->file, i->state.pos, SEEK_SET);
   }
@@ -359,12 +1067,39 @@ static void mpc_input_rewind(mpc_input_t *i) {
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
+/*
+** Make sure the pipe buffer holds the character at the
+** current position, reading another chunk if it doesn't.
+** Returns zero at the end of the input.
+*/
+
+static int mpc_input_buffer_fill(mpc_input_t *i) {
+
+  long keep = i->marks_num > 0 ? i->marks[0].pos : i->state.pos;
+  size_t drop, n;
+
+  if (i->state.pos < i->buffer_pos + (long)i->buffer_len) { return 1; }
+  if (feof(i->file) || ferror(i->file)) { return 0; }
+
+  drop = (size_t)(keep - i->buffer_pos);
+  if (drop > 0) {
+    memmove(i->buffer, i->buffer + drop, i->buffer_len - drop);
+    i->buffer_len -= drop;
+    i->buffer_pos = keep;
+  }
+
+  if (i->buffer_len == i->buffer_slots) {
+    i->buffer_slots = i->buffer_slots ? i->buffer_slots * 2 : MPC_INPUT_READ_CHUNK;
+    i->buffer = realloc(i->buffer, i->buffer_slots);
+  }
+
+  n = fread(i->buffer + i->buffer_len, 1, i->buffer_slots - i->buffer_len, i->file);
+  i->buffer_len += n;
+  return n > 0;
 }
 
 static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
+  return mpc_input_buffer_fill(i) ? i->buffer[i->state.pos - i->buffer_pos] : '\0';
 }
 
 static char mpc_input_getc(mpc_input_t *i) {
@@ -373,20 +1108,10 @@ static char mpc_input_getc(mpc_input_t *i) {
 
   switch (i->type) {
 
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+      return (size_t)i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
-    case MPC_INPUT_PIPE:
-
-      if (!i->buffer) { c = getc(i->file); return c; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        c = mpc_input_buffer_get(i);
-        return c;
-      } else {
-        c = getc(i->file);
-        return c;
-      }
-
+    case MPC_INPUT_PIPE: return mpc_input_buffer_get(i);
     default: return c;
   }
 }
@@ -396,7 +1121,8 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
 
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING:
+      return (size_t)i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE:
 
       c = fgetc(i->file);
@@ -405,24 +1131,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
       fseek(i->file, -1, SEEK_CUR);
       return c;
 
-    case MPC_INPUT_PIPE:
-
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        return mpc_input_buffer_get(i);
-      } else {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-
+    case MPC_INPUT_PIPE: return mpc_input_buffer_get(i);
     default: return c;
   }
 
@@ -434,43 +1143,85 @@ static int mpc_input_terminated(mpc_input_t *i) {
 
 static int mpc_input_failure(mpc_input_t *i, char c) {
 
+  (void)c;
+
   switch (i->type) {
     case MPC_INPUT_STRING: { break; }
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
-    case MPC_INPUT_PIPE: {
-
-      if (!i->buffer) { ungetc(c, i->file); break; }
-
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
-        break;
-      } else {
-        ungetc(c, i->file);
-      }
-    }
+    case MPC_INPUT_PIPE: { break; }
     default: { break; }
   }
   return 0;
 }
 
-static int mpc_input_success(mpc_input_t *i, char c, char **o) {
+/*
+** With lazy positions a string input only counts bytes.
+** The row and column of a position are found when they
+** are needed from the starts of the lines before it,
+** which are indexed as far as any position asked for.
+*/
 
-  if (i->type == MPC_INPUT_PIPE
-  &&  i->buffer && !mpc_input_buffer_in_range(i)) {
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
-  }
+/* Positions are mostly asked for in order so the last row is tried first */
+static int mpc_input_on_line(mpc_input_t *i, long pos, long row) {
+  return row <= i->lines_num
+    && (row == 0 || i->lines[row-1] <= pos)
+    && (row == i->lines_num || i->lines[row] > pos);
+}
 
-  i->last = c;
-  i->state.pos++;
-  i->state.col++;
+static void mpc_input_locate(mpc_input_t *i, mpc_state_t *s) {
 
-  if (c == '\n') {
-    i->state.col = 0;
-    i->state.row++;
+  long lo = 0, hi, mid;
+  const char *n;
+
+  if (s->pos < 0) { return; }
+
+  while (i->lines_end < s->pos) {
+    n = memchr(i->string + i->lines_end, '\n', (size_t)(s->pos - i->lines_end));
+    if (n == NULL) { i->lines_end = s->pos; break; }
+    if (i->lines_num == i->lines_slots) {
+      i->lines_slots = i->lines_slots ? i->lines_slots * 2 : 64;
+      i->lines = realloc(i->lines, sizeof(long) * i->lines_slots);
+    }
+    i->lines_end = (long)(n - i->string) + 1;
+    i->lines[i->lines_num++] = i->lines_end;
   }
 
-  if (o) {
+  /* Count the lines starting at or before the position */
+  hi = i->lines_num;
+  if (mpc_input_on_line(i, s->pos, i->lines_last)) {
+    lo = i->lines_last;
+  } else if (mpc_input_on_line(i, s->pos, i->lines_last + 1)) {
+    lo = i->lines_last + 1;
+  } else {
+    while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (i->lines[mid] <= s->pos) { lo = mid + 1; } else { hi = mid; }
+    }
+  }
+
+  i->lines_last = lo;
+  s->row = lo;
+  s->col = s->pos - (lo ? i->lines[lo-1] : 0);
+}
+
+static void mpc_input_advance(mpc_input_t *i, mpc_state_t *s, const char *x, size_t n) {
+  if (i->lazy) { s->pos += (long)n; } else { mpc_state_advance(s, x, n); }
+}
+
+static int mpc_input_success(mpc_input_t *i, char c, char **o) {
+
+  i->last = c;
+  i->state.pos++;
+
+  if (!i->lazy) {
+    i->state.col++;
+    if (c == '\n') {
+      i->state.col = 0;
+      i->state.row++;
+    }
+  }
+
+  if (o) {
     (*o) = mpc_malloc(i, 2);
     (*o)[0] = c;
     (*o)[1] = '\0';
@@ -500,18 +1251,42 @@ static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
 }
 
-static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
+static int mpc_input_class(mpc_input_t *i, const mpc_class_t *c, char **o) {
   char x;
   if (mpc_input_terminated(i)) { return 0; }
   x = mpc_input_getc(i);
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+  return mpc_class_has(c, x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
 }
 
-static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
+static size_t mpc_input_span(mpc_input_t *i, const mpc_class_t *c, char **o) {
+
+  size_t n = 0, slots = 1;
   char x;
-  if (mpc_input_terminated(i)) { return 0; }
-  x = mpc_input_getc(i);
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);
+
+  /* Strings are scanned in place */
+  if (i->type == MPC_INPUT_STRING) {
+    n = mpc_class_span(c, i->string + i->state.pos, i->length - i->state.pos);
+    *o = mpc_malloc(i, n + 1);
+    memcpy(*o, i->string + i->state.pos, n);
+    (*o)[n] = '\0';
+    mpc_input_advance(i, &i->state, *o, n);
+    if (n > 0) { i->last = (*o)[n-1]; }
+    return n;
+  }
+
+  *o = mpc_malloc(i, slots);
+  while (!mpc_input_terminated(i)) {
+    x = mpc_input_getc(i);
+    if (!mpc_class_has(c, x)) { mpc_input_failure(i, x); break; }
+    mpc_input_success(i, x, NULL);
+    if (n + 1 == slots) {
+      slots *= 2;
+      *o = mpc_realloc(i, *o, slots);
+    }
+    (*o)[n++] = x;
+  }
+  (*o)[n] = '\0';
+  return n;
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
@@ -565,6 +1340,7 @@ static int mpc_input_eoi(mpc_input_t* i, char **o) {
 static mpc_state_t *mpc_input_state_copy(mpc_input_t *i) {
   mpc_state_t *r = mpc_malloc(i, sizeof(mpc_state_t));
   memcpy(r, &i->state, sizeof(mpc_state_t));
+  if (i->lazy) { mpc_input_locate(i, r); }
   return r;
 }
 
@@ -601,14 +1377,13 @@ static void mpc_err_string_cat(char *buffer, int *pos, int *max, char const *fmt
   va_end(va);
 }
 
-static char char_unescape_buffer[4];
-
-static const char *mpc_err_char_unescape(char c) {
+/* Uses the caller's `buffer` so errors can be printed from many threads */
+static const char *mpc_err_char_unescape(char c, char *buffer) {
 
-  char_unescape_buffer[0] = '\'';
-  char_unescape_buffer[1] = ' ';
-  char_unescape_buffer[2] = '\'';
-  char_unescape_buffer[3] = '\0';
+  buffer[0] = '\'';
+  buffer[1] = ' ';
+  buffer[2] = '\'';
+  buffer[3] = '\0';
 
   switch (c) {
     case '\a': return "bell";
@@ -621,8 +1396,8 @@ static const char *mpc_err_char_unescape(char c) {
     case '\t': return "tab";
     case ' ' : return "space";
     default:
-      char_unescape_buffer[1] = c;
-      return char_unescape_buffer;
+      buffer[1] = c;
+      return buffer;
   }
 
 }
@@ -632,6 +1407,7 @@ char *mpc_err_string(mpc_err_t *x) {
   int i;
   int pos = 0;
   int max = 1023;
+  char received[4];
   char *buffer = calloc(1, 1024);
 
   if (x->failure) {
@@ -657,12 +1433,32 @@ char *mpc_err_string(mpc_err_t *x) {
   }
 
   mpc_err_string_cat(buffer, &pos, &max, " at ");
-  mpc_err_string_cat(buffer, &pos, &max, mpc_err_char_unescape(x->received));
+  mpc_err_string_cat(buffer, &pos, &max, "%s", mpc_err_char_unescape(x->received, received));
   mpc_err_string_cat(buffer, &pos, &max, "\n");
 
   return realloc(buffer, strlen(buffer) + 1);
 }
 
+static mpc_err_t *mpc_err_copy(mpc_err_t *x) {
+  int j;
+  mpc_err_t *y;
+  if (x == NULL) { return NULL; }
+  y = malloc(sizeof(mpc_err_t));
+  memcpy(y, x, sizeof(mpc_err_t));
+  y->filename = malloc(strlen(x->filename) + 1);
+  strcpy(y->filename, x->filename);
+  y->expected = x->expected_num ? malloc(sizeof(char*) * x->expected_num) : NULL;
+  for (j = 0; j < x->expected_num; j++) {
+    y->expected[j] = malloc(strlen(x->expected[j]) + 1);
+    strcpy(y->expected[j], x->expected[j]);
+  }
+  if (x->failure) {
+    y->failure = malloc(strlen(x->failure) + 1);
+    strcpy(y->failure, x->failure);
+  }
+  return y;
+}
+
 static mpc_err_t *mpc_err_new(mpc_input_t *i, const char *expected) {
   mpc_err_t *x;
   if (i->suppress) { return NULL; }
@@ -862,6 +1658,7 @@ static mpc_err_t *mpc_err_count(mpc_input_t *i, mpc_err_t *x, int n) {
   mpc_err_t *y;
   int digits = n/10 + 1;
   char *prefix;
+  if (x == NULL) { return NULL; }
   prefix = mpc_malloc(i, digits + strlen(" of ") + 1);
   sprintf(prefix, "%i of ", n);
   y = mpc_err_repeat(i, x, prefix);
@@ -914,9 +1711,52 @@ enum {
   MPC_TYPE_CHECK_WITH = 26,
 
   MPC_TYPE_SOI        = 27,
-  MPC_TYPE_EOI        = 28
+  MPC_TYPE_EOI        = 28,
+
+  MPC_TYPE_DFA        = 29,
+  MPC_TYPE_SPAN       = 30,
+  MPC_TYPE_MEMO       = 31
 };
 
+/*
+** Regexes that can be run as a table driven DFA
+** carry the table along with the combinator form
+** they were compiled from. For every state the
+** table also stores the errors the combinator form
+** would report when stuck in that state.
+*/
+
+typedef struct {
+  char accept;
+  int merged_back;
+  int merged_num;
+  char **merged;
+  int failed_back;
+  int failed_num;
+  char **failed;
+} mpc_dfa_state_t;
+
+typedef struct {
+  int states_num;
+  short *next;
+  mpc_dfa_state_t *states;
+} mpc_dfa_t;
+
+/*
+** An `or` whose alternatives can be told apart by the
+** next character carries a table of which alternatives
+** could match it. Each character maps to a list of
+** alternatives in `alts`, or to no list at all when
+** every alternative has to be tried.
+*/
+
+typedef struct {
+  short start[256];
+  short num[256];
+  int alts_num;
+  int *alts;
+} mpc_dispatch_t;
+
 typedef struct { char *m; } mpc_pdata_fail_t;
 typedef struct { mpc_ctor_t lf; void *x; } mpc_pdata_lift_t;
 typedef struct { mpc_parser_t *x; char *m; } mpc_pdata_expect_t;
@@ -925,6 +1765,7 @@ typedef struct { char x; } mpc_pdata_single_t;
 typedef struct { char x; char y; } mpc_pdata_range_t;
 typedef struct { int(*f)(char); } mpc_pdata_satisfy_t;
 typedef struct { char *x; } mpc_pdata_string_t;
+typedef struct { char *x; mpc_class_t *c; } mpc_pdata_class_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_check_t f; char *e; } mpc_pdata_check_t;
@@ -932,8 +1773,11 @@ typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_check_with_t f; void *d; ch
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; mpc_dispatch_t *d; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_dfa_t *d; mpc_parser_t *x; } mpc_pdata_dfa_t;
+typedef struct { mpc_parser_t *x; mpc_class_t *c; int min; } mpc_pdata_span_t;
+typedef struct { mpc_parser_t *x; mpc_apply_t cf; mpc_dtor_t df; } mpc_pdata_memo_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -944,6 +1788,7 @@ typedef union {
   mpc_pdata_range_t range;
   mpc_pdata_satisfy_t satisfy;
   mpc_pdata_string_t string;
+  mpc_pdata_class_t cls;
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_check_t check;
@@ -953,6 +1798,9 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_dfa_t dfa;
+  mpc_pdata_span_t span;
+  mpc_pdata_memo_t memo;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -960,8 +1808,209 @@ struct mpc_parser_t {
   mpc_pdata_t data;
   char type;
   char retained;
+  int id;
 };
 
+/*
+** Arena ASTs
+**
+** When the input has an AST arena the functions the
+** `mpca_` combinators build ASTs with are swapped for
+** the ones below. Nodes get their children in the same
+** allocation, since a fold knows how many there will be,
+** and tags are looked up in a table so each distinct one
+** is only stored once. Nodes thrown away when the parse
+** backtracks stay in the arena until it is released.
+*/
+
+static mpc_ast_arena_t *mpc_ast_arena_new(void) {
+  mpc_ast_arena_t *a = malloc(sizeof(mpc_ast_arena_t));
+  a->blocks = NULL;
+  a->buffer = NULL;
+  a->length = 0;
+  a->storage = MPC_INPUT_BORROWED;
+  a->tags = NULL;
+  a->tags_num = 0;
+  a->tags_slots = 0;
+  a->scratch = NULL;
+  a->scratch_len = 0;
+  return a;
+}
+
+static void mpc_ast_arena_delete(mpc_ast_arena_t *a) {
+#ifdef MPC_HAVE_MMAP
+  if (a->storage == MPC_INPUT_MAPPED) { munmap(a->buffer, a->length); }
+#endif
+  if (a->storage == MPC_INPUT_HEAP) { free(a->buffer); }
+  mpc_blocks_free(a->blocks);
+  free(a->tags);
+  free(a->scratch);
+  free(a);
+}
+
+static unsigned long mpc_ast_arena_hash(const char *t, size_t n) {
+  unsigned long h = 5381;
+  size_t j;
+  for (j = 0; j < n; j++) { h = h * 33 + (unsigned char)t[j]; }
+  return h;
+}
+
+static char *mpc_ast_arena_intern(mpc_ast_arena_t *a, const char *t, size_t n) {
+
+  char **old = a->tags;
+  int j, k, slots = a->tags_slots;
+
+  if (a->tags_num * 2 >= a->tags_slots) {
+    a->tags_slots = slots ? slots * 2 : 64;
+    a->tags = calloc(a->tags_slots, sizeof(char*));
+    for (j = 0; j < slots; j++) {
+      if (old[j] == NULL) { continue; }
+      k = (int)(mpc_ast_arena_hash(old[j], strlen(old[j])) & (unsigned long)(a->tags_slots-1));
+      while (a->tags[k]) { k = (k+1) & (a->tags_slots-1); }
+      a->tags[k] = old[j];
+    }
+    free(old);
+  }
+
+  k = (int)(mpc_ast_arena_hash(t, n) & (unsigned long)(a->tags_slots-1));
+  while (a->tags[k]) {
+    if (strncmp(a->tags[k], t, n) == 0 && a->tags[k][n] == '\0') { return a->tags[k]; }
+    k = (k+1) & (a->tags_slots-1);
+  }
+
+  a->tags[k] = mpc_blocks_alloc(&a->blocks, n + 1);
+  memcpy(a->tags[k], t, n);
+  a->tags[k][n] = '\0';
+  a->tags_num++;
+  return a->tags[k];
+}
+
+/* Interns the first `n` characters of `x` followed by `y` and `z` */
+static char *mpc_ast_arena_join(mpc_ast_arena_t *a, const char *x, size_t n, const char *y, const char *z) {
+  size_t yn = strlen(y), zn = strlen(z);
+  if (n + yn + zn > a->scratch_len) {
+    a->scratch_len = n + yn + zn;
+    a->scratch = realloc(a->scratch, a->scratch_len);
+  }
+  memcpy(a->scratch, x, n);
+  memcpy(a->scratch + n, y, yn);
+  memcpy(a->scratch + n + yn, z, zn);
+  return mpc_ast_arena_intern(a, a->scratch, n + yn + zn);
+}
+
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *a, char *tag, const char *contents, size_t n, int children_num) {
+  mpc_ast_t *x = mpc_blocks_alloc(&a->blocks, sizeof(mpc_ast_t) + sizeof(mpc_ast_t*) * children_num);
+  x->tag = tag;
+  x->tag_id = -1;
+  x->contents = (char*)contents;
+  x->contents_len = n;
+  x->state = mpc_state_new();
+  x->children_num = children_num;
+  x->children = children_num ? (mpc_ast_t**)(x + 1) : NULL;
+  x->flags = MPC_AST_ARENA;
+  return x;
+}
+
+static mpc_ast_t *mpc_ast_arena_copy(mpc_ast_arena_t *a, mpc_ast_t *x) {
+  int j;
+  mpc_ast_t *y = mpc_ast_arena_node(a, x->tag, x->contents, x->contents_len, x->children_num);
+  y->tag_id = x->tag_id;
+  y->state = x->state;
+  y->flags |= x->flags & MPC_AST_DROPPABLE;
+  for (j = 0; j < x->children_num; j++) {
+    y->children[j] = mpc_ast_arena_copy(a, x->children[j]);
+  }
+  return y;
+}
+
+static mpc_ast_t *mpc_ast_arena_add_root(mpc_ast_arena_t *a, mpc_ast_t *x) {
+  mpc_ast_t *r;
+  if (x == NULL) { return x; }
+  if (x->children_num <= 1) { return x; }
+  r = mpc_ast_arena_node(a, mpc_ast_arena_intern(a, ">", 1), "", 0, 1);
+  r->children[0] = x;
+  return r;
+}
+
+static mpc_ast_t *mpc_ast_arena_tag(mpc_ast_arena_t *a, mpc_ast_t *x, const char *t) {
+  x->tag = mpc_ast_arena_intern(a, t, strlen(t));
+  return x;
+}
+
+static mpc_ast_t *mpc_ast_arena_add_tag(mpc_ast_arena_t *a, mpc_ast_t *x, const char *t) {
+  if (x == NULL) { return x; }
+  x->tag = mpc_ast_arena_join(a, t, strlen(t), "|", x->tag);
+  return x;
+}
+
+static mpc_ast_t *mpc_ast_arena_add_root_tag(mpc_ast_arena_t *a, mpc_ast_t *x, const char *t) {
+  if (x == NULL) { return x; }
+  x->tag = mpc_ast_arena_join(a, t, strlen(t)-1, "", x->tag);
+  return x;
+}
+
+static mpc_ast_t *mpc_ast_arena_add_rule(mpc_ast_arena_t *a, mpc_ast_t *x, mpc_parser_t *p) {
+  if (x == NULL) { return x; }
+  x->tag = mpc_ast_arena_join(a, p->name, strlen(p->name), "|", x->tag);
+  if (x->tag_id < 0) { x->tag_id = p->id; }
+  return x;
+}
+
+/*
+** A token's contents are the characters it matched, so
+** they can be found in a string input just before the
+** current position, with only the whitespace `mpc_tok`
+** skipped after them in between.
+*/
+
+static const char *mpc_input_view(mpc_input_t *i, const char *c, size_t n) {
+  long p;
+  if (i->type != MPC_INPUT_STRING || n == 0) { return NULL; }
+  for (p = i->state.pos - (long)n; p >= 0; p--) {
+    if (memcmp(i->string + p, c, n) == 0) { return i->string + p; }
+    if (!isspace((unsigned char)i->string[p + (long)n - 1])) { break; }
+  }
+  return NULL;
+}
+
+static mpc_ast_t *mpc_input_ast_leaf(mpc_input_t *i, const char *c) {
+  size_t n = strlen(c);
+  const char *v = mpc_input_view(i, c, n);
+  char *t;
+  if (v == NULL) {
+    t = mpc_blocks_alloc(&i->ast->blocks, n + 1);
+    memcpy(t, c, n + 1);
+    v = t;
+  }
+  return mpc_ast_arena_node(i->ast, mpc_ast_arena_intern(i->ast, "", 0), v, n, 0);
+}
+
+/*
+** Once the parse succeeds the root is moved to the start
+** of the arena. If `own` is set the input it points into
+** is handed over too, so it outlives the input.
+*/
+
+static mpc_ast_t *mpc_input_ast_finish(mpc_input_t *i, mpc_ast_t *x, int own) {
+
+  mpc_ast_arena_t *a = i->ast;
+
+  if (x == NULL) { return x; }
+
+  a->root = *x;
+  a->root.flags = x->flags | MPC_AST_ARENA_ROOT;
+
+  if (own && i->type == MPC_INPUT_STRING) {
+    a->buffer = i->string;
+    a->length = i->length;
+    a->storage = i->storage;
+    i->storage = MPC_INPUT_BORROWED;
+  }
+
+  i->ast = NULL;
+  return &a->root;
+}
+
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x) {
   int j;
   for (j = 0; j < n; j++) { if (j != x) { mpc_free(i, xs[j]); } }
@@ -991,6 +2040,42 @@ static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
   return a;
 }
 
+static mpc_val_t *mpcf_input_fold_ast(mpc_input_t *i, int n, mpc_val_t **xs) {
+
+  int j, k, m = 0;
+  mpc_ast_t **as = (mpc_ast_t**)xs;
+  mpc_ast_t *r;
+
+  if (n == 0) { return NULL; }
+  if (n == 1) { return xs[0]; }
+  if (n == 2 && xs[1] == NULL) { return xs[0]; }
+  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+
+  for (j = 0; j < n; j++) {
+    if (as[j] == NULL) { continue; }
+    m += as[j]->children_num >= 2 ? as[j]->children_num : 1;
+  }
+
+  r = mpc_ast_arena_node(i->ast, mpc_ast_arena_intern(i->ast, ">", 1), "", 0, m);
+
+  for (j = 0, m = 0; j < n; j++) {
+    if (as[j] == NULL) { continue; }
+    if (as[j]->children_num == 0) {
+      r->children[m++] = as[j];
+    } else if (as[j]->children_num == 1) {
+      r->children[m++] = mpc_ast_arena_add_root_tag(i->ast, as[j]->children[0], as[j]->tag);
+    } else {
+      for (k = 0; k < as[j]->children_num; k++) { r->children[m++] = as[j]->children[k]; }
+    }
+  }
+
+  if (r->children_num) {
+    r->state = r->children[0]->state;
+  }
+
+  return r;
+}
+
 static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs) {
   int j;
   if (f == mpcf_null)      { return mpcf_null(n, xs); }
@@ -1002,6 +2087,7 @@ static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t
   if (f == mpcf_trd_free)  { return mpcf_input_trd_free(i, n, xs); }
   if (f == mpcf_strfold)   { return mpcf_input_strfold(i, n, xs); }
   if (f == mpcf_state_ast) { return mpcf_input_state_ast(i, n, xs); }
+  if (f == mpcf_fold_ast && i->ast) { return mpcf_input_fold_ast(i, n, xs); }
   for (j = 0; j < n; j++) { xs[j] = mpc_export(i, xs[j]); }
   return f(j, xs);
 }
@@ -1012,21 +2098,40 @@ static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x) {
 }
 
 static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
+  mpc_ast_t *a = i->ast ? mpc_input_ast_leaf(i, c) : mpc_ast_new("", c);
   mpc_free(i, c);
   return a;
 }
 
+static mpc_val_t *mpcf_input_lit_ast(mpc_input_t *i, mpc_val_t *c) {
+  mpc_ast_t *a = mpcf_input_str_ast(i, c);
+  a->flags |= MPC_AST_DROPPABLE;
+  return a;
+}
+
 static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
   if (f == mpcf_free)     { return mpcf_input_free(i, x); }
   if (f == mpcf_str_ast)  { return mpcf_input_str_ast(i, x); }
+  if (f == mpcf_lit_ast)  { return mpcf_input_lit_ast(i, x); }
+  if (f == (mpc_apply_t)mpc_ast_add_root && i->ast) { return mpc_ast_arena_add_root(i->ast, x); }
   return f(mpc_export(i, x));
 }
 
 static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d) {
+  if (i->ast) {
+    if (f == (mpc_apply_to_t)mpc_ast_tag)          { return mpc_ast_arena_tag(i->ast, x, d); }
+    if (f == (mpc_apply_to_t)mpc_ast_add_tag)      { return mpc_ast_arena_add_tag(i->ast, x, d); }
+    if (f == (mpc_apply_to_t)mpc_ast_add_root_tag) { return mpc_ast_arena_add_root_tag(i->ast, x, d); }
+    if (f == (mpc_apply_to_t)mpc_ast_add_rule)     { return mpc_ast_arena_add_rule(i->ast, x, d); }
+  }
   return f(mpc_export(i, x), d);
 }
 
+static mpc_val_t *mpc_parse_copy(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x) {
+  if (f == (mpc_apply_t)mpc_ast_copy && i->ast) { return mpc_ast_arena_copy(i->ast, x); }
+  return f(x);
+}
+
 static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x) {
   if (d == free) { mpc_free(i, x); return; }
   d(mpc_export(i, x));
@@ -1042,3026 +2147,5739 @@ enum {
   if (x) { MPC_SUCCESS(r->output); } \
   else { MPC_FAILURE(NULL); }
 
-#define MPC_MAX_RECURSION_DEPTH 1000
+/*
+** A span is `many` or `many1` of an expected character
+** class folded into a string. It reports the same errors
+** as the combinators it replaces.
+*/
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+static int mpc_parse_span(mpc_input_t *i, mpc_pdata_span_t *d, mpc_result_t *r, mpc_err_t **e) {
 
-  int j = 0, k = 0;
-  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
-  mpc_result_t *results;
-  int results_slots = MPC_PARSE_STACK_MIN;
+  char *out;
+  size_t n = mpc_input_span(i, d->c, &out);
 
-  if (depth == MPC_MAX_RECURSION_DEPTH)
-  {
-    MPC_FAILURE(mpc_err_fail(i, "Maximum recursion depth exceeded!"));
+  if (n < (size_t)d->min) {
+    mpc_free(i, out);
+    MPC_FAILURE(mpc_err_many1(i, mpc_err_new(i, d->x->data.expect.m)));
   }
 
-  switch (p->type) {
-
-    /* Basic Parsers */
+  *e = mpc_err_merge(i, *e, mpc_err_new(i, d->x->data.expect.m));
+  MPC_SUCCESS(out);
+}
 
-    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
-    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
-    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
-    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_oneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_noneof(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
-    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
-    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
-    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
-    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+/*
+** DFA Matching
+*/
 
-    /* Other parsers */
+/*
+** The errors of a DFA state are reported a fixed number
+** of characters back from where the DFA got stuck. The
+** errors are built from the matched text so this works
+** the same for every kind of input.
+*/
 
-    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
-    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
-    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
-    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
-    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
+static mpc_err_t *mpc_err_dfa(mpc_input_t *i, mpc_state_t s, const char *text, size_t num, char stuck, int back, char **expected, int n) {
+  mpc_err_t *x;
+  int j;
+  if (i->suppress || n < 0) { return NULL; }
+  x = mpc_malloc(i, sizeof(mpc_err_t));
+  x->filename = mpc_malloc(i, strlen(i->filename) + 1);
+  strcpy(x->filename, i->filename);
+  mpc_input_advance(i, &s, text, num - back);
+  x->state = s;
+  x->expected_num = n;
+  x->expected = n ? mpc_malloc(i, sizeof(char*) * n) : NULL;
+  for (j = 0; j < n; j++) {
+    x->expected[j] = mpc_malloc(i, strlen(expected[j]) + 1);
+    strcpy(x->expected[j], expected[j]);
+  }
+  x->failure = NULL;
+  x->received = back ? text[num - back] : stuck;
+  return x;
+}
 
-    /* Application Parsers */
+/*
+** Runs the DFA for the longest match. The table only
+** exists for regexes where this is the same match the
+** combinator form finds, and the errors it would have
+** reported are looked up by the state the DFA got
+** stuck in. This only holds while the input can
+** backtrack, so predictive parsers run the combinators.
+*/
 
-    case MPC_TYPE_APPLY:
-      if (mpc_parse_run(i, p->data.apply.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
-      } else {
-        MPC_FAILURE(r->output);
-      }
+static int mpc_parse_dfa(mpc_input_t *i, mpc_dfa_t *d, mpc_result_t *r, mpc_err_t **e) {
 
-    case MPC_TYPE_APPLY_TO:
-      if (mpc_parse_run(i, p->data.apply_to.x, r, e, depth+1)) {
-        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
-      } else {
-        MPC_FAILURE(r->error);
-      }
+  mpc_state_t start = i->state;
+  mpc_dfa_state_t *ds;
+  const unsigned char *x;
+  const char *text;
+  char *buffer = NULL, *out = NULL;
+  char stuck, c;
+  size_t pos, num = 0, slots = 0;
+  long alen;
+  int s = 0, n;
 
-    case MPC_TYPE_CHECK:
-      if (mpc_parse_run(i, p->data.check.x, r, e, depth+1)) {
-        if (p->data.check.f(&r->output)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
-          MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
-      }
+  alen = d->states[0].accept ? 0 : -1;
 
-    case MPC_TYPE_CHECK_WITH:
-      if (mpc_parse_run(i, p->data.check_with.x, r, e, depth+1)) {
-        if (p->data.check_with.f(&r->output, p->data.check_with.d)) {
-          MPC_SUCCESS(r->output);
-        } else {
-          mpc_parse_dtor(i, p->data.check.dx, r->output);
-          MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
-        }
-      } else {
-        MPC_FAILURE(r->error);
-      }
+  if (i->type == MPC_INPUT_STRING) {
 
-    case MPC_TYPE_EXPECT:
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.expect.x, r, e, depth+1)) {
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_suppress_disable(i);
-        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
-      }
+    /* Scan the string directly */
+    x = (const unsigned char*)i->string + start.pos;
+    while (start.pos + num < i->length && (n = d->next[s * 256 + x[num]]) >= 0) {
+      s = n;
+      num++;
+      if (d->states[s].accept) { alen = num; }
+    }
 
-    case MPC_TYPE_PREDICT:
-      mpc_input_backtrack_disable(i);
-      if (mpc_parse_run(i, p->data.predict.x, r, e, depth+1)) {
-        mpc_input_backtrack_enable(i);
-        MPC_SUCCESS(r->output);
-      } else {
-        mpc_input_backtrack_enable(i);
-        MPC_FAILURE(r->error);
-      }
+    text = i->string + start.pos;
+    stuck = start.pos + num < i->length ? (char)x[num] : '\0';
 
-    /* Optional Parsers */
+    if (alen > 0) {
+      mpc_input_advance(i, &i->state, text, alen);
+      i->last = text[alen-1];
+    }
 
-    /* TODO: Update Not Error Message */
+  } else {
 
-    case MPC_TYPE_NOT:
-      mpc_input_mark(i);
-      mpc_input_suppress_enable(i);
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
-        mpc_input_rewind(i);
-        mpc_input_suppress_disable(i);
-        mpc_parse_dtor(i, p->data.not.dx, r->output);
-        MPC_FAILURE(mpc_err_new(i, "opposite"));
-      } else {
-        mpc_input_unmark(i);
-        mpc_input_suppress_disable(i);
-        MPC_SUCCESS(p->data.not.lf());
+    /* Read ahead then rewind and consume the match */
+    mpc_input_backtrack_enable(i);
+    mpc_input_mark(i);
+
+    while (!mpc_input_terminated(i)) {
+      c = mpc_input_getc(i);
+      n = d->next[s * 256 + (unsigned char)c];
+      if (n < 0) { mpc_input_failure(i, c); break; }
+      mpc_input_success(i, c, NULL);
+      if (num == slots) {
+        slots = slots ? slots * 2 : 32;
+        buffer = realloc(buffer, slots);
       }
+      buffer[num++] = c;
+      s = n;
+      if (d->states[s].accept) { alen = num; }
+    }
 
-    case MPC_TYPE_MAYBE:
-      if (mpc_parse_run(i, p->data.not.x, r, e, depth+1)) {
-        MPC_SUCCESS(r->output);
-      } else {
-        *e = mpc_err_merge(i, *e, r->error);
-        MPC_SUCCESS(p->data.not.lf());
-      }
+    text = buffer;
+    stuck = mpc_input_peekc(i);
+    mpc_input_rewind(i);
 
-    /* Repeat Parsers */
+    for (pos = 0; alen > 0 && pos < (size_t)alen; pos++) {
+      c = mpc_input_getc(i);
+      mpc_input_success(i, c, NULL);
+    }
 
-    case MPC_TYPE_MANY:
+    mpc_input_backtrack_disable(i);
+  }
 
-      results = results_stk;
+  ds = &d->states[s];
+  *e = mpc_err_merge(i, *e, mpc_err_dfa(i, start, text, num, stuck,
+    ds->merged_back, ds->merged, ds->merged_num));
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
+  if (alen >= 0) {
+    out = mpc_malloc(i, alen + 1);
+    if (alen > 0) { memcpy(out, text, alen); }
+    out[alen] = '\0';
+    free(buffer);
+    MPC_SUCCESS(out);
+  } else {
+    r->error = mpc_err_dfa(i, start, text, num, stuck,
+      ds->failed_back, ds->failed, ds->failed_num);
+    free(buffer);
+    return 0;
+  }
+}
 
-      *e = mpc_err_merge(i, *e, results[j].error);
 
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+/*
+** Packrat Memoisation
+*/
 
-    case MPC_TYPE_MANY1:
+typedef struct {
+  mpc_state_t start;
+  char last;
+  char flags;
+  char seen;
+} mpc_memo_key_t;
+
+static void mpc_memo_clear(mpc_memo_t *m) {
+  if (m->p == NULL) { return; }
+  if (m->output && m->dtor) { m->dtor(m->output); }
+  if (m->error) { mpc_err_delete(m->error); }
+  if (m->merged) { mpc_err_delete(m->merged); }
+  memset(m, 0, sizeof(mpc_memo_t));
+}
+
+static mpc_memo_t *mpc_memo_slot(mpc_input_t *i, mpc_parser_t *p, long pos) {
+  size_t h = ((size_t)p >> 4) * 31 + (size_t)pos;
+  if (i->memo == NULL) {
+    i->memo = mpc_arena_alloc(i, sizeof(mpc_memo_t) * MPC_MEMO_SLOTS);
+    memset(i->memo, 0, sizeof(mpc_memo_t) * MPC_MEMO_SLOTS);
+  }
+  return &i->memo[h % MPC_MEMO_SLOTS];
+}
 
-      results = results_stk;
+/*
+** Looks up the result of running `p` at the current
+** position. Results also depend on whether errors are
+** suppressed, whether backtracking is enabled and the
+** last character (for anchors) so these go in the key
+** too. If a result is stored it is replayed into `r`.
+*/
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == MPC_PARSE_STACK_MIN) {
-          results_slots = j + j / 2;
-          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
-        } else if (j >= results_slots) {
-          results_slots = j + j / 2;
-          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
-        }
-      }
+static int mpc_memo_find(mpc_input_t *i, mpc_parser_t *p, mpc_apply_t cf, mpc_memo_key_t *k, mpc_result_t *r, mpc_err_t **e, int *ok) {
 
-      if (j == 0) {
-        MPC_FAILURE(
-          mpc_err_many1(i, results[j].error);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
+  mpc_memo_t *m;
 
-        *e = mpc_err_merge(i, *e, results[j].error);
+  k->start = i->state;
+  k->last = i->last;
+  k->flags = (char)((i->suppress > 0) | ((i->backtrack > 0) << 1));
 
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
+  m = mpc_memo_slot(i, p, k->start.pos);
+  k->seen = m->p == p && m->pos == k->start.pos && m->last == k->last && m->flags == k->flags;
 
-    case MPC_TYPE_COUNT:
+  if (!k->seen || m->result == MPC_MEMO_SEEN) { return 0; }
 
-      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
-        : results_stk;
+  i->state = m->end;
+  i->last = m->end_last;
+  *e = mpc_err_merge(i, *e, mpc_err_copy(m->merged));
+  if (m->result == MPC_MEMO_SUCCESS) {
+    r->output = m->output ? mpc_parse_copy(i, cf, m->output) : NULL;
+    *ok = 1;
+  } else {
+    r->error = mpc_err_copy(m->error);
+    *ok = 0;
+  }
+  return 1;
+}
 
-      while (mpc_parse_run(i, p->data.repeat.x, &results[j], e, depth+1)) {
-        j++;
-        if (j == p->data.repeat.n) { break; }
-      }
+/*
+** Stores the result of running `p` from the key. The
+** errors merged along the way are kept on their own so
+** they can be merged again on a replay. Successes are
+** only stored when there is a function to copy them.
+*/
 
-      if (j == p->data.repeat.n) {
-        MPC_SUCCESS(
-          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      } else {
-        for (k = 0; k < j; k++) {
-          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
-        }
-        MPC_FAILURE(
-          mpc_err_count(i, results[j].error, p->data.repeat.n);
-          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-      }
+static void mpc_memo_store(mpc_input_t *i, mpc_parser_t *p, mpc_apply_t cf, mpc_dtor_t df, mpc_memo_key_t *k, int ok, mpc_result_t *r, mpc_err_t *merged) {
 
-    /* Combinatory Parsers */
+  mpc_memo_t *m;
 
-    case MPC_TYPE_OR:
+  if (ok && !cf) { return; }
 
-      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+  m = mpc_memo_slot(i, p, k->start.pos);
+  mpc_memo_clear(m);
+  m->p = p;
+  m->pos = k->start.pos;
+  m->last = k->last;
+  m->flags = k->flags;
+  m->result = !ok ? MPC_MEMO_FAILURE : k->seen ? MPC_MEMO_SUCCESS : MPC_MEMO_SEEN;
+  m->end = i->state;
+  m->end_last = i->last;
+  m->output = m->result == MPC_MEMO_SUCCESS && r->output ? mpc_parse_copy(i, cf, r->output) : NULL;
+  m->dtor = df;
+  m->error = ok ? NULL : mpc_err_copy(r->error);
+  m->merged = m->result != MPC_MEMO_SEEN ? mpc_err_copy(merged) : NULL;
+}
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+/*
+** Dispatch
+**
+** An alternative that can't match the next character
+** or the empty string fails without consuming any
+** input, so its errors are all at the start of the `or`.
+** When one of the alternatives that were run succeeds
+** and consumes input, or they fail further on, those
+** errors can never be reported and it is skipped. Else
+** the alternatives are all run again in order so the
+** error lists the same things it always did. Without
+** backtracking a failed alternative can leave input
+** consumed, so predictive parsers try every one.
+*/
 
-      for (j = 0; j < p->data.or.n; j++) {
-        if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e, depth+1)) {
-          MPC_SUCCESS(results[j].output;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        } else {
-          *e = mpc_err_merge(i, *e, results[j].error);
-        }
-      }
+static mpc_dispatch_t *mpc_dispatch_copy(const mpc_dispatch_t *d) {
+  mpc_dispatch_t *c;
+  if (d == NULL) { return NULL; }
+  c = malloc(sizeof(mpc_dispatch_t));
+  memcpy(c, d, sizeof(mpc_dispatch_t));
+  c->alts = malloc(sizeof(int) * d->alts_num);
+  memcpy(c->alts, d->alts, sizeof(int) * d->alts_num);
+  return c;
+}
 
-      MPC_FAILURE(NULL;
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+static void mpc_dispatch_delete(mpc_dispatch_t *d) {
+  if (d == NULL) { return; }
+  free(d->alts);
+  free(d);
+}
 
-    case MPC_TYPE_AND:
+static int mpc_dispatch_find(mpc_input_t *i, mpc_dispatch_t *d, int **alts, int *num) {
 
-      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+  unsigned char c;
 
-      results = p->data.or.n > MPC_PARSE_STACK_MIN
-        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
-        : results_stk;
+  if (d == NULL
+  ||  i->backtrack < 1
+  ||  i->type != MPC_INPUT_STRING
+  ||  (size_t)i->state.pos >= i->length) { return 0; }
 
-      mpc_input_mark(i);
-      for (j = 0; j < p->data.and.n; j++) {
-        if (!mpc_parse_run(i, p->data.and.xs[j], &results[j], e, depth+1)) {
-          mpc_input_rewind(i);
-          for (k = 0; k < j; k++) {
-            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
-          }
-          MPC_FAILURE(results[j].error;
-            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
-        }
-      }
-      mpc_input_unmark(i);
-      MPC_SUCCESS(
-        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
-        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+  c = (unsigned char)i->string[i->state.pos];
+  if (c == '\0' || d->num[c] < 0) { return 0; }
 
-    /* End */
+  /* Unless errors are suppressed they are all needed */
+  if (d->num[c] == 0 && !i->suppress) { return 0; }
 
-    default:
+  *alts = d->alts + d->start[c];
+  *num = d->num[c];
+  return 1;
+}
 
-      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
-  }
+static int mpc_dispatch_rerun(mpc_input_t *i, long pos, mpc_err_t *merged) {
+  return !i->suppress && (merged == NULL || merged->state.pos <= pos);
+}
 
-  return 0;
+/*
+** Profiling
+**
+** When a parse is given a profile each parser is pushed
+** on a stack of its own as it starts and popped as it
+** finishes, and its counts are added to the record for
+** its type and, if it has a name, to the record for it.
+** Rewinds are counted against whichever parser is on top
+** of the stack when they happen. A parser that hands over
+** to another without waiting for it is marked as a tail
+** and finishes along with it.
+*/
+
+enum {
+  MPC_PROFILE_SLOTS_MIN = 64
+};
+
+/* Parsers met once the table of names is this big aren't recorded by name */
+#define MPC_PROFILE_SLOTS_MAX ((size_t)1 << 20)
+
+typedef struct {
+  mpc_parser_t *p;
+  char *name;
+  unsigned long calls;
+  unsigned long successes;
+  unsigned long failures;
+  unsigned long rewinds;
+  unsigned long bytes;
+  double time;
+} mpc_profile_rec_t;
+
+struct mpc_profile_t {
+  mpc_profile_rec_t types[MPC_TYPE_MEMO+1];
+  mpc_profile_rec_t *named;
+  size_t named_num;
+  size_t named_slots;
+};
 
+static const char *mpc_type_names[MPC_TYPE_MEMO+1] = {
+  "undefined", "pass", "fail", "lift", "lift_val", "expect", "anchor", "state",
+  "any", "single", "oneof", "noneof", "range", "satisfy", "string",
+  "apply", "apply_to", "predict", "not", "maybe", "many", "many1", "count",
+  "or", "and", "check", "check_with", "soi", "eoi", "dfa", "span", "memo"
+};
+
+static double mpc_profile_now(void) {
+#ifdef MPC_HAVE_CLOCK_GETTIME
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (double)t.tv_sec + (double)t.tv_nsec * 1e-9;
+#else
+  return (double)clock() / CLOCKS_PER_SEC;
+#endif
 }
 
-#undef MPC_SUCCESS
-#undef MPC_FAILURE
-#undef MPC_PRIMITIVE
+static mpc_profile_rec_t *mpc_profile_probe(mpc_profile_rec_t *named, size_t slots, mpc_parser_t *p) {
+  size_t h = ((size_t)p >> 4) & (slots - 1);
+  while (named[h].p && named[h].p != p) { h = (h + 1) & (slots - 1); }
+  return &named[h];
+}
 
-int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
-  e->state = mpc_state_invalid();
-  x = mpc_parse_run(i, p, r, &e, 0);
-  if (x) {
-    mpc_err_delete_internal(i, e);
-    r->output = mpc_export(i, r->output);
-  } else {
-    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+/*
+** The record of `p` by name, or NULL if it can't be
+** made because the table is full or memory ran out. The
+** parse is then only counted in the totals by type.
+*/
+static mpc_profile_rec_t *mpc_profile_named(mpc_profile_t *pr, mpc_parser_t *p) {
+
+  mpc_profile_rec_t *x, *named;
+  size_t j, slots;
+  char *name;
+
+  if (pr->named_slots > 0) {
+    x = mpc_profile_probe(pr->named, pr->named_slots, p);
+    if (x->p) { return x; }
   }
+
+  if ((pr->named_num + 1) * 2 > pr->named_slots) {
+    if (pr->named_slots >= MPC_PROFILE_SLOTS_MAX) { return NULL; }
+    slots = pr->named_slots ? pr->named_slots * 2 : MPC_PROFILE_SLOTS_MIN;
+    named = calloc(slots, sizeof(mpc_profile_rec_t));
+    if (named == NULL) { return NULL; }
+    for (j = 0; j < pr->named_slots; j++) {
+      if (pr->named[j].p) { *mpc_profile_probe(named, slots, pr->named[j].p) = pr->named[j]; }
+    }
+    free(pr->named);
+    pr->named = named;
+    pr->named_slots = slots;
+  }
+
+  name = malloc(strlen(p->name) + 1);
+  if (name == NULL) { return NULL; }
+  strcpy(name, p->name);
+
+  x = mpc_profile_probe(pr->named, pr->named_slots, p);
+  x->p = p;
+  x->name = name;
+  pr->named_num++;
   return x;
 }
 
-int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_input_t *i = mpc_input_new_string(filename, string);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
+static void mpc_profile_enter(mpc_input_t *i, mpc_parser_t *p) {
+
+  mpc_profile_frame_t *f;
+
+  if (i->profile_num == i->profile_slots) {
+    i->profile_slots = i->profile_slots ? i->profile_slots * 2 : MPC_PROFILE_SLOTS_MIN;
+    i->profile_stk = realloc(i->profile_stk, sizeof(mpc_profile_frame_t) * i->profile_slots);
+  }
+
+  f = &i->profile_stk[i->profile_num++];
+  f->p = p;
+  f->pos = i->state.pos;
+  f->tail = 0;
+  f->rewinds = 0;
+  f->start = mpc_profile_now();
 }
 
-int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_input_t *i = mpc_input_new_nstring(filename, string, length);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
+static void mpc_profile_add(mpc_profile_rec_t *x, int ok, unsigned long bytes, unsigned long rewinds, double time) {
+  x->calls++;
+  if (ok) { x->successes++; } else { x->failures++; }
+  x->rewinds += rewinds;
+  x->bytes += bytes;
+  x->time += time;
 }
 
-int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_input_t *i = mpc_input_new_file(filename, file);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
+static void mpc_profile_leave(mpc_input_t *i, int ok) {
+
+  mpc_profile_frame_t *f;
+  mpc_profile_rec_t *x;
+  double now = mpc_profile_now(), time;
+  unsigned long bytes;
+
+  do {
+    f = &i->profile_stk[--i->profile_num];
+    time = now - f->start;
+    bytes = ok ? (unsigned long)(i->state.pos - f->pos) : 0;
+    mpc_profile_add(&i->profile->types[(int)f->p->type], ok, bytes, f->rewinds, time);
+    x = f->p->name ? mpc_profile_named(i->profile, f->p) : NULL;
+    if (x) { mpc_profile_add(x, ok, bytes, f->rewinds, time); }
+  } while (i->profile_num > 0 && i->profile_stk[i->profile_num-1].tail);
 }
 
-int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r) {
-  int x;
-  mpc_input_t *i = mpc_input_new_pipe(filename, pipe);
-  x = mpc_parse_input(i, p, r);
-  mpc_input_delete(i);
-  return x;
+mpc_profile_t *mpc_profile_new(void) {
+  return calloc(1, sizeof(mpc_profile_t));
 }
 
-int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+void mpc_profile_delete(mpc_profile_t *pr) {
+  size_t j;
+  for (j = 0; j < pr->named_slots; j++) { free(pr->named[j].name); }
+  free(pr->named);
+  free(pr);
+}
 
-  FILE *f = fopen(filename, "rb");
-  int res;
+static int mpc_profile_cmp(const void *a, const void *b) {
+  double x = (*(mpc_profile_rec_t* const*)a)->time;
+  double y = (*(mpc_profile_rec_t* const*)b)->time;
+  return x < y ? 1 : (x > y ? -1 : 0);
+}
 
-  if (f == NULL) {
-    r->output = NULL;
-    r->error = mpc_err_file(filename, "Unable to open file!");
-    return 0;
+static void mpc_profile_name(FILE *f, const char *s, int format) {
+  switch (format) {
+    case MPC_PROFILE_CSV:
+      fputc('"', f);
+      for (; *s; s++) { if (*s == '"') { fputc('"', f); } fputc(*s, f); }
+      fputc('"', f);
+      break;
+    case MPC_PROFILE_JSON:
+      fputc('"', f);
+      for (; *s; s++) {
+        if (*s == '"' || *s == '\\') { fprintf(f, "\\%c", *s); }
+        else if ((unsigned char)*s < 0x20) { fprintf(f, "\\u%04x", (unsigned char)*s); }
+        else { fputc(*s, f); }
+      }
+      fputc('"', f);
+      break;
+    default: fprintf(f, "%-20s", s); break;
   }
+}
 
-  res = mpc_parse_file(filename, f, p, r);
-  fclose(f);
-  return res;
+static void mpc_profile_dump_recs(FILE *f, const char *kind, mpc_profile_rec_t **xs, int n, int format) {
+
+  int j;
+
+  if (format == MPC_PROFILE_TEXT) {
+    fprintf(f, "%-20s %10s %10s %10s %10s %12s %12s\n",
+      kind, "Calls", "Success", "Failure", "Rewinds", "Bytes", "Seconds");
+  }
+
+  for (j = 0; j < n; j++) {
+    switch (format) {
+      case MPC_PROFILE_CSV:
+        fprintf(f, "%s,", kind);
+        mpc_profile_name(f, xs[j]->name, format);
+        fprintf(f, ",%lu,%lu,%lu,%lu,%lu,%.9f\n",
+          xs[j]->calls, xs[j]->successes, xs[j]->failures,
+          xs[j]->rewinds, xs[j]->bytes, xs[j]->time);
+        break;
+      case MPC_PROFILE_JSON:
+        fprintf(f, "%s\n    {\"name\": ", j ? "," : "");
+        mpc_profile_name(f, xs[j]->name, format);
+        fprintf(f, ", \"calls\": %lu, \"successes\": %lu, \"failures\": %lu,"
+          " \"rewinds\": %lu, \"bytes\": %lu, \"seconds\": %.9f}",
+          xs[j]->calls, xs[j]->successes, xs[j]->failures,
+          xs[j]->rewinds, xs[j]->bytes, xs[j]->time);
+        break;
+      default:
+        mpc_profile_name(f, xs[j]->name, format);
+        fprintf(f, " %10lu %10lu %10lu %10lu %12lu %12.6f\n",
+          xs[j]->calls, xs[j]->successes, xs[j]->failures,
+          xs[j]->rewinds, xs[j]->bytes, xs[j]->time);
+        break;
+    }
+  }
 }
 
-/*
-** Building a Parser
-*/
+void mpc_profile_dump(mpc_profile_t *pr, FILE *f, int format) {
 
-static void mpc_undefine_unretained(mpc_parser_t *p, int force);
+  mpc_profile_rec_t **named = malloc(sizeof(mpc_profile_rec_t*) * (pr->named_num + 1));
+  mpc_profile_rec_t *types[MPC_TYPE_MEMO+1];
+  int j, named_num = 0, types_num = 0;
+  size_t k;
 
-static void mpc_undefine_or(mpc_parser_t *p) {
+  if (named == NULL) { return; }
 
-  int i;
-  for (i = 0; i < p->data.or.n; i++) {
-    mpc_undefine_unretained(p->data.or.xs[i], 0);
+  for (k = 0; k < pr->named_slots; k++) {
+    if (pr->named[k].p) { named[named_num++] = &pr->named[k]; }
   }
-  free(p->data.or.xs);
 
-}
+  for (j = 0; j <= MPC_TYPE_MEMO; j++) {
+    if (pr->types[j].calls == 0) { continue; }
+    pr->types[j].name = (char*)mpc_type_names[j];
+    types[types_num++] = &pr->types[j];
+  }
 
-static void mpc_undefine_and(mpc_parser_t *p) {
+  qsort(named, named_num, sizeof(mpc_profile_rec_t*), mpc_profile_cmp);
+  qsort(types, types_num, sizeof(mpc_profile_rec_t*), mpc_profile_cmp);
 
-  int i;
-  for (i = 0; i < p->data.and.n; i++) {
-    mpc_undefine_unretained(p->data.and.xs[i], 0);
+  switch (format) {
+    case MPC_PROFILE_CSV:
+      fprintf(f, "kind,name,calls,successes,failures,rewinds,bytes,seconds\n");
+      mpc_profile_dump_recs(f, "parser", named, named_num, format);
+      mpc_profile_dump_recs(f, "type", types, types_num, format);
+      break;
+    case MPC_PROFILE_JSON:
+      fprintf(f, "{\n  \"parsers\": [");
+      mpc_profile_dump_recs(f, "parser", named, named_num, format);
+      fprintf(f, "\n  ],\n  \"types\": [");
+      mpc_profile_dump_recs(f, "type", types, types_num, format);
+      fprintf(f, "\n  ]\n}\n");
+      break;
+    default:
+      fprintf(f, "Profile\n");
+      fprintf(f, "=======\n");
+      mpc_profile_dump_recs(f, "Parser", named, named_num, format);
+      fprintf(f, "\n");
+      mpc_profile_dump_recs(f, "Type", types, types_num, format);
+      break;
   }
-  free(p->data.and.xs);
-  free(p->data.and.dxs);
 
+  for (j = 0; j < types_num; j++) { types[j]->name = NULL; }
+  free(named);
 }
 
-static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
+#ifdef MPC_RECURSIVE
 
-  if (p->retained && !force) { return; }
+/*
+** Recursive Engine
+*/
 
-  switch (p->type) {
+#define MPC_MAX_RECURSION_DEPTH 1000
 
-    case MPC_TYPE_FAIL: free(p->data.fail.m); break;
+static int mpc_parse_rec(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth);
 
-    case MPC_TYPE_ONEOF:
-    case MPC_TYPE_NONEOF:
-    case MPC_TYPE_STRING:
-      free(p->data.string.x);
-      break;
+/*
+** Runs `x` remembering the result against `p`. Only
+** string inputs are memoised as other inputs can't jump
+** ahead to the end of a result.
+*/
 
-    case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
-    case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
-    case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
+static int mpc_parse_memo(mpc_input_t *i, mpc_parser_t *p, mpc_parser_t *x, mpc_apply_t cf, mpc_dtor_t df, mpc_result_t *r, mpc_err_t **e, int depth) {
 
-    case MPC_TYPE_MAYBE:
-    case MPC_TYPE_NOT:
-      mpc_undefine_unretained(p->data.not.x, 0);
-      break;
+  mpc_memo_key_t k;
+  mpc_err_t *merged = NULL;
+  int x_ok;
 
-    case MPC_TYPE_EXPECT:
-      mpc_undefine_unretained(p->data.expect.x, 0);
-      free(p->data.expect.m);
-      break;
+  if (i->type != MPC_INPUT_STRING) {
+    i->memo_skip = x;
+    return mpc_parse_rec(i, x, r, e, depth+1);
+  }
 
-    case MPC_TYPE_MANY:
-    case MPC_TYPE_MANY1:
-    case MPC_TYPE_COUNT:
-      mpc_undefine_unretained(p->data.repeat.x, 0);
-      break;
+  if (mpc_memo_find(i, p, cf, &k, r, e, &x_ok)) { return x_ok; }
 
-    case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
-    case MPC_TYPE_AND: mpc_undefine_and(p); break;
+  i->memo_skip = x;
+  x_ok = mpc_parse_rec(i, x, r, &merged, depth+1);
+  mpc_memo_store(i, p, cf, df, &k, x_ok, r, merged);
 
-    case MPC_TYPE_CHECK:
-      mpc_undefine_unretained(p->data.check.x, 0);
-      free(p->data.check.e);
-      break;
+  *e = mpc_err_merge(i, *e, merged);
+  return x_ok;
+}
 
-    case MPC_TYPE_CHECK_WITH:
-      mpc_undefine_unretained(p->data.check_with.x, 0);
-      free(p->data.check_with.e);
-      break;
+static int mpc_parse_node(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
 
-    default: break;
+  int j = 0, k = 0;
+  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
+  mpc_result_t *results;
+  int results_slots = MPC_PARSE_STACK_MIN;
+  mpc_err_t *merged = NULL;
+  int *alts;
+  long pos;
+
+  /*
+  ** Running out of depth fails the whole parse. Every
+  ** parser after it fails too, so a `many` or `or` can't
+  ** carry on as if it was an ordinary failure.
+  */
+  if (i->overflow) { MPC_FAILURE(NULL); }
+  if (depth == MPC_MAX_RECURSION_DEPTH) {
+    i->overflow = 1;
+    MPC_FAILURE(NULL);
   }
 
-  if (!force) {
-    free(p->name);
-    free(p);
+  /* In a packrat parse every named parser is memoised */
+  if (i->memo_all && p->retained && p != i->memo_skip) {
+    return mpc_parse_memo(i, p, p, i->memo_copy, i->memo_dtor, r, e, depth);
   }
+  i->memo_skip = NULL;
 
-}
-
-void mpc_delete(mpc_parser_t *p) {
-  if (p->retained) {
+  switch (p->type) {
 
-    if (p->type != MPC_TYPE_UNDEFINED) {
-      mpc_undefine_unretained(p, 0);
-    }
+    /* Basic Parsers */
 
-    free(p->name);
-    free(p);
+    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&r->output));
+    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&r->output));
+    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&r->output));
+    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_class(i, p->data.cls.c, (char**)&r->output));
+    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_class(i, p->data.cls.c, (char**)&r->output));
+    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&r->output));
+    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&r->output));
+    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&r->output));
+    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
+    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+    case MPC_TYPE_DFA:
+      if (i->backtrack < 1) { return mpc_parse_rec(i, p->data.dfa.x, r, e, depth+1); }
+      return mpc_parse_dfa(i, p->data.dfa.d, r, e);
+    case MPC_TYPE_SPAN:    return mpc_parse_span(i, &p->data.span, r, e);
+    case MPC_TYPE_MEMO:    return mpc_parse_memo(i, p, p->data.memo.x, p->data.memo.cf, p->data.memo.df, r, e, depth);
 
-  } else {
-    mpc_undefine_unretained(p, 0);
-  }
-}
+    /* Other parsers */
 
-static void mpc_soft_delete(mpc_val_t *x) {
-  mpc_undefine_unretained(x, 0);
-}
+    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
+    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
+    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
+    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
+    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
+    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
 
-static mpc_parser_t *mpc_undefined(void) {
-  mpc_parser_t *p = calloc(1, sizeof(mpc_parser_t));
-  p->retained = 0;
-  p->type = MPC_TYPE_UNDEFINED;
-  p->name = NULL;
-  return p;
-}
+    /* Application Parsers */
 
-mpc_parser_t *mpc_new(const char *name) {
-  mpc_parser_t *p = mpc_undefined();
-  p->retained = 1;
-  p->name = realloc(p->name, strlen(name) + 1);
-  strcpy(p->name, name);
-  return p;
-}
+    case MPC_TYPE_APPLY:
+      if (mpc_parse_rec(i, p->data.apply.x, r, e, depth+1)) {
+        MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, r->output));
+      } else {
+        MPC_FAILURE(r->output);
+      }
 
-mpc_parser_t *mpc_copy(mpc_parser_t *a) {
-  int i = 0;
-  mpc_parser_t *p;
+    case MPC_TYPE_APPLY_TO:
+      if (mpc_parse_rec(i, p->data.apply_to.x, r, e, depth+1)) {
+        MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, r->output, p->data.apply_to.d));
+      } else {
+        MPC_FAILURE(r->error);
+      }
 
-  if (a->retained) { return a; }
+    case MPC_TYPE_CHECK:
+      if (mpc_parse_rec(i, p->data.check.x, r, e, depth+1)) {
+        if (p->data.check.f(&r->output)) {
+          MPC_SUCCESS(r->output);
+        } else {
+          mpc_parse_dtor(i, p->data.check.dx, r->output);
+          MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
+        }
+      } else {
+        MPC_FAILURE(r->error);
+      }
 
-  p = mpc_undefined();
-  p->retained = a->retained;
-  p->type = a->type;
-  p->data = a->data;
+    case MPC_TYPE_CHECK_WITH:
+      if (mpc_parse_rec(i, p->data.check_with.x, r, e, depth+1)) {
+        if (p->data.check_with.f(&r->output, p->data.check_with.d)) {
+          MPC_SUCCESS(r->output);
+        } else {
+          mpc_parse_dtor(i, p->data.check.dx, r->output);
+          MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
+        }
+      } else {
+        MPC_FAILURE(r->error);
+      }
 
-  if (a->name) {
-    p->name = malloc(strlen(a->name)+1);
-    strcpy(p->name, a->name);
-  }
+    case MPC_TYPE_EXPECT:
+      mpc_input_suppress_enable(i);
+      if (mpc_parse_rec(i, p->data.expect.x, r, e, depth+1)) {
+        mpc_input_suppress_disable(i);
+        MPC_SUCCESS(r->output);
+      } else {
+        mpc_input_suppress_disable(i);
+        MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
+      }
 
-  switch (a->type) {
+    case MPC_TYPE_PREDICT:
+      mpc_input_backtrack_disable(i);
+      if (mpc_parse_rec(i, p->data.predict.x, r, e, depth+1)) {
+        mpc_input_backtrack_enable(i);
+        MPC_SUCCESS(r->output);
+      } else {
+        mpc_input_backtrack_enable(i);
+        MPC_FAILURE(r->error);
+      }
 
-    case MPC_TYPE_FAIL:
-      p->data.fail.m = malloc(strlen(a->data.fail.m)+1);
-      strcpy(p->data.fail.m, a->data.fail.m);
-    break;
+    /* Optional Parsers */
 
-    case MPC_TYPE_ONEOF:
-    case MPC_TYPE_NONEOF:
-    case MPC_TYPE_STRING:
-      p->data.string.x = malloc(strlen(a->data.string.x)+1);
-      strcpy(p->data.string.x, a->data.string.x);
-      break;
+    /* TODO: Update Not Error Message */
 
-    case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
-    case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
-    case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
+    case MPC_TYPE_NOT:
+      mpc_input_mark(i);
+      mpc_input_suppress_enable(i);
+      if (mpc_parse_rec(i, p->data.not.x, r, e, depth+1)) {
+        mpc_input_rewind(i);
+        mpc_input_suppress_disable(i);
+        mpc_parse_dtor(i, p->data.not.dx, r->output);
+        MPC_FAILURE(mpc_err_new(i, "opposite"));
+      } else {
+        mpc_input_unmark(i);
+        mpc_input_suppress_disable(i);
+        MPC_SUCCESS(p->data.not.lf());
+      }
 
     case MPC_TYPE_MAYBE:
-    case MPC_TYPE_NOT:
-      p->data.not.x = mpc_copy(a->data.not.x);
-      break;
+      if (mpc_parse_rec(i, p->data.not.x, r, e, depth+1)) {
+        MPC_SUCCESS(r->output);
+      } else {
+        *e = mpc_err_merge(i, *e, r->error);
+        MPC_SUCCESS(p->data.not.lf());
+      }
 
-    case MPC_TYPE_EXPECT:
-      p->data.expect.x = mpc_copy(a->data.expect.x);
-      p->data.expect.m = malloc(strlen(a->data.expect.m)+1);
-      strcpy(p->data.expect.m, a->data.expect.m);
-      break;
+    /* Repeat Parsers */
 
     case MPC_TYPE_MANY:
-    case MPC_TYPE_MANY1:
-    case MPC_TYPE_COUNT:
-      p->data.repeat.x = mpc_copy(a->data.repeat.x);
-      break;
 
-    case MPC_TYPE_OR:
-      p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
-      for (i = 0; i < a->data.or.n; i++) {
-        p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
-      }
-    break;
-    case MPC_TYPE_AND:
-      p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
-      for (i = 0; i < a->data.and.n; i++) {
-        p->data.and.xs[i] = mpc_copy(a->data.and.xs[i]);
-      }
-      p->data.and.dxs = malloc((a->data.and.n-1) * sizeof(mpc_dtor_t));
-      for (i = 0; i < a->data.and.n-1; i++) {
-        p->data.and.dxs[i] = a->data.and.dxs[i];
-      }
-    break;
+      results = results_stk;
 
-    case MPC_TYPE_CHECK:
-      p->data.check.x      = mpc_copy(a->data.check.x);
-      p->data.check.e      = malloc(strlen(a->data.check.e)+1);
-      strcpy(p->data.check.e, a->data.check.e);
-      break;
-    case MPC_TYPE_CHECK_WITH:
-      p->data.check_with.x = mpc_copy(a->data.check_with.x);
-      p->data.check_with.e = malloc(strlen(a->data.check_with.e)+1);
-      strcpy(p->data.check_with.e, a->data.check_with.e);
-      break;
+      while (mpc_parse_rec(i, p->data.repeat.x, &results[j], e, depth+1)) {
+        j++;
+        if (j == MPC_PARSE_STACK_MIN) {
+          results_slots = j + j / 2;
+          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
+          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
+        } else if (j >= results_slots) {
+          results_slots = j + j / 2;
+          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
+        }
+      }
 
-    default: break;
-  }
+      *e = mpc_err_merge(i, *e, results[j].error);
 
+      MPC_SUCCESS(
+        mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
+        if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
 
-  return p;
-}
+    case MPC_TYPE_MANY1:
 
-mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
-  mpc_undefine_unretained(p, 1);
-  p->type = MPC_TYPE_UNDEFINED;
-  return p;
-}
+      results = results_stk;
 
-mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
+      while (mpc_parse_rec(i, p->data.repeat.x, &results[j], e, depth+1)) {
+        j++;
+        if (j == MPC_PARSE_STACK_MIN) {
+          results_slots = j + j / 2;
+          results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
+          memcpy(results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
+        } else if (j >= results_slots) {
+          results_slots = j + j / 2;
+          results = mpc_realloc(i, results, sizeof(mpc_result_t) * results_slots);
+        }
+      }
 
-  if (p->retained) {
-    p->type = a->type;
-    p->data = a->data;
-  } else {
-    mpc_parser_t *a2 = mpc_failf("Attempt to assign to Unretained Parser!");
-    p->type = a2->type;
-    p->data = a2->data;
-    free(a2);
-  }
+      if (j == 0) {
+        MPC_FAILURE(
+          mpc_err_many1(i, results[j].error);
+          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      } else {
 
-  free(a);
-  return p;
-}
+        *e = mpc_err_merge(i, *e, results[j].error);
 
-void mpc_cleanup(int n, ...) {
-  int i;
-  mpc_parser_t **list = malloc(sizeof(mpc_parser_t*) * n);
+        MPC_SUCCESS(
+          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
+          if (j >= MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      }
 
-  va_list va;
-  va_start(va, n);
-  for (i = 0; i < n; i++) { list[i] = va_arg(va, mpc_parser_t*); }
-  for (i = 0; i < n; i++) { mpc_undefine(list[i]); }
-  for (i = 0; i < n; i++) { mpc_delete(list[i]); }
-  va_end(va);
+    case MPC_TYPE_COUNT:
 
-  free(list);
-}
+      results = p->data.repeat.n > MPC_PARSE_STACK_MIN
+        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n)
+        : results_stk;
 
-mpc_parser_t *mpc_pass(void) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_PASS;
-  return p;
-}
+      while (mpc_parse_rec(i, p->data.repeat.x, &results[j], e, depth+1)) {
+        j++;
+        if (j == p->data.repeat.n) { break; }
+      }
 
-mpc_parser_t *mpc_fail(const char *m) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_FAIL;
-  p->data.fail.m = malloc(strlen(m) + 1);
-  strcpy(p->data.fail.m, m);
-  return p;
-}
+      if (j == p->data.repeat.n) {
+        MPC_SUCCESS(
+          mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
+          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      } else {
+        for (k = 0; k < j; k++) {
+          mpc_parse_dtor(i, p->data.repeat.dx, results[k].output);
+        }
+        MPC_FAILURE(
+          mpc_err_count(i, results[j].error, p->data.repeat.n);
+          if (p->data.repeat.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+      }
 
-/*
-** As `snprintf` is not ANSI standard this
-** function `mpc_failf` should be considered
-** unsafe.
-**
-** You have a few options if this is going to be
-** trouble.
-**
-** - Ensure the format string does not exceed
-**   the buffer length using precision specifiers
-**   such as `%.512s`.
-**
-** - Patch this function in your code base to
-**   use `snprintf` or whatever variant your
-**   system supports.
-**
-** - Avoid it altogether.
-**
-*/
+    /* Combinatory Parsers */
 
-mpc_parser_t *mpc_failf(const char *fmt, ...) {
+    case MPC_TYPE_OR:
 
-  va_list va;
-  char *buffer;
+      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
 
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_FAIL;
+      if (mpc_dispatch_find(i, p->data.or.d, &alts, &k)) {
+        pos = i->state.pos;
+        for (j = 0; j < k; j++) {
+          if (mpc_parse_rec(i, p->data.or.xs[alts[j]], r, &merged, depth+1)) {
+            if (merged) { *e = mpc_err_merge(i, *e, merged); }
+            return 1;
+          }
+          merged = mpc_err_merge(i, merged, r->error);
+        }
+        if (!mpc_dispatch_rerun(i, pos, merged)) {
+          if (merged) { *e = mpc_err_merge(i, *e, merged); }
+          MPC_FAILURE(NULL);
+        }
+        mpc_err_delete_internal(i, merged);
+      }
 
-  va_start(va, fmt);
-  buffer = malloc(2048);
-  vsprintf(buffer, fmt, va);
-  va_end(va);
+      results = p->data.or.n > MPC_PARSE_STACK_MIN
+        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
+        : results_stk;
 
-  buffer = realloc(buffer, strlen(buffer) + 1);
-  p->data.fail.m = buffer;
-  return p;
+      for (j = 0; j < p->data.or.n; j++) {
+        if (mpc_parse_rec(i, p->data.or.xs[j], &results[j], e, depth+1)) {
+          MPC_SUCCESS(results[j].output;
+            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+        } else {
+          *e = mpc_err_merge(i, *e, results[j].error);
+        }
+      }
 
-}
+      MPC_FAILURE(NULL;
+        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
 
-mpc_parser_t *mpc_lift_val(mpc_val_t *x) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_LIFT_VAL;
-  p->data.lift.x = x;
-  return p;
-}
+    case MPC_TYPE_AND:
 
-mpc_parser_t *mpc_lift(mpc_ctor_t lf) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_LIFT;
-  p->data.lift.lf = lf;
-  return p;
-}
+      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+
+      results = p->data.or.n > MPC_PARSE_STACK_MIN
+        ? mpc_malloc(i, sizeof(mpc_result_t) * p->data.or.n)
+        : results_stk;
+
+      mpc_input_mark(i);
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_parse_rec(i, p->data.and.xs[j], &results[j], e, depth+1)) {
+          mpc_input_rewind(i);
+          for (k = 0; k < j; k++) {
+            mpc_parse_dtor(i, p->data.and.dxs[k], results[k].output);
+          }
+          MPC_FAILURE(results[j].error;
+            if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+        }
+      }
+      mpc_input_unmark(i);
+      MPC_SUCCESS(
+        mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
+        if (p->data.or.n > MPC_PARSE_STACK_MIN) { mpc_free(i, results); });
+
+    /* End */
+
+    default:
+
+      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+  }
+
+  return 0;
 
-mpc_parser_t *mpc_anchor(int(*f)(char,char)) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_ANCHOR;
-  p->data.anchor.f = f;
-  return mpc_expect(p, "anchor");
 }
 
-mpc_parser_t *mpc_state(void) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_STATE;
-  return p;
+static int mpc_parse_rec(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth) {
+  int x;
+  if (i->profile == NULL) { return mpc_parse_node(i, p, r, e, depth); }
+  mpc_profile_enter(i, p);
+  x = mpc_parse_node(i, p, r, e, depth);
+  mpc_profile_leave(i, x);
+  return x;
 }
 
-mpc_parser_t *mpc_expect(mpc_parser_t *a, const char *expected) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_EXPECT;
-  p->data.expect.x = a;
-  p->data.expect.m = malloc(strlen(expected) + 1);
-  strcpy(p->data.expect.m, expected);
-  return p;
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+  return mpc_parse_rec(i, p, r, e, 0);
 }
 
+#else
+
 /*
-** As `snprintf` is not ANSI standard this
-** function `mpc_expectf` should be considered
-** unsafe.
-**
-** You have a few options if this is going to be
-** trouble.
-**
-** - Ensure the format string does not exceed
-**   the buffer length using precision specifiers
-**   such as `%.512s`.
-**
-** - Patch this function in your code base to
-**   use `snprintf` or whatever variant your
-**   system supports.
+** Iterative Engine
 **
-** - Avoid it altogether.
+** Rather than recursing in C the engine keeps its own
+** stack of frames which grows in the arena, so how deeply
+** the input nests is only limited by memory. A stack that
+** has grown is kept for the next parse of the same input. A frame is
+** pushed for each combinator while its children run.
+** When a parser finishes its result is left in `ok` and
+** `ret` and the frame on top of the stack resumes with
+** it. Primitives finish straight away without a frame.
 **
+** Define MPC_RECURSIVE to build the recursive engine.
 */
 
-mpc_parser_t *mpc_expectf(mpc_parser_t *a, const char *fmt, ...) {
-  va_list va;
-  char *buffer;
-
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_EXPECT;
+enum {
+  MPC_PARSE_FRAMES_MIN = 32
+};
 
-  va_start(va, fmt);
-  buffer = malloc(2048);
-  vsprintf(buffer, fmt, va);
-  va_end(va);
+typedef struct {
+  int type;
+  int j;
+  mpc_parser_t *p;
+  int slots;
+  mpc_result_t *results;
+  mpc_result_t results_stk[MPC_PARSE_STACK_MIN];
+  mpc_apply_t cf;
+  mpc_dtor_t df;
+  mpc_err_t *e;
+  mpc_memo_key_t k;
+  int *alts;
+  int alts_num;
+  long pos;
+} mpc_frame_t;
 
-  buffer = realloc(buffer, strlen(buffer) + 1);
-  p->data.expect.x = a;
-  p->data.expect.m = buffer;
-  return p;
+static mpc_frame_t *mpc_frame_grow(mpc_input_t *i, mpc_frame_t *frames, int slots) {
+  mpc_frame_t *f = mpc_arena_alloc(i, sizeof(mpc_frame_t) * slots * 2);
+  memcpy(f, frames, sizeof(mpc_frame_t) * slots);
+  i->frames = f;
+  i->frames_slots = slots * 2;
+  return f;
 }
 
-/*
-** Basic Parsers
-*/
-
-mpc_parser_t *mpc_any(void) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_ANY;
-  return mpc_expect(p, "any character");
-}
+#undef MPC_SUCCESS
+#undef MPC_FAILURE
+#undef MPC_PRIMITIVE
 
-mpc_parser_t *mpc_char(char c) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_SINGLE;
-  p->data.single.x = c;
-  return mpc_expectf(p, "'%c'", c);
-}
+#define MPC_SUCCESS(x) ret.output = x; ok = 1; goto done
+#define MPC_FAILURE(x) ret.error = x; ok = 0; goto done
+#define MPC_PRIMITIVE(x) \
+  if (x) { ok = 1; } \
+  else { ret.error = NULL; ok = 0; } \
+  goto done
+#define MPC_PUSH() \
+  if (++top == slots) { \
+    frames = mpc_frame_grow(i, frames, slots); \
+    slots = slots * 2; \
+  } \
+  f = &frames[top]; \
+  f->type = p->type; \
+  f->j = 0; \
+  f->p = p; \
+  f->slots = MPC_PARSE_STACK_MIN; \
+  f->results = NULL
+#define MPC_CALL(x) p = x; goto call
+#define MPC_RESULTS(f) ((f)->results ? (f)->results : (f)->results_stk)
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e) {
+
+  mpc_frame_t frames_stk[MPC_PARSE_FRAMES_MIN];
+  mpc_frame_t *frames = i->frames ? i->frames : frames_stk;
+  mpc_frame_t *f;
+  int top = -1, slots = i->frames ? i->frames_slots : MPC_PARSE_FRAMES_MIN;
+
+  mpc_result_t ret, *results;
+  mpc_err_t *merged;
+  mpc_parser_t *x;
+  mpc_apply_t cf;
+  mpc_dtor_t df;
+  mpc_memo_key_t k;
+  int ok, j, n;
+
+  ret.output = NULL;
+
+call:
+
+  if (i->profile) { mpc_profile_enter(i, p); }
+
+  /* In a packrat parse every named parser is memoised */
+  if (i->memo_all && p->retained && p != i->memo_skip) {
+    x = p; cf = i->memo_copy; df = i->memo_dtor;
+    goto memo;
+  }
+  i->memo_skip = NULL;
 
-mpc_parser_t *mpc_range(char s, char e) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_RANGE;
-  p->data.range.x = s;
-  p->data.range.y = e;
-  return mpc_expectf(p, "character between '%c' and '%c'", s, e);
-}
+  switch (p->type) {
 
-mpc_parser_t *mpc_oneof(const char *s) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "one of '%s'", s);
-}
+    /* Basic Parsers */
 
-mpc_parser_t *mpc_noneof(const char *s) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "none of '%s'", s);
+    case MPC_TYPE_ANY:     MPC_PRIMITIVE(mpc_input_any(i, (char**)&ret.output));
+    case MPC_TYPE_SINGLE:  MPC_PRIMITIVE(mpc_input_char(i, p->data.single.x, (char**)&ret.output));
+    case MPC_TYPE_RANGE:   MPC_PRIMITIVE(mpc_input_range(i, p->data.range.x, p->data.range.y, (char**)&ret.output));
+    case MPC_TYPE_ONEOF:   MPC_PRIMITIVE(mpc_input_class(i, p->data.cls.c, (char**)&ret.output));
+    case MPC_TYPE_NONEOF:  MPC_PRIMITIVE(mpc_input_class(i, p->data.cls.c, (char**)&ret.output));
+    case MPC_TYPE_SATISFY: MPC_PRIMITIVE(mpc_input_satisfy(i, p->data.satisfy.f, (char**)&ret.output));
+    case MPC_TYPE_STRING:  MPC_PRIMITIVE(mpc_input_string(i, p->data.string.x, (char**)&ret.output));
+    case MPC_TYPE_ANCHOR:  MPC_PRIMITIVE(mpc_input_anchor(i, p->data.anchor.f, (char**)&ret.output));
+    case MPC_TYPE_SOI:     MPC_PRIMITIVE(mpc_input_soi(i, (char**)&ret.output));
+    case MPC_TYPE_EOI:     MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&ret.output));
+    case MPC_TYPE_DFA:
+      if (i->backtrack < 1) {
+        /* So the combinators are run in place of `p` */
+        if (i->profile) { i->profile_stk[i->profile_num-1].tail = 1; }
+        MPC_CALL(p->data.dfa.x);
+      }
+      ok = mpc_parse_dfa(i, p->data.dfa.d, &ret, e);
+      goto done;
+    case MPC_TYPE_SPAN:    ok = mpc_parse_span(i, &p->data.span, &ret, e); goto done;
+    case MPC_TYPE_MEMO:
+      x = p->data.memo.x; cf = p->data.memo.cf; df = p->data.memo.df;
+      goto memo;
 
-}
+    /* Other parsers */
 
-mpc_parser_t *mpc_satisfy(int(*f)(char)) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_SATISFY;
-  p->data.satisfy.f = f;
-  return mpc_expectf(p, "character satisfying function %p", f);
-}
+    case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i, "Parser Undefined!"));
+    case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
+    case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i, p->data.fail.m));
+    case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
+    case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
+    case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_input_state_copy(i));
 
-mpc_parser_t *mpc_string(const char *s) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_STRING;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "\"%s\"", s);
-}
+    /* Application Parsers */
 
-/*
-** Core Parsers
-*/
+    case MPC_TYPE_APPLY:      MPC_PUSH(); MPC_CALL(p->data.apply.x);
+    case MPC_TYPE_APPLY_TO:   MPC_PUSH(); MPC_CALL(p->data.apply_to.x);
+    case MPC_TYPE_CHECK:      MPC_PUSH(); MPC_CALL(p->data.check.x);
+    case MPC_TYPE_CHECK_WITH: MPC_PUSH(); MPC_CALL(p->data.check_with.x);
 
-mpc_parser_t *mpc_apply(mpc_parser_t *a, mpc_apply_t f) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_APPLY;
-  p->data.apply.x = a;
-  p->data.apply.f = f;
-  return p;
-}
+    case MPC_TYPE_EXPECT:
+      mpc_input_suppress_enable(i);
+      MPC_PUSH(); MPC_CALL(p->data.expect.x);
 
-mpc_parser_t *mpc_apply_to(mpc_parser_t *a, mpc_apply_to_t f, void *x) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_APPLY_TO;
-  p->data.apply_to.x = a;
-  p->data.apply_to.f = f;
-  p->data.apply_to.d = x;
-  return p;
-}
+    case MPC_TYPE_PREDICT:
+      mpc_input_backtrack_disable(i);
+      MPC_PUSH(); MPC_CALL(p->data.predict.x);
 
-mpc_parser_t *mpc_check(mpc_parser_t *a, mpc_dtor_t da, mpc_check_t f, const char *e) {
-  mpc_parser_t  *p = mpc_undefined();
-  p->type = MPC_TYPE_CHECK;
-  p->data.check.x = a;
-  p->data.check.dx = da;
-  p->data.check.f = f;
-  p->data.check.e = malloc(strlen(e) + 1);
-  strcpy(p->data.check.e, e);
-  return p;
-}
+    /* Optional Parsers */
 
-mpc_parser_t *mpc_check_with(mpc_parser_t *a, mpc_dtor_t da, mpc_check_with_t f, void *x, const char *e) {
-  mpc_parser_t  *p = mpc_undefined();
-  p->type = MPC_TYPE_CHECK_WITH;
-  p->data.check_with.x = a;
-  p->data.check_with.dx = da;
-  p->data.check_with.f = f;
-  p->data.check_with.d = x;
-  p->data.check_with.e = malloc(strlen(e) + 1);
-  strcpy(p->data.check_with.e, e);
-  return p;
-}
+    case MPC_TYPE_NOT:
+      mpc_input_mark(i);
+      mpc_input_suppress_enable(i);
+      MPC_PUSH(); MPC_CALL(p->data.not.x);
 
-mpc_parser_t *mpc_checkf(mpc_parser_t *a, mpc_dtor_t da, mpc_check_t f, const char *fmt, ...) {
-  va_list va;
-  char *buffer;
-  mpc_parser_t *p;
+    case MPC_TYPE_MAYBE:
+      MPC_PUSH(); MPC_CALL(p->data.not.x);
 
-  va_start(va, fmt);
-  buffer = malloc(2048);
-  vsprintf(buffer, fmt, va);
-  va_end(va);
+    /* Repeat Parsers */
 
-  p = mpc_check(a, da, f, buffer);
-  free(buffer);
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      MPC_PUSH(); MPC_CALL(p->data.repeat.x);
 
-  return p;
-}
+    case MPC_TYPE_COUNT:
+      MPC_PUSH();
+      if (p->data.repeat.n > MPC_PARSE_STACK_MIN) {
+        f->results = mpc_malloc(i, sizeof(mpc_result_t) * p->data.repeat.n);
+      }
+      MPC_CALL(p->data.repeat.x);
 
-mpc_parser_t *mpc_check_withf(mpc_parser_t *a, mpc_dtor_t da, mpc_check_with_t f, void *x, const char *fmt, ...) {
-  va_list va;
-  char *buffer;
-  mpc_parser_t *p;
+    /* Combinatory Parsers */
 
-  va_start(va, fmt);
-  buffer = malloc(2048);
-  vsprintf(buffer, fmt, va);
-  va_end(va);
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
+      MPC_PUSH();
+      f->alts = NULL;
+      if (mpc_dispatch_find(i, p->data.or.d, &f->alts, &f->alts_num)) {
+        if (f->alts_num == 0) { top--; MPC_FAILURE(NULL); }
+        f->pos = i->state.pos;
+        f->e = *e;
+        *e = NULL;
+        MPC_CALL(p->data.or.xs[f->alts[0]]);
+      }
+      MPC_CALL(p->data.or.xs[0]);
 
-  p = mpc_check_with(a, da, f, x, buffer);
-  free(buffer);
+    case MPC_TYPE_AND:
+      if (p->data.and.n == 0) { MPC_SUCCESS(NULL); }
+      MPC_PUSH();
+      if (p->data.and.n > MPC_PARSE_STACK_MIN) {
+        f->results = mpc_malloc(i, sizeof(mpc_result_t) * p->data.and.n);
+      }
+      mpc_input_mark(i);
+      MPC_CALL(p->data.and.xs[0]);
 
-  return p;
-}
+    /* End */
 
-mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_PREDICT;
-  p->data.predict.x = a;
-  return p;
-}
+    default:
 
-mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_NOT;
-  p->data.not.x = a;
-  p->data.not.dx = da;
-  p->data.not.lf = lf;
-  return p;
-}
+      MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
+  }
 
-mpc_parser_t *mpc_not(mpc_parser_t *a, mpc_dtor_t da) {
-  return mpc_not_lift(a, da, mpcf_ctor_null);
-}
+memo:
 
-mpc_parser_t *mpc_maybe_lift(mpc_parser_t *a, mpc_ctor_t lf) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_MAYBE;
-  p->data.not.x = a;
-  p->data.not.lf = lf;
-  return p;
-}
+  /* Other inputs can't jump ahead to the end of a result */
+  if (i->type != MPC_INPUT_STRING) {
+    /* So `x` is run in place of `p`, which finishes with it */
+    if (i->profile) { i->profile_stk[i->profile_num-1].tail = 1; }
+    i->memo_skip = x;
+    MPC_CALL(x);
+  }
 
-mpc_parser_t *mpc_maybe(mpc_parser_t *a) {
-  return mpc_maybe_lift(a, mpcf_ctor_null);
-}
+  if (mpc_memo_find(i, p, cf, &k, &ret, e, &ok)) { goto done; }
 
-mpc_parser_t *mpc_many(mpc_fold_t f, mpc_parser_t *a) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_MANY;
-  p->data.repeat.x = a;
-  p->data.repeat.f = f;
-  return p;
-}
+  MPC_PUSH();
+  f->type = MPC_TYPE_MEMO;
+  f->cf = cf;
+  f->df = df;
+  f->k = k;
+  f->e = *e;
+  *e = NULL;
+  i->memo_skip = x;
+  MPC_CALL(x);
 
-mpc_parser_t *mpc_many1(mpc_fold_t f, mpc_parser_t *a) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_MANY1;
-  p->data.repeat.x = a;
-  p->data.repeat.f = f;
-  return p;
-}
+done:
 
-mpc_parser_t *mpc_count(int n, mpc_fold_t f, mpc_parser_t *a, mpc_dtor_t da) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_COUNT;
-  p->data.repeat.n = n;
-  p->data.repeat.f = f;
-  p->data.repeat.x = a;
-  p->data.repeat.dx = da;
-  return p;
-}
+  if (i->profile) { mpc_profile_leave(i, ok); }
 
-mpc_parser_t *mpc_or(int n, ...) {
+  if (top < 0) {
+    *r = ret;
+    return ok;
+  }
 
-  int i;
-  va_list va;
+  f = &frames[top];
+  p = f->p;
 
-  mpc_parser_t *p = mpc_undefined();
+  switch (f->type) {
 
-  p->type = MPC_TYPE_OR;
-  p->data.or.n = n;
-  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+    case MPC_TYPE_MEMO:
+      top--;
+      merged = *e;
+      *e = f->e;
+      mpc_memo_store(i, p, f->cf, f->df, &f->k, ok, &ret, merged);
+      *e = mpc_err_merge(i, *e, merged);
+      goto done;
 
-  va_start(va, n);
-  for (i = 0; i < n; i++) {
-    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
-  }
-  va_end(va);
+    /* Application Parsers */
 
-  return p;
-}
+    case MPC_TYPE_APPLY:
+      top--;
+      if (ok) { MPC_SUCCESS(mpc_parse_apply(i, p->data.apply.f, ret.output)); }
+      goto done;
 
-mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...) {
+    case MPC_TYPE_APPLY_TO:
+      top--;
+      if (ok) { MPC_SUCCESS(mpc_parse_apply_to(i, p->data.apply_to.f, ret.output, p->data.apply_to.d)); }
+      goto done;
 
-  int i;
-  va_list va;
+    case MPC_TYPE_CHECK:
+      top--;
+      if (!ok || p->data.check.f(&ret.output)) { goto done; }
+      mpc_parse_dtor(i, p->data.check.dx, ret.output);
+      MPC_FAILURE(mpc_err_fail(i, p->data.check.e));
 
-  mpc_parser_t *p = mpc_undefined();
+    case MPC_TYPE_CHECK_WITH:
+      top--;
+      if (!ok || p->data.check_with.f(&ret.output, p->data.check_with.d)) { goto done; }
+      mpc_parse_dtor(i, p->data.check_with.dx, ret.output);
+      MPC_FAILURE(mpc_err_fail(i, p->data.check_with.e));
 
-  p->type = MPC_TYPE_AND;
-  p->data.and.n = n;
-  p->data.and.f = f;
-  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
-  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
+    case MPC_TYPE_EXPECT:
+      top--;
+      mpc_input_suppress_disable(i);
+      if (ok) { goto done; }
+      MPC_FAILURE(mpc_err_new(i, p->data.expect.m));
 
-  va_start(va, f);
-  for (i = 0; i < n; i++) {
-    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
-  }
-  for (i = 0; i < (n-1); i++) {
-    p->data.and.dxs[i] = va_arg(va, mpc_dtor_t);
-  }
-  va_end(va);
+    case MPC_TYPE_PREDICT:
+      top--;
+      mpc_input_backtrack_enable(i);
+      goto done;
 
-  return p;
-}
+    /* Optional Parsers */
 
-/*
-** Common Parsers
-*/
+    case MPC_TYPE_NOT:
+      top--;
+      if (ok) {
+        mpc_input_rewind(i);
+        mpc_input_suppress_disable(i);
+        mpc_parse_dtor(i, p->data.not.dx, ret.output);
+        MPC_FAILURE(mpc_err_new(i, "opposite"));
+      } else {
+        mpc_input_unmark(i);
+        mpc_input_suppress_disable(i);
+        MPC_SUCCESS(p->data.not.lf());
+      }
 
-mpc_parser_t *mpc_soi(void) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_SOI;
-  return mpc_expect(p, "start of input");
-}
+    case MPC_TYPE_MAYBE:
+      top--;
+      if (ok) { goto done; }
+      *e = mpc_err_merge(i, *e, ret.error);
+      MPC_SUCCESS(p->data.not.lf());
 
-mpc_parser_t *mpc_eoi(void) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_EOI;
-  return mpc_expect(p, "end of input");
-}
+    /* Repeat Parsers */
 
-static int mpc_boundary_anchor(char prev, char next) {
-  const char* word = "abcdefghijklmnopqrstuvwxyz"
-                     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-                     "0123456789_";
-  if ( strchr(word, next) &&  prev == '\0') { return 1; }
-  if ( strchr(word, prev) &&  next == '\0') { return 1; }
-  if ( strchr(word, next) && !strchr(word, prev)) { return 1; }
-  if (!strchr(word, next) &&  strchr(word, prev)) { return 1; }
-  return 0;
-}
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
 
-static int mpc_boundary_newline_anchor(char prev, char next) {
-  (void)next;
-  return prev == '\n';
-}
+      results = MPC_RESULTS(f);
+      results[f->j] = ret;
 
-mpc_parser_t *mpc_boundary(void) { return mpc_expect(mpc_anchor(mpc_boundary_anchor), "word boundary"); }
-mpc_parser_t *mpc_boundary_newline(void) { return mpc_expect(mpc_anchor(mpc_boundary_newline_anchor), "start of newline"); }
+      if (ok) {
+        j = ++f->j;
+        if (j == MPC_PARSE_STACK_MIN) {
+          f->slots = j + j / 2;
+          f->results = mpc_malloc(i, sizeof(mpc_result_t) * f->slots);
+          memcpy(f->results, f->results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
+        } else if (j >= f->slots) {
+          f->slots = j + j / 2;
+          f->results = mpc_realloc(i, f->results, sizeof(mpc_result_t) * f->slots);
+        }
+        MPC_CALL(p->data.repeat.x);
+      }
 
-mpc_parser_t *mpc_whitespace(void) { return mpc_expect(mpc_oneof(" \f\n\r\t\v"), "whitespace"); }
-mpc_parser_t *mpc_whitespaces(void) { return mpc_expect(mpc_many(mpcf_strfold, mpc_whitespace()), "spaces"); }
-mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_apply(mpc_whitespaces(), mpcf_free), "whitespace"); }
+      top--;
+      j = f->j;
 
-mpc_parser_t *mpc_newline(void) { return mpc_expect(mpc_char('\n'), "newline"); }
-mpc_parser_t *mpc_tab(void) { return mpc_expect(mpc_char('\t'), "tab"); }
-mpc_parser_t *mpc_escape(void) { return mpc_and(2, mpcf_strfold, mpc_char('\\'), mpc_any(), free); }
+      if (j == 0 && f->type == MPC_TYPE_MANY1) {
+        ret.error = mpc_err_many1(i, results[j].error);
+      } else {
+        *e = mpc_err_merge(i, *e, results[j].error);
+        ret.output = mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
+        ok = 1;
+      }
 
-mpc_parser_t *mpc_digit(void) { return mpc_expect(mpc_oneof("0123456789"), "digit"); }
-mpc_parser_t *mpc_hexdigit(void) { return mpc_expect(mpc_oneof("0123456789ABCDEFabcdef"), "hex digit"); }
-mpc_parser_t *mpc_octdigit(void) { return mpc_expect(mpc_oneof("01234567"), "oct digit"); }
-mpc_parser_t *mpc_digits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_digit()), "digits"); }
-mpc_parser_t *mpc_hexdigits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_hexdigit()), "hex digits"); }
-mpc_parser_t *mpc_octdigits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_octdigit()), "oct digits"); }
+      if (f->results) { mpc_free(i, f->results); }
+      goto done;
 
-mpc_parser_t *mpc_lower(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyz"), "lowercase letter"); }
-mpc_parser_t *mpc_upper(void) { return mpc_expect(mpc_oneof("ABCDEFGHIJKLMNOPQRSTUVWXYZ"), "uppercase letter"); }
-mpc_parser_t *mpc_alpha(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"), "letter"); }
-mpc_parser_t *mpc_underscore(void) { return mpc_expect(mpc_char('_'), "underscore"); }
-mpc_parser_t *mpc_alphanum(void) { return mpc_expect(mpc_or(3, mpc_alpha(), mpc_digit(), mpc_underscore()), "alphanumeric"); }
+    case MPC_TYPE_COUNT:
 
-mpc_parser_t *mpc_int(void) { return mpc_expect(mpc_apply(mpc_digits(), mpcf_int), "integer"); }
-mpc_parser_t *mpc_hex(void) { return mpc_expect(mpc_apply(mpc_hexdigits(), mpcf_hex), "hexadecimal"); }
-mpc_parser_t *mpc_oct(void) { return mpc_expect(mpc_apply(mpc_octdigits(), mpcf_oct), "octadecimal"); }
-mpc_parser_t *mpc_number(void) { return mpc_expect(mpc_or(3, mpc_int(), mpc_hex(), mpc_oct()), "number"); }
+      results = MPC_RESULTS(f);
+      results[f->j] = ret;
 
-mpc_parser_t *mpc_real(void) {
+      if (ok && ++f->j < p->data.repeat.n) { MPC_CALL(p->data.repeat.x); }
 
-  /* [+-]?\d+(\.\d+)?([eE][+-]?[0-9]+)? */
+      top--;
+      j = f->j;
 
-  mpc_parser_t *p0, *p1, *p2, *p30, *p31, *p32, *p3;
+      if (ok) {
+        ret.output = mpc_parse_fold(i, p->data.repeat.f, j, (mpc_val_t**)results);
+      } else {
+        for (n = 0; n < j; n++) {
+          mpc_parse_dtor(i, p->data.repeat.dx, results[n].output);
+        }
+        ret.error = mpc_err_count(i, results[j].error, p->data.repeat.n);
+      }
 
-  p0 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
-  p1 = mpc_digits();
-  p2 = mpc_maybe_lift(mpc_and(2, mpcf_strfold, mpc_char('.'), mpc_digits(), free), mpcf_ctor_str);
-  p30 = mpc_oneof("eE");
-  p31 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
-  p32 = mpc_digits();
-  p3 = mpc_maybe_lift(mpc_and(3, mpcf_strfold, p30, p31, p32, free, free), mpcf_ctor_str);
+      if (f->results) { mpc_free(i, f->results); }
+      goto done;
 
-  return mpc_expect(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free), "real");
+    /* Combinatory Parsers */
 
-}
+    case MPC_TYPE_OR:
 
-mpc_parser_t *mpc_float(void) {
-  return mpc_expect(mpc_apply(mpc_real(), mpcf_float), "float");
-}
+      if (f->alts) {
+        if (!ok) {
+          *e = mpc_err_merge(i, *e, ret.error);
+          if (++f->j < f->alts_num) { MPC_CALL(p->data.or.xs[f->alts[f->j]]); }
+        }
+        merged = *e;
+        *e = f->e;
+        if (!ok && mpc_dispatch_rerun(i, f->pos, merged)) {
+          mpc_err_delete_internal(i, merged);
+          f->alts = NULL;
+          f->j = 0;
+          MPC_CALL(p->data.or.xs[0]);
+        }
+        top--;
+        if (merged) { *e = mpc_err_merge(i, *e, merged); }
+        if (ok) { goto done; }
+        MPC_FAILURE(NULL);
+      }
 
-mpc_parser_t *mpc_char_lit(void) {
-  return mpc_expect(mpc_between(mpc_or(2, mpc_escape(), mpc_any()), free, "'", "'"), "char");
-}
+      if (ok) { top--; goto done; }
 
-mpc_parser_t *mpc_string_lit(void) {
-  mpc_parser_t *strchar = mpc_or(2, mpc_escape(), mpc_noneof("\""));
-  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, strchar), free, "\"", "\""), "string");
-}
+      *e = mpc_err_merge(i, *e, ret.error);
+      if (++f->j < p->data.or.n) { MPC_CALL(p->data.or.xs[f->j]); }
 
-mpc_parser_t *mpc_regex_lit(void) {
-  mpc_parser_t *regexchar = mpc_or(2, mpc_escape(), mpc_noneof("/"));
-  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, regexchar), free, "/", "/"), "regex");
-}
+      top--;
+      MPC_FAILURE(NULL);
 
-mpc_parser_t *mpc_ident(void) {
-  mpc_parser_t *p0, *p1;
-  p0 = mpc_or(2, mpc_alpha(), mpc_underscore());
-  p1 = mpc_many(mpcf_strfold, mpc_alphanum());
-  return mpc_and(2, mpcf_strfold, p0, p1, free);
-}
+    case MPC_TYPE_AND:
 
-/*
-** Useful Parsers
-*/
+      results = MPC_RESULTS(f);
+      results[f->j] = ret;
 
-mpc_parser_t *mpc_startwith(mpc_parser_t *a) { return mpc_and(2, mpcf_snd, mpc_soi(), a, mpcf_dtor_null); }
-mpc_parser_t *mpc_endwith(mpc_parser_t *a, mpc_dtor_t da) { return mpc_and(2, mpcf_fst, a, mpc_eoi(), da); }
-mpc_parser_t *mpc_whole(mpc_parser_t *a, mpc_dtor_t da) { return mpc_and(3, mpcf_snd, mpc_soi(), a, mpc_eoi(), mpcf_dtor_null, da); }
+      if (ok && ++f->j < p->data.and.n) { MPC_CALL(p->data.and.xs[f->j]); }
 
-mpc_parser_t *mpc_stripl(mpc_parser_t *a) { return mpc_and(2, mpcf_snd, mpc_blank(), a, mpcf_dtor_null); }
-mpc_parser_t *mpc_stripr(mpc_parser_t *a) { return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null); }
-mpc_parser_t *mpc_strip(mpc_parser_t *a) { return mpc_and(3, mpcf_snd, mpc_blank(), a, mpc_blank(), mpcf_dtor_null, mpcf_dtor_null); }
-mpc_parser_t *mpc_tok(mpc_parser_t *a) { return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null); }
-mpc_parser_t *mpc_sym(const char *s) { return mpc_tok(mpc_string(s)); }
+      top--;
+      j = f->j;
 
-mpc_parser_t *mpc_total(mpc_parser_t *a, mpc_dtor_t da) { return mpc_whole(mpc_strip(a), da); }
+      if (ok) {
+        mpc_input_unmark(i);
+        ret.output = mpc_parse_fold(i, p->data.and.f, j, (mpc_val_t**)results);
+      } else {
+        mpc_input_rewind(i);
+        for (n = 0; n < j; n++) {
+          mpc_parse_dtor(i, p->data.and.dxs[n], results[n].output);
+        }
+      }
 
-mpc_parser_t *mpc_between(mpc_parser_t *a, mpc_dtor_t ad, const char *o, const char *c) {
-  return mpc_and(3, mpcf_snd_free,
-    mpc_string(o), a, mpc_string(c),
-    free, ad);
-}
+      if (f->results) { mpc_free(i, f->results); }
+      goto done;
 
-mpc_parser_t *mpc_parens(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_between(a, ad, "(", ")"); }
-mpc_parser_t *mpc_braces(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_between(a, ad, "<", ">"); }
-mpc_parser_t *mpc_brackets(mpc_parser_t *a, mpc_dtor_t ad) { return mpc_between(a, ad, "{", "}"); }
-mpc_parser_t *mpc_squares(mpc_parser_t *a, mpc_dtor_t ad)  { return mpc_between(a, ad, "[", "]"); }
+  }
+
+  MPC_FAILURE(mpc_err_fail(i, "Unknown Parser Type Id!"));
 
-mpc_parser_t *mpc_tok_between(mpc_parser_t *a, mpc_dtor_t ad, const char *o, const char *c) {
-  return mpc_and(3, mpcf_snd_free,
-    mpc_sym(o), mpc_tok(a), mpc_sym(c),
-    free, ad);
 }
 
-mpc_parser_t *mpc_tok_parens(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_tok_between(a, ad, "(", ")"); }
-mpc_parser_t *mpc_tok_braces(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_tok_between(a, ad, "<", ">"); }
-mpc_parser_t *mpc_tok_brackets(mpc_parser_t *a, mpc_dtor_t ad) { return mpc_tok_between(a, ad, "{", "}"); }
-mpc_parser_t *mpc_tok_squares(mpc_parser_t *a, mpc_dtor_t ad)  { return mpc_tok_between(a, ad, "[", "]"); }
+#undef MPC_PUSH
+#undef MPC_CALL
+#undef MPC_RESULTS
 
-/*
-** Regular Expression Parsers
-*/
+#endif
 
-/*
-** So here is a cute bootstrapping.
-**
-** I'm using the previously defined
-** mpc constructs and functions to
-** parse the user regex string and
-** construct a parser from it.
-**
-** As it turns out lots of the standard
-** mpc functions look a lot like `fold`
-** functions and so can be used indirectly
-** by many of the parsing functions to build
-** a parser directly - as we are parsing.
-**
-** This is certainly something that
-** would be less elegant/interesting
-** in a two-phase parser which first
-** builds an AST and then traverses it
-** to generate the object.
-**
-** This whole thing acts as a great
-** case study for how trivial it can be
-** to write a great parser in a few
-** lines of code using mpc.
-*/
+#undef MPC_SUCCESS
+#undef MPC_FAILURE
+#undef MPC_PRIMITIVE
+
+static int mpc_parse_input_errors(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
+  e->state = mpc_state_invalid();
+  i->overflow = 0;
+  x = mpc_parse_run(i, p, r, &e);
+  if (x) {
+    mpc_err_delete_internal(i, e);
+    r->output = mpc_export(i, r->output);
+  } else if (i->overflow) {
+    mpc_err_delete_internal(i, mpc_err_merge(i, e, r->error));
+    r->error = mpc_err_export(i, mpc_err_fail(i, "Maximum recursion depth exceeded!"));
+  } else {
+    r->error = mpc_err_export(i, mpc_err_merge(i, e, r->error));
+    if (i->lazy) { mpc_input_locate(i, &r->error->state); }
+  }
+  return x;
+}
 
 /*
-**
-**  ### Regular Expression Grammar
-**
-**      <regex> : <term> | (<term> "|" <regex>)
-**
-**      <term> : <factor>*
-**
-**      <factor> : <base>
-**               | <base> "*"
-**               | <base> "+"
-**               | <base> "?"
-**               | <base> "{" <digits> "}"
-**
-**      <base> : <char>
-**             | "\" <char>
-**             | "(" <regex> ")"
-**             | "[" <range> "]"
+** Errors are only wanted when the parse fails, and most
+** of those made along the way are thrown out once some
+** later alternative succeeds. So a string is first parsed
+** with errors suppressed, which doesn't make any at all.
+** If that fails the input is put back where it started
+** and parsed again making errors, which gives the same
+** error as ever. Other inputs can't always be put back
+** so they make errors as they go.
 */
 
-static mpc_val_t *mpcf_re_or(int n, mpc_val_t **xs) {
-  (void) n;
-  if (xs[1] == NULL) { return xs[0]; }
-  else { return mpc_or(2, xs[0], xs[1]); }
-}
+int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r) {
 
-static mpc_val_t *mpcf_re_and(int n, mpc_val_t **xs) {
-  int i;
-  mpc_parser_t *p = mpc_lift(mpcf_ctor_str);
-  for (i = 0; i < n; i++) {
-    p = mpc_and(2, mpcf_strfold, p, xs[i], free);
-  }
-  return p;
-}
+  mpc_state_t start = i->state;
+  char last = i->last;
+  mpc_err_t *e = NULL;
+  int x;
 
-static mpc_val_t *mpcf_re_repeat(int n, mpc_val_t **xs) {
-  int num;
-  (void) n;
-  if (xs[1] == NULL) { return xs[0]; }
-  switch(((char*)xs[1])[0])
-  {
-    case '*': { free(xs[1]); return mpc_many(mpcf_strfold, xs[0]); }; break;
-    case '+': { free(xs[1]); return mpc_many1(mpcf_strfold, xs[0]); }; break;
-    case '?': { free(xs[1]); return mpc_maybe_lift(xs[0], mpcf_ctor_str); }; break;
-    default:
-      num = *(int*)xs[1];
-      free(xs[1]);
+  if (i->type != MPC_INPUT_STRING) { return mpc_parse_input_errors(i, p, r); }
+
+  mpc_input_suppress_enable(i);
+  i->overflow = 0;
+  x = mpc_parse_run(i, p, r, &e);
+  mpc_input_suppress_disable(i);
+
+  if (x) {
+    r->output = mpc_export(i, r->output);
+    return 1;
   }
 
-  return mpc_count(num, mpcf_strfold, xs[0], free);
+  i->state = start;
+  i->last = last;
+  return mpc_parse_input_errors(i, p, r);
 }
 
-static mpc_parser_t *mpc_re_escape_char(char c) {
-  switch (c) {
-    case 'a': return mpc_char('\a');
-    case 'f': return mpc_char('\f');
-    case 'n': return mpc_char('\n');
-    case 'r': return mpc_char('\r');
-    case 't': return mpc_char('\t');
-    case 'v': return mpc_char('\v');
-    case 'b': return mpc_and(2, mpcf_snd, mpc_boundary(), mpc_lift(mpcf_ctor_str), free);
-    case 'B': return mpc_not_lift(mpc_boundary(), free, mpcf_ctor_str);
-    case 'A': return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
-    case 'Z': return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free);
-    case 'd': return mpc_digit();
-    case 'D': return mpc_not_lift(mpc_digit(), free, mpcf_ctor_str);
-    case 's': return mpc_whitespace();
-    case 'S': return mpc_not_lift(mpc_whitespace(), free, mpcf_ctor_str);
-    case 'w': return mpc_alphanum();
-    case 'W': return mpc_not_lift(mpc_alphanum(), free, mpcf_ctor_str);
-    default: return NULL;
-  }
+int mpc_parse(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
-static mpc_val_t *mpcf_re_escape(mpc_val_t *x, void* data) {
+int mpc_nparse(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_nstring(filename, string, length);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
 
-  int mode = *((int*)data);
-  char *s = x;
-  mpc_parser_t *p;
+int mpc_parse_borrowed(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_nparse_borrowed(filename, string, strlen(string), p, r);
+}
 
-  /* Any Character */
-  if (s[0] == '.') {
-    free(s);
-    if (mode & MPC_RE_DOTALL) {
-      return mpc_any();
-    } else {
-      return mpc_expect(mpc_noneof("\n"), "any character except a newline");
-    }
-  }
+int mpc_nparse_borrowed(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_borrowed(filename, string, length);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
 
-  /* Start of Input */
-  if (s[0] == '^') {
-    free(s);
-    if (mode & MPC_RE_MULTILINE) {
-      return mpc_and(2, mpcf_snd, mpc_or(2, mpc_soi(), mpc_boundary_newline()), mpc_lift(mpcf_ctor_str), free);
-    } else {
-      return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
-    }
-  }
+int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_file(filename, file);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
+}
 
-  /* End of Input */
-  if (s[0] == '$') {
-    free(s);
-    if (mode & MPC_RE_MULTILINE) {
-      return mpc_or(2,
-        mpc_newline(),
-        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
-    } else {
-      return mpc_or(2,
-        mpc_and(2, mpcf_fst, mpc_newline(), mpc_eoi(), free),
-        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
-    }
-  }
-
-  /* Regex Escape */
-  if (s[0] == '\\') {
-    p = mpc_re_escape_char(s[1]);
-    p = (p == NULL) ? mpc_char(s[1]) : p;
-    free(s);
-    return p;
-  }
-
-  /* Regex Standard */
-  p = mpc_char(s[0]);
-  free(s);
-  return p;
+int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r) {
+  int x;
+  mpc_input_t *i = mpc_input_new_pipe(filename, pipe);
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
-static const char *mpc_re_range_escape_char(char c) {
-  switch (c) {
-    case '-': return "-";
-    case 'a': return "\a";
-    case 'f': return "\f";
-    case 'n': return "\n";
-    case 'r': return "\r";
-    case 't': return "\t";
-    case 'v': return "\v";
-    case 'b': return "\b";
-    case 'd': return "0123456789";
-    case 's': return " \f\n\r\t\v";
-    case 'w': return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
-    default: return NULL;
-  }
+int mpc_parse_packrat(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_apply_t cf, mpc_dtor_t df) {
+  int x;
+  mpc_input_t *i = mpc_input_new_string(filename, string);
+  i->memo_all = 1;
+  i->memo_copy = cf;
+  i->memo_dtor = df;
+  x = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
+  return x;
 }
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
-
-  mpc_parser_t *out;
-  size_t i, j;
-  size_t start, end;
-  const char *tmp = NULL;
-  const char *s = x;
-  int comp = s[0] == '^' ? 1 : 0;
-  char *range = calloc(1,1);
-
-  if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
-  if (s[0] == '^' &&
-      s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
+  return mpc_parse_contents_with(filename, p, r, NULL);
+}
 
-  for (i = comp; i < strlen(s); i++){
+static int mpc_parse_input_with(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, const mpc_parse_opts_t *o) {
+  int x;
+  if (o && o->pool_size > 0) { i->mem_num = o->pool_size; }
+  if (o && o->flags & MPC_PARSE_AST_ARENA) { i->ast = mpc_ast_arena_new(); }
+  if (o && o->flags & MPC_PARSE_LAZY_POSITIONS) { i->lazy = i->type == MPC_INPUT_STRING; }
+  i->profile = o ? o->profile : NULL;
+  x = mpc_parse_input(i, p, r);
+  if (x && i->ast) { r->output = mpc_input_ast_finish(i, r->output, 1); }
+  if (o && o->stats) { *o->stats = i->stats; }
+  mpc_input_delete(i);
+  return x;
+}
 
-    /* Regex Range Escape */
-    if (s[i] == '\\') {
-      tmp = mpc_re_range_escape_char(s[i+1]);
-      if (tmp != NULL) {
-        range = realloc(range, strlen(range) + strlen(tmp) + 1);
-        strcat(range, tmp);
-      } else {
-        range = realloc(range, strlen(range) + 1 + 1);
-        range[strlen(range) + 1] = '\0';
-        range[strlen(range) + 0] = s[i+1];
-      }
-      i++;
-    }
+int mpc_parse_with(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, const mpc_parse_opts_t *o) {
+  mpc_input_t *i = o && o->flags & MPC_PARSE_BORROWED
+    ? mpc_input_new_borrowed(filename, string, strlen(string))
+    : mpc_input_new_string(filename, string);
+  return mpc_parse_input_with(i, p, r, o);
+}
 
-    /* Regex Range...Range */
-    else if (s[i] == '-') {
-      if (s[i+1] == '\0' || i == 0) {
-          range = realloc(range, strlen(range) + strlen("-") + 1);
-          strcat(range, "-");
-      } else {
-        start = s[i-1]+1;
-        end = s[i+1]-1;
-        for (j = start; j <= end; j++) {
-          range = realloc(range, strlen(range) + 1 + 1 + 1);
-          range[strlen(range) + 1] = '\0';
-          range[strlen(range) + 0] = (char)j;
-        }
-      }
-    }
+static mpc_input_t *mpc_input_open_contents(const char *filename, mpc_result_t *r) {
 
-    /* Regex Range Normal */
-    else {
-      range = realloc(range, strlen(range) + 1 + 1);
-      range[strlen(range) + 1] = '\0';
-      range[strlen(range) + 0] = s[i];
-    }
+  FILE *f = fopen(filename, "rb");
+  mpc_input_t *i;
 
+  if (f == NULL) {
+    r->output = NULL;
+    r->error = mpc_err_file(filename, "Unable to open file!");
+    return NULL;
   }
 
-  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
+  i = mpc_input_new_contents(filename, f);
+  fclose(f);
 
-  free(x);
-  free(range);
+  if (i == NULL) {
+    r->output = NULL;
+    r->error = mpc_err_file(filename, "Unable to read file!");
+    return NULL;
+  }
 
-  return out;
+  return i;
 }
 
-mpc_parser_t *mpc_re(const char *re) {
-  return mpc_re_mode(re, MPC_RE_DEFAULT);
+int mpc_parse_contents_with(const char *filename, mpc_parser_t *p, mpc_result_t *r, const mpc_parse_opts_t *o) {
+  mpc_input_t *i = mpc_input_open_contents(filename, r);
+  if (i == NULL) { return 0; }
+  return mpc_parse_input_with(i, p, r, o);
 }
 
-mpc_parser_t *mpc_re_mode(const char *re, int mode) {
-
-  char *err_msg;
-  mpc_parser_t *err_out;
-  mpc_result_t r;
-  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose;
+/*
+** Streams
+*/
 
-  Regex  = mpc_new("regex");
-  Term   = mpc_new("term");
-  Factor = mpc_new("factor");
-  Base   = mpc_new("base");
-  Range  = mpc_new("range");
+struct mpc_stream_t {
+  mpc_input_t *input;
+};
 
-  mpc_define(Regex, mpc_and(2, mpcf_re_or,
-    Term,
-    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
-    (mpc_dtor_t)mpc_delete
-  ));
+mpc_stream_t *mpc_stream_contents(const char *filename, mpc_result_t *r) {
+  mpc_stream_t *s;
+  mpc_input_t *i = mpc_input_open_contents(filename, r);
+  if (i == NULL) { return NULL; }
+  s = malloc(sizeof(mpc_stream_t));
+  s->input = i;
+  return s;
+}
 
-  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
+mpc_stream_t *mpc_stream_pipe(const char *filename, FILE *pipe) {
+  mpc_stream_t *s = malloc(sizeof(mpc_stream_t));
+  s->input = mpc_input_new_pipe(filename, pipe);
+  return s;
+}
 
-  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
-    Base,
-    mpc_or(5,
-      mpc_char('*'), mpc_char('+'), mpc_char('?'),
-      mpc_brackets(mpc_int(), free),
-      mpc_pass()),
-    (mpc_dtor_t)mpc_delete
-  ));
+int mpc_stream_next(mpc_stream_t *s, mpc_parser_t *p, mpc_result_t *r, const mpc_parse_opts_t *o) {
 
-  mpc_define(Base, mpc_or(4,
-    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
-    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
-    mpc_apply_to(mpc_escape(), mpcf_re_escape, &mode),
-    mpc_apply_to(mpc_noneof(")|"), mpcf_re_escape, &mode)
-  ));
+  mpc_input_t *i = s->input;
+  int x, j;
 
-  mpc_define(Range, mpc_apply(
-    mpc_many(mpcf_strfold, mpc_or(2, mpc_escape(), mpc_noneof("]"))),
-    mpcf_re_range
-  ));
+  if (o && o->pool_size > 0 && i->mem == NULL) { i->mem_num = o->pool_size; }
+  if (o && o->flags & MPC_PARSE_AST_ARENA) { i->ast = mpc_ast_arena_new(); }
+  i->lazy = o && o->flags & MPC_PARSE_LAZY_POSITIONS && i->type == MPC_INPUT_STRING;
+  i->profile = o ? o->profile : NULL;
 
-  RegexEnclose = mpc_whole(mpc_predictive(Regex), (mpc_dtor_t)mpc_delete);
+  x = mpc_parse_input(i, p, r);
 
-  mpc_optimise(RegexEnclose);
-  mpc_optimise(Regex);
-  mpc_optimise(Term);
-  mpc_optimise(Factor);
-  mpc_optimise(Base);
-  mpc_optimise(Range);
+  /* The next call may not be lazy so the position is kept whole */
+  if (i->lazy) { mpc_input_locate(i, &i->state); }
 
-  if(!mpc_parse("<mpc_re_compiler>", re, RegexEnclose, &r)) {
-    err_msg = mpc_err_string(r.error);
-    err_out = mpc_failf("Invalid Regex: %s", err_msg);
-    mpc_err_delete(r.error);
-    free(err_msg);
-    r.output = err_out;
+  if (i->ast) {
+    if (x) { r->output = mpc_input_ast_finish(i, r->output, 0); }
+    /* Memoised results may be in this arena, and won't be used again */
+    if (i->memo) {
+      for (j = 0; j < MPC_MEMO_SLOTS; j++) { mpc_memo_clear(&i->memo[j]); }
+    }
+    if (i->ast) { mpc_ast_arena_delete(i->ast); }
+    i->ast = NULL;
   }
 
-  mpc_cleanup(6, RegexEnclose, Regex, Term, Factor, Base, Range);
-
-  mpc_optimise(r.output);
+  if (o && o->stats) { *o->stats = i->stats; }
+  return x;
+}
 
-  return r.output;
+int mpc_stream_eoi(mpc_stream_t *s) {
+  return mpc_input_terminated(s->input);
+}
 
+void mpc_stream_delete(mpc_stream_t *s) {
+  mpc_input_delete(s->input);
+  free(s);
 }
 
 /*
-** Common Fold Functions
+** Building a Parser
 */
 
-void mpcf_dtor_null(mpc_val_t *x) { (void) x; return; }
-
-mpc_val_t *mpcf_ctor_null(void) { return NULL; }
-mpc_val_t *mpcf_ctor_str(void) { return calloc(1, 1); }
-mpc_val_t *mpcf_free(mpc_val_t *x) { free(x); return NULL; }
+static void mpc_undefine_unretained(mpc_parser_t *p, int force);
 
-mpc_val_t *mpcf_int(mpc_val_t *x) {
-  int *y = malloc(sizeof(int));
-  *y = strtol(x, NULL, 10);
-  free(x);
-  return y;
+static char **mpc_dfa_strs_copy(char **xs, int n) {
+  int j;
+  char **ys;
+  if (n <= 0) { return NULL; }
+  ys = malloc(sizeof(char*) * n);
+  for (j = 0; j < n; j++) {
+    ys[j] = malloc(strlen(xs[j]) + 1);
+    strcpy(ys[j], xs[j]);
+  }
+  return ys;
 }
 
-mpc_val_t *mpcf_hex(mpc_val_t *x) {
-  int *y = malloc(sizeof(int));
-  *y = strtol(x, NULL, 16);
-  free(x);
-  return y;
+static void mpc_dfa_strs_delete(char **xs, int n) {
+  int j;
+  for (j = 0; j < n; j++) { free(xs[j]); }
+  free(xs);
 }
 
-mpc_val_t *mpcf_oct(mpc_val_t *x) {
-  int *y = malloc(sizeof(int));
-  *y = strtol(x, NULL, 8);
-  free(x);
-  return y;
+static void mpc_dfa_delete(mpc_dfa_t *d) {
+  int j;
+  for (j = 0; j < d->states_num; j++) {
+    mpc_dfa_strs_delete(d->states[j].merged, d->states[j].merged_num);
+    mpc_dfa_strs_delete(d->states[j].failed, d->states[j].failed_num);
+  }
+  free(d->states);
+  free(d->next);
+  free(d);
 }
 
-mpc_val_t *mpcf_float(mpc_val_t *x) {
-  float *y = malloc(sizeof(float));
-  *y = strtod(x, NULL);
-  free(x);
-  return y;
+static mpc_dfa_t *mpc_dfa_copy(mpc_dfa_t *a) {
+  int j;
+  mpc_dfa_t *d = malloc(sizeof(mpc_dfa_t));
+  d->states_num = a->states_num;
+  d->next = malloc(sizeof(short) * 256 * a->states_num);
+  memcpy(d->next, a->next, sizeof(short) * 256 * a->states_num);
+  d->states = malloc(sizeof(mpc_dfa_state_t) * a->states_num);
+  for (j = 0; j < a->states_num; j++) {
+    d->states[j] = a->states[j];
+    d->states[j].merged = mpc_dfa_strs_copy(a->states[j].merged, a->states[j].merged_num);
+    d->states[j].failed = mpc_dfa_strs_copy(a->states[j].failed, a->states[j].failed_num);
+  }
+  return d;
 }
 
-mpc_val_t *mpcf_strtriml(mpc_val_t *x) {
-  char *s = x;
-  while (isspace((unsigned char)*s)) {
-    memmove(s, s+1, strlen(s));
+static void mpc_undefine_or(mpc_parser_t *p) {
+
+  int i;
+  for (i = 0; i < p->data.or.n; i++) {
+    mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
-  return s;
+  free(p->data.or.xs);
+  mpc_dispatch_delete(p->data.or.d);
+
 }
 
-mpc_val_t *mpcf_strtrimr(mpc_val_t *x) {
-  char *s = x;
-  size_t l = strlen(s);
-  while (l > 0 && isspace((unsigned char)s[l-1])) {
-    s[l-1] = '\0'; l--;
+static void mpc_undefine_and(mpc_parser_t *p) {
+
+  int i;
+  for (i = 0; i < p->data.and.n; i++) {
+    mpc_undefine_unretained(p->data.and.xs[i], 0);
   }
-  return s;
-}
+  free(p->data.and.xs);
+  free(p->data.and.dxs);
 
-mpc_val_t *mpcf_strtrim(mpc_val_t *x) {
-  return mpcf_strtriml(mpcf_strtrimr(x));
 }
 
-static const char mpc_escape_input_c[]  = {
-  '\a', '\b', '\f', '\n', '\r',
-  '\t', '\v', '\\', '\'', '\"', '\0'};
+static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
 
-static const char *mpc_escape_output_c[] = {
-  "\\a", "\\b", "\\f", "\\n", "\\r", "\\t",
-  "\\v", "\\\\", "\\'", "\\\"", "\\0", NULL};
+  if (p->retained && !force) { return; }
 
-static const char mpc_escape_input_raw_re[] = { '/' };
-static const char *mpc_escape_output_raw_re[] = { "\\/", NULL };
-
-static const char mpc_escape_input_raw_cstr[] = { '"' };
-static const char *mpc_escape_output_raw_cstr[] = { "\\\"", NULL };
-
-static const char mpc_escape_input_raw_cchar[] = { '\'' };
-static const char *mpc_escape_output_raw_cchar[] = { "\\'", NULL };
-
-static mpc_val_t *mpcf_escape_new(mpc_val_t *x, const char *input, const char **output) {
-
-  int i;
-  int found;
-  char buff[2];
-  char *s = x;
-  char *y = calloc(1, 1);
+  switch (p->type) {
 
-  while (*s) {
+    case MPC_TYPE_FAIL: free(p->data.fail.m); break;
 
-    i = 0;
-    found = 0;
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      free(p->data.cls.x);
+      free(p->data.cls.c);
+      break;
 
-    while (output[i]) {
-      if (*s == input[i]) {
-        y = realloc(y, strlen(y) + strlen(output[i]) + 1);
-        strcat(y, output[i]);
-        found = 1;
-        break;
-      }
-      i++;
-    }
+    case MPC_TYPE_STRING:
+      free(p->data.string.x);
+      break;
 
-    if (!found) {
-      y = realloc(y, strlen(y) + 2);
-      buff[0] = *s; buff[1] = '\0';
-      strcat(y, buff);
-    }
+    case MPC_TYPE_APPLY:    mpc_undefine_unretained(p->data.apply.x, 0);    break;
+    case MPC_TYPE_APPLY_TO: mpc_undefine_unretained(p->data.apply_to.x, 0); break;
+    case MPC_TYPE_PREDICT:  mpc_undefine_unretained(p->data.predict.x, 0);  break;
 
-    s++;
-  }
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_NOT:
+      mpc_undefine_unretained(p->data.not.x, 0);
+      break;
 
+    case MPC_TYPE_EXPECT:
+      mpc_undefine_unretained(p->data.expect.x, 0);
+      free(p->data.expect.m);
+      break;
 
-  return y;
-}
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_undefine_unretained(p->data.repeat.x, 0);
+      break;
 
-static mpc_val_t *mpcf_unescape_new(mpc_val_t *x, const char *input, const char **output) {
+    case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
+    case MPC_TYPE_AND: mpc_undefine_and(p); break;
 
-  int i;
-  int found = 0;
-  char buff[2];
-  char *s = x;
-  char *y = calloc(1, 1);
+    case MPC_TYPE_CHECK:
+      mpc_undefine_unretained(p->data.check.x, 0);
+      free(p->data.check.e);
+      break;
 
-  while (*s) {
+    case MPC_TYPE_CHECK_WITH:
+      mpc_undefine_unretained(p->data.check_with.x, 0);
+      free(p->data.check_with.e);
+      break;
 
-    i = 0;
-    found = 0;
+    case MPC_TYPE_DFA:
+      mpc_undefine_unretained(p->data.dfa.x, 0);
+      mpc_dfa_delete(p->data.dfa.d);
+      break;
 
-    while (output[i]) {
-      if ((*(s+0)) == output[i][0] &&
-          (*(s+1)) == output[i][1]) {
-        y = realloc(y, strlen(y) + 1 + 1);
-        buff[0] = input[i]; buff[1] = '\0';
-        strcat(y, buff);
-        found = 1;
-        s++;
-        break;
-      }
-      i++;
-    }
+    case MPC_TYPE_SPAN:
+      mpc_undefine_unretained(p->data.span.x, 0);
+      free(p->data.span.c);
+      break;
 
-    if (!found) {
-      y = realloc(y, strlen(y) + 1 + 1);
-      buff[0] = *s; buff[1] = '\0';
-      strcat(y, buff);
-    }
+    case MPC_TYPE_MEMO: mpc_undefine_unretained(p->data.memo.x, 0); break;
 
-    if (*s == '\0') { break; }
-    else { s++; }
+    default: break;
   }
 
-  return y;
+  if (!force) {
+    free(p->name);
+    free(p);
+  }
 
 }
 
-mpc_val_t *mpcf_escape(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_c, mpc_escape_output_c);
-  free(x);
-  return y;
-}
+void mpc_delete(mpc_parser_t *p) {
+  if (p->retained) {
 
-mpc_val_t *mpcf_unescape(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_c, mpc_escape_output_c);
-  free(x);
-  return y;
-}
+    if (p->type != MPC_TYPE_UNDEFINED) {
+      mpc_undefine_unretained(p, 0);
+    }
 
-mpc_val_t *mpcf_escape_regex(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_re, mpc_escape_output_raw_re);
-  free(x);
-  return y;
-}
+    free(p->name);
+    free(p);
 
-mpc_val_t *mpcf_unescape_regex(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_re, mpc_escape_output_raw_re);
-  free(x);
-  return y;
+  } else {
+    mpc_undefine_unretained(p, 0);
+  }
 }
 
-mpc_val_t *mpcf_escape_string_raw(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_cstr, mpc_escape_output_raw_cstr);
-  free(x);
-  return y;
+static void mpc_soft_delete(mpc_val_t *x) {
+  mpc_undefine_unretained(x, 0);
 }
 
-mpc_val_t *mpcf_unescape_string_raw(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_cstr, mpc_escape_output_raw_cstr);
-  free(x);
-  return y;
+static mpc_parser_t *mpc_undefined(void) {
+  mpc_parser_t *p = calloc(1, sizeof(mpc_parser_t));
+  p->retained = 0;
+  p->type = MPC_TYPE_UNDEFINED;
+  p->name = NULL;
+  p->id = -1;
+  return p;
 }
 
-mpc_val_t *mpcf_escape_char_raw(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_cchar, mpc_escape_output_raw_cchar);
-  free(x);
-  return y;
+mpc_parser_t *mpc_new(const char *name) {
+  mpc_parser_t *p = mpc_undefined();
+  p->retained = 1;
+  p->name = realloc(p->name, strlen(name) + 1);
+  strcpy(p->name, name);
+  return p;
 }
 
-mpc_val_t *mpcf_unescape_char_raw(mpc_val_t *x) {
-  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_cchar, mpc_escape_output_raw_cchar);
-  free(x);
-  return y;
-}
+mpc_parser_t *mpc_copy(mpc_parser_t *a) {
+  int i = 0;
+  mpc_parser_t *p;
 
-mpc_val_t *mpcf_null(int n, mpc_val_t** xs) { (void) n; (void) xs; return NULL; }
-mpc_val_t *mpcf_fst(int n, mpc_val_t **xs) { (void) n; return xs[0]; }
-mpc_val_t *mpcf_snd(int n, mpc_val_t **xs) { (void) n; return xs[1]; }
-mpc_val_t *mpcf_trd(int n, mpc_val_t **xs) { (void) n; return xs[2]; }
+  if (a->retained) { return a; }
 
-static mpc_val_t *mpcf_nth_free(int n, mpc_val_t **xs, int x) {
-  int i;
-  for (i = 0; i < n; i++) {
-    if (i != x) { free(xs[i]); }
-  }
-  return xs[x];
-}
+  p = mpc_undefined();
+  p->retained = a->retained;
+  p->type = a->type;
+  p->data = a->data;
 
-mpc_val_t *mpcf_fst_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 0); }
-mpc_val_t *mpcf_snd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 1); }
-mpc_val_t *mpcf_trd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 2); }
-mpc_val_t *mpcf_all_free(int n, mpc_val_t** xs) {
-  int i;
-  for (i = 0; i < n; i++) {
-    free(xs[i]);
+  if (a->name) {
+    p->name = malloc(strlen(a->name)+1);
+    strcpy(p->name, a->name);
   }
-  return NULL;
-}
-
-mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
-  int i;
-  size_t l = 0;
-
-  if (n == 0) { return calloc(1, 1); }
 
-  for (i = 0; i < n; i++) { l += strlen(xs[i]); }
+  switch (a->type) {
 
-  xs[0] = realloc(xs[0], l + 1);
+    case MPC_TYPE_FAIL:
+      p->data.fail.m = malloc(strlen(a->data.fail.m)+1);
+      strcpy(p->data.fail.m, a->data.fail.m);
+    break;
 
-  for (i = 1; i < n; i++) {
-    strcat(xs[0], xs[i]); free(xs[i]);
-  }
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      p->data.cls.x = malloc(strlen(a->data.cls.x)+1);
+      strcpy(p->data.cls.x, a->data.cls.x);
+      p->data.cls.c = mpc_class_copy(a->data.cls.c);
+      break;
 
-  return xs[0];
-}
+    case MPC_TYPE_STRING:
+      p->data.string.x = malloc(strlen(a->data.string.x)+1);
+      strcpy(p->data.string.x, a->data.string.x);
+      break;
 
-mpc_val_t *mpcf_maths(int n, mpc_val_t **xs) {
-  int **vs = (int**)xs;
-  (void) n;
+    case MPC_TYPE_APPLY:    p->data.apply.x    = mpc_copy(a->data.apply.x);    break;
+    case MPC_TYPE_APPLY_TO: p->data.apply_to.x = mpc_copy(a->data.apply_to.x); break;
+    case MPC_TYPE_PREDICT:  p->data.predict.x  = mpc_copy(a->data.predict.x);  break;
 
-  switch(((char*)xs[1])[0])
-  {
-    case '*': { *vs[0] *= *vs[2]; }; break;
-    case '/': { *vs[0] /= *vs[2]; }; break;
-    case '%': { *vs[0] %= *vs[2]; }; break;
-    case '+': { *vs[0] += *vs[2]; }; break;
-    case '-': { *vs[0] -= *vs[2]; }; break;
-    default: break;
-  }
+    case MPC_TYPE_MAYBE:
+    case MPC_TYPE_NOT:
+      p->data.not.x = mpc_copy(a->data.not.x);
+      break;
 
-  free(xs[1]); free(xs[2]);
+    case MPC_TYPE_EXPECT:
+      p->data.expect.x = mpc_copy(a->data.expect.x);
+      p->data.expect.m = malloc(strlen(a->data.expect.m)+1);
+      strcpy(p->data.expect.m, a->data.expect.m);
+      break;
 
-  return xs[0];
-}
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      p->data.repeat.x = mpc_copy(a->data.repeat.x);
+      break;
 
-/*
-** Printing
-*/
+    case MPC_TYPE_OR:
+      p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
+      for (i = 0; i < a->data.or.n; i++) {
+        p->data.or.xs[i] = mpc_copy(a->data.or.xs[i]);
+      }
+      p->data.or.d = mpc_dispatch_copy(a->data.or.d);
+    break;
+    case MPC_TYPE_AND:
+      p->data.and.xs = malloc(a->data.and.n * sizeof(mpc_parser_t*));
+      for (i = 0; i < a->data.and.n; i++) {
+        p->data.and.xs[i] = mpc_copy(a->data.and.xs[i]);
+      }
+      p->data.and.dxs = malloc((a->data.and.n-1) * sizeof(mpc_dtor_t));
+      for (i = 0; i < a->data.and.n-1; i++) {
+        p->data.and.dxs[i] = a->data.and.dxs[i];
+      }
+    break;
 
-static void mpc_print_unretained(mpc_parser_t *p, int force) {
+    case MPC_TYPE_CHECK:
+      p->data.check.x      = mpc_copy(a->data.check.x);
+      p->data.check.e      = malloc(strlen(a->data.check.e)+1);
+      strcpy(p->data.check.e, a->data.check.e);
+      break;
+    case MPC_TYPE_CHECK_WITH:
+      p->data.check_with.x = mpc_copy(a->data.check_with.x);
+      p->data.check_with.e = malloc(strlen(a->data.check_with.e)+1);
+      strcpy(p->data.check_with.e, a->data.check_with.e);
+      break;
 
-  /* TODO: Print Everything Escaped */
+    case MPC_TYPE_DFA:
+      p->data.dfa.x = mpc_copy(a->data.dfa.x);
+      p->data.dfa.d = mpc_dfa_copy(a->data.dfa.d);
+      break;
 
-  int i;
-  char *s, *e;
-  char buff[2];
+    case MPC_TYPE_SPAN:
+      p->data.span.x = mpc_copy(a->data.span.x);
+      p->data.span.c = mpc_class_copy(a->data.span.c);
+      break;
 
-  if (p->retained && !force) {;
-    if (p->name) { printf("<%s>", p->name); }
-    else { printf("<anon>"); }
-    return;
-  }
+    case MPC_TYPE_MEMO: p->data.memo.x = mpc_copy(a->data.memo.x); break;
 
-  if (p->type == MPC_TYPE_UNDEFINED) { printf("<?>"); }
-  if (p->type == MPC_TYPE_PASS)   { printf("<:>"); }
-  if (p->type == MPC_TYPE_FAIL)   { printf("<!>"); }
-  if (p->type == MPC_TYPE_LIFT)   { printf("<#>"); }
-  if (p->type == MPC_TYPE_STATE)  { printf("<S>"); }
-  if (p->type == MPC_TYPE_ANCHOR) { printf("<@>"); }
-  if (p->type == MPC_TYPE_EXPECT) {
-    printf("%s", p->data.expect.m);
-    /*mpc_print_unretained(p->data.expect.x, 0);*/
+    default: break;
   }
 
-  if (p->type == MPC_TYPE_ANY) { printf("<.>"); }
-  if (p->type == MPC_TYPE_SATISFY) { printf("<f>"); }
-
-  if (p->type == MPC_TYPE_SINGLE) {
-    buff[0] = p->data.single.x; buff[1] = '\0';
-    s = mpcf_escape_new(
-      buff,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("'%s'", s);
-    free(s);
-  }
 
-  if (p->type == MPC_TYPE_RANGE) {
-    buff[0] = p->data.range.x; buff[1] = '\0';
-    s = mpcf_escape_new(
-      buff,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    buff[0] = p->data.range.y; buff[1] = '\0';
-    e = mpcf_escape_new(
-      buff,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("[%s-%s]", s, e);
-    free(s);
-    free(e);
-  }
+  return p;
+}
 
-  if (p->type == MPC_TYPE_ONEOF) {
-    s = mpcf_escape_new(
-      p->data.string.x,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("[%s]", s);
-    free(s);
-  }
+mpc_parser_t *mpc_undefine(mpc_parser_t *p) {
+  mpc_undefine_unretained(p, 1);
+  p->type = MPC_TYPE_UNDEFINED;
+  return p;
+}
 
-  if (p->type == MPC_TYPE_NONEOF) {
-    s = mpcf_escape_new(
-      p->data.string.x,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("[^%s]", s);
-    free(s);
-  }
+mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
 
-  if (p->type == MPC_TYPE_STRING) {
-    s = mpcf_escape_new(
-      p->data.string.x,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("\"%s\"", s);
-    free(s);
+  if (p->retained) {
+    p->type = a->type;
+    p->data = a->data;
+  } else {
+    mpc_parser_t *a2 = mpc_failf("Attempt to assign to Unretained Parser!");
+    p->type = a2->type;
+    p->data = a2->data;
+    free(a2);
   }
 
-  if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
-  if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
-  if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
-
-  if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
-  if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
-
-  if (p->type == MPC_TYPE_MANY)  { mpc_print_unretained(p->data.repeat.x, 0); printf("*"); }
-  if (p->type == MPC_TYPE_MANY1) { mpc_print_unretained(p->data.repeat.x, 0); printf("+"); }
-  if (p->type == MPC_TYPE_COUNT) { mpc_print_unretained(p->data.repeat.x, 0); printf("{%i}", p->data.repeat.n); }
-
-  if (p->type == MPC_TYPE_OR) {
-    printf("(");
-    for(i = 0; i < p->data.or.n-1; i++) {
-      mpc_print_unretained(p->data.or.xs[i], 0);
-      printf(" | ");
-    }
-    mpc_print_unretained(p->data.or.xs[p->data.or.n-1], 0);
-    printf(")");
-  }
+  free(a);
+  return p;
+}
 
-  if (p->type == MPC_TYPE_AND) {
-    printf("(");
-    for(i = 0; i < p->data.and.n-1; i++) {
-      mpc_print_unretained(p->data.and.xs[i], 0);
-      printf(" ");
-    }
-    mpc_print_unretained(p->data.and.xs[p->data.and.n-1], 0);
-    printf(")");
-  }
+void mpc_cleanup(int n, ...) {
+  int i;
+  mpc_parser_t **list = malloc(sizeof(mpc_parser_t*) * n);
 
-  if (p->type == MPC_TYPE_CHECK) {
-    mpc_print_unretained(p->data.check.x, 0);
-    printf("->?");
-  }
-  if (p->type == MPC_TYPE_CHECK_WITH) {
-    mpc_print_unretained(p->data.check_with.x, 0);
-    printf("->?");
-  }
+  va_list va;
+  va_start(va, n);
+  for (i = 0; i < n; i++) { list[i] = va_arg(va, mpc_parser_t*); }
+  for (i = 0; i < n; i++) { mpc_undefine(list[i]); }
+  for (i = 0; i < n; i++) { mpc_delete(list[i]); }
+  va_end(va);
 
+  free(list);
 }
 
-void mpc_print(mpc_parser_t *p) {
-  mpc_print_unretained(p, 1);
-  printf("\n");
+mpc_parser_t *mpc_pass(void) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PASS;
+  return p;
 }
 
-/*
-** Testing
-*/
+mpc_parser_t *mpc_fail(const char *m) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_FAIL;
+  p->data.fail.m = malloc(strlen(m) + 1);
+  strcpy(p->data.fail.m, m);
+  return p;
+}
 
 /*
-** These functions are slightly unwieldy and
-** also the whole of the testing suite for mpc
-** mpc is pretty shaky.
+** As `snprintf` is not ANSI standard this
+** function `mpc_failf` should be considered
+** unsafe.
 **
-** It could do with a lot more tests and more
-** precision. Currently I am only really testing
-** changes off of the examples.
+** You have a few options if this is going to be
+** trouble.
+**
+** - Ensure the format string does not exceed
+**   the buffer length using precision specifiers
+**   such as `%.512s`.
+**
+** - Patch this function in your code base to
+**   use `snprintf` or whatever variant your
+**   system supports.
+**
+** - Avoid it altogether.
 **
 */
 
-int mpc_test_fail(mpc_parser_t *p, const char *s, const void *d,
-  int(*tester)(const void*, const void*),
-  mpc_dtor_t destructor,
-  void(*printer)(const void*)) {
-  mpc_result_t r;
-  (void) printer;
-  if (mpc_parse("<test>", s, p, &r)) {
+mpc_parser_t *mpc_failf(const char *fmt, ...) {
 
-    if (tester(r.output, d)) {
-      destructor(r.output);
-      return 0;
-    } else {
-      destructor(r.output);
-      return 1;
-    }
+  va_list va;
+  char *buffer;
 
-  } else {
-    mpc_err_delete(r.error);
-    return 1;
-  }
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_FAIL;
 
-}
+  va_start(va, fmt);
+  buffer = malloc(2048);
+  vsprintf(buffer, fmt, va);
+  va_end(va);
 
-int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
-  int(*tester)(const void*, const void*),
-  mpc_dtor_t destructor,
-  void(*printer)(const void*)) {
+  buffer = realloc(buffer, strlen(buffer) + 1);
+  p->data.fail.m = buffer;
+  return p;
 
-  mpc_result_t r;
-  if (mpc_parse("<test>", s, p, &r)) {
+}
 
-    if (tester(r.output, d)) {
-      destructor(r.output);
-      return 1;
-    } else {
-      printf("Got "); printer(r.output); printf("\n");
-      printf("Expected "); printer(d); printf("\n");
-      destructor(r.output);
-      return 0;
-    }
+mpc_parser_t *mpc_lift_val(mpc_val_t *x) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_LIFT_VAL;
+  p->data.lift.x = x;
+  return p;
+}
 
-  } else {
-    mpc_err_print(r.error);
-    mpc_err_delete(r.error);
-    return 0;
+mpc_parser_t *mpc_lift(mpc_ctor_t lf) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_LIFT;
+  p->data.lift.lf = lf;
+  return p;
+}
 
-  }
+mpc_parser_t *mpc_anchor(int(*f)(char,char)) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_ANCHOR;
+  p->data.anchor.f = f;
+  return mpc_expect(p, "anchor");
+}
 
+mpc_parser_t *mpc_state(void) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_STATE;
+  return p;
 }
 
+mpc_parser_t *mpc_expect(mpc_parser_t *a, const char *expected) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_EXPECT;
+  p->data.expect.x = a;
+  p->data.expect.m = malloc(strlen(expected) + 1);
+  strcpy(p->data.expect.m, expected);
+  return p;
+}
 
 /*
-** AST
+** As `snprintf` is not ANSI standard this
+** function `mpc_expectf` should be considered
+** unsafe.
+**
+** You have a few options if this is going to be
+** trouble.
+**
+** - Ensure the format string does not exceed
+**   the buffer length using precision specifiers
+**   such as `%.512s`.
+**
+** - Patch this function in your code base to
+**   use `snprintf` or whatever variant your
+**   system supports.
+**
+** - Avoid it altogether.
+**
 */
 
-void mpc_ast_delete(mpc_ast_t *a) {
-
-  int i;
-
-  if (a == NULL) { return; }
+mpc_parser_t *mpc_expectf(mpc_parser_t *a, const char *fmt, ...) {
+  va_list va;
+  char *buffer;
 
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_delete(a->children[i]);
-  }
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_EXPECT;
 
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
+  va_start(va, fmt);
+  buffer = malloc(2048);
+  vsprintf(buffer, fmt, va);
+  va_end(va);
 
+  buffer = realloc(buffer, strlen(buffer) + 1);
+  p->data.expect.x = a;
+  p->data.expect.m = buffer;
+  return p;
 }
 
-static void mpc_ast_delete_no_children(mpc_ast_t *a) {
-  free(a->children);
-  free(a->tag);
-  free(a->contents);
-  free(a);
-}
+/*
+** Basic Parsers
+*/
 
-mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
+/*
+** Control characters in what a parser expects are
+** written as C escapes, so an error naming them
+** stays on one line.
+*/
 
-  mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
+static const char mpc_escape_input_ctrl[] = {
+  '\a', '\b', '\f', '\n', '\r', '\t', '\v'};
 
-  a->tag = malloc(strlen(tag) + 1);
-  strcpy(a->tag, tag);
+static const char *mpc_escape_output_ctrl[] = {
+  "\\a", "\\b", "\\f", "\\n", "\\r", "\\t", "\\v", NULL};
 
-  a->contents = malloc(strlen(contents) + 1);
-  strcpy(a->contents, contents);
+static mpc_val_t *mpcf_escape_new(mpc_val_t *x, const char *input, const char **output);
 
-  a->state = mpc_state_new();
+static char *mpc_expect_escape(const char *s) {
+  return mpcf_escape_new((char*)s, mpc_escape_input_ctrl, mpc_escape_output_ctrl);
+}
 
-  a->children_num = 0;
-  a->children = NULL;
-  return a;
+static mpc_parser_t *mpc_expect_str(mpc_parser_t *p, const char *fmt, const char *s) {
+  char *e = mpc_expect_escape(s);
+  p = mpc_expectf(p, fmt, e);
+  free(e);
+  return p;
+}
 
+mpc_parser_t *mpc_any(void) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_ANY;
+  return mpc_expect(p, "any character");
 }
 
-mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
+mpc_parser_t *mpc_char(char c) {
+  char s[2];
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_SINGLE;
+  p->data.single.x = c;
+  s[0] = c; s[1] = '\0';
+  return mpc_expect_str(p, "'%s'", s);
+}
 
-  mpc_ast_t *a = mpc_ast_new(tag, "");
+mpc_parser_t *mpc_range(char s, char e) {
+  char xs[2], ys[2];
+  char *x, *y;
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_RANGE;
+  p->data.range.x = s;
+  p->data.range.y = e;
+  xs[0] = s; xs[1] = '\0';
+  ys[0] = e; ys[1] = '\0';
+  x = mpc_expect_escape(xs);
+  y = mpc_expect_escape(ys);
+  p = mpc_expectf(p, "character between '%s' and '%s'", x, y);
+  free(x);
+  free(y);
+  return p;
+}
 
-  int i;
-  va_list va;
-  va_start(va, tag);
+mpc_parser_t *mpc_oneof(const char *s) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_ONEOF;
+  p->data.cls.x = malloc(strlen(s) + 1);
+  strcpy(p->data.cls.x, s);
+  p->data.cls.c = mpc_class_new(mpc_class_oneof, s);
+  return mpc_expect_str(p, "one of '%s'", s);
+}
 
-  for (i = 0; i < n; i++) {
-    mpc_ast_add_child(a, va_arg(va, mpc_ast_t*));
-  }
+mpc_parser_t *mpc_noneof(const char *s) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_NONEOF;
+  p->data.cls.x = malloc(strlen(s) + 1);
+  strcpy(p->data.cls.x, s);
+  p->data.cls.c = mpc_class_new(mpc_class_noneof, s);
+  return mpc_expect_str(p, "none of '%s'", s);
 
-  va_end(va);
+}
 
-  return a;
+mpc_parser_t *mpc_satisfy(int(*f)(char)) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_SATISFY;
+  p->data.satisfy.f = f;
+  return mpc_expectf(p, "character satisfying function %p", f);
+}
 
+mpc_parser_t *mpc_string(const char *s) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_STRING;
+  p->data.string.x = malloc(strlen(s) + 1);
+  strcpy(p->data.string.x, s);
+  return mpc_expect_str(p, "\"%s\"", s);
 }
 
-mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
+/*
+** Core Parsers
+*/
 
-  mpc_ast_t *r;
+mpc_parser_t *mpc_apply(mpc_parser_t *a, mpc_apply_t f) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_APPLY;
+  p->data.apply.x = a;
+  p->data.apply.f = f;
+  return p;
+}
 
-  if (a == NULL) { return a; }
-  if (a->children_num == 0) { return a; }
-  if (a->children_num == 1) { return a; }
+mpc_parser_t *mpc_apply_to(mpc_parser_t *a, mpc_apply_to_t f, void *x) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_APPLY_TO;
+  p->data.apply_to.x = a;
+  p->data.apply_to.f = f;
+  p->data.apply_to.d = x;
+  return p;
+}
 
-  r = mpc_ast_new(">", "");
-  mpc_ast_add_child(r, a);
-  return r;
+mpc_parser_t *mpc_check(mpc_parser_t *a, mpc_dtor_t da, mpc_check_t f, const char *e) {
+  mpc_parser_t  *p = mpc_undefined();
+  p->type = MPC_TYPE_CHECK;
+  p->data.check.x = a;
+  p->data.check.dx = da;
+  p->data.check.f = f;
+  p->data.check.e = malloc(strlen(e) + 1);
+  strcpy(p->data.check.e, e);
+  return p;
 }
 
-int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
+mpc_parser_t *mpc_check_with(mpc_parser_t *a, mpc_dtor_t da, mpc_check_with_t f, void *x, const char *e) {
+  mpc_parser_t  *p = mpc_undefined();
+  p->type = MPC_TYPE_CHECK_WITH;
+  p->data.check_with.x = a;
+  p->data.check_with.dx = da;
+  p->data.check_with.f = f;
+  p->data.check_with.d = x;
+  p->data.check_with.e = malloc(strlen(e) + 1);
+  strcpy(p->data.check_with.e, e);
+  return p;
+}
 
-  int i;
+mpc_parser_t *mpc_checkf(mpc_parser_t *a, mpc_dtor_t da, mpc_check_t f, const char *fmt, ...) {
+  va_list va;
+  char *buffer;
+  mpc_parser_t *p;
 
-  if (strcmp(a->tag, b->tag) != 0) { return 0; }
-  if (strcmp(a->contents, b->contents) != 0) { return 0; }
-  if (a->children_num != b->children_num) { return 0; }
+  va_start(va, fmt);
+  buffer = malloc(2048);
+  vsprintf(buffer, fmt, va);
+  va_end(va);
 
-  for (i = 0; i < a->children_num; i++) {
-    if (!mpc_ast_eq(a->children[i], b->children[i])) { return 0; }
-  }
+  p = mpc_check(a, da, f, buffer);
+  free(buffer);
 
-  return 1;
+  return p;
 }
 
-mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
-  r->children_num++;
-  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
-  r->children[r->children_num-1] = a;
-  return r;
-}
+mpc_parser_t *mpc_check_withf(mpc_parser_t *a, mpc_dtor_t da, mpc_check_with_t f, void *x, const char *fmt, ...) {
+  va_list va;
+  char *buffer;
+  mpc_parser_t *p;
 
-mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
-  if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
-  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, strlen(t));
-  memmove(a->tag + strlen(t), "|", 1);
-  return a;
-}
+  va_start(va, fmt);
+  buffer = malloc(2048);
+  vsprintf(buffer, fmt, va);
+  va_end(va);
 
-mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
-  if (a == NULL) { return a; }
-  a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
-  memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
-  memmove(a->tag, t, (strlen(t)-1));
-  return a;
-}
+  p = mpc_check_with(a, da, f, x, buffer);
+  free(buffer);
 
-mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
-  a->tag = realloc(a->tag, strlen(t) + 1);
-  strcpy(a->tag, t);
-  return a;
+  return p;
 }
 
-mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
-  if (a == NULL) { return a; }
-  a->state = s;
-  return a;
+mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_PREDICT;
+  p->data.predict.x = a;
+  return p;
 }
 
-static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
+mpc_parser_t *mpc_memo(mpc_parser_t *a, mpc_apply_t cf, mpc_dtor_t df) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MEMO;
+  p->data.memo.x = a;
+  p->data.memo.cf = cf;
+  p->data.memo.df = df;
+  return p;
+}
 
-  int i;
-
-  if (a == NULL) {
-    fprintf(fp, "NULL\n");
-    return;
-  }
-
-  for (i = 0; i < d; i++) { fprintf(fp, "  "); }
+mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_NOT;
+  p->data.not.x = a;
+  p->data.not.dx = da;
+  p->data.not.lf = lf;
+  return p;
+}
 
-  if (strlen(a->contents)) {
-    fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag,
-      (long unsigned int)(a->state.row+1),
-      (long unsigned int)(a->state.col+1),
-      a->contents);
-  } else {
-    fprintf(fp, "%s \n", a->tag);
-  }
+mpc_parser_t *mpc_not(mpc_parser_t *a, mpc_dtor_t da) {
+  return mpc_not_lift(a, da, mpcf_ctor_null);
+}
 
-  for (i = 0; i < a->children_num; i++) {
-    mpc_ast_print_depth(a->children[i], d+1, fp);
-  }
+mpc_parser_t *mpc_maybe_lift(mpc_parser_t *a, mpc_ctor_t lf) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MAYBE;
+  p->data.not.x = a;
+  p->data.not.lf = lf;
+  return p;
+}
 
+mpc_parser_t *mpc_maybe(mpc_parser_t *a) {
+  return mpc_maybe_lift(a, mpcf_ctor_null);
 }
 
-void mpc_ast_print(mpc_ast_t *a) {
-  mpc_ast_print_depth(a, 0, stdout);
+mpc_parser_t *mpc_many(mpc_fold_t f, mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MANY;
+  p->data.repeat.x = a;
+  p->data.repeat.f = f;
+  return p;
 }
 
-void mpc_ast_print_to(mpc_ast_t *a, FILE *fp) {
-  mpc_ast_print_depth(a, 0, fp);
+mpc_parser_t *mpc_many1(mpc_fold_t f, mpc_parser_t *a) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MANY1;
+  p->data.repeat.x = a;
+  p->data.repeat.f = f;
+  return p;
 }
 
-int mpc_ast_get_index(mpc_ast_t *ast, const char *tag) {
-  return mpc_ast_get_index_lb(ast, tag, 0);
+mpc_parser_t *mpc_count(int n, mpc_fold_t f, mpc_parser_t *a, mpc_dtor_t da) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_COUNT;
+  p->data.repeat.n = n;
+  p->data.repeat.f = f;
+  p->data.repeat.x = a;
+  p->data.repeat.dx = da;
+  return p;
 }
 
-int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb) {
+mpc_parser_t *mpc_or(int n, ...) {
+
   int i;
+  va_list va;
 
-  for(i=lb; i<ast->children_num; i++) {
-    if(strcmp(ast->children[i]->tag, tag) == 0) {
-      return i;
-    }
+  mpc_parser_t *p = mpc_undefined();
+
+  p->type = MPC_TYPE_OR;
+  p->data.or.n = n;
+  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+
+  va_start(va, n);
+  for (i = 0; i < n; i++) {
+    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
   }
+  va_end(va);
 
-  return -1;
+  return p;
 }
 
-mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag) {
-  return mpc_ast_get_child_lb(ast, tag, 0);
-}
+mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...) {
 
-mpc_ast_t *mpc_ast_get_child_lb(mpc_ast_t *ast, const char *tag, int lb) {
   int i;
+  va_list va;
 
-  for(i=lb; i<ast->children_num; i++) {
-    if(strcmp(ast->children[i]->tag, tag) == 0) {
-      return ast->children[i];
-    }
+  mpc_parser_t *p = mpc_undefined();
+
+  p->type = MPC_TYPE_AND;
+  p->data.and.n = n;
+  p->data.and.f = f;
+  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
+
+  va_start(va, f);
+  for (i = 0; i < n; i++) {
+    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
+  }
+  for (i = 0; i < (n-1); i++) {
+    p->data.and.dxs[i] = va_arg(va, mpc_dtor_t);
   }
+  va_end(va);
 
-  return NULL;
+  return p;
 }
 
-mpc_ast_trav_t *mpc_ast_traverse_start(mpc_ast_t *ast,
-                                       mpc_ast_trav_order_t order)
-{
-  mpc_ast_trav_t *trav, *n_trav;
-  mpc_ast_t *cnode = ast;
-
-  /* Create the traversal structure */
-  trav = malloc(sizeof(mpc_ast_trav_t));
-  trav->curr_node = cnode;
-  trav->parent = NULL;
-  trav->curr_child = 0;
-  trav->order = order;
+/*
+** Common Parsers
+*/
 
-  /* Get start node */
-  switch(order) {
-    case mpc_ast_trav_order_pre:
-      /* Nothing else is needed for pre order start */
-      break;
+mpc_parser_t *mpc_soi(void) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_SOI;
+  return mpc_expect(p, "start of input");
+}
 
-    case mpc_ast_trav_order_post:
-      while(cnode->children_num > 0) {
-        cnode = cnode->children[0];
+mpc_parser_t *mpc_eoi(void) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_EOI;
+  return mpc_expect(p, "end of input");
+}
 
-        n_trav = malloc(sizeof(mpc_ast_trav_t));
-        n_trav->curr_node = cnode;
-        n_trav->parent = trav;
-        n_trav->curr_child = 0;
-        n_trav->order = order;
+static int mpc_boundary_anchor(char prev, char next) {
+  const char* word = "abcdefghijklmnopqrstuvwxyz"
+                     "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                     "0123456789_";
+  if ( strchr(word, next) &&  prev == '\0') { return 1; }
+  if ( strchr(word, prev) &&  next == '\0') { return 1; }
+  if ( strchr(word, next) && !strchr(word, prev)) { return 1; }
+  if (!strchr(word, next) &&  strchr(word, prev)) { return 1; }
+  return 0;
+}
 
-        trav = n_trav;
-      }
+static int mpc_boundary_newline_anchor(char prev, char next) {
+  (void)next;
+  return prev == '\n';
+}
 
-      break;
+mpc_parser_t *mpc_boundary(void) { return mpc_expect(mpc_anchor(mpc_boundary_anchor), "word boundary"); }
+mpc_parser_t *mpc_boundary_newline(void) { return mpc_expect(mpc_anchor(mpc_boundary_newline_anchor), "start of newline"); }
 
-    default:
-      /* Unreachable, but compiler complaints */
-      break;
-  }
+mpc_parser_t *mpc_whitespace(void) { return mpc_expect(mpc_oneof(" \f\n\r\t\v"), "whitespace"); }
+mpc_parser_t *mpc_whitespaces(void) { return mpc_expect(mpc_many(mpcf_strfold, mpc_whitespace()), "spaces"); }
+mpc_parser_t *mpc_blank(void) { return mpc_expect(mpc_apply(mpc_whitespaces(), mpcf_free), "whitespace"); }
 
-  return trav;
-}
+mpc_parser_t *mpc_newline(void) { return mpc_expect(mpc_char('\n'), "newline"); }
+mpc_parser_t *mpc_tab(void) { return mpc_expect(mpc_char('\t'), "tab"); }
+mpc_parser_t *mpc_escape(void) { return mpc_and(2, mpcf_strfold, mpc_char('\\'), mpc_any(), free); }
 
-mpc_ast_t *mpc_ast_traverse_next(mpc_ast_trav_t **trav) {
-  mpc_ast_trav_t *n_trav, *to_free;
-  mpc_ast_t *ret = NULL;
-  int cchild;
+mpc_parser_t *mpc_digit(void) { return mpc_expect(mpc_oneof("0123456789"), "digit"); }
+mpc_parser_t *mpc_hexdigit(void) { return mpc_expect(mpc_oneof("0123456789ABCDEFabcdef"), "hex digit"); }
+mpc_parser_t *mpc_octdigit(void) { return mpc_expect(mpc_oneof("01234567"), "oct digit"); }
+mpc_parser_t *mpc_digits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_digit()), "digits"); }
+mpc_parser_t *mpc_hexdigits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_hexdigit()), "hex digits"); }
+mpc_parser_t *mpc_octdigits(void) { return mpc_expect(mpc_many1(mpcf_strfold, mpc_octdigit()), "oct digits"); }
 
-  /* The end of traversal was reached */
-  if(*trav == NULL) return NULL;
+mpc_parser_t *mpc_lower(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyz"), "lowercase letter"); }
+mpc_parser_t *mpc_upper(void) { return mpc_expect(mpc_oneof("ABCDEFGHIJKLMNOPQRSTUVWXYZ"), "uppercase letter"); }
+mpc_parser_t *mpc_alpha(void) { return mpc_expect(mpc_oneof("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"), "letter"); }
+mpc_parser_t *mpc_underscore(void) { return mpc_expect(mpc_char('_'), "underscore"); }
+mpc_parser_t *mpc_alphanum(void) { return mpc_expect(mpc_or(3, mpc_alpha(), mpc_digit(), mpc_underscore()), "alphanumeric"); }
 
-  switch((*trav)->order) {
-    case mpc_ast_trav_order_pre:
-      ret = (*trav)->curr_node;
+mpc_parser_t *mpc_int(void) { return mpc_expect(mpc_apply(mpc_digits(), mpcf_int), "integer"); }
+mpc_parser_t *mpc_hex(void) { return mpc_expect(mpc_apply(mpc_hexdigits(), mpcf_hex), "hexadecimal"); }
+mpc_parser_t *mpc_oct(void) { return mpc_expect(mpc_apply(mpc_octdigits(), mpcf_oct), "octadecimal"); }
+mpc_parser_t *mpc_number(void) { return mpc_expect(mpc_or(3, mpc_int(), mpc_hex(), mpc_oct()), "number"); }
 
-      /* If there aren't any more children, go up */
-      while(*trav != NULL &&
-        (*trav)->curr_child >= (*trav)->curr_node->children_num)
-      {
-        to_free = *trav;
-        *trav = (*trav)->parent;
-        free(to_free);
-      }
+mpc_parser_t *mpc_real(void) {
 
-      /* If trav is NULL, the end was reached */
-      if(*trav == NULL) {
-        break;
-      }
+  /* [+-]?\d+(\.\d+)?([eE][+-]?[0-9]+)? */
 
-      /* Go to next child */
-      n_trav = malloc(sizeof(mpc_ast_trav_t));
+  mpc_parser_t *p0, *p1, *p2, *p30, *p31, *p32, *p3;
 
-      cchild = (*trav)->curr_child;
-      n_trav->curr_node = (*trav)->curr_node->children[cchild];
-      n_trav->parent = *trav;
-      n_trav->curr_child = 0;
-      n_trav->order = (*trav)->order;
+  p0 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
+  p1 = mpc_digits();
+  p2 = mpc_maybe_lift(mpc_and(2, mpcf_strfold, mpc_char('.'), mpc_digits(), free), mpcf_ctor_str);
+  p30 = mpc_oneof("eE");
+  p31 = mpc_maybe_lift(mpc_oneof("+-"), mpcf_ctor_str);
+  p32 = mpc_digits();
+  p3 = mpc_maybe_lift(mpc_and(3, mpcf_strfold, p30, p31, p32, free, free), mpcf_ctor_str);
 
-      (*trav)->curr_child++;
-      *trav = n_trav;
+  return mpc_expect(mpc_and(4, mpcf_strfold, p0, p1, p2, p3, free, free, free), "real");
 
-      break;
+}
 
-    case mpc_ast_trav_order_post:
-      ret = (*trav)->curr_node;
+mpc_parser_t *mpc_float(void) {
+  return mpc_expect(mpc_apply(mpc_real(), mpcf_float), "float");
+}
 
-      /* Move up tree to the parent If the parent doesn't have any more nodes,
-       * then this is the current node. If it does, move down to its left most
-       * child. Also, free the previous traversal node */
-      to_free = *trav;
-      *trav = (*trav)->parent;
-      free(to_free);
+mpc_parser_t *mpc_char_lit(void) {
+  return mpc_expect(mpc_between(mpc_or(2, mpc_escape(), mpc_any()), free, "'", "'"), "char");
+}
 
-      if(*trav == NULL)
-        break;
+mpc_parser_t *mpc_string_lit(void) {
+  mpc_parser_t *strchar = mpc_or(2, mpc_escape(), mpc_noneof("\""));
+  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, strchar), free, "\"", "\""), "string");
+}
 
-      /* Next child */
-      (*trav)->curr_child++;
+mpc_parser_t *mpc_regex_lit(void) {
+  mpc_parser_t *regexchar = mpc_or(2, mpc_escape(), mpc_noneof("/"));
+  return mpc_expect(mpc_between(mpc_many(mpcf_strfold, regexchar), free, "/", "/"), "regex");
+}
 
-      /* If there aren't any more children, this is the next node */
-      if((*trav)->curr_child >= (*trav)->curr_node->children_num) {
-        break;
-      }
+mpc_parser_t *mpc_ident(void) {
+  mpc_parser_t *p0, *p1;
+  p0 = mpc_or(2, mpc_alpha(), mpc_underscore());
+  p1 = mpc_many(mpcf_strfold, mpc_alphanum());
+  return mpc_and(2, mpcf_strfold, p0, p1, free);
+}
 
-      /* If there are still more children, find the leftmost child from this
-       * node */
-      while((*trav)->curr_node->children_num > 0) {
-        n_trav = malloc(sizeof(mpc_ast_trav_t));
+/*
+** Useful Parsers
+*/
 
-        cchild = (*trav)->curr_child;
-        n_trav->curr_node = (*trav)->curr_node->children[cchild];
-        n_trav->parent = *trav;
-        n_trav->curr_child = 0;
-        n_trav->order = (*trav)->order;
+mpc_parser_t *mpc_startwith(mpc_parser_t *a) { return mpc_and(2, mpcf_snd, mpc_soi(), a, mpcf_dtor_null); }
+mpc_parser_t *mpc_endwith(mpc_parser_t *a, mpc_dtor_t da) { return mpc_and(2, mpcf_fst, a, mpc_eoi(), da); }
+mpc_parser_t *mpc_whole(mpc_parser_t *a, mpc_dtor_t da) { return mpc_and(3, mpcf_snd, mpc_soi(), a, mpc_eoi(), mpcf_dtor_null, da); }
 
-        *trav = n_trav;
-      }
+mpc_parser_t *mpc_stripl(mpc_parser_t *a) { return mpc_and(2, mpcf_snd, mpc_blank(), a, mpcf_dtor_null); }
+mpc_parser_t *mpc_stripr(mpc_parser_t *a) { return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null); }
+mpc_parser_t *mpc_strip(mpc_parser_t *a) { return mpc_and(3, mpcf_snd, mpc_blank(), a, mpc_blank(), mpcf_dtor_null, mpcf_dtor_null); }
+mpc_parser_t *mpc_tok(mpc_parser_t *a) { return mpc_and(2, mpcf_fst, a, mpc_blank(), mpcf_dtor_null); }
+mpc_parser_t *mpc_sym(const char *s) { return mpc_tok(mpc_string(s)); }
+
+mpc_parser_t *mpc_total(mpc_parser_t *a, mpc_dtor_t da) { return mpc_whole(mpc_strip(a), da); }
+
+mpc_parser_t *mpc_between(mpc_parser_t *a, mpc_dtor_t ad, const char *o, const char *c) {
+  return mpc_and(3, mpcf_snd_free,
+    mpc_string(o), a, mpc_string(c),
+    free, ad);
+}
+
+mpc_parser_t *mpc_parens(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_between(a, ad, "(", ")"); }
+mpc_parser_t *mpc_braces(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_between(a, ad, "<", ">"); }
+mpc_parser_t *mpc_brackets(mpc_parser_t *a, mpc_dtor_t ad) { return mpc_between(a, ad, "{", "}"); }
+mpc_parser_t *mpc_squares(mpc_parser_t *a, mpc_dtor_t ad)  { return mpc_between(a, ad, "[", "]"); }
+
+mpc_parser_t *mpc_tok_between(mpc_parser_t *a, mpc_dtor_t ad, const char *o, const char *c) {
+  return mpc_and(3, mpcf_snd_free,
+    mpc_sym(o), mpc_tok(a), mpc_sym(c),
+    free, ad);
+}
+
+mpc_parser_t *mpc_tok_parens(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_tok_between(a, ad, "(", ")"); }
+mpc_parser_t *mpc_tok_braces(mpc_parser_t *a, mpc_dtor_t ad)   { return mpc_tok_between(a, ad, "<", ">"); }
+mpc_parser_t *mpc_tok_brackets(mpc_parser_t *a, mpc_dtor_t ad) { return mpc_tok_between(a, ad, "{", "}"); }
+mpc_parser_t *mpc_tok_squares(mpc_parser_t *a, mpc_dtor_t ad)  { return mpc_tok_between(a, ad, "[", "]"); }
+
+/*
+** Regular Expression Parsers
+*/
+
+/*
+** So here is a cute bootstrapping.
+**
+** I'm using the previously defined
+** mpc constructs and functions to
+** parse the user regex string and
+** construct a parser from it.
+**
+** As it turns out lots of the standard
+** mpc functions look a lot like `fold`
+** functions and so can be used indirectly
+** by many of the parsing functions to build
+** a parser directly - as we are parsing.
+**
+** This is certainly something that
+** would be less elegant/interesting
+** in a two-phase parser which first
+** builds an AST and then traverses it
+** to generate the object.
+**
+** This whole thing acts as a great
+** case study for how trivial it can be
+** to write a great parser in a few
+** lines of code using mpc.
+*/
+
+/*
+**
+**  ### Regular Expression Grammar
+**
+**      <regex> : <term> | (<term> "|" <regex>)
+**
+**      <term> : <factor>*
+**
+**      <factor> : <base>
+**               | <base> "*"
+**               | <base> "+"
+**               | <base> "?"
+**               | <base> "{" <digits> "}"
+**
+**      <base> : <char>
+**             | "\" <char>
+**             | "(" <regex> ")"
+**             | "[" <range> "]"
+*/
+
+static mpc_val_t *mpcf_re_or(int n, mpc_val_t **xs) {
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  else { return mpc_or(2, xs[0], xs[1]); }
+}
+
+static mpc_val_t *mpcf_re_and(int n, mpc_val_t **xs) {
+  int i;
+  mpc_parser_t *p = mpc_lift(mpcf_ctor_str);
+  for (i = 0; i < n; i++) {
+    p = mpc_and(2, mpcf_strfold, p, xs[i], free);
+  }
+  return p;
+}
 
+static mpc_val_t *mpcf_re_repeat(int n, mpc_val_t **xs) {
+  int num;
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  switch(((char*)xs[1])[0])
+  {
+    case '*': { free(xs[1]); return mpc_many(mpcf_strfold, xs[0]); }; break;
+    case '+': { free(xs[1]); return mpc_many1(mpcf_strfold, xs[0]); }; break;
+    case '?': { free(xs[1]); return mpc_maybe_lift(xs[0], mpcf_ctor_str); }; break;
     default:
-      /* Unreachable, but compiler complaints */
-      break;
+      num = *(int*)xs[1];
+      free(xs[1]);
   }
 
-  return ret;
+  return mpc_count(num, mpcf_strfold, xs[0], free);
 }
 
-void mpc_ast_traverse_free(mpc_ast_trav_t **trav) {
-  mpc_ast_trav_t *n_trav;
+static mpc_parser_t *mpc_re_escape_char(char c) {
+  switch (c) {
+    case 'a': return mpc_char('\a');
+    case 'f': return mpc_char('\f');
+    case 'n': return mpc_char('\n');
+    case 'r': return mpc_char('\r');
+    case 't': return mpc_char('\t');
+    case 'v': return mpc_char('\v');
+    case 'b': return mpc_and(2, mpcf_snd, mpc_boundary(), mpc_lift(mpcf_ctor_str), free);
+    case 'B': return mpc_not_lift(mpc_boundary(), free, mpcf_ctor_str);
+    case 'A': return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
+    case 'Z': return mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free);
+    case 'd': return mpc_digit();
+    case 'D': return mpc_not_lift(mpc_digit(), free, mpcf_ctor_str);
+    case 's': return mpc_whitespace();
+    case 'S': return mpc_not_lift(mpc_whitespace(), free, mpcf_ctor_str);
+    case 'w': return mpc_alphanum();
+    case 'W': return mpc_not_lift(mpc_alphanum(), free, mpcf_ctor_str);
+    default: return NULL;
+  }
+}
 
-  /* Go through parents until all are free */
-  while(*trav != NULL) {
-      n_trav = (*trav)->parent;
-      free(*trav);
-      *trav = n_trav;
+static mpc_val_t *mpcf_re_escape(mpc_val_t *x, void* data) {
+
+  int mode = *((int*)data);
+  char *s = x;
+  mpc_parser_t *p;
+
+  /* Any Character */
+  if (s[0] == '.') {
+    free(s);
+    if (mode & MPC_RE_DOTALL) {
+      return mpc_any();
+    } else {
+      return mpc_expect(mpc_noneof("\n"), "any character except a newline");
+    }
+  }
+
+  /* Start of Input */
+  if (s[0] == '^') {
+    free(s);
+    if (mode & MPC_RE_MULTILINE) {
+      return mpc_and(2, mpcf_snd, mpc_or(2, mpc_soi(), mpc_boundary_newline()), mpc_lift(mpcf_ctor_str), free);
+    } else {
+      return mpc_and(2, mpcf_snd, mpc_soi(), mpc_lift(mpcf_ctor_str), free);
+    }
+  }
+
+  /* End of Input */
+  if (s[0] == '$') {
+    free(s);
+    if (mode & MPC_RE_MULTILINE) {
+      return mpc_or(2,
+        mpc_newline(),
+        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+    } else {
+      return mpc_or(2,
+        mpc_and(2, mpcf_fst, mpc_newline(), mpc_eoi(), free),
+        mpc_and(2, mpcf_snd, mpc_eoi(), mpc_lift(mpcf_ctor_str), free));
+    }
+  }
+
+  /* Regex Escape */
+  if (s[0] == '\\') {
+    p = mpc_re_escape_char(s[1]);
+    p = (p == NULL) ? mpc_char(s[1]) : p;
+    free(s);
+    return p;
   }
+
+  /* Regex Standard */
+  p = mpc_char(s[0]);
+  free(s);
+  return p;
 }
 
-mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
+static const char *mpc_re_range_escape_char(char c) {
+  switch (c) {
+    case '-': return "-";
+    case 'a': return "\a";
+    case 'f': return "\f";
+    case 'n': return "\n";
+    case 'r': return "\r";
+    case 't': return "\t";
+    case 'v': return "\v";
+    case 'b': return "\b";
+    case 'd': return "0123456789";
+    case 's': return " \f\n\r\t\v";
+    case 'w': return "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+    default: return NULL;
+  }
+}
 
-  int i, j;
-  mpc_ast_t** as = (mpc_ast_t**)xs;
-  mpc_ast_t *r;
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
 
-  if (n == 0) { return NULL; }
-  if (n == 1) { return xs[0]; }
-  if (n == 2 && xs[1] == NULL) { return xs[0]; }
-  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+  mpc_parser_t *out;
+  size_t i, j;
+  size_t start, end;
+  const char *tmp = NULL;
+  const char *s = x;
+  int comp = s[0] == '^' ? 1 : 0;
+  char *range = calloc(1,1);
+
+  if (s[0] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  if (s[0] == '^' &&
+      s[1] == '\0') { free(range); free(x); return mpc_fail("Invalid Regex Range Expression"); }
+
+  for (i = comp; i < strlen(s); i++){
+
+    /* Regex Range Escape */
+    if (s[i] == '\\') {
+      tmp = mpc_re_range_escape_char(s[i+1]);
+      if (tmp != NULL) {
+        range = realloc(range, strlen(range) + strlen(tmp) + 1);
+        strcat(range, tmp);
+      } else {
+        range = realloc(range, strlen(range) + 1 + 1);
+        range[strlen(range) + 1] = '\0';
+        range[strlen(range) + 0] = s[i+1];
+      }
+      i++;
+    }
+
+    /* Regex Range...Range */
+    else if (s[i] == '-') {
+      if (s[i+1] == '\0' || i == 0) {
+          range = realloc(range, strlen(range) + strlen("-") + 1);
+          strcat(range, "-");
+      } else {
+        start = s[i-1]+1;
+        end = s[i+1]-1;
+        for (j = start; j <= end; j++) {
+          range = realloc(range, strlen(range) + 1 + 1 + 1);
+          range[strlen(range) + 1] = '\0';
+          range[strlen(range) + 0] = (char)j;
+        }
+      }
+    }
+
+    /* Regex Range Normal */
+    else {
+      range = realloc(range, strlen(range) + 1 + 1);
+      range[strlen(range) + 1] = '\0';
+      range[strlen(range) + 0] = s[i];
+    }
+
+  }
+
+  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
+
+  free(x);
+  free(range);
+
+  return out;
+}
+
+/*
+** Regexes made only of characters, sequences,
+** alternatives and repetitions are compiled into a
+** DFA using the positions of the characters in the
+** regex (Glushkov's construction). This is only used
+** when the result is deterministic and behaves exactly
+** like the combinators, which is checked by running
+** the combinators over a path into every state. The
+** check runs with backtracking on, the only way the DFA
+** is used. Without it the combinators can fail having
+** consumed input, and report errors the table doesn't
+** hold.
+*/
+
+#define MPC_DFA_POSITIONS_MAX 32
+
+typedef unsigned long mpc_dfa_set_t;
+
+typedef struct {
+  int nullable;
+  mpc_dfa_set_t first;
+  mpc_dfa_set_t last;
+} mpc_dfa_frag_t;
+
+typedef struct {
+  int num;
+  unsigned char classes[MPC_DFA_POSITIONS_MAX][32];
+  mpc_dfa_set_t follow[MPC_DFA_POSITIONS_MAX];
+} mpc_dfa_builder_t;
+
+static int mpc_dfa_class_has(unsigned char *cls, int c) {
+  return (cls[c / 8] >> (c % 8)) & 1;
+}
+
+static int mpc_dfa_leaf_match(mpc_parser_t *p, char c) {
+  switch (p->type) {
+    case MPC_TYPE_ANY:     return 1;
+    case MPC_TYPE_SINGLE:  return c == p->data.single.x;
+    case MPC_TYPE_RANGE:   return c >= p->data.range.x && c <= p->data.range.y;
+    case MPC_TYPE_ONEOF:   return mpc_class_has(p->data.cls.c, c);
+    case MPC_TYPE_NONEOF:  return mpc_class_has(p->data.cls.c, c);
+    case MPC_TYPE_SATISFY: return p->data.satisfy.f(c) != 0;
+    default: return 0;
+  }
+}
+
+static void mpc_dfa_frag_seq(mpc_dfa_builder_t *b, mpc_dfa_frag_t *f, mpc_dfa_frag_t *g) {
+  int k;
+  for (k = 0; k < b->num; k++) {
+    if ((f->last >> k) & 1) { b->follow[k] |= g->first; }
+  }
+  f->first = f->nullable ? f->first | g->first : f->first;
+  f->last = g->nullable ? f->last | g->last : g->last;
+  f->nullable = f->nullable && g->nullable;
+}
+
+static int mpc_dfa_frag(mpc_dfa_builder_t *b, mpc_parser_t *p, mpc_dfa_frag_t *f);
+
+static int mpc_dfa_frag_repeat(mpc_dfa_builder_t *b, mpc_parser_t *x, int min, mpc_dfa_frag_t *f) {
+
+  mpc_dfa_frag_t g;
+  int j;
+
+  f->nullable = 1;
+  f->first = 0;
+  f->last = 0;
+
+  if (min) {
+    if (!mpc_dfa_frag(b, x, &g) || g.nullable) { return 0; }
+    mpc_dfa_frag_seq(b, f, &g);
+  }
+
+  if (!mpc_dfa_frag(b, x, &g) || g.nullable) { return 0; }
+  for (j = 0; j < b->num; j++) {
+    if ((g.last >> j) & 1) { b->follow[j] |= g.first; }
+  }
+  g.nullable = 1;
+  mpc_dfa_frag_seq(b, f, &g);
+  return 1;
+}
+
+static int mpc_dfa_frag(mpc_dfa_builder_t *b, mpc_parser_t *p, mpc_dfa_frag_t *f) {
+
+  mpc_dfa_frag_t g;
+  int j, c;
+
+  f->nullable = 1;
+  f->first = 0;
+  f->last = 0;
+
+  if (p->retained) { return 0; }
+
+  switch (p->type) {
+
+    case MPC_TYPE_EXPECT: return mpc_dfa_frag(b, p->data.expect.x, f);
+
+    case MPC_TYPE_LIFT: return p->data.lift.lf == mpcf_ctor_str;
+
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+      if (b->num == MPC_DFA_POSITIONS_MAX) { return 0; }
+      memset(b->classes[b->num], 0, 32);
+      for (c = 1; c < 256; c++) {
+        if (mpc_dfa_leaf_match(p, (char)c)) {
+          b->classes[b->num][c / 8] |= 1 << (c % 8);
+        }
+      }
+      b->follow[b->num] = 0;
+      f->nullable = 0;
+      f->first = f->last = 1UL << b->num;
+      b->num++;
+      return 1;
+
+    case MPC_TYPE_AND:
+      if (p->data.and.f != mpcf_strfold) { return 0; }
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_dfa_frag(b, p->data.and.xs[j], &g)) { return 0; }
+        mpc_dfa_frag_seq(b, f, &g);
+      }
+      return 1;
+
+    case MPC_TYPE_OR:
+      f->nullable = 0;
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_dfa_frag(b, p->data.or.xs[j], &g)) { return 0; }
+        if (g.nullable && j != p->data.or.n-1) { return 0; }
+        f->nullable = f->nullable || g.nullable;
+        f->first |= g.first;
+        f->last |= g.last;
+      }
+      return p->data.or.n > 0;
+
+    case MPC_TYPE_MAYBE:
+      if (p->data.not.lf != mpcf_ctor_str) { return 0; }
+      if (!mpc_dfa_frag(b, p->data.not.x, f) || f->nullable) { return 0; }
+      f->nullable = 1;
+      return 1;
+
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      return mpc_dfa_frag_repeat(b, p->data.repeat.x, p->type == MPC_TYPE_MANY1, f);
+
+    case MPC_TYPE_SPAN:
+      return mpc_dfa_frag_repeat(b, p->data.span.x, p->data.span.min, f);
+
+    case MPC_TYPE_COUNT:
+      if (p->data.repeat.f != mpcf_strfold) { return 0; }
+      for (j = 0; j < p->data.repeat.n; j++) {
+        if (!mpc_dfa_frag(b, p->data.repeat.x, &g)) { return 0; }
+        mpc_dfa_frag_seq(b, f, &g);
+      }
+      return 1;
+
+    default: return 0;
+  }
+
+}
+
+static mpc_dfa_t *mpc_dfa_new(mpc_dfa_builder_t *b, mpc_dfa_frag_t *f) {
+
+  mpc_dfa_t *d;
+  mpc_dfa_set_t next;
+  int s, k, c;
+
+  d = malloc(sizeof(mpc_dfa_t));
+  d->states_num = b->num + 1;
+  d->next = malloc(sizeof(short) * 256 * d->states_num);
+  d->states = calloc(d->states_num, sizeof(mpc_dfa_state_t));
+
+  for (s = 0; s < d->states_num; s++) {
+
+    d->states[s].accept = (char)(s == 0 ? f->nullable : (int)((f->last >> (s-1)) & 1));
+    d->states[s].merged_num = -1;
+    d->states[s].failed_num = -1;
+
+    next = s == 0 ? f->first : b->follow[s-1];
+    for (c = 0; c < 256; c++) {
+      d->next[s * 256 + c] = -1;
+      for (k = 0; k < b->num; k++) {
+        if (!((next >> k) & 1) || !mpc_dfa_class_has(b->classes[k], c)) { continue; }
+        if (d->next[s * 256 + c] != -1) { mpc_dfa_delete(d); return NULL; }
+        d->next[s * 256 + c] = k + 1;
+      }
+    }
+  }
+
+  return d;
+}
+
+/*
+** Finds a shortest path into every state, optionally
+** only going through states which don't accept. These
+** are the paths on which the DFA can fail to match.
+*/
+
+static void mpc_dfa_paths(mpc_dfa_t *d, int failing, char **paths) {
+
+  int *queue = malloc(sizeof(int) * d->states_num);
+  int head = 0, tail = 0, s, c, n;
+  size_t l;
+
+  if (failing && d->states[0].accept) { free(queue); return; }
+
+  paths[0] = calloc(1, 1);
+  queue[tail++] = 0;
+
+  while (head < tail) {
+    s = queue[head++];
+    for (c = 1; c < 256; c++) {
+      n = d->next[s * 256 + c];
+      if (n < 0 || paths[n] || (failing && d->states[n].accept)) { continue; }
+      l = strlen(paths[s]);
+      paths[n] = malloc(l + 2);
+      memcpy(paths[n], paths[s], l);
+      paths[n][l] = (char)c;
+      paths[n][l+1] = '\0';
+      queue[tail++] = n;
+    }
+  }
+
+  free(queue);
+}
+
+/*
+** Errors are only recorded when they sit a fixed number
+** of characters back from where the DFA gets stuck and
+** carry no failure message, which the table can't hold.
+*/
+
+static int mpc_dfa_errs_store(char ***xs, int *xn, int *xb, mpc_err_t *y, const char *path, long len, int seen) {
+
+  int j, back;
+
+  if (y == NULL) {
+    if (seen) { return *xn == -1; }
+    *xn = -1;
+    return 1;
+  }
+
+  back = (int)(len - y->state.pos);
+  if (y->failure || back < 0 || back > len) { return 0; }
+  if (y->received != (back ? path[len - back] : '\0')) { return 0; }
+
+  if (seen) {
+    if (*xn != y->expected_num || *xb != back) { return 0; }
+    for (j = 0; j < *xn; j++) {
+      if (strcmp((*xs)[j], y->expected[j]) != 0) { return 0; }
+    }
+    return 1;
+  }
+
+  *xn = y->expected_num;
+  *xb = back;
+  *xs = mpc_dfa_strs_copy(y->expected, y->expected_num);
+  return 1;
+}
+
+/*
+** Runs the combinators over a path ending in the given
+** state and checks they agree with the DFA. The errors
+** they report are recorded against the state the first
+** time it is seen and must match every time after.
+*/
+
+static int mpc_dfa_check(mpc_dfa_t *d, mpc_parser_t *x, const char *path, char *seen) {
+
+  mpc_input_t *i;
+  mpc_result_t r;
+  mpc_err_t *e = NULL;
+  mpc_dfa_state_t *ds;
+  long alen, len = strlen(path), j;
+  int s = 0, ok, matched;
+
+  alen = d->states[0].accept ? 0 : -1;
+  for (j = 0; j < len; j++) {
+    s = d->next[s * 256 + (unsigned char)path[j]];
+    if (d->states[s].accept) { alen = j + 1; }
+  }
+  ds = &d->states[s];
+
+  i = mpc_input_new_nstring("<mpc_dfa>", path, len);
+  matched = mpc_parse_run(i, x, &r, &e);
+
+  ok = (alen >= 0) == matched;
+  ok = ok && mpc_dfa_errs_store(&ds->merged, &ds->merged_num, &ds->merged_back,
+    e, path, len, seen[s] & 1);
+  seen[s] |= 1;
+
+  if (matched) {
+    ok = ok && i->state.pos == alen && strlen(r.output) == (size_t)alen
+      && strncmp(r.output, path, alen) == 0;
+    mpc_free(i, r.output);
+  } else {
+    ok = ok && mpc_dfa_errs_store(&ds->failed, &ds->failed_num, &ds->failed_back,
+      r.error, path, len, seen[s] & 2);
+    seen[s] |= 2;
+    mpc_err_delete_internal(i, r.error);
+  }
+
+  mpc_err_delete_internal(i, e);
+  mpc_input_delete(i);
+  return ok;
+}
+
+static mpc_dfa_t *mpc_dfa_compile(mpc_parser_t *x) {
+
+  mpc_dfa_builder_t b;
+  mpc_dfa_frag_t f;
+  mpc_dfa_t *d;
+  char **paths[2], *seen, *path;
+  int ok = 1, k, s, n, c;
+  size_t l;
+
+  b.num = 0;
+  if (!mpc_dfa_frag(&b, x, &f)) { return NULL; }
+
+  d = mpc_dfa_new(&b, &f);
+  if (d == NULL) { return NULL; }
+
+  paths[0] = calloc(d->states_num, sizeof(char*));
+  paths[1] = calloc(d->states_num, sizeof(char*));
+  seen = calloc(d->states_num, 1);
+  mpc_dfa_paths(d, 0, paths[0]);
+  mpc_dfa_paths(d, 1, paths[1]);
+
+  /* Check the start state and every edge out of a known path */
+  for (k = 0; k < 2 && ok; k++) {
+    if (paths[k][0]) { ok = mpc_dfa_check(d, x, paths[k][0], seen); }
+    for (s = 0; s < d->states_num && ok; s++) {
+      if (paths[k][s] == NULL) { continue; }
+      l = strlen(paths[k][s]);
+      path = malloc(l + 2);
+      memcpy(path, paths[k][s], l);
+      path[l+1] = '\0';
+      for (n = 0; n < d->states_num && ok; n++) {
+        for (c = 1; c < 256; c++) {
+          if (d->next[s * 256 + c] != n) { continue; }
+          if (k == 1 && d->states[n].accept) { break; }
+          path[l] = (char)c;
+          ok = mpc_dfa_check(d, x, path, seen);
+          break;
+        }
+      }
+      free(path);
+    }
+  }
+
+  for (s = 0; s < d->states_num; s++) { free(paths[0][s]); free(paths[1][s]); }
+  free(paths[0]);
+  free(paths[1]);
+  free(seen);
+
+  if (!ok) { mpc_dfa_delete(d); return NULL; }
+  return d;
+}
+
+static mpc_parser_t *mpc_re_dfa(mpc_parser_t *x) {
+  mpc_parser_t *p;
+  mpc_dfa_t *d = mpc_dfa_compile(x);
+  if (d == NULL) { return x; }
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa.d = d;
+  p->data.dfa.x = x;
+  return p;
+}
+
+mpc_parser_t *mpc_re(const char *re) {
+  return mpc_re_mode(re, MPC_RE_DEFAULT);
+}
+
+mpc_parser_t *mpc_re_mode(const char *re, int mode) {
+
+  char *err_msg;
+  mpc_parser_t *err_out;
+  mpc_result_t r;
+  mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose;
+
+  Regex  = mpc_new("regex");
+  Term   = mpc_new("term");
+  Factor = mpc_new("factor");
+  Base   = mpc_new("base");
+  Range  = mpc_new("range");
+
+  mpc_define(Regex, mpc_and(2, mpcf_re_or,
+    Term,
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_char('|'), Regex, free)),
+    (mpc_dtor_t)mpc_delete
+  ));
+
+  mpc_define(Term, mpc_many(mpcf_re_and, Factor));
+
+  mpc_define(Factor, mpc_and(2, mpcf_re_repeat,
+    Base,
+    mpc_or(5,
+      mpc_char('*'), mpc_char('+'), mpc_char('?'),
+      mpc_brackets(mpc_int(), free),
+      mpc_pass()),
+    (mpc_dtor_t)mpc_delete
+  ));
+
+  mpc_define(Base, mpc_or(4,
+    mpc_parens(Regex, (mpc_dtor_t)mpc_delete),
+    mpc_squares(Range, (mpc_dtor_t)mpc_delete),
+    mpc_apply_to(mpc_escape(), mpcf_re_escape, &mode),
+    mpc_apply_to(mpc_noneof(")|"), mpcf_re_escape, &mode)
+  ));
+
+  mpc_define(Range, mpc_apply(
+    mpc_many(mpcf_strfold, mpc_or(2, mpc_escape(), mpc_noneof("]"))),
+    mpcf_re_range
+  ));
+
+  RegexEnclose = mpc_whole(mpc_predictive(Regex), (mpc_dtor_t)mpc_delete);
+
+  mpc_optimise(RegexEnclose);
+  mpc_optimise(Regex);
+  mpc_optimise(Term);
+  mpc_optimise(Factor);
+  mpc_optimise(Base);
+  mpc_optimise(Range);
+
+  if(!mpc_parse("<mpc_re_compiler>", re, RegexEnclose, &r)) {
+    err_msg = mpc_err_string(r.error);
+    err_out = mpc_failf("Invalid Regex: %s", err_msg);
+    mpc_err_delete(r.error);
+    free(err_msg);
+    r.output = err_out;
+  }
+
+  mpc_cleanup(6, RegexEnclose, Regex, Term, Factor, Base, Range);
+
+  mpc_optimise(r.output);
+
+  return mpc_re_dfa(r.output);
+
+}
+
+/*
+** Common Fold Functions
+*/
+
+void mpcf_dtor_null(mpc_val_t *x) { (void) x; return; }
+
+mpc_val_t *mpcf_ctor_null(void) { return NULL; }
+mpc_val_t *mpcf_ctor_str(void) { return calloc(1, 1); }
+mpc_val_t *mpcf_free(mpc_val_t *x) { free(x); return NULL; }
+
+mpc_val_t *mpcf_int(mpc_val_t *x) {
+  int *y = malloc(sizeof(int));
+  *y = strtol(x, NULL, 10);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_hex(mpc_val_t *x) {
+  int *y = malloc(sizeof(int));
+  *y = strtol(x, NULL, 16);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_oct(mpc_val_t *x) {
+  int *y = malloc(sizeof(int));
+  *y = strtol(x, NULL, 8);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_float(mpc_val_t *x) {
+  float *y = malloc(sizeof(float));
+  *y = strtod(x, NULL);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_strtriml(mpc_val_t *x) {
+  char *s = x;
+  while (isspace((unsigned char)*s)) {
+    memmove(s, s+1, strlen(s));
+  }
+  return s;
+}
+
+mpc_val_t *mpcf_strtrimr(mpc_val_t *x) {
+  char *s = x;
+  size_t l = strlen(s);
+  while (l > 0 && isspace((unsigned char)s[l-1])) {
+    s[l-1] = '\0'; l--;
+  }
+  return s;
+}
+
+mpc_val_t *mpcf_strtrim(mpc_val_t *x) {
+  return mpcf_strtriml(mpcf_strtrimr(x));
+}
+
+static const char mpc_escape_input_c[]  = {
+  '\a', '\b', '\f', '\n', '\r',
+  '\t', '\v', '\\', '\'', '\"', '\0'};
+
+static const char *mpc_escape_output_c[] = {
+  "\\a", "\\b", "\\f", "\\n", "\\r", "\\t",
+  "\\v", "\\\\", "\\'", "\\\"", "\\0", NULL};
+
+static const char mpc_escape_input_raw_re[] = { '/' };
+static const char *mpc_escape_output_raw_re[] = { "\\/", NULL };
+
+static const char mpc_escape_input_raw_cstr[] = { '"' };
+static const char *mpc_escape_output_raw_cstr[] = { "\\\"", NULL };
+
+static const char mpc_escape_input_raw_cchar[] = { '\'' };
+static const char *mpc_escape_output_raw_cchar[] = { "\\'", NULL };
+
+static mpc_val_t *mpcf_escape_new(mpc_val_t *x, const char *input, const char **output) {
+
+  int i;
+  int found;
+  char buff[2];
+  char *s = x;
+  char *y = calloc(1, 1);
+
+  while (*s) {
+
+    i = 0;
+    found = 0;
+
+    while (output[i]) {
+      if (*s == input[i]) {
+        y = realloc(y, strlen(y) + strlen(output[i]) + 1);
+        strcat(y, output[i]);
+        found = 1;
+        break;
+      }
+      i++;
+    }
+
+    if (!found) {
+      y = realloc(y, strlen(y) + 2);
+      buff[0] = *s; buff[1] = '\0';
+      strcat(y, buff);
+    }
+
+    s++;
+  }
+
+
+  return y;
+}
+
+static mpc_val_t *mpcf_unescape_new(mpc_val_t *x, const char *input, const char **output) {
+
+  int i;
+  int found = 0;
+  char buff[2];
+  char *s = x;
+  char *y = calloc(1, 1);
+
+  while (*s) {
+
+    i = 0;
+    found = 0;
+
+    while (output[i]) {
+      if ((*(s+0)) == output[i][0] &&
+          (*(s+1)) == output[i][1]) {
+        y = realloc(y, strlen(y) + 1 + 1);
+        buff[0] = input[i]; buff[1] = '\0';
+        strcat(y, buff);
+        found = 1;
+        s++;
+        break;
+      }
+      i++;
+    }
+
+    if (!found) {
+      y = realloc(y, strlen(y) + 1 + 1);
+      buff[0] = *s; buff[1] = '\0';
+      strcat(y, buff);
+    }
+
+    if (*s == '\0') { break; }
+    else { s++; }
+  }
+
+  return y;
+
+}
+
+mpc_val_t *mpcf_escape(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_c, mpc_escape_output_c);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_unescape(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_c, mpc_escape_output_c);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_escape_regex(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_re, mpc_escape_output_raw_re);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_unescape_regex(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_re, mpc_escape_output_raw_re);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_escape_string_raw(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_cstr, mpc_escape_output_raw_cstr);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_unescape_string_raw(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_cstr, mpc_escape_output_raw_cstr);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_escape_char_raw(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_escape_new(x, mpc_escape_input_raw_cchar, mpc_escape_output_raw_cchar);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_unescape_char_raw(mpc_val_t *x) {
+  mpc_val_t *y = mpcf_unescape_new(x, mpc_escape_input_raw_cchar, mpc_escape_output_raw_cchar);
+  free(x);
+  return y;
+}
+
+mpc_val_t *mpcf_null(int n, mpc_val_t** xs) { (void) n; (void) xs; return NULL; }
+mpc_val_t *mpcf_fst(int n, mpc_val_t **xs) { (void) n; return xs[0]; }
+mpc_val_t *mpcf_snd(int n, mpc_val_t **xs) { (void) n; return xs[1]; }
+mpc_val_t *mpcf_trd(int n, mpc_val_t **xs) { (void) n; return xs[2]; }
+
+static mpc_val_t *mpcf_nth_free(int n, mpc_val_t **xs, int x) {
+  int i;
+  for (i = 0; i < n; i++) {
+    if (i != x) { free(xs[i]); }
+  }
+  return xs[x];
+}
+
+mpc_val_t *mpcf_fst_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 0); }
+mpc_val_t *mpcf_snd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 1); }
+mpc_val_t *mpcf_trd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 2); }
+mpc_val_t *mpcf_all_free(int n, mpc_val_t** xs) {
+  int i;
+  for (i = 0; i < n; i++) {
+    free(xs[i]);
+  }
+  return NULL;
+}
+
+mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
+  int i;
+  size_t l = 0;
+
+  if (n == 0) { return calloc(1, 1); }
+
+  for (i = 0; i < n; i++) { l += strlen(xs[i]); }
+
+  xs[0] = realloc(xs[0], l + 1);
+
+  for (i = 1; i < n; i++) {
+    strcat(xs[0], xs[i]); free(xs[i]);
+  }
+
+  return xs[0];
+}
+
+mpc_val_t *mpcf_maths(int n, mpc_val_t **xs) {
+  int **vs = (int**)xs;
+  (void) n;
+
+  switch(((char*)xs[1])[0])
+  {
+    case '*': { *vs[0] *= *vs[2]; }; break;
+    case '/': { *vs[0] /= *vs[2]; }; break;
+    case '%': { *vs[0] %= *vs[2]; }; break;
+    case '+': { *vs[0] += *vs[2]; }; break;
+    case '-': { *vs[0] -= *vs[2]; }; break;
+    default: break;
+  }
+
+  free(xs[1]); free(xs[2]);
+
+  return xs[0];
+}
+
+/*
+** Printing
+*/
+
+static void mpc_print_unretained(mpc_parser_t *p, int force) {
+
+  /* TODO: Print Everything Escaped */
+
+  int i;
+  char *s, *e;
+  char buff[2];
+
+  if (p->retained && !force) {;
+    if (p->name) { printf("<%s>", p->name); }
+    else { printf("<anon>"); }
+    return;
+  }
+
+  if (p->type == MPC_TYPE_UNDEFINED) { printf("<?>"); }
+  if (p->type == MPC_TYPE_PASS)   { printf("<:>"); }
+  if (p->type == MPC_TYPE_FAIL)   { printf("<!>"); }
+  if (p->type == MPC_TYPE_LIFT)   { printf("<#>"); }
+  if (p->type == MPC_TYPE_STATE)  { printf("<S>"); }
+  if (p->type == MPC_TYPE_ANCHOR) { printf("<@>"); }
+  if (p->type == MPC_TYPE_EXPECT) {
+    printf("%s", p->data.expect.m);
+    /*mpc_print_unretained(p->data.expect.x, 0);*/
+  }
+
+  if (p->type == MPC_TYPE_ANY) { printf("<.>"); }
+  if (p->type == MPC_TYPE_SATISFY) { printf("<f>"); }
+
+  if (p->type == MPC_TYPE_SINGLE) {
+    buff[0] = p->data.single.x; buff[1] = '\0';
+    s = mpcf_escape_new(
+      buff,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("'%s'", s);
+    free(s);
+  }
+
+  if (p->type == MPC_TYPE_RANGE) {
+    buff[0] = p->data.range.x; buff[1] = '\0';
+    s = mpcf_escape_new(
+      buff,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    buff[0] = p->data.range.y; buff[1] = '\0';
+    e = mpcf_escape_new(
+      buff,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("[%s-%s]", s, e);
+    free(s);
+    free(e);
+  }
+
+  if (p->type == MPC_TYPE_ONEOF) {
+    s = mpcf_escape_new(
+      p->data.cls.x,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("[%s]", s);
+    free(s);
+  }
+
+  if (p->type == MPC_TYPE_NONEOF) {
+    s = mpcf_escape_new(
+      p->data.cls.x,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("[^%s]", s);
+    free(s);
+  }
+
+  if (p->type == MPC_TYPE_STRING) {
+    s = mpcf_escape_new(
+      p->data.string.x,
+      mpc_escape_input_c,
+      mpc_escape_output_c);
+    printf("\"%s\"", s);
+    free(s);
+  }
+
+  if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
+  if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
+  if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+
+  if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
+  if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
+
+  if (p->type == MPC_TYPE_MANY)  { mpc_print_unretained(p->data.repeat.x, 0); printf("*"); }
+  if (p->type == MPC_TYPE_MANY1) { mpc_print_unretained(p->data.repeat.x, 0); printf("+"); }
+  if (p->type == MPC_TYPE_COUNT) { mpc_print_unretained(p->data.repeat.x, 0); printf("{%i}", p->data.repeat.n); }
+
+  if (p->type == MPC_TYPE_DFA)   { mpc_print_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)  { mpc_print_unretained(p->data.span.x, 0); printf(p->data.span.min ? "+" : "*"); }
+  if (p->type == MPC_TYPE_MEMO)  { mpc_print_unretained(p->data.memo.x, 0); }
+
+  if (p->type == MPC_TYPE_OR) {
+    printf("(");
+    for(i = 0; i < p->data.or.n-1; i++) {
+      mpc_print_unretained(p->data.or.xs[i], 0);
+      printf(" | ");
+    }
+    mpc_print_unretained(p->data.or.xs[p->data.or.n-1], 0);
+    printf(")");
+  }
+
+  if (p->type == MPC_TYPE_AND) {
+    printf("(");
+    for(i = 0; i < p->data.and.n-1; i++) {
+      mpc_print_unretained(p->data.and.xs[i], 0);
+      printf(" ");
+    }
+    mpc_print_unretained(p->data.and.xs[p->data.and.n-1], 0);
+    printf(")");
+  }
+
+  if (p->type == MPC_TYPE_CHECK) {
+    mpc_print_unretained(p->data.check.x, 0);
+    printf("->?");
+  }
+  if (p->type == MPC_TYPE_CHECK_WITH) {
+    mpc_print_unretained(p->data.check_with.x, 0);
+    printf("->?");
+  }
+
+}
+
+void mpc_print(mpc_parser_t *p) {
+  mpc_print_unretained(p, 1);
+  printf("\n");
+}
+
+/*
+** Testing
+*/
+
+/*
+** These functions are slightly unwieldy and
+** also the whole of the testing suite for mpc
+** mpc is pretty shaky.
+**
+** It could do with a lot more tests and more
+** precision. Currently I am only really testing
+** changes off of the examples.
+**
+*/
+
+int mpc_test_fail(mpc_parser_t *p, const char *s, const void *d,
+  int(*tester)(const void*, const void*),
+  mpc_dtor_t destructor,
+  void(*printer)(const void*)) {
+  mpc_result_t r;
+  (void) printer;
+  if (mpc_parse("<test>", s, p, &r)) {
+
+    if (tester(r.output, d)) {
+      destructor(r.output);
+      return 0;
+    } else {
+      destructor(r.output);
+      return 1;
+    }
+
+  } else {
+    mpc_err_delete(r.error);
+    return 1;
+  }
+
+}
+
+int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
+  int(*tester)(const void*, const void*),
+  mpc_dtor_t destructor,
+  void(*printer)(const void*)) {
+
+  mpc_result_t r;
+  if (mpc_parse("<test>", s, p, &r)) {
+
+    if (tester(r.output, d)) {
+      destructor(r.output);
+      return 1;
+    } else {
+      printf("Got "); printer(r.output); printf("\n");
+      printf("Expected "); printer(d); printf("\n");
+      destructor(r.output);
+      return 0;
+    }
+
+  } else {
+    mpc_err_print(r.error);
+    mpc_err_delete(r.error);
+    return 0;
+
+  }
+
+}
+
+
+/*
+** AST
+*/
+
+void mpc_ast_delete(mpc_ast_t *a) {
+
+  int i;
+
+  if (a == NULL) { return; }
+
+  if (a->flags & MPC_AST_ARENA) {
+    if (a->flags & MPC_AST_ARENA_ROOT) { mpc_ast_arena_delete((mpc_ast_arena_t*)a); }
+    return;
+  }
+
+  for (i = 0; i < a->children_num; i++) {
+    mpc_ast_delete(a->children[i]);
+  }
+
+  free(a->children);
+  free(a->tag);
+  free(a->contents);
+  free(a);
+
+}
+
+static void mpc_ast_delete_no_children(mpc_ast_t *a) {
+  if (a->flags & MPC_AST_ARENA) { return; }
+  free(a->children);
+  free(a->tag);
+  free(a->contents);
+  free(a);
+}
+
+static mpc_ast_t *mpc_ast_new_len(const char *tag, const char *contents, size_t n) {
+
+  mpc_ast_t *a = malloc(sizeof(mpc_ast_t));
+
+  a->tag = malloc(strlen(tag) + 1);
+  strcpy(a->tag, tag);
+  a->tag_id = -1;
+
+  a->contents = malloc(n + 1);
+  memcpy(a->contents, contents, n);
+  a->contents[n] = '\0';
+  a->contents_len = n;
+
+  a->state = mpc_state_new();
+
+  a->children_num = 0;
+  a->children = NULL;
+  a->flags = 0;
+  return a;
+
+}
+
+mpc_ast_t *mpc_ast_new(const char *tag, const char *contents) {
+  return mpc_ast_new_len(tag, contents, strlen(contents));
+}
+
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+
+  int i;
+  mpc_ast_t *b = mpc_ast_new_len(a->tag, a->contents, a->contents_len);
+
+  b->tag_id = a->tag_id;
+  b->state = a->state;
+  b->flags = a->flags & MPC_AST_DROPPABLE;
+  b->children_num = a->children_num;
+  b->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+
+  for (i = 0; i < a->children_num; i++) {
+    b->children[i] = mpc_ast_copy(a->children[i]);
+  }
+
+  return b;
+}
+
+mpc_ast_t *mpc_ast_build(int n, const char *tag, ...) {
+
+  mpc_ast_t *a = mpc_ast_new(tag, "");
+
+  int i;
+  va_list va;
+  va_start(va, tag);
+
+  for (i = 0; i < n; i++) {
+    mpc_ast_add_child(a, va_arg(va, mpc_ast_t*));
+  }
+
+  va_end(va);
+
+  return a;
+
+}
+
+mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a) {
+
+  mpc_ast_t *r;
+
+  if (a == NULL) { return a; }
+  if (a->children_num == 0) { return a; }
+  if (a->children_num == 1) { return a; }
+
+  r = mpc_ast_new(">", "");
+  mpc_ast_add_child(r, a);
+  return r;
+}
+
+int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b) {
+
+  int i;
+
+  if (strcmp(a->tag, b->tag) != 0) { return 0; }
+  if (a->contents_len != b->contents_len) { return 0; }
+  if (memcmp(a->contents, b->contents, a->contents_len) != 0) { return 0; }
+  if (a->children_num != b->children_num) { return 0; }
+
+  for (i = 0; i < a->children_num; i++) {
+    if (!mpc_ast_eq(a->children[i], b->children[i])) { return 0; }
+  }
+
+  return 1;
+}
+
+mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a) {
+  r->children_num++;
+  r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
+  r->children[r->children_num-1] = a;
+  return r;
+}
+
+mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t) {
+  if (a == NULL) { return a; }
+  a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
+  memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
+  memmove(a->tag, t, strlen(t));
+  memmove(a->tag + strlen(t), "|", 1);
+  return a;
+}
+
+mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t) {
+  if (a == NULL) { return a; }
+  a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
+  memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
+  memmove(a->tag, t, (strlen(t)-1));
+  return a;
+}
+
+/* The innermost rule gives a node its `tag_id` */
+mpc_ast_t *mpc_ast_add_rule(mpc_ast_t *a, mpc_parser_t *p) {
+  if (a == NULL) { return a; }
+  a = mpc_ast_add_tag(a, p->name);
+  if (a->tag_id < 0) { a->tag_id = p->id; }
+  return a;
+}
+
+mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t) {
+  a->tag = realloc(a->tag, strlen(t) + 1);
+  strcpy(a->tag, t);
+  return a;
+}
+
+mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s) {
+  if (a == NULL) { return a; }
+  a->state = s;
+  return a;
+}
+
+static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp) {
+
+  int i;
+
+  if (a == NULL) {
+    fprintf(fp, "NULL\n");
+    return;
+  }
+
+  for (i = 0; i < d; i++) { fprintf(fp, "  "); }
+
+  if (a->contents_len) {
+    fprintf(fp, "%s:%lu:%lu '%.*s'\n", a->tag,
+      (long unsigned int)(a->state.row+1),
+      (long unsigned int)(a->state.col+1),
+      (int)a->contents_len, a->contents);
+  } else {
+    fprintf(fp, "%s \n", a->tag);
+  }
+
+  for (i = 0; i < a->children_num; i++) {
+    mpc_ast_print_depth(a->children[i], d+1, fp);
+  }
+
+}
+
+void mpc_ast_print(mpc_ast_t *a) {
+  mpc_ast_print_depth(a, 0, stdout);
+}
+
+void mpc_ast_print_to(mpc_ast_t *a, FILE *fp) {
+  mpc_ast_print_depth(a, 0, fp);
+}
+
+int mpc_ast_get_index(mpc_ast_t *ast, const char *tag) {
+  return mpc_ast_get_index_lb(ast, tag, 0);
+}
+
+int mpc_ast_get_index_lb(mpc_ast_t *ast, const char *tag, int lb) {
+  int i;
+
+  for(i=lb; i<ast->children_num; i++) {
+    if(strcmp(ast->children[i]->tag, tag) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+mpc_ast_t *mpc_ast_get_child(mpc_ast_t *ast, const char *tag) {
+  return mpc_ast_get_child_lb(ast, tag, 0);
+}
+
+mpc_ast_t *mpc_ast_get_child_lb(mpc_ast_t *ast, const char *tag, int lb) {
+  int i;
+
+  for(i=lb; i<ast->children_num; i++) {
+    if(strcmp(ast->children[i]->tag, tag) == 0) {
+      return ast->children[i];
+    }
+  }
+
+  return NULL;
+}
+
+mpc_ast_trav_t *mpc_ast_traverse_start(mpc_ast_t *ast,
+                                       mpc_ast_trav_order_t order)
+{
+  mpc_ast_trav_t *trav, *n_trav;
+  mpc_ast_t *cnode = ast;
+
+  /* Create the traversal structure */
+  trav = malloc(sizeof(mpc_ast_trav_t));
+  trav->curr_node = cnode;
+  trav->parent = NULL;
+  trav->curr_child = 0;
+  trav->order = order;
+
+  /* Get start node */
+  switch(order) {
+    case mpc_ast_trav_order_pre:
+      /* Nothing else is needed for pre order start */
+      break;
+
+    case mpc_ast_trav_order_post:
+      while(cnode->children_num > 0) {
+        cnode = cnode->children[0];
+
+        n_trav = malloc(sizeof(mpc_ast_trav_t));
+        n_trav->curr_node = cnode;
+        n_trav->parent = trav;
+        n_trav->curr_child = 0;
+        n_trav->order = order;
+
+        trav = n_trav;
+      }
+
+      break;
+
+    default:
+      /* Unreachable, but compiler complaints */
+      break;
+  }
+
+  return trav;
+}
+
+mpc_ast_t *mpc_ast_traverse_next(mpc_ast_trav_t **trav) {
+  mpc_ast_trav_t *n_trav, *to_free;
+  mpc_ast_t *ret = NULL;
+  int cchild;
+
+  /* The end of traversal was reached */
+  if(*trav == NULL) return NULL;
+
+  switch((*trav)->order) {
+    case mpc_ast_trav_order_pre:
+      ret = (*trav)->curr_node;
+
+      /* If there aren't any more children, go up */
+      while(*trav != NULL &&
+        (*trav)->curr_child >= (*trav)->curr_node->children_num)
+      {
+        to_free = *trav;
+        *trav = (*trav)->parent;
+        free(to_free);
+      }
+
+      /* If trav is NULL, the end was reached */
+      if(*trav == NULL) {
+        break;
+      }
+
+      /* Go to next child */
+      n_trav = malloc(sizeof(mpc_ast_trav_t));
+
+      cchild = (*trav)->curr_child;
+      n_trav->curr_node = (*trav)->curr_node->children[cchild];
+      n_trav->parent = *trav;
+      n_trav->curr_child = 0;
+      n_trav->order = (*trav)->order;
+
+      (*trav)->curr_child++;
+      *trav = n_trav;
+
+      break;
+
+    case mpc_ast_trav_order_post:
+      ret = (*trav)->curr_node;
+
+      /* Move up tree to the parent If the parent doesn't have any more nodes,
+       * then this is the current node. If it does, move down to its left most
+       * child. Also, free the previous traversal node */
+      to_free = *trav;
+      *trav = (*trav)->parent;
+      free(to_free);
+
+      if(*trav == NULL)
+        break;
+
+      /* Next child */
+      (*trav)->curr_child++;
+
+      /* If there aren't any more children, this is the next node */
+      if((*trav)->curr_child >= (*trav)->curr_node->children_num) {
+        break;
+      }
+
+      /* If there are still more children, find the leftmost child from this
+       * node */
+      while((*trav)->curr_node->children_num > 0) {
+        n_trav = malloc(sizeof(mpc_ast_trav_t));
+
+        cchild = (*trav)->curr_child;
+        n_trav->curr_node = (*trav)->curr_node->children[cchild];
+        n_trav->parent = *trav;
+        n_trav->curr_child = 0;
+        n_trav->order = (*trav)->order;
+
+        *trav = n_trav;
+      }
+
+    default:
+      /* Unreachable, but compiler complaints */
+      break;
+  }
+
+  return ret;
+}
+
+void mpc_ast_traverse_free(mpc_ast_trav_t **trav) {
+  mpc_ast_trav_t *n_trav;
+
+  /* Go through parents until all are free */
+  while(*trav != NULL) {
+      n_trav = (*trav)->parent;
+      free(*trav);
+      *trav = n_trav;
+  }
+}
+
+mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs) {
+
+  int i, j;
+  mpc_ast_t** as = (mpc_ast_t**)xs;
+  mpc_ast_t *r;
+
+  if (n == 0) { return NULL; }
+  if (n == 1) { return xs[0]; }
+  if (n == 2 && xs[1] == NULL) { return xs[0]; }
+  if (n == 2 && xs[0] == NULL) { return xs[1]; }
+
+  r = mpc_ast_new(">", "");
+
+  for (i = 0; i < n; i++) {
+
+    if (as[i] == NULL) { continue; }
+
+    if        (as[i] && as[i]->children_num == 0) {
+      mpc_ast_add_child(r, as[i]);
+    } else if (as[i] && as[i]->children_num == 1) {
+      mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
+      mpc_ast_delete_no_children(as[i]);
+    } else if (as[i] && as[i]->children_num >= 2) {
+      for (j = 0; j < as[i]->children_num; j++) {
+        mpc_ast_add_child(r, as[i]->children[j]);
+      }
+      mpc_ast_delete_no_children(as[i]);
+    }
+
+  }
+
+  if (r->children_num) {
+    r->state = r->children[0]->state;
+  }
+
+  return r;
+}
+
+mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
+  mpc_ast_t *a = mpc_ast_new("", c);
+  free(c);
+  return a;
+}
+
+mpc_val_t *mpcf_lit_ast(mpc_val_t *c) {
+  mpc_ast_t *a = mpcf_str_ast(c);
+  a->flags |= MPC_AST_DROPPABLE;
+  return a;
+}
+
+mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs) {
+  mpc_state_t *s = ((mpc_state_t**)xs)[0];
+  mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
+  (void)n;
+  a = mpc_ast_state(a, *s);
+  free(s);
+  return a;
+}
+
+mpc_parser_t *mpca_state(mpc_parser_t *a) {
+  return mpc_and(2, mpcf_state_ast, mpc_state(), a, free);
+}
+
+mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t) {
+  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_tag, (void*)t);
+}
+
+mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
+  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
+}
+
+mpc_parser_t *mpca_root(mpc_parser_t *a) {
+  return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
+}
+
+mpc_parser_t *mpca_not(mpc_parser_t *a) { return mpc_not(a, (mpc_dtor_t)mpc_ast_delete); }
+mpc_parser_t *mpca_maybe(mpc_parser_t *a) { return mpc_maybe(a); }
+mpc_parser_t *mpca_many(mpc_parser_t *a) { return mpc_many(mpcf_fold_ast, a); }
+mpc_parser_t *mpca_many1(mpc_parser_t *a) { return mpc_many1(mpcf_fold_ast, a); }
+mpc_parser_t *mpca_count(int n, mpc_parser_t *a) { return mpc_count(n, mpcf_fold_ast, a, (mpc_dtor_t)mpc_ast_delete); }
+
+mpc_parser_t *mpca_or(int n, ...) {
+
+  int i;
+  va_list va;
+
+  mpc_parser_t *p = mpc_undefined();
+
+  p->type = MPC_TYPE_OR;
+  p->data.or.n = n;
+  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+
+  va_start(va, n);
+  for (i = 0; i < n; i++) {
+    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
+  }
+  va_end(va);
+
+  return p;
+
+}
+
+mpc_parser_t *mpca_and(int n, ...) {
+
+  int i;
+  va_list va;
+
+  mpc_parser_t *p = mpc_undefined();
+
+  p->type = MPC_TYPE_AND;
+  p->data.and.n = n;
+  p->data.and.f = mpcf_fold_ast;
+  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
+
+  va_start(va, n);
+  for (i = 0; i < n; i++) {
+    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
+  }
+  for (i = 0; i < (n-1); i++) {
+    p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete;
+  }
+  va_end(va);
+
+  return p;
+}
+
+mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
+
+/*
+** Grammar Parser
+*/
+
+/*
+** This is another interesting bootstrapping.
+**
+** Having a general purpose AST type allows
+** users to specify the grammar alone and
+** let all fold rules be automatically taken
+** care of by existing functions.
+**
+** You don't get to control the type spat
+** out but this means you can make a nice
+** parser to take in some grammar in nice
+** syntax and spit out a parser that works.
+**
+** The grammar for this looks surprisingly
+** like regex but the main difference is that
+** it is now whitespace insensitive and the
+** base type takes literals of some form.
+*/
+
+/*
+**
+**  ### Grammar Grammar
+**
+**      <grammar> : (<term> "|" <grammar>) | <term>
+**
+**      <term> : <factor>*
+**
+**      <factor> : <base>
+**               | <base> "*"
+**               | <base> "+"
+**               | <base> "?"
+**               | <base> "{" <digits> "}"
+**
+**      <base> : "<" (<digits> | <ident>) ">"
+**             | <string_lit>
+**             | <char_lit>
+**             | <regex_lit> <regex_mode>
+**             | "(" <grammar> ")"
+*/
+
+typedef struct {
+  va_list *va;
+  int parsers_num;
+  mpc_parser_t **parsers;
+  int flags;
+} mpca_grammar_st_t;
+
+static mpc_val_t *mpcaf_grammar_or(int n, mpc_val_t **xs) {
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  else { return mpca_or(2, xs[0], xs[1]); }
+}
+
+static mpc_val_t *mpcaf_grammar_and(int n, mpc_val_t **xs) {
+  int i;
+  mpc_parser_t *p = mpc_pass();
+  for (i = 0; i < n; i++) {
+    if (xs[i] != NULL) { p = mpca_and(2, p, xs[i]); }
+  }
+  return p;
+}
+
+static mpc_val_t *mpcaf_grammar_repeat(int n, mpc_val_t **xs) {
+  int num;
+  (void) n;
+  if (xs[1] == NULL) { return xs[0]; }
+  switch(((char*)xs[1])[0])
+  {
+    case '*': { free(xs[1]); return mpca_many(xs[0]); }; break;
+    case '+': { free(xs[1]); return mpca_many1(xs[0]); }; break;
+    case '?': { free(xs[1]); return mpca_maybe(xs[0]); }; break;
+    case '!': { free(xs[1]); return mpca_not(xs[0]); }; break;
+    default:
+      num = *((int*)xs[1]);
+      free(xs[1]);
+  }
+  return mpca_count(num, xs[0]);
+}
+
+static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
+  mpca_grammar_st_t *st = s;
+  char *y = mpcf_unescape(x);
+  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpc_tok(mpc_string(y));
+  free(y);
+  return mpca_state(mpca_tag(mpc_apply(p, mpcf_lit_ast), "string"));
+}
+
+static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
+  mpca_grammar_st_t *st = s;
+  char *y = mpcf_unescape(x);
+  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpc_tok(mpc_char(y[0]));
+  free(y);
+  return mpca_state(mpca_tag(mpc_apply(p, mpcf_lit_ast), "char"));
+}
+
+static mpc_val_t *mpcaf_fold_regex(int n, mpc_val_t **xs) {
+  char *y = xs[0];
+  char *m = xs[1];
+  mpca_grammar_st_t *st = xs[2];
+  mpc_parser_t *p;
+  mpc_apply_t f;
+  int mode = MPC_RE_DEFAULT;
+
+  (void)n;
+  if (strchr(m, 'm')) { mode |= MPC_RE_MULTILINE; }
+  if (strchr(m, 's')) { mode |= MPC_RE_DOTALL; }
+  y = mpcf_unescape_regex(y);
+  p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re_mode(y, mode) : mpc_tok(mpc_re_mode(y, mode));
+
+  /* A regex of only anchors never matches any text */
+  f = y[strspn(y, "^$")] == '\0' ? mpcf_lit_ast : mpcf_str_ast;
+  free(y);
+  free(m);
+
+  return mpca_state(mpca_tag(mpc_apply(p, f), "regex"));
+}
+
+/* Should this just use `isdigit` instead? */
+static int is_number(const char* s) {
+  size_t i;
+  for (i = 0; i < strlen(s); i++) { if (!strchr("0123456789", s[i])) { return 0; } }
+  return 1;
+}
+
+static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
+
+  int i;
+  mpc_parser_t *p;
+
+  /* Case of Number */
+  if (is_number(x)) {
+
+    i = strtol(x, NULL, 10);
+
+    while (st->parsers_num <= i) {
+      st->parsers_num++;
+      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
+      st->parsers[st->parsers_num-1] = va_arg(*st->va, mpc_parser_t*);
+      if (st->parsers[st->parsers_num-1] == NULL) {
+        return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
+      }
+      st->parsers[st->parsers_num-1]->id = st->parsers_num-1;
+    }
+
+    return st->parsers[st->parsers_num-1];
+
+  /* Case of Identifier */
+  } else {
+
+    /* Search Existing Parsers */
+    for (i = 0; i < st->parsers_num; i++) {
+      mpc_parser_t *q = st->parsers[i];
+      if (q == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
+      if (q->name && strcmp(q->name, x) == 0) { return q; }
+    }
+
+    /* Search New Parsers */
+    while (1) {
+
+      p = va_arg(*st->va, mpc_parser_t*);
+
+      st->parsers_num++;
+      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
+      st->parsers[st->parsers_num-1] = p;
+
+      if (p == NULL || p->name == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
+      p->id = st->parsers_num-1;
+      if (strcmp(p->name, x) == 0) { return p; }
+
+    }
+
+  }
+
+}
+
+static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
+
+  mpca_grammar_st_t *st = s;
+  mpc_parser_t *p = mpca_grammar_find_parser(x, st);
+  free(x);
+
+  if (p->name) {
+    return mpca_state(mpca_root(mpc_apply_to(p, (mpc_apply_to_t)mpc_ast_add_rule, p)));
+  } else {
+    return mpca_state(mpca_root(p));
+  }
+}
+
+mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
+
+  char *err_msg;
+  mpc_parser_t *err_out;
+  mpc_result_t r;
+  mpc_parser_t *GrammarTotal, *Grammar, *Term, *Factor, *Base;
+
+  GrammarTotal = mpc_new("grammar_total");
+  Grammar = mpc_new("grammar");
+  Term = mpc_new("term");
+  Factor = mpc_new("factor");
+  Base = mpc_new("base");
+
+  mpc_define(GrammarTotal,
+    mpc_predictive(mpc_total(Grammar, mpc_soft_delete))
+  );
+
+  mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
+    Term,
+    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, free)),
+    mpc_soft_delete
+  ));
+
+  mpc_define(Term, mpc_many1(mpcaf_grammar_and, Factor));
+
+  mpc_define(Factor, mpc_and(2, mpcaf_grammar_repeat,
+    Base,
+      mpc_or(6,
+        mpc_sym("*"),
+        mpc_sym("+"),
+        mpc_sym("?"),
+        mpc_sym("!"),
+        mpc_tok_brackets(mpc_int(), free),
+        mpc_pass()),
+    mpc_soft_delete
+  ));
+
+  mpc_define(Base, mpc_or(5,
+    mpc_apply_to(mpc_tok(mpc_string_lit()), mpcaf_grammar_string, st),
+    mpc_apply_to(mpc_tok(mpc_char_lit()),   mpcaf_grammar_char, st),
+    mpc_tok(mpc_and(3, mpcaf_fold_regex, mpc_regex_lit(), mpc_many(mpcf_strfold, mpc_oneof("ms")), mpc_lift_val(st), free, free)),
+    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), free), mpcaf_grammar_id, st),
+    mpc_tok_parens(Grammar, mpc_soft_delete)
+  ));
+
+  mpc_optimise(GrammarTotal);
+  mpc_optimise(Grammar);
+  mpc_optimise(Factor);
+  mpc_optimise(Term);
+  mpc_optimise(Base);
+
+  if(!mpc_parse("<mpc_grammar_compiler>", grammar, GrammarTotal, &r)) {
+    err_msg = mpc_err_string(r.error);
+    err_out = mpc_failf("Invalid Grammar: %s", err_msg);
+    mpc_err_delete(r.error);
+    free(err_msg);
+    r.output = err_out;
+  }
+
+  mpc_cleanup(5, GrammarTotal, Grammar, Term, Factor, Base);
+
+  mpc_optimise(r.output);
+
+  return (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_predictive(r.output) : r.output;
+
+}
+
+mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...) {
+  mpca_grammar_st_t st;
+  mpc_parser_t *res;
+  va_list va;
+  va_start(va, grammar);
+
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+
+  res = mpca_grammar_st(grammar, &st);
+  free(st.parsers);
+  va_end(va);
+  return res;
+}
+
+typedef struct {
+  char *ident;
+  char *name;
+  mpc_parser_t *grammar;
+} mpca_stmt_t;
+
+static mpc_val_t *mpca_stmt_afold(int n, mpc_val_t **xs) {
+  mpca_stmt_t *stmt = malloc(sizeof(mpca_stmt_t));
+  stmt->ident = ((char**)xs)[0];
+  stmt->name = ((char**)xs)[1];
+  stmt->grammar = ((mpc_parser_t**)xs)[3];
+  (void) n;
+  free(((char**)xs)[2]);
+  free(((char**)xs)[4]);
+
+  return stmt;
+}
+
+static mpc_val_t *mpca_stmt_fold(int n, mpc_val_t **xs) {
+
+  int i;
+  mpca_stmt_t **stmts = malloc(sizeof(mpca_stmt_t*) * (n+1));
+
+  for (i = 0; i < n; i++) {
+    stmts[i] = xs[i];
+  }
+  stmts[n] = NULL;
+
+  return stmts;
+}
+
+static void mpca_stmt_list_delete(mpc_val_t *x) {
+
+  mpca_stmt_t **stmts = x;
+
+  while(*stmts) {
+    mpca_stmt_t *stmt = *stmts;
+    free(stmt->ident);
+    free(stmt->name);
+    mpc_soft_delete(stmt->grammar);
+    free(stmt);
+    stmts++;
+  }
+  free(x);
+
+}
+
+static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
+
+  mpca_grammar_st_t *st = s;
+  mpca_stmt_t *stmt;
+  mpca_stmt_t **stmts = x;
+  mpc_parser_t *left;
+
+  while(*stmts) {
+    stmt = *stmts;
+    left = mpca_grammar_find_parser(stmt->ident, st);
+    if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
+    if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
+    if (st->flags & MPCA_LANG_PACKRAT) {
+      stmt->grammar = mpc_memo(stmt->grammar, (mpc_apply_t)mpc_ast_copy, (mpc_dtor_t)mpc_ast_delete);
+    }
+    mpc_optimise(stmt->grammar);
+    mpc_define(left, stmt->grammar);
+    free(stmt->ident);
+    free(stmt->name);
+    free(stmt);
+    stmts++;
+  }
+
+  free(x);
+
+  return NULL;
+}
+
+static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
+
+  mpc_result_t r;
+  mpc_err_t *e;
+  mpc_parser_t *Lang, *Stmt, *Grammar, *Term, *Factor, *Base;
+
+  Lang    = mpc_new("lang");
+  Stmt    = mpc_new("stmt");
+  Grammar = mpc_new("grammar");
+  Term    = mpc_new("term");
+  Factor  = mpc_new("factor");
+  Base    = mpc_new("base");
+
+  mpc_define(Lang, mpc_apply_to(
+    mpc_total(mpc_predictive(mpc_many(mpca_stmt_fold, Stmt)), mpca_stmt_list_delete),
+    mpca_stmt_list_apply_to, st
+  ));
+
+  mpc_define(Stmt, mpc_and(5, mpca_stmt_afold,
+    mpc_tok(mpc_ident()), mpc_maybe(mpc_tok(mpc_string_lit())), mpc_sym(":"), Grammar, mpc_sym(";"),
+    free, free, free, mpc_soft_delete
+  ));
+
+  mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
+      Term,
+      mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, free)),
+      mpc_soft_delete
+  ));
+
+  mpc_define(Term, mpc_many1(mpcaf_grammar_and, Factor));
+
+  mpc_define(Factor, mpc_and(2, mpcaf_grammar_repeat,
+    Base,
+      mpc_or(6,
+        mpc_sym("*"),
+        mpc_sym("+"),
+        mpc_sym("?"),
+        mpc_sym("!"),
+        mpc_tok_brackets(mpc_int(), free),
+        mpc_pass()),
+    mpc_soft_delete
+  ));
+
+  mpc_define(Base, mpc_or(5,
+    mpc_apply_to(mpc_tok(mpc_string_lit()), mpcaf_grammar_string, st),
+    mpc_apply_to(mpc_tok(mpc_char_lit()),   mpcaf_grammar_char, st),
+    mpc_tok(mpc_and(3, mpcaf_fold_regex, mpc_regex_lit(), mpc_many(mpcf_strfold, mpc_oneof("ms")), mpc_lift_val(st), free, free)),
+    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), free), mpcaf_grammar_id, st),
+    mpc_tok_parens(Grammar, mpc_soft_delete)
+  ));
+
+  mpc_optimise(Lang);
+  mpc_optimise(Stmt);
+  mpc_optimise(Grammar);
+  mpc_optimise(Term);
+  mpc_optimise(Factor);
+  mpc_optimise(Base);
+
+  if (!mpc_parse_input(i, Lang, &r)) {
+    e = r.error;
+  } else {
+    e = NULL;
+  }
+
+  mpc_cleanup(6, Lang, Stmt, Grammar, Term, Factor, Base);
+
+  return e;
+}
+
+mpc_err_t *mpca_lang_file(int flags, FILE *f, ...) {
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+
+  va_list va;
+  va_start(va, f);
+
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+
+  i = mpc_input_new_file("<mpca_lang_file>", f);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
+mpc_err_t *mpca_lang_pipe(int flags, FILE *p, ...) {
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+
+  va_list va;
+  va_start(va, p);
+
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+
+  i = mpc_input_new_pipe("<mpca_lang_pipe>", p);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
+mpc_err_t *mpca_lang(int flags, const char *language, ...) {
+
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+
+  va_list va;
+  va_start(va, language);
+
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+
+  i = mpc_input_new_string("<mpca_lang>", language);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+
+  free(st.parsers);
+  va_end(va);
+  return err;
+}
+
+mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
+
+  mpca_grammar_st_t st;
+  mpc_input_t *i;
+  mpc_err_t *err;
+
+  va_list va;
+
+  FILE *f = fopen(filename, "rb");
+
+  if (f == NULL) {
+    err = mpc_err_file(filename, "Unable to open file!");
+    return err;
+  }
+
+  va_start(va, filename);
+
+  st.va = &va;
+  st.parsers_num = 0;
+  st.parsers = NULL;
+  st.flags = flags;
+
+  i = mpc_input_new_file(filename, f);
+  err = mpca_lang_st(i, &st);
+  mpc_input_delete(i);
+
+  free(st.parsers);
+  va_end(va);
+
+  fclose(f);
+
+  return err;
+}
+
+static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
+
+  int i, total;
+
+  if (p->retained && !force) { return 0; }
+
+  if (p->type == MPC_TYPE_EXPECT) { return 1 + mpc_nodecount_unretained(p->data.expect.x, 0); }
+
+  if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
+  if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
+  if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
 
-  r = mpc_ast_new(">", "");
+  if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
+  if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
 
-  for (i = 0; i < n; i++) {
+  if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
 
-    if (as[i] == NULL) { continue; }
+  if (p->type == MPC_TYPE_MANY)  { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
 
-    if        (as[i] && as[i]->children_num == 0) {
-      mpc_ast_add_child(r, as[i]);
-    } else if (as[i] && as[i]->children_num == 1) {
-      mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
-      mpc_ast_delete_no_children(as[i]);
-    } else if (as[i] && as[i]->children_num >= 2) {
-      for (j = 0; j < as[i]->children_num; j++) {
-        mpc_ast_add_child(r, as[i]->children[j]);
-      }
-      mpc_ast_delete_no_children(as[i]);
-    }
+  if (p->type == MPC_TYPE_DFA)   { return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0); }
+  if (p->type == MPC_TYPE_SPAN)  { return 1 + mpc_nodecount_unretained(p->data.span.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)  { return 1 + mpc_nodecount_unretained(p->data.memo.x, 0); }
 
+  if (p->type == MPC_TYPE_OR) {
+    total = 1;
+    for(i = 0; i < p->data.or.n; i++) {
+      total += mpc_nodecount_unretained(p->data.or.xs[i], 0);
+    }
+    return total;
   }
 
-  if (r->children_num) {
-    r->state = r->children[0]->state;
+  if (p->type == MPC_TYPE_AND) {
+    total = 1;
+    for(i = 0; i < p->data.and.n; i++) {
+      total += mpc_nodecount_unretained(p->data.and.xs[i], 0);
+    }
+    return total;
   }
 
-  return r;
-}
+  return 1;
 
-mpc_val_t *mpcf_str_ast(mpc_val_t *c) {
-  mpc_ast_t *a = mpc_ast_new("", c);
-  free(c);
-  return a;
 }
 
-mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs) {
-  mpc_state_t *s = ((mpc_state_t**)xs)[0];
-  mpc_ast_t *a = ((mpc_ast_t**)xs)[1];
-  (void)n;
-  a = mpc_ast_state(a, *s);
-  free(s);
-  return a;
+void mpc_stats(mpc_parser_t* p) {
+  printf("Stats\n");
+  printf("=====\n");
+  printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
 }
 
-mpc_parser_t *mpca_state(mpc_parser_t *a) {
-  return mpc_and(2, mpcf_state_ast, mpc_state(), a, free);
+static mpc_class_t *mpc_optimise_class(mpc_parser_t *p) {
+  char r[2];
+  switch (p->type) {
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      return mpc_class_copy(p->data.cls.c);
+    case MPC_TYPE_RANGE:
+      r[0] = p->data.range.x;
+      r[1] = p->data.range.y;
+      return mpc_class_new(mpc_class_range, r);
+    default: return NULL;
+  }
 }
 
-mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t) {
-  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_tag, (void*)t);
-}
+static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
 
-mpc_parser_t *mpca_add_tag(mpc_parser_t *a, const char *t) {
-  return mpc_apply_to(a, (mpc_apply_to_t)mpc_ast_add_tag, (void*)t);
-}
+  int i, n, m;
+  mpc_parser_t *t;
 
-mpc_parser_t *mpca_root(mpc_parser_t *a) {
-  return mpc_apply(a, (mpc_apply_t)mpc_ast_add_root);
-}
+  if (p->retained && !force) { return; }
 
-mpc_parser_t *mpca_not(mpc_parser_t *a) { return mpc_not(a, (mpc_dtor_t)mpc_ast_delete); }
-mpc_parser_t *mpca_maybe(mpc_parser_t *a) { return mpc_maybe(a); }
-mpc_parser_t *mpca_many(mpc_parser_t *a) { return mpc_many(mpcf_fold_ast, a); }
-mpc_parser_t *mpca_many1(mpc_parser_t *a) { return mpc_many1(mpcf_fold_ast, a); }
-mpc_parser_t *mpca_count(int n, mpc_parser_t *a) { return mpc_count(n, mpcf_fold_ast, a, (mpc_dtor_t)mpc_ast_delete); }
+  /* Optimise Subexpressions */
 
-mpc_parser_t *mpca_or(int n, ...) {
+  if (p->type == MPC_TYPE_EXPECT)     { mpc_optimise_unretained(p->data.expect.x, 0); }
+  if (p->type == MPC_TYPE_APPLY)      { mpc_optimise_unretained(p->data.apply.x, 0); }
+  if (p->type == MPC_TYPE_APPLY_TO)   { mpc_optimise_unretained(p->data.apply_to.x, 0); }
+  if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
+  if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0); }
+  if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_unretained(p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_MANY1)      { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_COUNT)      { mpc_optimise_unretained(p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)       { mpc_optimise_unretained(p->data.memo.x, 0); }
 
-  int i;
-  va_list va;
+  if (p->type == MPC_TYPE_OR) {
+    for(i = 0; i < p->data.or.n; i++) {
+      mpc_optimise_unretained(p->data.or.xs[i], 0);
+    }
+  }
 
-  mpc_parser_t *p = mpc_undefined();
+  if (p->type == MPC_TYPE_AND) {
+    for(i = 0; i < p->data.and.n; i++) {
+      mpc_optimise_unretained(p->data.and.xs[i], 0);
+    }
+  }
 
-  p->type = MPC_TYPE_OR;
-  p->data.or.n = n;
-  p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  /* Perform optimisations */
 
-  va_start(va, n);
-  for (i = 0; i < n; i++) {
-    p->data.or.xs[i] = va_arg(va, mpc_parser_t*);
-  }
-  va_end(va);
+  while (1) {
 
-  return p;
+    /* Merge rhs `or` */
+    if (p->type == MPC_TYPE_OR
+    &&  p->data.or.xs[p->data.or.n-1]->type == MPC_TYPE_OR
+    && !p->data.or.xs[p->data.or.n-1]->retained) {
+      t = p->data.or.xs[p->data.or.n-1];
+      n = p->data.or.n; m = t->data.or.n;
+      p->data.or.n = n + m - 1;
+      p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
+      memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
+      mpc_dispatch_delete(t->data.or.d);
+      free(t->data.or.xs); free(t->name); free(t);
+      continue;
+    }
 
-}
+    /* Merge lhs `or` */
+    if (p->type == MPC_TYPE_OR
+    &&  p->data.or.xs[0]->type == MPC_TYPE_OR
+    && !p->data.or.xs[0]->retained) {
+      t = p->data.or.xs[0];
+      n = p->data.or.n; m = t->data.or.n;
+      p->data.or.n = n + m - 1;
+      p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
+      memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
+      memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
+      mpc_dispatch_delete(t->data.or.d);
+      free(t->data.or.xs); free(t->name); free(t);
+      continue;
+    }
 
-mpc_parser_t *mpca_and(int n, ...) {
+    /* Remove ast `pass` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.n == 2
+    &&  p->data.and.xs[0]->type == MPC_TYPE_PASS
+    && !p->data.and.xs[0]->retained
+    &&  p->data.and.f == mpcf_fold_ast) {
+      t = p->data.and.xs[1];
+      mpc_delete(p->data.and.xs[0]);
+      free(p->data.and.xs); free(p->data.and.dxs); free(p->name);
+      memcpy(p, t, sizeof(mpc_parser_t));
+      free(t);
+      continue;
+    }
 
-  int i;
-  va_list va;
+    /* Merge ast lhs `and` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.f == mpcf_fold_ast
+    &&  p->data.and.xs[0]->type == MPC_TYPE_AND
+    && !p->data.and.xs[0]->retained
+    &&  p->data.and.xs[0]->data.and.f == mpcf_fold_ast) {
+      t = p->data.and.xs[0];
+      n = p->data.and.n; m = t->data.and.n;
+      p->data.and.n = n + m - 1;
+      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m - 1));
+      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
+      memmove(p->data.and.xs + m, p->data.and.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
+      memmove(p->data.and.xs, t->data.and.xs, m * sizeof(mpc_parser_t*));
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
+      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t);
+      continue;
+    }
 
-  mpc_parser_t *p = mpc_undefined();
+    /* Merge ast rhs `and` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.f == mpcf_fold_ast
+    &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
+    && !p->data.and.xs[p->data.and.n-1]->retained
+    &&  p->data.and.xs[p->data.and.n-1]->data.and.f == mpcf_fold_ast) {
+      t = p->data.and.xs[p->data.and.n-1];
+      n = p->data.and.n; m = t->data.and.n;
+      p->data.and.n = n + m - 1;
+      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m -1));
+      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
+      memmove(p->data.and.xs + n - 1, t->data.and.xs, m * sizeof(mpc_parser_t*));
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
+      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t);
+      continue;
+    }
 
-  p->type = MPC_TYPE_AND;
-  p->data.and.n = n;
-  p->data.and.f = mpcf_fold_ast;
-  p->data.and.xs = malloc(sizeof(mpc_parser_t*) * n);
-  p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (n-1));
+    /* Remove re `lift` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.n == 2
+    &&  p->data.and.xs[0]->type == MPC_TYPE_LIFT
+    &&  p->data.and.xs[0]->data.lift.lf == mpcf_ctor_str
+    && !p->data.and.xs[0]->retained
+    &&  p->data.and.f == mpcf_strfold) {
+      t = p->data.and.xs[1];
+      mpc_delete(p->data.and.xs[0]);
+      free(p->data.and.xs); free(p->data.and.dxs); free(p->name);
+      memcpy(p, t, sizeof(mpc_parser_t));
+      free(t);
+      continue;
+    }
 
-  va_start(va, n);
-  for (i = 0; i < n; i++) {
-    p->data.and.xs[i] = va_arg(va, mpc_parser_t*);
-  }
-  for (i = 0; i < (n-1); i++) {
-    p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete;
-  }
-  va_end(va);
+    /* Merge re lhs `and` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.f == mpcf_strfold
+    &&  p->data.and.xs[0]->type == MPC_TYPE_AND
+    && !p->data.and.xs[0]->retained
+    &&  p->data.and.xs[0]->data.and.f == mpcf_strfold) {
+      t = p->data.and.xs[0];
+      n = p->data.and.n; m = t->data.and.n;
+      p->data.and.n = n + m - 1;
+      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m - 1));
+      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
+      memmove(p->data.and.xs + m, p->data.and.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
+      memmove(p->data.and.xs, t->data.and.xs, m * sizeof(mpc_parser_t*));
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = free; }
+      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t);
+      continue;
+    }
 
-  return p;
-}
+    /* Merge re rhs `and` */
+    if (p->type == MPC_TYPE_AND
+    &&  p->data.and.f == mpcf_strfold
+    &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
+    && !p->data.and.xs[p->data.and.n-1]->retained
+    &&  p->data.and.xs[p->data.and.n-1]->data.and.f == mpcf_strfold) {
+      t = p->data.and.xs[p->data.and.n-1];
+      n = p->data.and.n; m = t->data.and.n;
+      p->data.and.n = n + m - 1;
+      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m -1));
+      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
+      memmove(p->data.and.xs + n - 1, t->data.and.xs, m * sizeof(mpc_parser_t*));
+      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = free; }
+      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t);
+      continue;
+    }
+
+    /* Fuse `many` of a character class into a `span` */
+    if ((p->type == MPC_TYPE_MANY || p->type == MPC_TYPE_MANY1)
+    &&  p->data.repeat.f == mpcf_strfold
+    &&  p->data.repeat.x->type == MPC_TYPE_EXPECT
+    && !p->data.repeat.x->retained
+    && !p->data.repeat.x->data.expect.x->retained
+    && (p->data.repeat.x->data.expect.x->type == MPC_TYPE_ONEOF
+    ||  p->data.repeat.x->data.expect.x->type == MPC_TYPE_NONEOF
+    ||  p->data.repeat.x->data.expect.x->type == MPC_TYPE_RANGE)) {
+      t = p->data.repeat.x;
+      n = p->type == MPC_TYPE_MANY1;
+      p->type = MPC_TYPE_SPAN;
+      p->data.span.x = t;
+      p->data.span.c = mpc_optimise_class(t->data.expect.x);
+      p->data.span.min = n;
+      continue;
+    }
 
-mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
+    return;
 
-/*
-** Grammar Parser
-*/
+  }
 
-/*
-** This is another interesting bootstrapping.
-**
-** Having a general purpose AST type allows
-** users to specify the grammar alone and
-** let all fold rules be automatically taken
-** care of by existing functions.
-**
-** You don't get to control the type spat
-** out but this means you can make a nice
-** parser to take in some grammar in nice
-** syntax and spit out a parser that works.
-**
-** The grammar for this looks surprisingly
-** like regex but the main difference is that
-** it is now whitespace insensitive and the
-** base type takes literals of some form.
-*/
+}
 
 /*
+** FIRST sets
 **
-**  ### Grammar Grammar
-**
-**      <grammar> : (<term> "|" <grammar>) | <term>
-**
-**      <term> : <factor>*
-**
-**      <factor> : <base>
-**               | <base> "*"
-**               | <base> "+"
-**               | <base> "?"
-**               | <base> "{" <digits> "}"
-**
-**      <base> : "<" (<digits> | <ident>) ">"
-**             | <string_lit>
-**             | <char_lit>
-**             | <regex_lit> <regex_mode>
-**             | "(" <grammar> ")"
+** The first set of a parser holds each character it
+** could consume first, and it is nullable when it could
+** succeed without consuming anything. Both err on the
+** safe side, so a parser that isn't understood could
+** start with anything and could match nothing. Named
+** parsers can refer to each other, so their sets are
+** grown until none of them change.
 */
 
 typedef struct {
-  va_list *va;
-  int parsers_num;
-  mpc_parser_t **parsers;
-  int flags;
-} mpca_grammar_st_t;
+  mpc_parser_t *p;
+  unsigned char set[32];
+  int nullable;
+  int visited;
+} mpc_first_rule_t;
 
-static mpc_val_t *mpcaf_grammar_or(int n, mpc_val_t **xs) {
-  (void) n;
-  if (xs[1] == NULL) { return xs[0]; }
-  else { return mpca_or(2, xs[0], xs[1]); }
-}
+typedef struct {
+  int rules_num;
+  mpc_first_rule_t *rules;
+  int changed;
+} mpc_first_t;
 
-static mpc_val_t *mpcaf_grammar_and(int n, mpc_val_t **xs) {
-  int i;
-  mpc_parser_t *p = mpc_pass();
-  for (i = 0; i < n; i++) {
-    if (xs[i] != NULL) { p = mpca_and(2, p, xs[i]); }
-  }
-  return p;
+static void mpc_first_add(unsigned char *set, int b) {
+  set[b >> 3] |= (unsigned char)(1 << (b & 7));
 }
 
-static mpc_val_t *mpcaf_grammar_repeat(int n, mpc_val_t **xs) {
-  int num;
-  (void) n;
-  if (xs[1] == NULL) { return xs[0]; }
-  switch(((char*)xs[1])[0])
-  {
-    case '*': { free(xs[1]); return mpca_many(xs[0]); }; break;
-    case '+': { free(xs[1]); return mpca_many1(xs[0]); }; break;
-    case '?': { free(xs[1]); return mpca_maybe(xs[0]); }; break;
-    case '!': { free(xs[1]); return mpca_not(xs[0]); }; break;
-    default:
-      num = *((int*)xs[1]);
-      free(xs[1]);
-  }
-  return mpca_count(num, xs[0]);
+static int mpc_first_has(const unsigned char *set, int b) {
+  return (set[b >> 3] >> (b & 7)) & 1;
 }
 
-static mpc_val_t *mpcaf_grammar_string(mpc_val_t *x, void *s) {
-  mpca_grammar_st_t *st = s;
-  char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_string(y) : mpc_tok(mpc_string(y));
-  free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "string"));
+static void mpc_first_union(unsigned char *set, const unsigned char *x) {
+  int b;
+  for (b = 0; b < 32; b++) { set[b] |= x[b]; }
 }
 
-static mpc_val_t *mpcaf_grammar_char(mpc_val_t *x, void *s) {
-  mpca_grammar_st_t *st = s;
-  char *y = mpcf_unescape(x);
-  mpc_parser_t *p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_char(y[0]) : mpc_tok(mpc_char(y[0]));
-  free(y);
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "char"));
-}
+static int mpc_first_run(mpc_first_t *st, mpc_parser_t *p, unsigned char *set);
 
-static mpc_val_t *mpcaf_fold_regex(int n, mpc_val_t **xs) {
-  char *y = xs[0];
-  char *m = xs[1];
-  mpca_grammar_st_t *st = xs[2];
-  mpc_parser_t *p;
-  int mode = MPC_RE_DEFAULT;
+static int mpc_first_node(mpc_first_t *st, mpc_parser_t *p, unsigned char *set) {
 
-  (void)n;
-  if (strchr(m, 'm')) { mode |= MPC_RE_MULTILINE; }
-  if (strchr(m, 's')) { mode |= MPC_RE_DOTALL; }
-  y = mpcf_unescape_regex(y);
-  p = (st->flags & MPCA_LANG_WHITESPACE_SENSITIVE) ? mpc_re_mode(y, mode) : mpc_tok(mpc_re_mode(y, mode));
-  free(y);
-  free(m);
+  int j, b, n;
 
-  return mpca_state(mpca_tag(mpc_apply(p, mpcf_str_ast), "regex"));
-}
+  switch (p->type) {
 
-/* Should this just use `isdigit` instead? */
-static int is_number(const char* s) {
-  size_t i;
-  for (i = 0; i < strlen(s); i++) { if (!strchr("0123456789", s[i])) { return 0; } }
-  return 1;
-}
+    case MPC_TYPE_SINGLE:
+      mpc_first_add(set, (unsigned char)p->data.single.x);
+      return 0;
 
-static mpc_parser_t *mpca_grammar_find_parser(char *x, mpca_grammar_st_t *st) {
+    case MPC_TYPE_RANGE:
+      for (b = 0; b < 256; b++) {
+        if ((char)b >= p->data.range.x && (char)b <= p->data.range.y) { mpc_first_add(set, b); }
+      }
+      return 0;
 
-  int i;
-  mpc_parser_t *p;
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      mpc_first_union(set, p->data.cls.c->set);
+      return 0;
 
-  /* Case of Number */
-  if (is_number(x)) {
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return 1; }
+      mpc_first_add(set, (unsigned char)p->data.string.x[0]);
+      return 0;
 
-    i = strtol(x, NULL, 10);
+    case MPC_TYPE_SPAN:
+      mpc_first_union(set, p->data.span.c->set);
+      return p->data.span.min == 0;
 
-    while (st->parsers_num <= i) {
-      st->parsers_num++;
-      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
-      st->parsers[st->parsers_num-1] = va_arg(*st->va, mpc_parser_t*);
-      if (st->parsers[st->parsers_num-1] == NULL) {
-        return mpc_failf("No Parser in position %i! Only supplied %i Parsers!", i, st->parsers_num);
+    case MPC_TYPE_DFA:
+      for (b = 0; b < 256; b++) {
+        if (p->data.dfa.d->next[b] >= 0) { mpc_first_add(set, b); }
       }
-    }
+      return p->data.dfa.d->states[0].accept;
 
-    return st->parsers[st->parsers_num-1];
+    case MPC_TYPE_FAIL: return 0;
 
-  /* Case of Identifier */
-  } else {
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_ANCHOR:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+      return 1;
 
-    /* Search Existing Parsers */
-    for (i = 0; i < st->parsers_num; i++) {
-      mpc_parser_t *q = st->parsers[i];
-      if (q == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
-      if (q->name && strcmp(q->name, x) == 0) { return q; }
-    }
+    case MPC_TYPE_EXPECT:     return mpc_first_run(st, p->data.expect.x, set);
+    case MPC_TYPE_APPLY:      return mpc_first_run(st, p->data.apply.x, set);
+    case MPC_TYPE_APPLY_TO:   return mpc_first_run(st, p->data.apply_to.x, set);
+    case MPC_TYPE_CHECK:      return mpc_first_run(st, p->data.check.x, set);
+    case MPC_TYPE_CHECK_WITH: return mpc_first_run(st, p->data.check_with.x, set);
+    case MPC_TYPE_PREDICT:    return mpc_first_run(st, p->data.predict.x, set);
+    case MPC_TYPE_MEMO:       return mpc_first_run(st, p->data.memo.x, set);
 
-    /* Search New Parsers */
-    while (1) {
+    case MPC_TYPE_NOT: return 1;
 
-      p = va_arg(*st->va, mpc_parser_t*);
+    case MPC_TYPE_MAYBE:
+      mpc_first_run(st, p->data.not.x, set);
+      return 1;
 
-      st->parsers_num++;
-      st->parsers = realloc(st->parsers, sizeof(mpc_parser_t*) * st->parsers_num);
-      st->parsers[st->parsers_num-1] = p;
+    case MPC_TYPE_MANY:
+      mpc_first_run(st, p->data.repeat.x, set);
+      return 1;
 
-      if (p == NULL || p->name == NULL) { return mpc_failf("Unknown Parser '%s'!", x); }
-      if (p->name && strcmp(p->name, x) == 0) { return p; }
+    case MPC_TYPE_MANY1:
+      return mpc_first_run(st, p->data.repeat.x, set);
 
-    }
+    case MPC_TYPE_COUNT:
+      n = mpc_first_run(st, p->data.repeat.x, set);
+      return n || p->data.repeat.n == 0;
+
+    case MPC_TYPE_OR:
+      n = 0;
+      for (j = 0; j < p->data.or.n; j++) {
+        n = mpc_first_run(st, p->data.or.xs[j], set) || n;
+      }
+      return n;
+
+    case MPC_TYPE_AND:
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_first_run(st, p->data.and.xs[j], set)) { return 0; }
+      }
+      return 1;
 
+    default:
+      memset(set, 0xFF, 32);
+      return 1;
   }
 
 }
 
-static mpc_val_t *mpcaf_grammar_id(mpc_val_t *x, void *s) {
+static int mpc_first_run(mpc_first_t *st, mpc_parser_t *p, unsigned char *set) {
 
-  mpca_grammar_st_t *st = s;
-  mpc_parser_t *p = mpca_grammar_find_parser(x, st);
-  free(x);
+  mpc_first_rule_t *r;
+  unsigned char x[32];
+  int j, b, n;
 
-  if (p->name) {
-    return mpca_state(mpca_root(mpca_add_tag(p, p->name)));
-  } else {
-    return mpca_state(mpca_root(p));
+  if (!p->retained) { return mpc_first_node(st, p, set); }
+
+  for (j = 0; j < st->rules_num; j++) {
+    if (st->rules[j].p == p) { break; }
+  }
+
+  if (j == st->rules_num) {
+    st->rules_num++;
+    st->rules = realloc(st->rules, sizeof(mpc_first_rule_t) * st->rules_num);
+    memset(&st->rules[j], 0, sizeof(mpc_first_rule_t));
+    st->rules[j].p = p;
+  }
+
+  /* A rule reached again only contributes what is known so far */
+  if (!st->rules[j].visited) {
+    st->rules[j].visited = 1;
+    memset(x, 0, 32);
+    n = mpc_first_node(st, p, x);
+    r = &st->rules[j];
+    for (b = 0; b < 32; b++) {
+      if (x[b] & ~r->set[b]) { r->set[b] |= x[b]; st->changed = 1; }
+    }
+    if (n && !r->nullable) { r->nullable = 1; st->changed = 1; }
   }
+
+  mpc_first_union(set, st->rules[j].set);
+  return st->rules[j].nullable;
 }
 
-mpc_parser_t *mpca_grammar_st(const char *grammar, mpca_grammar_st_t *st) {
+static mpc_dispatch_t *mpc_dispatch_new(mpc_first_t *st, mpc_parser_t *p) {
 
-  char *err_msg;
-  mpc_parser_t *err_out;
-  mpc_result_t r;
-  mpc_parser_t *GrammarTotal, *Grammar, *Term, *Factor, *Base;
+  mpc_dispatch_t *d;
+  unsigned char (*sets)[32];
+  int *nullable, *alts;
+  int j, b, m, n = p->data.or.n, useful = 0;
+  int last_start = 0, last_num = -1;
 
-  GrammarTotal = mpc_new("grammar_total");
-  Grammar = mpc_new("grammar");
-  Term = mpc_new("term");
-  Factor = mpc_new("factor");
-  Base = mpc_new("base");
+  sets = malloc(sizeof(*sets) * n);
+  nullable = malloc(sizeof(int) * n);
 
-  mpc_define(GrammarTotal,
-    mpc_predictive(mpc_total(Grammar, mpc_soft_delete))
-  );
+  do {
+    st->changed = 0;
+    for (j = 0; j < st->rules_num; j++) { st->rules[j].visited = 0; }
+    for (j = 0; j < n; j++) {
+      memset(sets[j], 0, 32);
+      nullable[j] = mpc_first_run(st, p->data.or.xs[j], sets[j]);
+    }
+  } while (st->changed);
 
-  mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
-    Term,
-    mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, free)),
-    mpc_soft_delete
-  ));
+  /* A nullable alternative could match before any other */
+  for (j = 0; j < n; j++) {
+    if (nullable[j]) { free(sets); free(nullable); return NULL; }
+  }
 
-  mpc_define(Term, mpc_many1(mpcaf_grammar_and, Factor));
+  d = malloc(sizeof(mpc_dispatch_t));
+  d->alts = malloc(sizeof(int) * n * 256);
+  d->alts_num = 0;
+  d->start[0] = 0;
+  d->num[0] = -1;
 
-  mpc_define(Factor, mpc_and(2, mpcaf_grammar_repeat,
-    Base,
-      mpc_or(6,
-        mpc_sym("*"),
-        mpc_sym("+"),
-        mpc_sym("?"),
-        mpc_sym("!"),
-        mpc_tok_brackets(mpc_int(), free),
-        mpc_pass()),
-    mpc_soft_delete
-  ));
+  for (b = 1; b < 256; b++) {
 
-  mpc_define(Base, mpc_or(5,
-    mpc_apply_to(mpc_tok(mpc_string_lit()), mpcaf_grammar_string, st),
-    mpc_apply_to(mpc_tok(mpc_char_lit()),   mpcaf_grammar_char, st),
-    mpc_tok(mpc_and(3, mpcaf_fold_regex, mpc_regex_lit(), mpc_many(mpcf_strfold, mpc_oneof("ms")), mpc_lift_val(st), free, free)),
-    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), free), mpcaf_grammar_id, st),
-    mpc_tok_parens(Grammar, mpc_soft_delete)
-  ));
+    alts = d->alts + d->alts_num;
+    for (j = 0, m = 0; j < n; j++) {
+      if (mpc_first_has(sets[j], b)) { alts[m++] = j; }
+    }
 
-  mpc_optimise(GrammarTotal);
-  mpc_optimise(Grammar);
-  mpc_optimise(Factor);
-  mpc_optimise(Term);
-  mpc_optimise(Base);
+    d->start[b] = 0;
+    d->num[b] = -1;
+    if (m == n || d->alts_num + m > SHRT_MAX) { continue; }
+    useful = 1;
 
-  if(!mpc_parse("<mpc_grammar_compiler>", grammar, GrammarTotal, &r)) {
-    err_msg = mpc_err_string(r.error);
-    err_out = mpc_failf("Invalid Grammar: %s", err_msg);
-    mpc_err_delete(r.error);
-    free(err_msg);
-    r.output = err_out;
-  }
+    /* Neighbouring characters often share a list */
+    if (m == last_num && memcmp(d->alts + last_start, alts, sizeof(int) * m) == 0) {
+      d->start[b] = last_start;
+      d->num[b] = m;
+      continue;
+    }
 
-  mpc_cleanup(5, GrammarTotal, Grammar, Term, Factor, Base);
+    d->start[b] = last_start = d->alts_num;
+    d->num[b] = last_num = m;
+    d->alts_num += m;
+  }
 
-  mpc_optimise(r.output);
+  free(sets);
+  free(nullable);
 
-  return (st->flags & MPCA_LANG_PREDICTIVE) ? mpc_predictive(r.output) : r.output;
+  if (!useful) { mpc_dispatch_delete(d); return NULL; }
 
+  d->alts = realloc(d->alts, sizeof(int) * (d->alts_num > 0 ? d->alts_num : 1));
+  return d;
 }
 
-mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...) {
-  mpca_grammar_st_t st;
-  mpc_parser_t *res;
-  va_list va;
-  va_start(va, grammar);
+static void mpc_optimise_dispatch(mpc_first_t *st, mpc_parser_t *p, int force) {
+
+  int i;
+
+  if (p->retained && !force) { return; }
+
+  if (p->type == MPC_TYPE_EXPECT)     { mpc_optimise_dispatch(st, p->data.expect.x, 0); }
+  if (p->type == MPC_TYPE_APPLY)      { mpc_optimise_dispatch(st, p->data.apply.x, 0); }
+  if (p->type == MPC_TYPE_APPLY_TO)   { mpc_optimise_dispatch(st, p->data.apply_to.x, 0); }
+  if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_dispatch(st, p->data.check.x, 0); }
+  if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_dispatch(st, p->data.check_with.x, 0); }
+  if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_dispatch(st, p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_NOT)        { mpc_optimise_dispatch(st, p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_dispatch(st, p->data.not.x, 0); }
+  if (p->type == MPC_TYPE_MANY)       { mpc_optimise_dispatch(st, p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_MANY1)      { mpc_optimise_dispatch(st, p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_COUNT)      { mpc_optimise_dispatch(st, p->data.repeat.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)       { mpc_optimise_dispatch(st, p->data.memo.x, 0); }
+
+  if (p->type == MPC_TYPE_AND) {
+    for (i = 0; i < p->data.and.n; i++) {
+      mpc_optimise_dispatch(st, p->data.and.xs[i], 0);
+    }
+  }
+
+  if (p->type == MPC_TYPE_OR) {
+    for (i = 0; i < p->data.or.n; i++) {
+      mpc_optimise_dispatch(st, p->data.or.xs[i], 0);
+    }
+    mpc_dispatch_delete(p->data.or.d);
+    p->data.or.d = mpc_dispatch_new(st, p);
+  }
 
-  st.va = &va;
-  st.parsers_num = 0;
-  st.parsers = NULL;
-  st.flags = flags;
+}
 
-  res = mpca_grammar_st(grammar, &st);
-  free(st.parsers);
-  va_end(va);
-  return res;
+/*
+** Dispatch tables look inside the named parsers that
+** are referred to. Parsers still undefined could match
+** anything, so it is best to optimise once the whole
+** grammar is defined.
+*/
+
+void mpc_optimise(mpc_parser_t *p) {
+  mpc_first_t st;
+  mpc_optimise_unretained(p, 1);
+  st.rules_num = 0;
+  st.rules = NULL;
+  mpc_optimise_dispatch(&st, p, 1);
+  free(st.rules);
 }
 
-typedef struct {
-  char *ident;
-  char *name;
-  mpc_parser_t *grammar;
-} mpca_stmt_t;
 
-static mpc_val_t *mpca_stmt_afold(int n, mpc_val_t **xs) {
-  mpca_stmt_t *stmt = malloc(sizeof(mpca_stmt_t));
-  stmt->ident = ((char**)xs)[0];
-  stmt->name = ((char**)xs)[1];
-  stmt->grammar = ((mpc_parser_t**)xs)[3];
-  (void) n;
-  free(((char**)xs)[2]);
-  free(((char**)xs)[4]);
+/*
+** Serialisation
+**
+** A parser graph is written out as a table of ints and
+** a table of strings. Each parser is its type followed by
+** its fields, with children written in place and retained
+** parsers referred to by their position in the list being
+** dumped. Functions are written by name and looked up in
+** the given symbols, then in the ones mpc itself defines.
+** Regexes keep their DFA tables so nothing is compiled
+** when a grammar is loaded.
+*/
 
-  return stmt;
-}
+enum {
+  MPC_DUMP_REF = -1
+};
 
-static mpc_val_t *mpca_stmt_fold(int n, mpc_val_t **xs) {
+static const mpc_symbol_t mpc_symbols[] = {
+  { "free",                      (mpc_func_t)free },
+  { "mpc_delete",                (mpc_func_t)mpc_delete },
+  { "mpcf_dtor_null",            (mpc_func_t)mpcf_dtor_null },
+  { "mpcf_ctor_null",            (mpc_func_t)mpcf_ctor_null },
+  { "mpcf_ctor_str",             (mpc_func_t)mpcf_ctor_str },
+  { "mpcf_free",                 (mpc_func_t)mpcf_free },
+  { "mpcf_int",                  (mpc_func_t)mpcf_int },
+  { "mpcf_hex",                  (mpc_func_t)mpcf_hex },
+  { "mpcf_oct",                  (mpc_func_t)mpcf_oct },
+  { "mpcf_float",                (mpc_func_t)mpcf_float },
+  { "mpcf_strtriml",             (mpc_func_t)mpcf_strtriml },
+  { "mpcf_strtrimr",             (mpc_func_t)mpcf_strtrimr },
+  { "mpcf_strtrim",              (mpc_func_t)mpcf_strtrim },
+  { "mpcf_escape",               (mpc_func_t)mpcf_escape },
+  { "mpcf_escape_regex",         (mpc_func_t)mpcf_escape_regex },
+  { "mpcf_escape_string_raw",    (mpc_func_t)mpcf_escape_string_raw },
+  { "mpcf_escape_char_raw",      (mpc_func_t)mpcf_escape_char_raw },
+  { "mpcf_unescape",             (mpc_func_t)mpcf_unescape },
+  { "mpcf_unescape_regex",       (mpc_func_t)mpcf_unescape_regex },
+  { "mpcf_unescape_string_raw",  (mpc_func_t)mpcf_unescape_string_raw },
+  { "mpcf_unescape_char_raw",    (mpc_func_t)mpcf_unescape_char_raw },
+  { "mpcf_null",                 (mpc_func_t)mpcf_null },
+  { "mpcf_fst",                  (mpc_func_t)mpcf_fst },
+  { "mpcf_snd",                  (mpc_func_t)mpcf_snd },
+  { "mpcf_trd",                  (mpc_func_t)mpcf_trd },
+  { "mpcf_fst_free",             (mpc_func_t)mpcf_fst_free },
+  { "mpcf_snd_free",             (mpc_func_t)mpcf_snd_free },
+  { "mpcf_trd_free",             (mpc_func_t)mpcf_trd_free },
+  { "mpcf_all_free",             (mpc_func_t)mpcf_all_free },
+  { "mpcf_strfold",              (mpc_func_t)mpcf_strfold },
+  { "mpcf_maths",                (mpc_func_t)mpcf_maths },
+  { "mpcf_fold_ast",             (mpc_func_t)mpcf_fold_ast },
+  { "mpcf_str_ast",              (mpc_func_t)mpcf_str_ast },
+  { "mpcf_lit_ast",              (mpc_func_t)mpcf_lit_ast },
+  { "mpcf_state_ast",            (mpc_func_t)mpcf_state_ast },
+  { "mpc_ast_delete",            (mpc_func_t)mpc_ast_delete },
+  { "mpc_ast_copy",              (mpc_func_t)mpc_ast_copy },
+  { "mpc_ast_add_root",          (mpc_func_t)mpc_ast_add_root },
+  { "mpc_ast_add_tag",           (mpc_func_t)mpc_ast_add_tag },
+  { "mpc_ast_add_root_tag",      (mpc_func_t)mpc_ast_add_root_tag },
+  { "mpc_ast_add_rule",          (mpc_func_t)mpc_ast_add_rule },
+  { "mpc_ast_tag",               (mpc_func_t)mpc_ast_tag },
+  { "mpc_boundary_anchor",         (mpc_func_t)mpc_boundary_anchor },
+  { "mpc_boundary_newline_anchor", (mpc_func_t)mpc_boundary_newline_anchor },
+  { NULL, NULL }
+};
 
-  int i;
-  mpca_stmt_t **stmts = malloc(sizeof(mpca_stmt_t*) * (n+1));
+/* These take the tag string as the data for `mpc_apply_to` */
+static int mpc_symbol_tags(mpc_func_t f) {
+  return f == (mpc_func_t)mpc_ast_tag
+    || f == (mpc_func_t)mpc_ast_add_tag
+    || f == (mpc_func_t)mpc_ast_add_root_tag;
+}
 
-  for (i = 0; i < n; i++) {
-    stmts[i] = xs[i];
+typedef struct {
+  int parsers_num;
+  mpc_parser_t **parsers;
+  const mpc_symbol_t *syms;
+  int data_num;
+  int data_slots;
+  int *data;
+  int strings_num;
+  const char **strings;
+} mpc_dump_t;
+
+static void mpc_dump_int(mpc_dump_t *d, int x) {
+  if (d->data_num == d->data_slots) {
+    d->data_slots = d->data_slots ? d->data_slots * 2 : 256;
+    d->data = realloc(d->data, sizeof(int) * d->data_slots);
   }
-  stmts[n] = NULL;
+  d->data[d->data_num++] = x;
+}
 
-  return stmts;
+static void mpc_dump_str(mpc_dump_t *d, const char *s) {
+  int j;
+  for (j = 0; j < d->strings_num; j++) {
+    if (strcmp(d->strings[j], s) == 0) { mpc_dump_int(d, j); return; }
+  }
+  d->strings = realloc(d->strings, sizeof(char*) * (d->strings_num + 1));
+  d->strings[d->strings_num] = s;
+  mpc_dump_int(d, d->strings_num++);
 }
 
-static void mpca_stmt_list_delete(mpc_val_t *x) {
+static int mpc_dump_func(mpc_dump_t *d, mpc_func_t f) {
+  const mpc_symbol_t *s;
+  if (f == NULL) { mpc_dump_int(d, -1); return 1; }
+  for (s = d->syms; s && s->name; s++) {
+    if (s->f == f) { mpc_dump_str(d, s->name); return 1; }
+  }
+  for (s = mpc_symbols; s->name; s++) {
+    if (s->f == f) { mpc_dump_str(d, s->name); return 1; }
+  }
+  return 0;
+}
 
-  mpca_stmt_t **stmts = x;
+static int mpc_dump_strs(mpc_dump_t *d, char **xs, int n) {
+  int j;
+  mpc_dump_int(d, n);
+  for (j = 0; j < n; j++) { mpc_dump_str(d, xs[j]); }
+  return 1;
+}
 
-  while(*stmts) {
-    mpca_stmt_t *stmt = *stmts;
-    free(stmt->ident);
-    free(stmt->name);
-    mpc_soft_delete(stmt->grammar);
-    free(stmt);
-    stmts++;
+static int mpc_dump_dfa(mpc_dump_t *d, mpc_dfa_t *a) {
+  int j;
+  mpc_dump_int(d, a->states_num);
+  for (j = 0; j < a->states_num * 256; j++) { mpc_dump_int(d, a->next[j]); }
+  for (j = 0; j < a->states_num; j++) {
+    mpc_dump_int(d, a->states[j].accept);
+    mpc_dump_int(d, a->states[j].merged_back);
+    mpc_dump_strs(d, a->states[j].merged, a->states[j].merged_num);
+    mpc_dump_int(d, a->states[j].failed_back);
+    mpc_dump_strs(d, a->states[j].failed, a->states[j].failed_num);
   }
-  free(x);
-
+  return 1;
 }
 
-static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
+static int mpc_dump_parser(mpc_dump_t *d, mpc_parser_t *p, int top) {
 
-  mpca_grammar_st_t *st = s;
-  mpca_stmt_t *stmt;
-  mpca_stmt_t **stmts = x;
-  mpc_parser_t *left;
+  int j;
 
-  while(*stmts) {
-    stmt = *stmts;
-    left = mpca_grammar_find_parser(stmt->ident, st);
-    if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
-    if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
-    mpc_optimise(stmt->grammar);
-    mpc_define(left, stmt->grammar);
-    free(stmt->ident);
-    free(stmt->name);
-    free(stmt);
-    stmts++;
+  if (p->retained && !top) {
+    for (j = 0; j < d->parsers_num; j++) {
+      if (d->parsers[j] == p) {
+        mpc_dump_int(d, MPC_DUMP_REF);
+        mpc_dump_int(d, j);
+        return 1;
+      }
+    }
+    return 0;
   }
 
-  free(x);
+  mpc_dump_int(d, p->type);
 
-  return NULL;
-}
+  switch (p->type) {
 
-static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+      return 1;
 
-  mpc_result_t r;
-  mpc_err_t *e;
-  mpc_parser_t *Lang, *Stmt, *Grammar, *Term, *Factor, *Base;
+    case MPC_TYPE_FAIL:     mpc_dump_str(d, p->data.fail.m); return 1;
+    case MPC_TYPE_LIFT:     return mpc_dump_func(d, (mpc_func_t)p->data.lift.lf);
+    case MPC_TYPE_LIFT_VAL: return p->data.lift.x == NULL;
+    case MPC_TYPE_ANCHOR:   return mpc_dump_func(d, (mpc_func_t)p->data.anchor.f);
+    case MPC_TYPE_SATISFY:  return mpc_dump_func(d, (mpc_func_t)p->data.satisfy.f);
+    case MPC_TYPE_SINGLE:   mpc_dump_int(d, p->data.single.x); return 1;
+    case MPC_TYPE_STRING:   mpc_dump_str(d, p->data.string.x); return 1;
+
+    case MPC_TYPE_RANGE:
+      mpc_dump_int(d, p->data.range.x);
+      mpc_dump_int(d, p->data.range.y);
+      return 1;
 
-  Lang    = mpc_new("lang");
-  Stmt    = mpc_new("stmt");
-  Grammar = mpc_new("grammar");
-  Term    = mpc_new("term");
-  Factor  = mpc_new("factor");
-  Base    = mpc_new("base");
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+      mpc_dump_str(d, p->data.cls.x);
+      return 1;
 
-  mpc_define(Lang, mpc_apply_to(
-    mpc_total(mpc_predictive(mpc_many(mpca_stmt_fold, Stmt)), mpca_stmt_list_delete),
-    mpca_stmt_list_apply_to, st
-  ));
+    case MPC_TYPE_EXPECT:
+      mpc_dump_str(d, p->data.expect.m);
+      return mpc_dump_parser(d, p->data.expect.x, 0);
 
-  mpc_define(Stmt, mpc_and(5, mpca_stmt_afold,
-    mpc_tok(mpc_ident()), mpc_maybe(mpc_tok(mpc_string_lit())), mpc_sym(":"), Grammar, mpc_sym(";"),
-    free, free, free, mpc_soft_delete
-  ));
+    case MPC_TYPE_APPLY:
+      return mpc_dump_func(d, (mpc_func_t)p->data.apply.f)
+        && mpc_dump_parser(d, p->data.apply.x, 0);
 
-  mpc_define(Grammar, mpc_and(2, mpcaf_grammar_or,
-      Term,
-      mpc_maybe(mpc_and(2, mpcf_snd_free, mpc_sym("|"), Grammar, free)),
-      mpc_soft_delete
-  ));
+    case MPC_TYPE_APPLY_TO:
+      if (!mpc_dump_func(d, (mpc_func_t)p->data.apply_to.f)) { return 0; }
+      if (mpc_symbol_tags((mpc_func_t)p->data.apply_to.f)) {
+        mpc_dump_str(d, p->data.apply_to.d);
+      } else if (p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_add_rule) {
+        for (j = 0; j < d->parsers_num; j++) {
+          if (d->parsers[j] == p->data.apply_to.d) { break; }
+        }
+        if (j == d->parsers_num) { return 0; }
+        mpc_dump_int(d, j);
+      } else if (p->data.apply_to.d != NULL) {
+        return 0;
+      }
+      return mpc_dump_parser(d, p->data.apply_to.x, 0);
 
-  mpc_define(Term, mpc_many1(mpcaf_grammar_and, Factor));
+    case MPC_TYPE_CHECK:
+      mpc_dump_str(d, p->data.check.e);
+      return mpc_dump_func(d, (mpc_func_t)p->data.check.dx)
+        && mpc_dump_func(d, (mpc_func_t)p->data.check.f)
+        && mpc_dump_parser(d, p->data.check.x, 0);
 
-  mpc_define(Factor, mpc_and(2, mpcaf_grammar_repeat,
-    Base,
-      mpc_or(6,
-        mpc_sym("*"),
-        mpc_sym("+"),
-        mpc_sym("?"),
-        mpc_sym("!"),
-        mpc_tok_brackets(mpc_int(), free),
-        mpc_pass()),
-    mpc_soft_delete
-  ));
+    case MPC_TYPE_CHECK_WITH:
+      if (p->data.check_with.d != NULL) { return 0; }
+      mpc_dump_str(d, p->data.check_with.e);
+      return mpc_dump_func(d, (mpc_func_t)p->data.check_with.dx)
+        && mpc_dump_func(d, (mpc_func_t)p->data.check_with.f)
+        && mpc_dump_parser(d, p->data.check_with.x, 0);
 
-  mpc_define(Base, mpc_or(5,
-    mpc_apply_to(mpc_tok(mpc_string_lit()), mpcaf_grammar_string, st),
-    mpc_apply_to(mpc_tok(mpc_char_lit()),   mpcaf_grammar_char, st),
-    mpc_tok(mpc_and(3, mpcaf_fold_regex, mpc_regex_lit(), mpc_many(mpcf_strfold, mpc_oneof("ms")), mpc_lift_val(st), free, free)),
-    mpc_apply_to(mpc_tok_braces(mpc_or(2, mpc_digits(), mpc_ident()), free), mpcaf_grammar_id, st),
-    mpc_tok_parens(Grammar, mpc_soft_delete)
-  ));
+    case MPC_TYPE_PREDICT:
+      return mpc_dump_parser(d, p->data.predict.x, 0);
 
-  mpc_optimise(Lang);
-  mpc_optimise(Stmt);
-  mpc_optimise(Grammar);
-  mpc_optimise(Term);
-  mpc_optimise(Factor);
-  mpc_optimise(Base);
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      return mpc_dump_func(d, (mpc_func_t)p->data.not.dx)
+        && mpc_dump_func(d, (mpc_func_t)p->data.not.lf)
+        && mpc_dump_parser(d, p->data.not.x, 0);
 
-  if (!mpc_parse_input(i, Lang, &r)) {
-    e = r.error;
-  } else {
-    e = NULL;
-  }
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_dump_int(d, p->data.repeat.n);
+      return mpc_dump_func(d, (mpc_func_t)p->data.repeat.f)
+        && mpc_dump_func(d, (mpc_func_t)p->data.repeat.dx)
+        && mpc_dump_parser(d, p->data.repeat.x, 0);
 
-  mpc_cleanup(6, Lang, Stmt, Grammar, Term, Factor, Base);
+    case MPC_TYPE_OR:
+      mpc_dump_int(d, p->data.or.n);
+      for (j = 0; j < p->data.or.n; j++) {
+        if (!mpc_dump_parser(d, p->data.or.xs[j], 0)) { return 0; }
+      }
+      return 1;
 
-  return e;
-}
+    case MPC_TYPE_AND:
+      mpc_dump_int(d, p->data.and.n);
+      if (!mpc_dump_func(d, (mpc_func_t)p->data.and.f)) { return 0; }
+      for (j = 0; j < p->data.and.n-1; j++) {
+        if (!mpc_dump_func(d, (mpc_func_t)p->data.and.dxs[j])) { return 0; }
+      }
+      for (j = 0; j < p->data.and.n; j++) {
+        if (!mpc_dump_parser(d, p->data.and.xs[j], 0)) { return 0; }
+      }
+      return 1;
 
-mpc_err_t *mpca_lang_file(int flags, FILE *f, ...) {
-  mpca_grammar_st_t st;
-  mpc_input_t *i;
-  mpc_err_t *err;
+    case MPC_TYPE_DFA:
+      return mpc_dump_dfa(d, p->data.dfa.d)
+        && mpc_dump_parser(d, p->data.dfa.x, 0);
 
-  va_list va;
-  va_start(va, f);
+    case MPC_TYPE_SPAN:
+      mpc_dump_int(d, p->data.span.min);
+      return mpc_dump_parser(d, p->data.span.x, 0);
 
-  st.va = &va;
-  st.parsers_num = 0;
-  st.parsers = NULL;
-  st.flags = flags;
+    case MPC_TYPE_MEMO:
+      return mpc_dump_func(d, (mpc_func_t)p->data.memo.cf)
+        && mpc_dump_func(d, (mpc_func_t)p->data.memo.df)
+        && mpc_dump_parser(d, p->data.memo.x, 0);
 
-  i = mpc_input_new_file("<mpca_lang_file>", f);
-  err = mpca_lang_st(i, &st);
-  mpc_input_delete(i);
+    default: return 0;
+  }
 
-  free(st.parsers);
-  va_end(va);
-  return err;
 }
 
-mpc_err_t *mpca_lang_pipe(int flags, FILE *p, ...) {
-  mpca_grammar_st_t st;
-  mpc_input_t *i;
-  mpc_err_t *err;
+static void mpc_dump_c_str(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    if (*s >= ' ' && *s <= '~' && *s != '"' && *s != '\\' && *s != '?') {
+      fputc(*s, f);
+    } else {
+      fprintf(f, "\\%03o", (unsigned char)*s);
+    }
+  }
+  fputc('"', f);
+}
 
-  va_list va;
-  va_start(va, p);
+int mpc_dump_c(FILE *f, const char *name, const mpc_symbol_t *syms, int n, ...) {
 
-  st.va = &va;
-  st.parsers_num = 0;
-  st.parsers = NULL;
-  st.flags = flags;
+  int j, ok = 1;
+  mpc_dump_t d;
+  va_list va;
 
-  i = mpc_input_new_pipe("<mpca_lang_pipe>", p);
-  err = mpca_lang_st(i, &st);
-  mpc_input_delete(i);
+  d.parsers_num = n;
+  d.parsers = malloc(sizeof(mpc_parser_t*) * n);
+  d.syms = syms;
+  d.data_num = 0;
+  d.data_slots = 0;
+  d.data = NULL;
+  d.strings_num = 0;
+  d.strings = NULL;
 
-  free(st.parsers);
+  va_start(va, n);
+  for (j = 0; j < n; j++) { d.parsers[j] = va_arg(va, mpc_parser_t*); }
   va_end(va);
-  return err;
-}
 
-mpc_err_t *mpca_lang(int flags, const char *language, ...) {
+  for (j = 0; j < n && ok; j++) {
+    ok = d.parsers[j]->retained;
+    if (ok) {
+      mpc_dump_str(&d, d.parsers[j]->name);
+      ok = mpc_dump_parser(&d, d.parsers[j], 1);
+    }
+  }
 
-  mpca_grammar_st_t st;
-  mpc_input_t *i;
-  mpc_err_t *err;
+  if (ok) {
 
-  va_list va;
-  va_start(va, language);
+    fprintf(f, "static const char *const %s_strings[] = {\n", name);
+    for (j = 0; j < d.strings_num; j++) {
+      fprintf(f, "  ");
+      mpc_dump_c_str(f, d.strings[j]);
+      fprintf(f, ",\n");
+    }
+    fprintf(f, "  NULL\n};\n\n");
 
-  st.va = &va;
-  st.parsers_num = 0;
-  st.parsers = NULL;
-  st.flags = flags;
+    fprintf(f, "static const int %s_data[] = {", name);
+    for (j = 0; j < d.data_num; j++) {
+      fprintf(f, j % 16 == 0 ? "\n  %d," : " %d,", d.data[j]);
+    }
+    fprintf(f, "\n  0\n};\n\n");
 
-  i = mpc_input_new_string("<mpca_lang>", language);
-  err = mpca_lang_st(i, &st);
-  mpc_input_delete(i);
+    fprintf(f, "const mpc_grammar_t %s = {\n  %d, %s_data, %d, %s_strings, %d\n};\n",
+      name, n, name, d.data_num, name, d.strings_num);
 
-  free(st.parsers);
-  va_end(va);
-  return err;
+    ok = !ferror(f);
+  }
+
+  free(d.parsers);
+  free(d.data);
+  free(d.strings);
+  return ok;
 }
 
-mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
+typedef struct {
+  const mpc_grammar_t *g;
+  int pos;
+  int parsers_num;
+  mpc_parser_t **parsers;
+  const mpc_symbol_t *syms;
+  int failed;
+} mpc_load_t;
 
-  mpca_grammar_st_t st;
-  mpc_input_t *i;
-  mpc_err_t *err;
+static int mpc_load_int(mpc_load_t *l) {
+  if (l->pos >= l->g->data_num) { l->failed = 1; return 0; }
+  return l->g->data[l->pos++];
+}
 
-  va_list va;
+static const char *mpc_load_str_ptr(mpc_load_t *l) {
+  int j = mpc_load_int(l);
+  if (j < 0 || j >= l->g->strings_num) { l->failed = 1; return ""; }
+  return l->g->strings[j];
+}
 
-  FILE *f = fopen(filename, "rb");
+static char *mpc_load_str(mpc_load_t *l) {
+  const char *s = mpc_load_str_ptr(l);
+  char *x = malloc(strlen(s) + 1);
+  strcpy(x, s);
+  return x;
+}
 
-  if (f == NULL) {
-    err = mpc_err_file(filename, "Unable to open file!");
-    return err;
+static mpc_func_t mpc_load_func(mpc_load_t *l) {
+  const mpc_symbol_t *s;
+  const char *name;
+  if (l->pos < l->g->data_num && l->g->data[l->pos] == -1) { l->pos++; return NULL; }
+  name = mpc_load_str_ptr(l);
+  for (s = l->syms; s && s->name; s++) {
+    if (strcmp(s->name, name) == 0) { return s->f; }
   }
+  for (s = mpc_symbols; s->name; s++) {
+    if (strcmp(s->name, name) == 0) { return s->f; }
+  }
+  l->failed = 1;
+  return NULL;
+}
 
-  va_start(va, filename);
+static char **mpc_load_strs(mpc_load_t *l, int *n) {
+  int j;
+  char **xs;
+  *n = mpc_load_int(l);
+  if (*n <= 0 || l->failed) { *n = 0; return NULL; }
+  xs = malloc(sizeof(char*) * *n);
+  for (j = 0; j < *n; j++) { xs[j] = mpc_load_str(l); }
+  return xs;
+}
 
-  st.va = &va;
-  st.parsers_num = 0;
-  st.parsers = NULL;
-  st.flags = flags;
+static mpc_dfa_t *mpc_load_dfa(mpc_load_t *l) {
 
-  i = mpc_input_new_file(filename, f);
-  err = mpca_lang_st(i, &st);
-  mpc_input_delete(i);
+  int j, n = mpc_load_int(l);
+  mpc_dfa_t *d = malloc(sizeof(mpc_dfa_t));
 
-  free(st.parsers);
-  va_end(va);
+  if (n <= 0 || n > (l->g->data_num - l->pos) / 256) { l->failed = 1; n = 0; }
 
-  fclose(f);
+  d->states_num = n;
+  d->next = malloc(sizeof(short) * 256 * n + 1);
+  for (j = 0; j < n * 256; j++) {
+    d->next[j] = (short)mpc_load_int(l);
+    if (d->next[j] < -1 || d->next[j] >= n) { l->failed = 1; d->next[j] = -1; }
+  }
 
-  return err;
+  d->states = malloc(sizeof(mpc_dfa_state_t) * n + 1);
+  for (j = 0; j < n; j++) {
+    d->states[j].accept = (char)mpc_load_int(l);
+    d->states[j].merged_back = mpc_load_int(l);
+    d->states[j].merged = mpc_load_strs(l, &d->states[j].merged_num);
+    d->states[j].failed_back = mpc_load_int(l);
+    d->states[j].failed = mpc_load_strs(l, &d->states[j].failed_num);
+  }
+
+  return d;
 }
 
-static int mpc_nodecount_unretained(mpc_parser_t* p, int force) {
+static mpc_parser_t *mpc_load_parser(mpc_load_t *l) {
 
-  int i, total;
+  int j, type = mpc_load_int(l);
+  mpc_parser_t *p;
 
-  if (p->retained && !force) { return 0; }
+  if (type == MPC_DUMP_REF) {
+    j = mpc_load_int(l);
+    if (j >= 0 && j < l->parsers_num) { return l->parsers[j]; }
+    l->failed = 1;
+    return mpc_undefined();
+  }
 
-  if (p->type == MPC_TYPE_EXPECT) { return 1 + mpc_nodecount_unretained(p->data.expect.x, 0); }
+  p = mpc_undefined();
+  p->type = (char)type;
 
-  if (p->type == MPC_TYPE_APPLY)    { return 1 + mpc_nodecount_unretained(p->data.apply.x, 0); }
-  if (p->type == MPC_TYPE_APPLY_TO) { return 1 + mpc_nodecount_unretained(p->data.apply_to.x, 0); }
-  if (p->type == MPC_TYPE_PREDICT)  { return 1 + mpc_nodecount_unretained(p->data.predict.x, 0); }
+  /* After a failure the parser is still built so it can be deleted */
+  if (l->failed) { p->type = MPC_TYPE_UNDEFINED; return p; }
 
-  if (p->type == MPC_TYPE_CHECK)    { return 1 + mpc_nodecount_unretained(p->data.check.x, 0); }
-  if (p->type == MPC_TYPE_CHECK_WITH) { return 1 + mpc_nodecount_unretained(p->data.check_with.x, 0); }
+  switch (type) {
 
-  if (p->type == MPC_TYPE_NOT)   { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
-  if (p->type == MPC_TYPE_MAYBE) { return 1 + mpc_nodecount_unretained(p->data.not.x, 0); }
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_STATE:
+    case MPC_TYPE_SOI:
+    case MPC_TYPE_EOI:
+    case MPC_TYPE_LIFT_VAL:
+      break;
 
-  if (p->type == MPC_TYPE_MANY)  { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_MANY1) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_COUNT) { return 1 + mpc_nodecount_unretained(p->data.repeat.x, 0); }
+    case MPC_TYPE_FAIL:    p->data.fail.m = mpc_load_str(l); break;
+    case MPC_TYPE_LIFT:    p->data.lift.lf = (mpc_ctor_t)mpc_load_func(l); break;
+    case MPC_TYPE_ANCHOR:  p->data.anchor.f = (int(*)(char,char))mpc_load_func(l); break;
+    case MPC_TYPE_SATISFY: p->data.satisfy.f = (int(*)(char))mpc_load_func(l); break;
+    case MPC_TYPE_SINGLE:  p->data.single.x = (char)mpc_load_int(l); break;
+    case MPC_TYPE_STRING:  p->data.string.x = mpc_load_str(l); break;
 
-  if (p->type == MPC_TYPE_OR) {
-    total = 1;
-    for(i = 0; i < p->data.or.n; i++) {
-      total += mpc_nodecount_unretained(p->data.or.xs[i], 0);
-    }
-    return total;
-  }
+    case MPC_TYPE_RANGE:
+      p->data.range.x = (char)mpc_load_int(l);
+      p->data.range.y = (char)mpc_load_int(l);
+      break;
 
-  if (p->type == MPC_TYPE_AND) {
-    total = 1;
-    for(i = 0; i < p->data.and.n; i++) {
-      total += mpc_nodecount_unretained(p->data.and.xs[i], 0);
-    }
-    return total;
-  }
+    case MPC_TYPE_ONEOF:
+      p->data.cls.x = mpc_load_str(l);
+      p->data.cls.c = mpc_class_new(mpc_class_oneof, p->data.cls.x);
+      break;
 
-  return 1;
+    case MPC_TYPE_NONEOF:
+      p->data.cls.x = mpc_load_str(l);
+      p->data.cls.c = mpc_class_new(mpc_class_noneof, p->data.cls.x);
+      break;
 
-}
+    case MPC_TYPE_EXPECT:
+      p->data.expect.m = mpc_load_str(l);
+      p->data.expect.x = mpc_load_parser(l);
+      break;
 
-void mpc_stats(mpc_parser_t* p) {
-  printf("Stats\n");
-  printf("=====\n");
-  printf("Node Count: %i\n", mpc_nodecount_unretained(p, 1));
-}
+    case MPC_TYPE_APPLY:
+      p->data.apply.f = (mpc_apply_t)mpc_load_func(l);
+      p->data.apply.x = mpc_load_parser(l);
+      break;
 
-static void mpc_optimise_unretained(mpc_parser_t *p, int force) {
+    case MPC_TYPE_APPLY_TO:
+      p->data.apply_to.f = (mpc_apply_to_t)mpc_load_func(l);
+      p->data.apply_to.d = mpc_symbol_tags((mpc_func_t)p->data.apply_to.f)
+        ? (void*)mpc_load_str_ptr(l) : NULL;
+      if (p->data.apply_to.f == (mpc_apply_to_t)mpc_ast_add_rule) {
+        j = mpc_load_int(l);
+        if (j >= 0 && j < l->parsers_num) { p->data.apply_to.d = l->parsers[j]; } else { l->failed = 1; }
+      }
+      p->data.apply_to.x = mpc_load_parser(l);
+      break;
 
-  int i, n, m;
-  mpc_parser_t *t;
+    case MPC_TYPE_CHECK:
+      p->data.check.e = mpc_load_str(l);
+      p->data.check.dx = (mpc_dtor_t)mpc_load_func(l);
+      p->data.check.f = (mpc_check_t)mpc_load_func(l);
+      p->data.check.x = mpc_load_parser(l);
+      break;
 
-  if (p->retained && !force) { return; }
+    case MPC_TYPE_CHECK_WITH:
+      p->data.check_with.e = mpc_load_str(l);
+      p->data.check_with.dx = (mpc_dtor_t)mpc_load_func(l);
+      p->data.check_with.f = (mpc_check_with_t)mpc_load_func(l);
+      p->data.check_with.x = mpc_load_parser(l);
+      break;
 
-  /* Optimise Subexpressions */
+    case MPC_TYPE_PREDICT:
+      p->data.predict.x = mpc_load_parser(l);
+      break;
 
-  if (p->type == MPC_TYPE_EXPECT)     { mpc_optimise_unretained(p->data.expect.x, 0); }
-  if (p->type == MPC_TYPE_APPLY)      { mpc_optimise_unretained(p->data.apply.x, 0); }
-  if (p->type == MPC_TYPE_APPLY_TO)   { mpc_optimise_unretained(p->data.apply_to.x, 0); }
-  if (p->type == MPC_TYPE_CHECK)      { mpc_optimise_unretained(p->data.check.x, 0); }
-  if (p->type == MPC_TYPE_CHECK_WITH) { mpc_optimise_unretained(p->data.check_with.x, 0); }
-  if (p->type == MPC_TYPE_PREDICT)    { mpc_optimise_unretained(p->data.predict.x, 0); }
-  if (p->type == MPC_TYPE_NOT)        { mpc_optimise_unretained(p->data.not.x, 0); }
-  if (p->type == MPC_TYPE_MAYBE)      { mpc_optimise_unretained(p->data.not.x, 0); }
-  if (p->type == MPC_TYPE_MANY)       { mpc_optimise_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_MANY1)      { mpc_optimise_unretained(p->data.repeat.x, 0); }
-  if (p->type == MPC_TYPE_COUNT)      { mpc_optimise_unretained(p->data.repeat.x, 0); }
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      p->data.not.dx = (mpc_dtor_t)mpc_load_func(l);
+      p->data.not.lf = (mpc_ctor_t)mpc_load_func(l);
+      p->data.not.x = mpc_load_parser(l);
+      break;
 
-  if (p->type == MPC_TYPE_OR) {
-    for(i = 0; i < p->data.or.n; i++) {
-      mpc_optimise_unretained(p->data.or.xs[i], 0);
-    }
-  }
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      p->data.repeat.n = mpc_load_int(l);
+      p->data.repeat.f = (mpc_fold_t)mpc_load_func(l);
+      p->data.repeat.dx = (mpc_dtor_t)mpc_load_func(l);
+      p->data.repeat.x = mpc_load_parser(l);
+      break;
 
-  if (p->type == MPC_TYPE_AND) {
-    for(i = 0; i < p->data.and.n; i++) {
-      mpc_optimise_unretained(p->data.and.xs[i], 0);
-    }
-  }
+    case MPC_TYPE_OR:
+      p->data.or.n = mpc_load_int(l);
+      if (p->data.or.n < 0 || p->data.or.n > l->g->data_num) { l->failed = 1; p->data.or.n = 0; }
+      p->data.or.xs = malloc(sizeof(mpc_parser_t*) * p->data.or.n + 1);
+      for (j = 0; j < p->data.or.n; j++) { p->data.or.xs[j] = mpc_load_parser(l); }
+      break;
 
-  /* Perform optimisations */
+    case MPC_TYPE_AND:
+      p->data.and.n = mpc_load_int(l);
+      if (p->data.and.n < 1 || p->data.and.n > l->g->data_num) { l->failed = 1; p->data.and.n = 1; }
+      p->data.and.f = (mpc_fold_t)mpc_load_func(l);
+      p->data.and.dxs = malloc(sizeof(mpc_dtor_t) * (p->data.and.n-1) + 1);
+      for (j = 0; j < p->data.and.n-1; j++) { p->data.and.dxs[j] = (mpc_dtor_t)mpc_load_func(l); }
+      p->data.and.xs = malloc(sizeof(mpc_parser_t*) * p->data.and.n);
+      for (j = 0; j < p->data.and.n; j++) { p->data.and.xs[j] = mpc_load_parser(l); }
+      break;
 
-  while (1) {
+    case MPC_TYPE_DFA:
+      p->data.dfa.d = mpc_load_dfa(l);
+      p->data.dfa.x = mpc_load_parser(l);
+      break;
 
-    /* Merge rhs `or` */
-    if (p->type == MPC_TYPE_OR
-    &&  p->data.or.xs[p->data.or.n-1]->type == MPC_TYPE_OR
-    && !p->data.or.xs[p->data.or.n-1]->retained) {
-      t = p->data.or.xs[p->data.or.n-1];
-      n = p->data.or.n; m = t->data.or.n;
-      p->data.or.n = n + m - 1;
-      p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
-      continue;
-    }
+    case MPC_TYPE_SPAN:
+      p->data.span.min = mpc_load_int(l);
+      p->data.span.x = mpc_load_parser(l);
+      p->data.span.c = p->data.span.x->type == MPC_TYPE_EXPECT
+        ? mpc_optimise_class(p->data.span.x->data.expect.x) : NULL;
+      if (p->data.span.c == NULL) { l->failed = 1; p->data.span.c = calloc(1, sizeof(mpc_class_t)); }
+      break;
 
-    /* Merge lhs `or` */
-    if (p->type == MPC_TYPE_OR
-    &&  p->data.or.xs[0]->type == MPC_TYPE_OR
-    && !p->data.or.xs[0]->retained) {
-      t = p->data.or.xs[0];
-      n = p->data.or.n; m = t->data.or.n;
-      p->data.or.n = n + m - 1;
-      p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
-      memmove(p->data.or.xs, t->data.or.xs, m * sizeof(mpc_parser_t*));
-      free(t->data.or.xs); free(t->name); free(t);
-      continue;
-    }
+    case MPC_TYPE_MEMO:
+      p->data.memo.cf = (mpc_apply_t)mpc_load_func(l);
+      p->data.memo.df = (mpc_dtor_t)mpc_load_func(l);
+      p->data.memo.x = mpc_load_parser(l);
+      break;
 
-    /* Remove ast `pass` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.n == 2
-    &&  p->data.and.xs[0]->type == MPC_TYPE_PASS
-    && !p->data.and.xs[0]->retained
-    &&  p->data.and.f == mpcf_fold_ast) {
-      t = p->data.and.xs[1];
-      mpc_delete(p->data.and.xs[0]);
-      free(p->data.and.xs); free(p->data.and.dxs); free(p->name);
-      memcpy(p, t, sizeof(mpc_parser_t));
-      free(t);
-      continue;
-    }
+    default:
+      l->failed = 1;
+      p->type = MPC_TYPE_UNDEFINED;
+      break;
+  }
 
-    /* Merge ast lhs `and` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.f == mpcf_fold_ast
-    &&  p->data.and.xs[0]->type == MPC_TYPE_AND
-    && !p->data.and.xs[0]->retained
-    &&  p->data.and.xs[0]->data.and.f == mpcf_fold_ast) {
-      t = p->data.and.xs[0];
-      n = p->data.and.n; m = t->data.and.n;
-      p->data.and.n = n + m - 1;
-      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m - 1));
-      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
-      memmove(p->data.and.xs + m, p->data.and.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
-      memmove(p->data.and.xs, t->data.and.xs, m * sizeof(mpc_parser_t*));
-      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
-      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t);
-      continue;
-    }
+  return p;
+}
 
-    /* Merge ast rhs `and` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.f == mpcf_fold_ast
-    &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
-    && !p->data.and.xs[p->data.and.n-1]->retained
-    &&  p->data.and.xs[p->data.and.n-1]->data.and.f == mpcf_fold_ast) {
-      t = p->data.and.xs[p->data.and.n-1];
-      n = p->data.and.n; m = t->data.and.n;
-      p->data.and.n = n + m - 1;
-      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
-      memmove(p->data.and.xs + n - 1, t->data.and.xs, m * sizeof(mpc_parser_t*));
-      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = (mpc_dtor_t)mpc_ast_delete; }
-      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t);
-      continue;
-    }
+int mpc_load(const mpc_grammar_t *g, const mpc_symbol_t *syms, int n, ...) {
 
-    /* Remove re `lift` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.n == 2
-    &&  p->data.and.xs[0]->type == MPC_TYPE_LIFT
-    &&  p->data.and.xs[0]->data.lift.lf == mpcf_ctor_str
-    && !p->data.and.xs[0]->retained
-    &&  p->data.and.f == mpcf_strfold) {
-      t = p->data.and.xs[1];
-      mpc_delete(p->data.and.xs[0]);
-      free(p->data.and.xs); free(p->data.and.dxs); free(p->name);
-      memcpy(p, t, sizeof(mpc_parser_t));
-      free(t);
-      continue;
-    }
+  int j;
+  mpc_load_t l;
+  mpc_first_t st;
+  mpc_parser_t **defs;
+  va_list va;
 
-    /* Merge re lhs `and` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.f == mpcf_strfold
-    &&  p->data.and.xs[0]->type == MPC_TYPE_AND
-    && !p->data.and.xs[0]->retained
-    &&  p->data.and.xs[0]->data.and.f == mpcf_strfold) {
-      t = p->data.and.xs[0];
-      n = p->data.and.n; m = t->data.and.n;
-      p->data.and.n = n + m - 1;
-      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m - 1));
-      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
-      memmove(p->data.and.xs + m, p->data.and.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
-      memmove(p->data.and.xs, t->data.and.xs, m * sizeof(mpc_parser_t*));
-      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = free; }
-      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t);
-      continue;
-    }
+  l.g = g;
+  l.pos = 0;
+  l.parsers_num = n;
+  l.parsers = malloc(sizeof(mpc_parser_t*) * n);
+  l.syms = syms;
+  l.failed = n != g->parsers_num;
 
-    /* Merge re rhs `and` */
-    if (p->type == MPC_TYPE_AND
-    &&  p->data.and.f == mpcf_strfold
-    &&  p->data.and.xs[p->data.and.n-1]->type == MPC_TYPE_AND
-    && !p->data.and.xs[p->data.and.n-1]->retained
-    &&  p->data.and.xs[p->data.and.n-1]->data.and.f == mpcf_strfold) {
-      t = p->data.and.xs[p->data.and.n-1];
-      n = p->data.and.n; m = t->data.and.n;
-      p->data.and.n = n + m - 1;
-      p->data.and.xs = realloc(p->data.and.xs, sizeof(mpc_parser_t*) * (n + m -1));
-      p->data.and.dxs = realloc(p->data.and.dxs, sizeof(mpc_dtor_t) * (n + m - 1 - 1));
-      memmove(p->data.and.xs + n - 1, t->data.and.xs, m * sizeof(mpc_parser_t*));
-      for (i = 0; i < p->data.and.n-1; i++) { p->data.and.dxs[i] = free; }
-      free(t->data.and.xs); free(t->data.and.dxs); free(t->name); free(t);
-      continue;
-    }
+  va_start(va, n);
+  for (j = 0; j < n; j++) { l.parsers[j] = va_arg(va, mpc_parser_t*); }
+  va_end(va);
 
-    return;
+  defs = calloc(n, sizeof(mpc_parser_t*));
+  for (j = 0; j < n && !l.failed; j++) {
+    if (!l.parsers[j]->retained || strcmp(mpc_load_str_ptr(&l), l.parsers[j]->name) != 0) {
+      l.failed = 1;
+    }
+    defs[j] = mpc_load_parser(&l);
+    if (defs[j]->retained) { defs[j] = NULL; l.failed = 1; }
+  }
 
+  for (j = 0; j < n; j++) {
+    if (defs[j] == NULL) { continue; }
+    if (l.failed) {
+      mpc_delete(defs[j]);
+    } else {
+      mpc_define(l.parsers[j], defs[j]);
+      l.parsers[j]->id = j;
+    }
   }
 
-}
+  /* Dispatch tables aren't saved so are built again */
+  if (!l.failed) {
+    st.rules_num = 0;
+    st.rules = NULL;
+    for (j = 0; j < n; j++) { mpc_optimise_dispatch(&st, l.parsers[j], 1); }
+    free(st.rules);
+  }
 
-void mpc_optimise(mpc_parser_t *p) {
-  mpc_optimise_unretained(p, 1);
+  free(defs);
+  free(l.parsers);
+  return !l.failed;
 }
-
@@ -71,6 +71,20 @@ int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+/*
+** Threads
+**
+** A parse keeps all of its state in an input of its own
+** and never changes the parsers it runs, so once a grammar
+** has been built, loaded and optimised it can be used by
+** any number of threads at once. Building, defining,
+** optimising or deleting parsers must not overlap with a
+** parse that uses them. The `stats` and `profile` given
+** in `mpc_parse_opts_t` are written by the parse, so each
+** thread needs its own, and the functions a grammar calls
+** on its outputs must be safe to call from many threads.
+*/
+
 /*
 ** Function Types
 */
@@ -85,6 +99,145 @@ typedef mpc_val_t*(*mpc_fold_t)(int,mpc_val_t**);
 typedef int(*mpc_check_t)(mpc_val_t**);
 typedef int(*mpc_check_with_t)(mpc_val_t**,void*);
 
+/*
+** Packrat Parsing
+**
+** Every named parser is memoised for the duration of the
+** parse. `cf` copies an output so a stored success can be
+** handed out again and `df` deletes the stored copies. All
+** named parsers must produce outputs `cf` can copy. With a
+** NULL `cf` only failures are memoised.
+*/
+
+int mpc_parse_packrat(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, mpc_apply_t cf, mpc_dtor_t df);
+
+/*
+** Borrowed Input
+**
+** `mpc_parse` and `mpc_nparse` copy the input and the
+** filename before parsing. The borrowed versions parse
+** the caller's buffer where it is, so it must not change
+** until they return.
+*/
+
+int mpc_parse_borrowed(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r);
+int mpc_nparse_borrowed(const char *filename, const char *string, size_t length, mpc_parser_t *p, mpc_result_t *r);
+
+/*
+** Parse Options
+**
+** Small objects made during a parse come from a pool
+** which holds `pool_size` of them, or a default number
+** if it is 0. When the pool runs out they come from the
+** heap. If `stats` isn't NULL it is filled in with how
+** many allocations the pool served, how many fell back
+** to the heap because it was full or they were too big,
+** and how many bytes the parse kept in its arena. If
+** `profile` isn't NULL the parse is profiled into it, see
+** Profiling below.
+**
+** With `MPC_PARSE_AST_ARENA` the AST made by a parser
+** built with `mpca_lang` or the `mpca_` combinators is
+** put in an arena of its own. Tags are interned and the
+** contents of each token point at where it was matched,
+** so they aren't NUL terminated and `contents_len` must
+** be used. The AST owns the copy of the input they point
+** into and `mpc_ast_delete` on the root releases it all
+** at once. Nodes in an arena can't be deleted or changed
+** on their own.
+**
+** With `MPC_PARSE_BORROWED` the string given to
+** `mpc_parse_with` is borrowed rather than copied. An
+** arena AST made that way points into the caller's
+** string instead of owning a copy, so it must be deleted
+** first.
+**
+** With `MPC_PARSE_LAZY_POSITIONS` a string input only
+** counts bytes as it is consumed. The row and column of
+** an error, or of a position taken by `mpc_state` or
+** `mpca_state`, are worked out from an index of line
+** starts only when they are made. Other inputs count rows
+** and columns as they go whether it is set or not.
+**
+** New members are only ever added at the end, and a
+** member left out of an initializer is zero, so an
+** initializer naming the leading members keeps its
+** meaning. Use designated initializers, or list every
+** member, to stay clear of missing initializer warnings.
+*/
+
+enum {
+  MPC_PARSE_DEFAULT        = 0,
+  MPC_PARSE_AST_ARENA      = 1,
+  MPC_PARSE_BORROWED       = 2,
+  MPC_PARSE_LAZY_POSITIONS = 4
+};
+
+typedef struct {
+  unsigned long pool_hits;
+  unsigned long pool_misses;
+  unsigned long large_allocs;
+  unsigned long arena_bytes;
+} mpc_parse_stats_t;
+
+typedef struct mpc_profile_t mpc_profile_t;
+
+typedef struct {
+  int flags;
+  int pool_size;
+  mpc_parse_stats_t *stats;
+  mpc_profile_t *profile;
+} mpc_parse_opts_t;
+
+int mpc_parse_with(const char *filename, const char *string, mpc_parser_t *p, mpc_result_t *r, const mpc_parse_opts_t *o);
+int mpc_parse_contents_with(const char *filename, mpc_parser_t *p, mpc_result_t *r, const mpc_parse_opts_t *o);
+
+/*
+** Streams
+**
+** A stream parses the contents of a file a piece at a
+** time. Each call to `mpc_stream_next` runs the parser
+** from where the last one stopped, and positions count
+** from the start of the file. `mpc_stream_eoi` says if
+** all of it has been consumed. If the file can't be read
+** `mpc_stream_contents` returns NULL with the error in
+** `r`. Arena ASTs made from a stream point into its input
+** rather than owning it, so they must be deleted first.
+** `mpc_stream_pipe` reads from a pipe instead, and only
+** keeps as much of it as the parse can still rewind to.
+*/
+
+typedef struct mpc_stream_t mpc_stream_t;
+
+mpc_stream_t *mpc_stream_contents(const char *filename, mpc_result_t *r);
+mpc_stream_t *mpc_stream_pipe(const char *filename, FILE *pipe);
+int mpc_stream_next(mpc_stream_t *s, mpc_parser_t *p, mpc_result_t *r, const mpc_parse_opts_t *o);
+int mpc_stream_eoi(mpc_stream_t *s);
+void mpc_stream_delete(mpc_stream_t *s);
+
+/*
+** Profiling
+**
+** A profile counts, for each named parser and for each
+** type of combinator, how many times it ran, how many of
+** those succeeded and failed, how many rewinds it made,
+** how many bytes it consumed and the time it took. Times
+** include the parsers each one called. It adds up over
+** every parse it is given to until it is deleted, and
+** `mpc_profile_dump` prints it slowest first as text, CSV
+** or JSON.
+*/
+
+enum {
+  MPC_PROFILE_TEXT = 0,
+  MPC_PROFILE_CSV  = 1,
+  MPC_PROFILE_JSON = 2
+};
+
+mpc_profile_t *mpc_profile_new(void);
+void mpc_profile_delete(mpc_profile_t *p);
+void mpc_profile_dump(mpc_profile_t *p, FILE *f, int format);
+
 /*
 ** Building a Parser
 */
@@ -147,6 +300,7 @@ mpc_parser_t *mpc_or(int n, ...);
 mpc_parser_t *mpc_and(int n, mpc_fold_t f, ...);
 
 mpc_parser_t *mpc_predictive(mpc_parser_t *a);
+mpc_parser_t *mpc_memo(mpc_parser_t *a, mpc_apply_t cf, mpc_dtor_t df);
 
 /*
 ** Common Parsers
@@ -279,22 +433,39 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode);
 
 /*
 ** AST
+**
+** Nodes made by a rule of `mpca_lang` have the rule's
+** position in the list of parsers given to `mpca_lang` or
+** `mpc_load` as their `tag_id`, which is -1 otherwise.
+** Literals and anchors in a grammar only make punctuation
+** nodes, these are marked `MPC_AST_DROPPABLE`.
 */
 
+enum {
+  MPC_AST_ARENA      = 1,
+  MPC_AST_ARENA_ROOT = 2,
+  MPC_AST_DROPPABLE  = 4
+};
+
 typedef struct mpc_ast_t {
   char *tag;
+  int tag_id;
   char *contents;
+  size_t contents_len;
   mpc_state_t state;
   int children_num;
   struct mpc_ast_t** children;
+  int flags;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_build(int n, const char *tag, ...);
 mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a);
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t);
+mpc_ast_t *mpc_ast_add_rule(mpc_ast_t *a, mpc_parser_t *p);
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s);
 
@@ -333,6 +504,7 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b);
 
 mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **as);
 mpc_val_t *mpcf_str_ast(mpc_val_t *c);
+mpc_val_t *mpcf_lit_ast(mpc_val_t *c);
 mpc_val_t *mpcf_state_ast(int n, mpc_val_t **xs);
 
 mpc_parser_t *mpca_tag(mpc_parser_t *a, const char *t);
@@ -354,7 +526,8 @@ mpc_parser_t *mpca_and(int n, ...);
 enum {
   MPCA_LANG_DEFAULT              = 0,
   MPCA_LANG_PREDICTIVE           = 1,
-  MPCA_LANG_WHITESPACE_SENSITIVE = 2
+  MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+  MPCA_LANG_PACKRAT              = 4
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -364,6 +537,37 @@ mpc_err_t *mpca_lang_file(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_pipe(int flags, FILE *f, ...);
 mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...);
 
+/*
+** Serialisation
+**
+** A built grammar can be written out as C source with
+** `mpc_dump_c` and loaded back with `mpc_load` without
+** parsing any grammar or regex text. The parsers passed
+** must be retained and are given in the same order to
+** both. Functions are stored by name so any not defined
+** by mpc must be listed in `syms`, which ends with an
+** entry whose name is NULL. The generated source needs
+** `mpc.h` included before it.
+*/
+
+typedef void(*mpc_func_t)(void);
+
+typedef struct {
+  const char *name;
+  mpc_func_t f;
+} mpc_symbol_t;
+
+typedef struct {
+  int parsers_num;
+  const int *data;
+  int data_num;
+  const char *const *strings;
+  int strings_num;
+} mpc_grammar_t;
+
+int mpc_dump_c(FILE *f, const char *name, const mpc_symbol_t *syms, int n, ...);
+int mpc_load(const mpc_grammar_t *g, const mpc_symbol_t *syms, int n, ...);
+
 /*
 ** Misc
 */
@@ -0,0 +1,389 @@
+// Conversions between decimal text and doubles for the reader and printer.
+// Numbers are read with a fast exact path for the common case and printed as
+// a decimal that reads back to the same double, found with Grisu2, which is
+// the shortest one nearly always
+
+#include "numconv.h"
+
+#include <errno.h>
+#include <locale.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Reading
+
+// Powers of ten that are exact as doubles
+static const double numconv_exact_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Numbers the fast path can't do exactly are read by strtod, from a
+// terminated copy of their text. strtod follows LC_NUMERIC, so the copy gets
+// the locale's decimal point in place of the '.'. Only overflow is an error,
+// numbers too small for a double just lose precision
+static size_t numconv_parse_slow(const char *s, size_t n, double *x) {
+  const char *dp = localeconv()->decimal_point;
+  size_t dpn = strlen(dp);
+  char buf[64];
+  char *t = n + dpn < sizeof(buf) ? buf : malloc(n + dpn + 1);
+  size_t j = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (s[i] == '.') {
+      memcpy(t + j, dp, dpn);
+      j += dpn;
+    } else {
+      t[j++] = s[i];
+    }
+  }
+  t[j] = '\0';
+  errno = 0;
+  *x = strtod(t, NULL);
+  int ok = errno != ERANGE || !isinf(*x);
+  if (t != buf) {
+    free(t);
+  }
+  return ok ? n : 0;
+}
+
+size_t numconv_parse(const char *s, size_t n, double *x) {
+  size_t i = 0;
+  int neg = 0, any = 0, digits = 0, inexact = 0;
+  uint64_t m = 0;
+  long e = 0;
+
+  if (i < n && (s[i] == '-' || s[i] == '+')) {
+    neg = s[i++] == '-';
+  }
+
+  // Up to 19 significant digits fit in m, the rest only move the exponent
+  for (; i < n && s[i] >= '0' && s[i] <= '9'; i++, any = 1) {
+    if (digits < 19) {
+      m = m * 10 + (uint64_t)(s[i] - '0');
+      digits += m != 0;
+    } else {
+      e++;
+      inexact |= s[i] != '0';
+    }
+  }
+  if (i < n && s[i] == '.') {
+    for (i++; i < n && s[i] >= '0' && s[i] <= '9'; i++, any = 1) {
+      if (digits < 19) {
+        m = m * 10 + (uint64_t)(s[i] - '0');
+        digits += m != 0;
+        e--;
+      } else {
+        inexact |= s[i] != '0';
+      }
+    }
+  }
+  if (!any) {
+    return 0;
+  }
+
+  // The exponent is only part of the number if it has digits
+  if (i < n && (s[i] == 'e' || s[i] == 'E')) {
+    size_t j = i + 1;
+    int eneg = 0;
+    long ex = 0;
+    if (j < n && (s[j] == '-' || s[j] == '+')) {
+      eneg = s[j++] == '-';
+    }
+    if (j < n && s[j] >= '0' && s[j] <= '9') {
+      for (; j < n && s[j] >= '0' && s[j] <= '9'; j++) {
+        if (ex < 100000) {
+          ex = ex * 10 + (s[j] - '0');
+        }
+      }
+      e += eneg ? -ex : ex;
+      i = j;
+    }
+  }
+
+  // Both the digits and the power of ten are exact as doubles, so one
+  // correctly rounded multiply or divide gives the correctly rounded result
+  if (!inexact && m <= (uint64_t)1 << 53 && e >= -22 && e <= 22) {
+    double d = (double)m;
+    d = e < 0 ? d / numconv_exact_pow10[-e] : d * numconv_exact_pow10[e];
+    *x = neg ? -d : d;
+    return i;
+  }
+  return numconv_parse_slow(s, i, x);
+}
+
+// Printing
+
+// A floating point number f * 2^e with a 64 bit significand
+typedef struct {
+  uint64_t f;
+  int e;
+} numconv_fp;
+
+// The product rounded to 64 bits
+static numconv_fp numconv_fp_mul(numconv_fp x, numconv_fp y) {
+  const uint64_t m32 = 0xFFFFFFFFu;
+  uint64_t a = x.f >> 32, b = x.f & m32, c = y.f >> 32, d = y.f & m32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t t = (bd >> 32) + (ad & m32) + (bc & m32) + ((uint64_t)1 << 31);
+  numconv_fp r = {ac + (ad >> 32) + (bc >> 32) + (t >> 32), x.e + y.e + 64};
+  return r;
+}
+
+static numconv_fp numconv_fp_normalize(numconv_fp x) {
+  while (!(x.f & ((uint64_t)1 << 63))) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+// 10^k for k = -348, -340 ... 340, normalized
+static const numconv_fp numconv_cached_pow10[] = {
+    {0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193},
+    {0x8b16fb203055ac76ULL, -1166}, {0xcf42894a5dce35eaULL, -1140},
+    {0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+    {0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034},
+    {0xbe5691ef416bd60cULL, -1007}, {0x8dd01fad907ffc3cULL, -980},
+    {0xd3515c2831559a83ULL, -954}, {0x9d71ac8fada6c9b5ULL, -927},
+    {0xea9c227723ee8bcbULL, -901}, {0xaecc49914078536dULL, -874},
+    {0x823c12795db6ce57ULL, -847}, {0xc21094364dfb5637ULL, -821},
+    {0x9096ea6f3848984fULL, -794}, {0xd77485cb25823ac7ULL, -768},
+    {0xa086cfcd97bf97f4ULL, -741}, {0xef340a98172aace5ULL, -715},
+    {0xb23867fb2a35b28eULL, -688}, {0x84c8d4dfd2c63f3bULL, -661},
+    {0xc5dd44271ad3cdbaULL, -635}, {0x936b9fcebb25c996ULL, -608},
+    {0xdbac6c247d62a584ULL, -582}, {0xa3ab66580d5fdaf6ULL, -555},
+    {0xf3e2f893dec3f126ULL, -529}, {0xb5b5ada8aaff80b8ULL, -502},
+    {0x87625f056c7c4a8bULL, -475}, {0xc9bcff6034c13053ULL, -449},
+    {0x964e858c91ba2655ULL, -422}, {0xdff9772470297ebdULL, -396},
+    {0xa6dfbd9fb8e5b88fULL, -369}, {0xf8a95fcf88747d94ULL, -343},
+    {0xb94470938fa89bcfULL, -316}, {0x8a08f0f8bf0f156bULL, -289},
+    {0xcdb02555653131b6ULL, -263}, {0x993fe2c6d07b7facULL, -236},
+    {0xe45c10c42a2b3b06ULL, -210}, {0xaa242499697392d3ULL, -183},
+    {0xfd87b5f28300ca0eULL, -157}, {0xbce5086492111aebULL, -130},
+    {0x8cbccc096f5088ccULL, -103}, {0xd1b71758e219652cULL, -77},
+    {0x9c40000000000000ULL, -50}, {0xe8d4a51000000000ULL, -24},
+    {0xad78ebc5ac620000ULL, 3}, {0x813f3978f8940984ULL, 30},
+    {0xc097ce7bc90715b3ULL, 56}, {0x8f7e32ce7bea5c70ULL, 83},
+    {0xd5d238a4abe98068ULL, 109}, {0x9f4f2726179a2245ULL, 136},
+    {0xed63a231d4c4fb27ULL, 162}, {0xb0de65388cc8ada8ULL, 189},
+    {0x83c7088e1aab65dbULL, 216}, {0xc45d1df942711d9aULL, 242},
+    {0x924d692ca61be758ULL, 269}, {0xda01ee641a708deaULL, 295},
+    {0xa26da3999aef774aULL, 322}, {0xf209787bb47d6b85ULL, 348},
+    {0xb454e4a179dd1877ULL, 375}, {0x865b86925b9bc5c2ULL, 402},
+    {0xc83553c5c8965d3dULL, 428}, {0x952ab45cfa97a0b3ULL, 455},
+    {0xde469fbd99a05fe3ULL, 481}, {0xa59bc234db398c25ULL, 508},
+    {0xf6c69a72a3989f5cULL, 534}, {0xb7dcbf5354e9beceULL, 561},
+    {0x88fcf317f22241e2ULL, 588}, {0xcc20ce9bd35c78a5ULL, 614},
+    {0x98165af37b2153dfULL, 641}, {0xe2a0b5dc971f303aULL, 667},
+    {0xa8d9d1535ce3b396ULL, 694}, {0xfb9b7cd9a4a7443cULL, 720},
+    {0xbb764c4ca7a44410ULL, 747}, {0x8bab8eefb6409c1aULL, 774},
+    {0xd01fef10a657842cULL, 800}, {0x9b10a4e5e9913129ULL, 827},
+    {0xe7109bfba19c0c9dULL, 853}, {0xac2820d9623bf429ULL, 880},
+    {0x80444b5e7aa7cf85ULL, 907}, {0xbf21e44003acdd2dULL, 933},
+    {0x8e679c2f5e44ff8fULL, 960}, {0xd433179d9c8cb841ULL, 986},
+    {0x9e19db92b4e31ba9ULL, 1013}, {0xeb96bf6ebadf77d9ULL, 1039},
+    {0xaf87023b9bf0ee6bULL, 1066}
+};
+
+// Picks a cached power of ten c_k that brings a number with binary exponent
+// e into the range the digits are generated in, and sets k to -k
+static numconv_fp numconv_cached_power(int e, int *k) {
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int ik = (int)dk;
+  if (ik != dk) {
+    ik++;
+  }
+  int index = (ik >> 3) + 1;
+  *k = -(-348 + index * 8);
+  return numconv_cached_pow10[index];
+}
+
+static const uint64_t numconv_pow10[] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+    100000000000000000ULL,
+    1000000000000000000ULL,
+    10000000000000000000ULL};
+
+// Moves the last digit down towards w while it stays inside the boundaries
+static void numconv_round(char *buf, int len, uint64_t delta, uint64_t rest,
+                          uint64_t ten_kappa, uint64_t wp_w) {
+  while (rest < wp_w && delta - rest >= ten_kappa &&
+         (rest + ten_kappa < wp_w || wp_w - rest > rest + ten_kappa - wp_w)) {
+    buf[len - 1]--;
+    rest += ten_kappa;
+  }
+}
+
+// Generates the fewest digits of mp that are within delta of it
+static void numconv_digits(numconv_fp w, numconv_fp mp, uint64_t delta,
+                           char *buf, int *len, int *k) {
+  numconv_fp one = {(uint64_t)1 << -mp.e, mp.e};
+  uint64_t wp_w = mp.f - w.f;
+  uint32_t p1 = (uint32_t)(mp.f >> -one.e);
+  uint64_t p2 = mp.f & (one.f - 1);
+  int kappa = 1;
+  while (kappa < 10 && p1 >= numconv_pow10[kappa]) {
+    kappa++;
+  }
+
+  *len = 0;
+  while (kappa > 0) {
+    uint32_t d = (uint32_t)(p1 / numconv_pow10[kappa - 1]);
+    p1 %= (uint32_t)numconv_pow10[kappa - 1];
+    if (d || *len) {
+      buf[(*len)++] = (char)('0' + d);
+    }
+    kappa--;
+    uint64_t t = ((uint64_t)p1 << -one.e) + p2;
+    if (t <= delta) {
+      *k += kappa;
+      numconv_round(buf, *len, delta, t, numconv_pow10[kappa] << -one.e, wp_w);
+      return;
+    }
+  }
+
+  for (;;) {
+    p2 *= 10;
+    delta *= 10;
+    char d = (char)(p2 >> -one.e);
+    if (d || *len) {
+      buf[(*len)++] = (char)('0' + d);
+    }
+    p2 &= one.f - 1;
+    kappa--;
+    if (p2 < delta) {
+      *k += kappa;
+      int index = -kappa;
+      numconv_round(buf, *len, delta, p2, one.f,
+                    wp_w * (index < 20 ? numconv_pow10[index] : 0));
+      return;
+    }
+  }
+}
+
+// Finds the digits of a positive finite x and the power of ten k they are
+// scaled by
+static void numconv_grisu2(double x, char *buf, int *len, int *k) {
+  uint64_t u;
+  memcpy(&u, &x, sizeof(u));
+  int be = (int)((u >> 52) & 0x7FF);
+  numconv_fp v = {u & (((uint64_t)1 << 52) - 1), -1074};
+  if (be) {
+    v.f += (uint64_t)1 << 52;
+    v.e = be - 1075;
+  }
+
+  // The boundaries halfway to the neighbouring doubles
+  numconv_fp mp = {(v.f << 1) + 1, v.e - 1};
+  mp = numconv_fp_normalize(mp);
+  numconv_fp mm = {(v.f << 1) - 1, v.e - 1};
+  if (v.f == (uint64_t)1 << 52) {
+    // Powers of two are closer to the double below them
+    mm.f = (v.f << 2) - 1;
+    mm.e = v.e - 2;
+  }
+  mm.f <<= mm.e - mp.e;
+  mm.e = mp.e;
+
+  numconv_fp c = numconv_cached_power(mp.e, k);
+  numconv_fp w = numconv_fp_mul(numconv_fp_normalize(v), c);
+  numconv_fp wp = numconv_fp_mul(mp, c);
+  numconv_fp wm = numconv_fp_mul(mm, c);
+  wm.f++;
+  wp.f--;
+  numconv_digits(w, wp, wp.f - wm.f, buf, len, k);
+}
+
+// Lays out the digits scaled by 10^k like JavaScript does, with a decimal
+// point unless the number is at least 1e21 or smaller than 1e-6
+static int numconv_layout(const char *digits, int len, int k, char *buf) {
+  int n = len + k, i = 0;
+  if (len <= n && n <= 21) {
+    memcpy(buf, digits, len);
+    memset(buf + len, '0', n - len);
+    i = n;
+  } else if (0 < n && n <= 21) {
+    memcpy(buf, digits, n);
+    buf[n] = '.';
+    memcpy(buf + n + 1, digits + n, len - n);
+    i = len + 1;
+  } else if (-6 < n && n <= 0) {
+    buf[i++] = '0';
+    buf[i++] = '.';
+    memset(buf + i, '0', -n);
+    i += -n;
+    memcpy(buf + i, digits, len);
+    i += len;
+  } else {
+    buf[i++] = digits[0];
+    if (len > 1) {
+      buf[i++] = '.';
+      memcpy(buf + i, digits + 1, len - 1);
+      i += len - 1;
+    }
+    int e = n - 1;
+    buf[i++] = 'e';
+    buf[i++] = e < 0 ? '-' : '+';
+    e = e < 0 ? -e : e;
+    if (e >= 100) {
+      buf[i++] = (char)('0' + e / 100);
+    }
+    buf[i++] = (char)('0' + e / 10 % 10);
+    buf[i++] = (char)('0' + e % 10);
+  }
+  buf[i] = '\0';
+  return i;
+}
+
+int numconv_format(double x, char *buf) {
+  char *p = buf;
+  if (signbit(x)) {
+    *p++ = '-';
+    x = -x;
+  }
+  if (isnan(x) || isinf(x)) {
+    strcpy(p, isnan(x) ? "nan" : "inf");
+    return (int)(p - buf) + 3;
+  }
+  if (x == 0) {
+    strcpy(p, "0");
+    return (int)(p - buf) + 1;
+  }
+
+  // Integers that doubles hold exactly never need an exponent, so they are
+  // written out directly
+  if (x < 9007199254740992.0 && x == (double)(uint64_t)x) {
+    char tmp[20];
+    int n = 0;
+    for (uint64_t u = (uint64_t)x; u; u /= 10) {
+      tmp[n++] = (char)('0' + u % 10);
+    }
+    while (n) {
+      *p++ = tmp[--n];
+    }
+    *p = '\0';
+    return (int)(p - buf);
+  }
+
+  char digits[24];
+  int len = 0, k = 0;
+  numconv_grisu2(x, digits, &len, &k);
+  return (int)(p - buf) + numconv_layout(digits, len, k, p);
+}
@@ -0,0 +1,20 @@
+#ifndef NUMCONV_H
+#define NUMCONV_H
+
+#include <stddef.h>
+
+// Longest text numconv_format writes, with the terminating NUL
+#define NUMCONV_FORMAT_MAX 32
+
+// Reads the decimal number at the start of the n characters at s, which may
+// have a sign, a fraction and an exponent. The decimal point is always '.',
+// whatever LC_NUMERIC says. Returns how many characters the number took, or 0
+// if there isn't one or it is too big for a double
+size_t numconv_parse(const char *s, size_t n, double *x);
+
+// Writes a decimal that reads back as exactly x, without an exponent unless
+// it is very large or very small. It is found with Grisu2, so it is usually
+// the shortest one but now and then a digit longer. Returns its length
+int numconv_format(double x, char *buf);
+
+#endif
@@ -0,0 +1,2 @@
+; Nests deeper than the recursive engine can parse, which must fail the load
+(load "tests/deep.cp")
@@ -0,0 +1,9 @@
+; A file that fails to parse reports the error of parsing it whole, whatever
+; forms before the error were read and evaluated
+(load "tests/malformed/symbol.cp")
+(load "tests/malformed/unclosed.cp")
+(load "tests/malformed/mismatched.cp")
+(load "tests/malformed/stray.cp")
+; A backslash in a string escapes any character, a newline too
+(load "tests/malformed/escape.cp")
+(load "tests/malformed/string.cp")
@@ -0,0 +1 @@
+(def {s} "abc\
\ No newline at end of file
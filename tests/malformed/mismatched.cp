@@ -0,0 +1,3 @@
+(def {y} 2)
+; a comment
+{y)}
@@ -0,0 +1 @@
+(def {z} 3) )
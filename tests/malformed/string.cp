@@ -0,0 +1 @@
+(def {s} "abc)
@@ -0,0 +1 @@
+head#
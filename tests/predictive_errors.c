@@ -0,0 +1,101 @@
+// Checks the errors a predictive mpca_lang grammar reports. Regexes which
+// compile to a DFA must fail the way their combinators do, which without
+// backtracking can mean consuming input first and listing the alternatives
+// of the rules around them. Each input is parsed from a string and a file
+//
+//   tests/predictive_errors
+
+#include "mpc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  const char *input;
+  const char *expected;
+} check;
+
+// What mpc reported before regexes ran as DFAs, NULL if the input parses
+static const check checks[] = {
+    {"/-)/+ 414", "<test>:1:3: error: expected one or more of one of "
+                  "'0123456789' or '(' at ')'\n"},
+    {"*5-)919", "<test>:1:4: error: expected one or more of one of "
+                "'0123456789', '(', newline or end of input at ')'\n"},
+    {"+ 1 2", NULL},
+    {"(+", "<test>:1:1: error: expected '+', '-', '*' or '/' at '('\n"},
+    {"+ (- 1", "<test>:1:7: error: expected one of '0123456789', '-', one or "
+               "more of one of '0123456789', '(' or ')' at end of input\n"},
+    {"- 12 (", NULL},
+    {"x", "<test>:1:1: error: expected '+', '-', '*' or '/' at 'x'\n"},
+    {"+ -", "<test>:1:4: error: expected one or more of one of '0123456789' "
+            "or '(' at end of input\n"},
+    {"* 1 (/ 2 -", NULL},
+};
+
+#define CHECKS (int)(sizeof(checks) / sizeof(checks[0]))
+
+// Returns the error as a string, or NULL if the input parsed
+static char *parse(mpc_parser_t *p, const char *input, int from_file) {
+  mpc_result_t r;
+  int ok;
+  if (from_file) {
+    FILE *f = tmpfile();
+    if (!f) {
+      perror("tmpfile");
+      exit(1);
+    }
+    fputs(input, f);
+    rewind(f);
+    ok = mpc_parse_file("<test>", f, p, &r);
+    fclose(f);
+  } else {
+    ok = mpc_parse("<test>", input, p, &r);
+  }
+  if (ok) {
+    mpc_ast_delete(r.output);
+    return NULL;
+  }
+  char *s = mpc_err_string(r.error);
+  mpc_err_delete(r.error);
+  return s;
+}
+
+int main(void) {
+  mpc_parser_t *Number = mpc_new("number");
+  mpc_parser_t *Operator = mpc_new("operator");
+  mpc_parser_t *Expr = mpc_new("expr");
+  mpc_parser_t *Lispy = mpc_new("lispy");
+
+  mpc_err_t *err = mpca_lang(MPCA_LANG_PREDICTIVE,
+                             " number   : /-?[0-9]+/ ;                     "
+                             " operator : '+' | '-' | '*' | '/' ;          "
+                             " expr     : <number>                         "
+                             "          | '(' <operator> <expr>+ ')' ;     "
+                             " lispy    : /^/ <operator> <expr>+ /$/ ;     ",
+                             Number, Operator, Expr, Lispy, NULL);
+  if (err) {
+    mpc_err_print(err);
+    mpc_err_delete(err);
+    return 1;
+  }
+
+  int failed = 0;
+  for (int i = 0; i < CHECKS; i++) {
+    for (int from_file = 0; from_file < 2; from_file++) {
+      const char *want = checks[i].expected;
+      char *got = parse(Lispy, checks[i].input, from_file);
+      if (want ? !got || strcmp(got, want) != 0 : got != NULL) {
+        printf("FAIL %s from a %s\n  expected: %s  got:      %s",
+               checks[i].input, from_file ? "file" : "string",
+               want ? want : "success\n", got ? got : "success\n");
+        failed++;
+      }
+      free(got);
+    }
+  }
+
+  mpc_cleanup(4, Number, Operator, Expr, Lispy);
+  printf("%d of %d predictive error checks passed\n", 2 * CHECKS - failed,
+         2 * CHECKS);
+  return failed ? 1 : 0;
+}
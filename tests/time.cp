@@ -0,0 +1,10 @@
+; The CPU time of single threaded work is never more than its wall time
+(fun {cost-ok c} {<= (lookup "cpu-ns" c) (lookup "wall-ns" c)})
+(fun {time-ok x} {cost-ok (snd (time x))})
+(fun {times-ok n x} {
+  if (== n 0) {1} {if (time-ok x) {times-ok (- n 1) x} {0}}
+})
+
+(print (times-ok 500 {+ 1 2}))
+(print (time-ok {fib 10}))
+(print (cost-ok (snd (bench 1000 {+ 1 2}))))